@@ -6,7 +6,12 @@
  */
 
 #include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
 #include <iomanip>
+#include <sstream>
 
 #include <libcamera/control_ids.h>
 #include <libcamera/property_ids.h>
@@ -15,6 +20,20 @@
 #include "event_loop.h"
 
 #include "file_sink.h"
+#include "frame_monitor.h"
+#include "frame_publisher.h"
+#include "frame_ring_writer.h"
+#include "frame_stamp.h"
+#include "frame_synchronizer.h"
+#include "frame_transform.h"
+#include "http_sink.h"
+#include "image.h"
+#include "lens_remap.h"
+#include "mkv_sink.h"
+#include "motion_detector.h"
+#include "stream_router.h"
+#include "tee_sink.h"
+#include "v4l2_output_sink.h"
 #ifdef HAVE_DRM
 #include "kms_sink.h"
 #endif
@@ -27,7 +46,58 @@
 
 using namespace libcamera;
 
-CameraSession::CameraSession(const CameraManager* const cm) : cm_(cm) {
+/*
+ * Parse a --stream ROLE[:WxH[:FORMAT]] argument, with ROLE one of viewfinder,
+ * video, still or raw.
+ */
+int parseStreamSpec(const std::string& spec, StreamSpec* stream) {
+  static const std::pair<const char*, StreamRole> roles[] = {
+      {"viewfinder", StreamRole::Viewfinder},
+      {"video", StreamRole::VideoRecording},
+      {"still", StreamRole::StillCapture},
+      {"raw", StreamRole::Raw},
+  };
+
+  std::vector<std::string> fields;
+  std::istringstream input(spec);
+  for (std::string field; std::getline(input, field, ':');)
+    fields.push_back(field);
+
+  const auto role =
+      std::find_if(std::begin(roles), std::end(roles), [&](const auto& entry) {
+        return !fields.empty() && fields[0] == entry.first;
+      });
+  if (role == std::end(roles) || fields.size() > 3) {
+    EPRINT("Invalid stream '%s', expected ROLE[:WxH[:FORMAT]] with ROLE "
+           "viewfinder, video, still or raw\n",
+           spec.c_str());
+    return -EINVAL;
+  }
+
+  *stream = StreamSpec();
+  stream->role = role->second;
+
+  if (fields.size() > 1 && !fields[1].empty()) {
+    unsigned int width, height;
+    char end;
+    if (sscanf(fields[1].c_str(), "%ux%u%c", &width, &height, &end) != 2 ||
+        !width || !height) {
+      EPRINT("Invalid stream size '%s', expected WIDTHxHEIGHT\n",
+             fields[1].c_str());
+      return -EINVAL;
+    }
+
+    stream->size = Size(width, height);
+  }
+
+  if (fields.size() > 2)
+    stream->format = fields[2];
+
+  return 0;
+}
+
+CameraSession::CameraSession(const CameraManager* const cm, long camera)
+    : requestedCamera_(camera), cm_(cm) {
   PRINT_FUNC();
 }
 
@@ -38,14 +108,19 @@ CameraSession::~CameraSession() {
 
 int CameraSession::init() {
   PRINT_FUNC();
-  if (opts.camera < 0) {
+  if (parseTransform(opts.transform, &transform_) < 0)
+    return 1;
+
+  if (requestedCamera_ < 0) {
     for (size_t i = 0; i < cm_->cameras().size(); ++i) {
       camera_ = cm_->cameras()[i];
+      cameraIndex_ = i;
       if (!validateConfig())
         return 0;
     }
-  } else if (opts.camera < static_cast<int>(cm_->cameras().size())) {
-    camera_ = cm_->cameras()[opts.camera];
+  } else if (requestedCamera_ < static_cast<long>(cm_->cameras().size())) {
+    camera_ = cm_->cameras()[requestedCamera_];
+    cameraIndex_ = requestedCamera_;
     if (!validateConfig()) {
       return 0;
     }
@@ -66,16 +141,37 @@ int CameraSession::validateConfig() {
     return 2;
   }
 
+  std::vector<StreamSpec> streams;
+  for (const std::string& spec : opts.streams) {
+    streams.emplace_back();
+    parseStreamSpec(spec, &streams.back());
+  }
+
+  std::vector<StreamRole> roles;
+  for (const StreamSpec& stream : streams)
+    roles.push_back(stream.role);
+  if (roles.empty())
+    roles.push_back(StreamRole::Viewfinder);
+
   std::unique_ptr<CameraConfiguration> cfg =
-      camera_->generateConfiguration({libcamera::StreamRole::Viewfinder});
-  if (!cfg || cfg->size() != 1) {
+      camera_->generateConfiguration(roles);
+  if (!cfg || cfg->size() != roles.size()) {
     EPRINT("Failed to get default stream configuration\n");
     camera_->release();
     camera_ = nullptr;
     return 3;
   }
 
-  cfg->at(0).pixelFormat = PixelFormat::fromString(opts.pf);
+  if (streams.empty())
+    cfg->at(0).pixelFormat = PixelFormat::fromString(opts.pf);
+
+  for (unsigned int index = 0; index < streams.size(); ++index) {
+    StreamConfiguration& stream = cfg->at(index);
+    if (!streams[index].size.isNull())
+      stream.size = streams[index].size;
+    if (!streams[index].format.empty())
+      stream.pixelFormat = PixelFormat::fromString(streams[index].format);
+  }
 
   switch (cfg->validate()) {
     case CameraConfiguration::Valid:
@@ -94,31 +190,306 @@ int CameraSession::validateConfig() {
       break;
   }
 
+  sinkTransform_ = requestCameraTransform(cfg.get());
   config_ = std::move(cfg);
 
   return 0;
 }
 
+/*
+ * Ask the camera for the requested transform, which is free when the sensor
+ * or the ISP can flip frames. Returns the transform left for later stages,
+ * the whole of it if the camera can't apply it.
+ */
+Transform CameraSession::requestCameraTransform(CameraConfiguration* config) {
+  if (transform_ == Transform::Identity)
+    return transform_;
+
+#ifdef HAVE_LIBCAMERA_ORIENTATION
+  const Orientation original = config->orientation;
+  const Orientation wanted = original * transform_;
+
+  config->orientation = wanted;
+  if (config->validate() != CameraConfiguration::Invalid &&
+      config->orientation == wanted) {
+    PRINT("Transform %s applied by the camera\n", transformName(transform_));
+    return Transform::Identity;
+  }
+
+  config->orientation = original;
+#else
+  config->transform = transform_;
+  if (config->validate() != CameraConfiguration::Invalid &&
+      config->transform == transform_) {
+    PRINT("Transform %s applied by the camera\n", transformName(transform_));
+    return Transform::Identity;
+  }
+
+  config->transform = Transform::Identity;
+#endif
+
+  config->validate();
+
+  return transform_;
+}
+
+/*
+ * Hand the transform the camera couldn't apply to the sink, and fall back to
+ * transforming frames in place on the CPU when the sink can't either.
+ */
+int CameraSession::setupTransform() {
+  cpuTransform_.reset();
+  mappedBuffers_.setMapMode(Image::MapMode::ReadOnly);
+
+  if (sinkTransform_ == Transform::Identity)
+    return 0;
+
+  const char* name = transformName(sinkTransform_);
+
+  if (!sink_->setTransform(sinkTransform_)) {
+    PRINT("Transform %s applied by the display\n", name);
+    return 0;
+  }
+
+  cpuTransform_ = std::make_unique<FrameTransform>();
+  int ret = cpuTransform_->configure(config_->at(0), sinkTransform_);
+  if (ret < 0) {
+    EPRINT("Transform %s not supported by the camera, display or CPU\n",
+           name);
+    cpuTransform_.reset();
+    return ret;
+  }
+
+  mappedBuffers_.setMapMode(Image::MapMode::ReadWrite);
+
+  PRINT("Transform %s applied on the CPU with %s kernels\n", name,
+        cpuTransform_->kernelsName());
+
+  return 0;
+}
+
+/*
+ * Stream into \a sink instead of the sink selected by the command line, for
+ * sessions that feed a consumer of several cameras. Must be called before
+ * start().
+ */
+void CameraSession::setSink(std::unique_ptr<FrameSink> sink) {
+  sink_ = std::move(sink);
+}
+
+/*
+ * Hand completed requests to \a sync as its input \a stream, instead of to the
+ * frame sink, which gets them when all cameras of the synchronizer delivered a
+ * matching frame.
+ */
+void CameraSession::setSynchronizer(FrameSynchronizer* sync,
+                                    unsigned int stream) {
+  sync_ = sync;
+  syncStream_ = stream;
+
+  sync_->frameReady.connect(this, &CameraSession::syncReady);
+  sync_->frameDropped.connect(this, &CameraSession::syncDropped);
+}
+
+/*
+ * Display frames on KMS \a connector, the first connected one if empty, in
+ * column \a slot of \a slots when several cameras share the connector.
+ */
+void CameraSession::setDisplay(const std::string& connector,
+                               unsigned int slot,
+                               unsigned int slots) {
+  connector_ = connector;
+  displaySlot_ = slot;
+  displaySlots_ = slots;
+}
+
+/*
+ * Make the camera number \a position of the \a count cameras selected, which
+ * pick their sink targets from the per camera lists of the command line.
+ */
+void CameraSession::setPosition(unsigned int position, unsigned int count) {
+  position_ = position;
+  cameraCount_ = count;
+}
+
+/*
+ * The entry of the camera in the comma separated \a list of sink targets,
+ * one per camera. Cameras beyond the list share its last entry, the camera is
+ * number \a slot of the \a slots cameras using the entry.
+ */
+std::string CameraSession::sinkTarget(const std::string& list,
+                                      unsigned int* slot,
+                                      unsigned int* slots) const {
+  std::vector<std::string> targets;
+  std::istringstream stream(list);
+  for (std::string target; std::getline(stream, target, ',');)
+    targets.push_back(target);
+
+  *slot = 0;
+  *slots = 1;
+  if (targets.empty())
+    return "";
+
+  const unsigned int last = targets.size() - 1;
+  if (position_ < last)
+    return targets[position_];
+
+  *slot = position_ - last;
+  *slots = std::max(cameraCount_, last + 1) - last;
+
+  return targets[last];
+}
+
+/*
+ * The path of a sink of the camera from the per camera \a list, with -camN
+ * inserted before the extension when other cameras share the entry.
+ */
+std::string CameraSession::sinkPath(const std::string& list) const {
+  unsigned int slot, slots;
+  std::string path = sinkTarget(list, &slot, &slots);
+  if (slots == 1)
+    return path;
+
+  const size_t dot = path.find_last_of("./");
+  path.insert(dot != std::string::npos && path[dot] == '.' ? dot : path.size(),
+              "-cam" + std::to_string(cameraIndex_));
+
+  return path;
+}
+
+/*
+ * Create the sinks selected on the command line, a display, a recording,
+ * frame sharing, HTTP streaming and a V4L2 output, several of them through a
+ * tee. Sink targets are given per camera, see sinkTarget(). Returns the
+ * number of sinks, or a negative error code.
+ */
 int CameraSession::parse_args() {
+  std::vector<std::unique_ptr<FrameSink>> sinks;
+
 #ifdef HAVE_SDL
-  if (opts.sdl) {
-    sink_ = std::make_unique<SDLSink>();
-    return 1;
-  }
+  if (opts.sdl)
+    sinks.push_back(std::make_unique<SDLSink>());
 #endif
 
 #ifdef HAVE_DRM
-  if (opts.drm) {
-    sink_ = std::make_unique<KMSSink>("");
-    return 2;
+  if (opts.drm && sinks.empty())
+    sinks.push_back(
+        std::make_unique<KMSSink>(connector_, displaySlot_, displaySlots_));
+#endif
+
+  if (!opts.filename.empty())
+    sinks.push_back(createFileSink(sinkPath(opts.filename)));
+
+  if (!opts.publish.empty())
+    sinks.push_back(std::make_unique<FramePublisher>(sinkPath(opts.publish)));
+
+  if (!opts.http.empty()) {
+    /* Cameras sharing a port serve on the ports following it. */
+    unsigned int slot, slots;
+    std::string http = sinkTarget(opts.http, &slot, &slots);
+    char* end;
+    const unsigned long port = strtoul(http.c_str(), &end, 10);
+    if (slots > 1)
+      http = *end ? sinkPath(opts.http) : std::to_string(port + slot);
+
+    sinks.push_back(std::make_unique<HttpSink>(http));
   }
+
+  if (!opts.v4l2_output.empty()) {
+    unsigned int slot, slots;
+    const std::string device = sinkTarget(opts.v4l2_output, &slot, &slots);
+    if (slots > 1) {
+      EPRINT("Give one --v4l2-output device per camera\n");
+      return -EINVAL;
+    }
+
+    sinks.push_back(std::make_unique<V4L2OutputSink>(device));
+  }
+
+  if (sinks.size() == 1) {
+    sink_ = std::move(sinks[0]);
+  } else if (sinks.size() > 1) {
+    auto tee = std::make_unique<TeeSink>();
+    for (std::unique_ptr<FrameSink>& sink : sinks)
+      tee->addSink(std::move(sink));
+    sink_ = std::move(tee);
+  }
+
+  return sinks.size();
+}
+
+/* The display selected on the command line, or the default one. */
+std::unique_ptr<FrameSink> CameraSession::createDisplaySink() {
+#ifdef HAVE_SDL
+  if (opts.sdl)
+    return std::make_unique<SDLSink>();
 #endif
 
-  if (!opts.filename.empty()) {
-    sink_ = std::make_unique<FileSink>(streamNames_, opts.filename);
-    return 3;
+#ifdef HAVE_DRM
+  if (opts.drm)
+    return std::make_unique<KMSSink>(connector_, displaySlot_, displaySlots_);
+#endif
+
+#if HAVE_SDL
+  return std::make_unique<SDLSink>();
+#elif HAVE_DRM
+  return std::make_unique<KMSSink>(connector_, displaySlot_, displaySlots_);
+#else
+  return nullptr;
+#endif
+}
+
+std::unique_ptr<FrameSink> CameraSession::createFileSink(
+    const std::string& filename) {
+  if (MKVSink::isMatroska(filename))
+    return std::make_unique<MKVSink>(filename);
+
+  auto fileSink = std::make_unique<FileSink>(streamNames_, filename);
+#ifdef HAVE_ZSTD
+  if (opts.compress)
+    fileSink->enableCompression(opts.compress_level);
+#endif
+
+  return fileSink;
+}
+
+/*
+ * Show the first stream and record each of the others to a file of its own,
+ * named after the -F filename with the stream index appended. All streams are
+ * recorded without a display.
+ */
+int CameraSession::createStreamSinks() {
+  if (opts.filename.empty()) {
+    EPRINT("Streams beyond the first one are recorded, give a filename with "
+           "-F\n");
+    return -EINVAL;
+  }
+
+  auto router = std::make_unique<StreamRouter>();
+  unsigned int first = 0;
+  if (std::unique_ptr<FrameSink> display = createDisplaySink()) {
+    router->addSink(0, std::move(display));
+    first = 1;
+  }
+
+  const std::string path = sinkPath(opts.filename);
+  const size_t dot = path.find_last_of("./");
+  const size_t split =
+      dot != std::string::npos && path[dot] == '.' ? dot : path.size();
+
+  for (unsigned int index = first; index < config_->size(); ++index) {
+    std::string filename = path;
+    if (config_->size() - first > 1)
+      filename.insert(split, "-stream" + std::to_string(index));
+
+    const Stream* stream = config_->at(index).stream();
+    PRINT("Recording %s to %s\n", streamNames_[stream].c_str(),
+          filename.c_str());
+    router->addSink(index, createFileSink(filename));
   }
 
+  sink_ = std::move(router);
+
   return 0;
 }
 
@@ -128,6 +499,9 @@ int CameraSession::start() {
 
   queueCount_ = 0;
   captureCount_ = 0;
+  dropCount_ = 0;
+  last_ = 0;
+  first_ = 0;
 
   ret = camera_->configure(config_.get());
   if (ret < 0) {
@@ -142,17 +516,36 @@ int CameraSession::start() {
                                  "-stream" + std::to_string(index);
   }
 
+  if (config_->size() > 1) {
+    for (const StreamConfiguration& cfg : *config_)
+      PRINT("%s: %s\n", streamNames_[cfg.stream()].c_str(),
+            cfg.toString().c_str());
+  }
+
   camera_->requestCompleted.connect(this, &CameraSession::requestComplete);
 
+  if (!sink_ && config_->size() > 1) {
+    ret = createStreamSinks();
+    if (ret < 0)
+      return ret;
+  }
+
   // When the user executes 'twincam' we want the most aesthetically pleasing
   // sink to be used, the advanced users can use command line parameters
-  if (!parse_args()) {
+  if (!sink_) {
+    ret = parse_args();
+    if (ret < 0)
+      return ret;
+  }
+
+  if (!sink_) {
 #if HAVE_SDL
     sink_ = std::make_unique<SDLSink>();
 #elif HAVE_DRM
-    sink_ = std::make_unique<KMSSink>("");
+    sink_ =
+        std::make_unique<KMSSink>(connector_, displaySlot_, displaySlots_);
 #else
-    sink_ = std::make_unique<FileSink>(streamNames_, opts.filename);
+    sink_ = std::make_unique<FileSink>(streamNames_, sinkPath(opts.filename));
 #endif
   }
 
@@ -162,14 +555,235 @@ int CameraSession::start() {
     return ret;
   }
 
+  ret = setupTransform();
+  if (ret < 0)
+    return ret;
+
+  ret = setupUndistort();
+  if (ret < 0)
+    return ret;
+
+  ret = setupMotion();
+  if (ret < 0)
+    return ret;
+
+  ret = setupMonitor();
+  if (ret < 0)
+    return ret;
+
+#ifdef HAVE_DRM
+  /* Frames carry their sequence to the screen to measure latency. */
+  if (opts.latency) {
+    if (!FrameStamp::isSupported(config_->at(0).pixelFormat)) {
+      EPRINT("Cannot stamp %s frames to measure latency\n",
+             config_->at(0).pixelFormat.toString().c_str());
+      return -EINVAL;
+    }
+    mappedBuffers_.setMapMode(Image::MapMode::ReadWrite);
+  }
+#endif
+
+  /* The ScalerCrop range depends on the configuration. */
+  scalerCropMaximum_ = Rectangle();
+  scalerCrop_.reset();
+  const ControlInfoMap& infoMap = camera_->controls();
+  if (auto info = infoMap.find(&controls::ScalerCrop);
+      info != infoMap.end() &&
+      info->second.max().type() == ControlTypeRectangle)
+    scalerCropMaximum_ = info->second.max().get<Rectangle>();
+
+  if (opts.zoom > 1.0 && setZoom(opts.zoom, opts.zoom_x, opts.zoom_y) < 0)
+    EPRINT("Showing the whole field of view\n");
+
   sink_->requestProcessed.connect(this, &CameraSession::sinkRelease);
+  sink_->frameDisplayed.connect(this, &CameraSession::sinkDisplayed);
+  mappedBuffers_.setCopyFrames(opts.copy_frames);
+  sink_->setMappedBuffers(&mappedBuffers_);
+
+  ring_.reset();
+  if (!opts.metadata_ring.empty()) {
+    ring_ = std::make_unique<FrameRingWriter>();
+    ret = ring_->open(opts.metadata_ring + "-cam" +
+                      std::to_string(cameraIndex_));
+    if (ret < 0)
+      return ret;
+  }
 
   allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
 
   return startCapture();
 }
 
+/*
+ * Build the lens correction tables, once per configuration, when a lens
+ * calibration is given.
+ */
+int CameraSession::setupUndistort() {
+  remap_.reset();
+  remapSource_.reset();
+  remapFrames_ = 0;
+  remapTime_ = 0;
+
+  if (opts.undistort.empty())
+    return 0;
+
+  LensCalibration calibration;
+  int ret = calibration.load(opts.undistort);
+  if (ret < 0)
+    return ret;
+
+  remap_ = std::make_unique<LensRemap>();
+  ret = remap_->configure(config_->at(0), calibration);
+  if (ret < 0) {
+    remap_.reset();
+    return ret;
+  }
+
+  mappedBuffers_.setMapMode(Image::MapMode::ReadWrite);
+
+  PRINT("Correcting lens distortion on the CPU with %s kernels\n",
+        remap_->kernelsName());
+
+  return 0;
+}
+
+/*
+ * Watch frames for motion when a threshold is given. Recording sinks are
+ * paused until motion is detected with --record-on-motion.
+ */
+int CameraSession::setupMotion() {
+  motion_.reset();
+  motionActive_ = false;
+  quietFrames_ = 0;
+  motionEvents_ = 0;
+  motionFrames_ = 0;
+  motionTime_ = 0;
+
+  if (opts.motion <= 0.0)
+    return 0;
+
+  motion_ = std::make_unique<MotionDetector>();
+  int ret = motion_->configure(config_->at(0), opts.motion);
+  if (ret < 0) {
+    motion_.reset();
+    return ret;
+  }
+
+  if (opts.record_on_motion)
+    sink_->setRecording(false);
+
+  PRINT("Detecting motion over %.1f%% of the frame with %s kernels\n",
+        opts.motion, motion_->kernelsName());
+
+  return 0;
+}
+
+/*
+ * Watch frames for alarms when a status file is given, one per camera with
+ * -camN inserted before the extension.
+ */
+int CameraSession::setupMonitor() {
+  monitor_.reset();
+
+  if (opts.monitor.empty())
+    return 0;
+
+  const size_t dot = opts.monitor.find_last_of("./");
+  std::string path = opts.monitor;
+  path.insert(dot != std::string::npos && path[dot] == '.' ? dot : path.size(),
+              "-cam" + std::to_string(cameraIndex_));
+
+  monitor_ = std::make_unique<FrameMonitor>();
+  int ret = monitor_->configure(config_->at(0), path, cameraIndex_,
+                                opts.monitor_frames);
+  if (ret < 0) {
+    monitor_.reset();
+    return ret;
+  }
+
+  monitor_->start();
+
+  PRINT("Monitoring frames with %s kernels, status in %s\n",
+        monitor_->kernelsName(), path.c_str());
+
+  return 0;
+}
+
+/*
+ * Region of \a full magnified \a factor times around (x, y), in fractions of
+ * the width and height, moved inside \a full if needed. Coordinates are kept
+ * even for chroma subsampled formats.
+ */
+static Rectangle zoomRectangle(const Rectangle& full,
+                               double factor,
+                               double x,
+                               double y) {
+  const unsigned int width = std::max(lround(full.width / factor) & ~1L, 2L);
+  const unsigned int height = std::max(lround(full.height / factor) & ~1L, 2L);
+
+  int left = full.x + lround(x * full.width) - width / 2;
+  int top = full.y + lround(y * full.height) - height / 2;
+  left = std::clamp<int>(left, full.x, full.x + full.width - width) & ~1;
+  top = std::clamp<int>(top, full.y, full.y + full.height - height) & ~1;
+
+  return Rectangle(left, top, width, height);
+}
+
+/*
+ * Zoom into the frames, \a factor times around (x, y) given in fractions of
+ * the frame size. The camera crops with ScalerCrop when it can, which keeps
+ * the full output resolution, otherwise the sink scans out the region. Zoom
+ * can change while streaming, it applies to the next request queued or frame
+ * displayed.
+ */
+int CameraSession::setZoom(double factor, double x, double y) {
+  if (factor < 1.0 || x < 0.0 || x > 1.0 || y < 0.0 || y > 1.0) {
+    EPRINT("Invalid zoom %.2fx at %.2f,%.2f\n", factor, x, y);
+    return -EINVAL;
+  }
+
+  if (scalerCropMaximum_.width && scalerCropMaximum_.height) {
+    scalerCrop_ = zoomRectangle(scalerCropMaximum_, factor, x, y);
+    PRINT("Zoom %.2fx applied by the camera with ScalerCrop %s\n", factor,
+          scalerCrop_->toString().c_str());
+    return 0;
+  }
+
+  const Size& size = config_->at(0).size;
+  const Rectangle crop = zoomRectangle(Rectangle(0, 0, size), factor, x, y);
+  if (sink_ && !sink_->setCrop(crop)) {
+    PRINT("Zoom %.2fx applied by the display, scanning out %s\n", factor,
+          crop.toString().c_str());
+    return 0;
+  }
+
+  EPRINT("Zoom not supported by the camera or the display\n");
+  return -ENOTSUP;
+}
+
 void CameraSession::stop() {
+  if (captureCount_ > 1 && last_ > first_) {
+    PRINT("cam%u: %u frames at %.2f fps, %u dropped\n", cameraIndex_,
+          captureCount_, (captureCount_ - 1) * 1000000000.0 / (last_ - first_),
+          dropCount_);
+  }
+
+  if (remapFrames_) {
+    PRINT("Corrected lens distortion in %.2f ms per frame\n",
+          remapTime_ / 1000000.0 / remapFrames_);
+  }
+
+  if (motionFrames_) {
+    PRINT("Detected motion %u times, in %.3f ms per frame\n", motionEvents_,
+          motionTime_ / 1000000.0 / motionFrames_);
+  }
+
+  if (sync_) {
+    sync_->frameReady.disconnect(this);
+    sync_->frameDropped.disconnect(this);
+    sync_ = nullptr;
+  }
+
   int ret = camera_->stop();
   if (ret)
     PRINT("Failed to stop capture\n");
@@ -181,9 +795,12 @@ void CameraSession::stop() {
   }
 
   sink_.reset();
+  ring_.reset();
+  monitor_.reset();
 
   requests_.clear();
 
+  mappedBuffers_.clear();
   allocator_.reset();
 }
 
@@ -200,19 +817,10 @@ int CameraSession::startCapture() {
       return -ENOMEM;
     }
 
-#if 0  // not priority right now, for MJPG mainly
+    /* Buffers are mapped on first CPU access, by the sinks that need it. */
     for (const std::unique_ptr<FrameBuffer>& buffer :
-         allocator_->buffers(cfg.stream())) {
-      /* Map memory buffers and cache the mappings. */
-      std::unique_ptr<Image> image =
-          Image::fromFrameBuffer(buffer.get(), Image::MapMode::ReadOnly);
-      if (!image) {
-        EPRINT("Can't allocate image buffers\n");
-      }
-
-      mappedBuffers_[buffer.get()] = std::move(image);
-    }
-#endif
+         allocator_->buffers(cfg.stream()))
+      mappedBuffers_.add(buffer.get());
 
     size_t allocated = allocator_->buffers(cfg.stream()).size();
     nbuffers = std::min(nbuffers, allocated);
@@ -243,7 +851,7 @@ int CameraSession::startCapture() {
       }
 
       if (sink_)
-        sink_->mapBuffer(buffer.get());
+        sink_->mapBuffer(stream, buffer.get());
     }
 
     VERBOSE_PRINT("Pushing request onto vector\n");
@@ -287,6 +895,12 @@ int CameraSession::startCapture() {
 int CameraSession::queueRequest(Request* request) {
   ++queueCount_;
 
+  /* Controls persist in the camera, set them on one request only. */
+  if (scalerCrop_) {
+    request->controls().set(controls::ScalerCrop, *scalerCrop_);
+    scalerCrop_.reset();
+  }
+
   return camera_->queueRequest(request);
 }
 
@@ -294,27 +908,38 @@ void CameraSession::requestComplete(Request* request) {
   if (request->status() == Request::RequestCancelled)
     return;
 
+  const uint64_t completed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+
   /*
    * Defer processing of the completed request to the event loop, to avoid
    * blocking the camera manager thread.
    */
   EventLoop::instance()->callLater(
-      [request, this]() { processRequest(request); });
+      [request, completed, this]() { processRequest(request, completed); });
 }
 
-void CameraSession::processRequest(Request* request) {
+void CameraSession::processRequest(Request* request, uint64_t completed) {
   const Request::BufferMap& buffers = request->buffers();
 
   /*
    * Compute the frame rate. The timestamp is arbitrarily retrieved from
    * the first buffer, as all buffers should have matching timestamps.
    */
-  uint64_t ts = buffers.begin()->second->metadata().timestamp;
+  const FrameMetadata& first = buffers.begin()->second->metadata();
+  uint64_t ts = first.timestamp;
   double fps = ts - last_;
   fps = last_ != 0 && fps ? 1000000000.0 / fps : 0.0;
   last_ = ts;
 
-  bool requeue = true;
+  /* The camera drops frames when no request is queued, it skips sequences. */
+  if (!first_)
+    first_ = ts;
+  else if (first.sequence > sequence_ + 1)
+    dropCount_ += first.sequence - sequence_ - 1;
+  sequence_ = first.sequence;
 
   std::string frame_str;
   STRING_PRINTF(frame_str, "(%.2f fps)", fps);
@@ -331,16 +956,29 @@ void CameraSession::processRequest(Request* request) {
       if (++nplane < metadata.planes().size())
         frame_str += "/";
     }
+  }
+
+  if (remap_)
+    undistortFrames(request);
+
+  if (cpuTransform_)
+    transformFrames(request);
 
-#if 0  // not priority right now, for MJPG mainly
-    Image* image = mappedBuffers_[buffer].get();
-    converter_.convert(image, size, &image_);
+  uint32_t flags = 0;
+  if (motion_ && detectMotion(request))
+    flags |= frameRingFlagMotion;
+
+  if (monitor_ && monitorFrame(request))
+    flags |= frameRingFlagAlarm;
+
+#ifdef HAVE_DRM
+  /* Last, the stamp must not be seen by the analysis above. */
+  if (opts.latency)
+    stampFrame(request);
 #endif
-  }
 
-  if (sink_ && !sink_->processRequest(request)) {
-    requeue = false;
-  }
+  if (ring_)
+    ring_->write(request, completed, flags);
 
   PRINT("%s\n", frame_str.c_str());
 
@@ -350,18 +988,184 @@ void CameraSession::processRequest(Request* request) {
    */
   ++captureCount_;
 
+  /* Hold the frame until the other cameras deliver theirs. */
+  if (sync_) {
+    sync_->push(syncStream_, request);
+    return;
+  }
+
+  deliverRequest(request);
+}
+
+void CameraSession::deliverRequest(Request* request) {
   /*
    * If the frame sink holds on the request, we'll requeue it later in the
    * complete handler.
    */
-  if (!requeue)
+  if (sink_ && !sink_->processRequest(request))
     return;
 
   request->reuse(Request::ReuseBuffers);
-  camera_->queueRequest(request);
+  queueRequest(request);
+}
+
+void CameraSession::syncReady(unsigned int stream, Request* request) {
+  if (stream == syncStream_)
+    deliverRequest(request);
+}
+
+void CameraSession::syncDropped(unsigned int stream, Request* request) {
+  if (stream != syncStream_)
+    return;
+
+  request->reuse(Request::ReuseBuffers);
+  queueRequest(request);
+}
+
+/* Transforms are configured for the first stream, the one displayed. */
+void CameraSession::transformFrames(Request* request) {
+  FrameBuffer* buffer = request->findBuffer(config_->at(0).stream());
+  Image* image = buffer ? mappedBuffers_.mapping(buffer) : nullptr;
+  if (!image)
+    return;
+
+  Image::CpuAccess access(image, Image::MapMode::ReadWrite);
+
+  std::vector<Span<uint8_t>> planes;
+  for (unsigned int i = 0; i < image->numPlanes(); ++i)
+    planes.push_back(image->data(i));
+
+  cpuTransform_->apply(planes);
+}
+
+/*
+ * Copy the frame out of the camera buffer, with streaming loads as the buffer
+ * may be uncached, and correct it back into the buffer so that sinks, KMS
+ * included, see the corrected frame. Only the first stream is corrected, the
+ * tables are built for its size.
+ */
+void CameraSession::undistortFrames(Request* request) {
+  FrameBuffer* buffer = request->findBuffer(config_->at(0).stream());
+  Image* image = buffer ? mappedBuffers_.mapping(buffer) : nullptr;
+  if (!image)
+    return;
+
+  if (!remapSource_) {
+    remapSource_ = Image::allocate(*image);
+    if (!remapSource_)
+      return;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+
+  Image::CpuAccess access(image, Image::MapMode::ReadWrite);
+  remapSource_->copyFrom(*image, buffer->metadata());
+
+  std::vector<Span<const uint8_t>> src;
+  std::vector<Span<uint8_t>> dst;
+  for (unsigned int i = 0; i < image->numPlanes(); ++i) {
+    src.push_back(remapSource_->data(i));
+    dst.push_back(image->data(i));
+  }
+
+  if (remap_->remap(src, dst) < 0)
+    return;
+
+  remapTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  ++remapFrames_;
+}
+
+/*
+ * Analyze the first stream for motion. Motion starts with the first frame it's
+ * detected in, and stops after kMotionHoldFrames frames without any, so that
+ * recordings don't stop at every pause of a moving subject.
+ */
+bool CameraSession::detectMotion(Request* request) {
+  static constexpr unsigned int kMotionHoldFrames = 60;
+
+  FrameBuffer* buffer = request->findBuffer(config_->at(0).stream());
+  Image* image = buffer ? mappedBuffers_.image(buffer) : nullptr;
+  if (!image)
+    return false;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  Image::CpuAccess access(image, Image::MapMode::ReadOnly);
+  std::vector<Span<const uint8_t>> planes;
+  for (unsigned int i = 0; i < image->numPlanes(); ++i)
+    planes.push_back(image->data(i));
+
+  const bool motion = motion_->analyze(planes);
+
+  motionTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  ++motionFrames_;
+
+  if (motion) {
+    quietFrames_ = 0;
+    if (!motionActive_) {
+      motionActive_ = true;
+      ++motionEvents_;
+      PRINT("Motion detected, %.1f%% of the frame changed\n",
+            motion_->changed());
+      if (opts.record_on_motion)
+        sink_->setRecording(true);
+    }
+  } else if (motionActive_ && ++quietFrames_ >= kMotionHoldFrames) {
+    motionActive_ = false;
+    PRINT("Motion stopped\n");
+    if (opts.record_on_motion)
+      sink_->setRecording(false);
+  }
+
+  return motion;
+}
+
+/* Check the first stream for alarms, returns true while any is raised. */
+bool CameraSession::monitorFrame(Request* request) {
+  FrameBuffer* buffer = request->findBuffer(config_->at(0).stream());
+  Image* image = buffer ? mappedBuffers_.image(buffer) : nullptr;
+  if (!image)
+    return monitor_->alarms();
+
+  Image::CpuAccess access(image, Image::MapMode::ReadOnly);
+  std::vector<Span<const uint8_t>> planes;
+  for (unsigned int i = 0; i < image->numPlanes(); ++i)
+    planes.push_back(image->data(i));
+
+  return monitor_->analyze(planes, buffer->metadata().sequence);
+}
+
+/* Draw the sequence of the first stream into its frame, see FrameStamp. */
+void CameraSession::stampFrame(Request* request) {
+  FrameBuffer* buffer = request->findBuffer(config_->at(0).stream());
+  Image* image = buffer ? mappedBuffers_.mapping(buffer) : nullptr;
+  if (!image)
+    return;
+
+  Image::CpuAccess access(image, Image::MapMode::ReadWrite);
+  std::vector<Span<uint8_t>> planes;
+  for (unsigned int i = 0; i < image->numPlanes(); ++i)
+    planes.push_back(image->data(i));
+
+  FrameStamp::write(config_->at(0), planes, buffer->metadata().sequence);
 }
 
 void CameraSession::sinkRelease(Request* request) {
   request->reuse(Request::ReuseBuffers);
   queueRequest(request);
 }
+
+void CameraSession::sinkDisplayed(Request* request) {
+  if (!ring_)
+    return;
+
+  const uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch())
+                           .count();
+  const FrameBuffer* buffer = request->buffers().begin()->second;
+  ring_->setDisplayed(buffer->metadata().sequence, now);
+}
@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -18,18 +19,34 @@
 #include <libcamera/camera_manager.h>
 #include <libcamera/framebuffer.h>
 #include <libcamera/framebuffer_allocator.h>
+#include <libcamera/geometry.h>
 #include <libcamera/request.h>
 #include <libcamera/stream.h>
+#include <libcamera/transform.h>
 
-#if 0  // not priority right now, for MJPG mainly
-#include "image.h"
-#endif
+#include "mapped_buffer_cache.h"
 
+class FrameMonitor;
+class FrameRingWriter;
 class FrameSink;
+class FrameSynchronizer;
+class FrameTransform;
+class LensRemap;
+class MotionDetector;
+
+/* A stream requested with --stream ROLE[:WxH[:FORMAT]]. */
+struct StreamSpec {
+  libcamera::StreamRole role = libcamera::StreamRole::Viewfinder;
+  /* Left to the camera when empty. */
+  libcamera::Size size;
+  std::string format;
+};
+
+int parseStreamSpec(const std::string& spec, StreamSpec* stream);
 
 class CameraSession {
  public:
-  CameraSession(const libcamera::CameraManager* const cm);
+  CameraSession(const libcamera::CameraManager* const cm, long camera = -1);
   ~CameraSession();
 
   int init();
@@ -42,40 +59,113 @@ class CameraSession {
   void listProperties() const;
   void infoConfiguration() const;
 
+  void setSink(std::unique_ptr<FrameSink> sink);
+  void setDisplay(const std::string& connector,
+                  unsigned int slot,
+                  unsigned int slots);
+  void setSynchronizer(FrameSynchronizer* sync, unsigned int stream);
+  void setPosition(unsigned int position, unsigned int count);
+
   int start();
   void stop();
 
+  int setZoom(double factor, double x, double y);
+
   libcamera::Signal<> captureDone;
 
  private:
   int parse_args();
+  std::string sinkTarget(const std::string& list,
+                         unsigned int* slot,
+                         unsigned int* slots) const;
+  std::string sinkPath(const std::string& list) const;
+  std::unique_ptr<FrameSink> createDisplaySink();
+  std::unique_ptr<FrameSink> createFileSink(const std::string& filename);
+  int createStreamSinks();
   int startCapture();
   int validateConfig();
+  libcamera::Transform requestCameraTransform(
+      libcamera::CameraConfiguration* config);
+  int setupTransform();
+  void transformFrames(libcamera::Request* request);
+  int setupUndistort();
+  void undistortFrames(libcamera::Request* request);
+  int setupMotion();
+  bool detectMotion(libcamera::Request* request);
+  int setupMonitor();
+  bool monitorFrame(libcamera::Request* request);
+  void stampFrame(libcamera::Request* request);
   int queueRequest(libcamera::Request* request);
   void requestComplete(libcamera::Request* request);
-  void processRequest(libcamera::Request* request);
+  void processRequest(libcamera::Request* request, uint64_t completed);
+  void deliverRequest(libcamera::Request* request);
+  void syncReady(unsigned int stream, libcamera::Request* request);
+  void syncDropped(unsigned int stream, libcamera::Request* request);
   void sinkRelease(libcamera::Request* request);
+  void sinkDisplayed(libcamera::Request* request);
 
   std::shared_ptr<libcamera::Camera> camera_;
   std::unique_ptr<libcamera::CameraConfiguration> config_;
 
   std::map<const libcamera::Stream*, std::string> streamNames_;
   std::unique_ptr<FrameSink> sink_;
+
+  /* Requested transform, and the part the camera left to the sink or CPU. */
+  libcamera::Transform transform_ = libcamera::Transform::Identity;
+  libcamera::Transform sinkTransform_ = libcamera::Transform::Identity;
+  std::unique_ptr<FrameTransform> cpuTransform_;
+
+  /* Lens correction, from a copy of the frame back into the buffer. */
+  std::unique_ptr<LensRemap> remap_;
+  std::unique_ptr<Image> remapSource_;
+  uint64_t remapFrames_ = 0;
+  uint64_t remapTime_ = 0;
+
+  /* Motion detection, and whether motion is ongoing. */
+  std::unique_ptr<MotionDetector> motion_;
+  bool motionActive_ = false;
+  unsigned int quietFrames_ = 0;
+  unsigned int motionEvents_ = 0;
+  uint64_t motionFrames_ = 0;
+  uint64_t motionTime_ = 0;
+
+  /* Frozen, stalled, black and saturated frame alarms. */
+  std::unique_ptr<FrameMonitor> monitor_;
+
+  /* Full ScalerCrop range, null if the camera can't crop. */
+  libcamera::Rectangle scalerCropMaximum_;
+  std::optional<libcamera::Rectangle> scalerCrop_;
+  /* Camera to open, the first one that can be configured if negative. */
+  long requestedCamera_;
   unsigned int cameraIndex_ = 0;
 
+  /* KMS connector and screen column, shared by the cameras on it. */
+  std::string connector_;
+  unsigned int displaySlot_ = 0;
+  unsigned int displaySlots_ = 1;
+  /* Position of the camera among those selected, for per camera sinks. */
+  unsigned int position_ = 0;
+  unsigned int cameraCount_ = 1;
+
+  /* Frame synchronizer shared with the other cameras, and our input in it. */
+  FrameSynchronizer* sync_ = nullptr;
+  unsigned int syncStream_ = 0;
+
+  /* Frame metadata shared with other processes, see frame_ring.h. */
+  std::unique_ptr<FrameRingWriter> ring_;
+
   uint64_t last_ = 0;
 
+  /* Capture statistics, printed when the session stops. */
+  uint64_t first_ = 0;
+  uint32_t sequence_ = 0;
+  unsigned int dropCount_ = 0;
+
   unsigned int queueCount_ = 0;
   unsigned int captureCount_ = 0;
   const libcamera::CameraManager* const cm_ = nullptr;
 
-#if 0  // not priority right now, for MJPG mainly
-  FormatConverter converter_;
-#endif
-
   std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
   std::vector<std::unique_ptr<libcamera::Request>> requests_;
-#if 0  // not priority right now, for MJPG mainly
-  std::map<libcamera::FrameBuffer*, std::unique_ptr<Image>> mappedBuffers_;
-#endif
+  MappedBufferCache mappedBuffers_;
 };
@@ -0,0 +1,599 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * compositor.cpp - Composite frames of several cameras into a single view
+ */
+
+#include "compositor.h"
+#include "cpu_features.h"
+#include "frame_planes.h"
+#include "lens_remap.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+#include "worker_pool.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+/* Output tiles, sized so that the source samples they read stay in cache. */
+constexpr unsigned int kTileWidth = 64;
+constexpr unsigned int kTileHeight = 16;
+
+/* Q4 fixed-point positions must fit in 16 bits. */
+constexpr unsigned int kMaxSize = 4096;
+
+/* Layer weights of a view that covers the whole tile alone. */
+constexpr size_t kOpaque = SIZE_MAX;
+
+/* View index of the layer blending in the fill color where views end. */
+constexpr unsigned int kBackground = UINT_MAX;
+
+const LensRemapKernels& bestKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::SSE2))
+    return sse2RemapKernels;
+#elif defined(__arm__) || defined(__aarch64__)
+  if (CpuFeatures::has(CpuFeatures::NEON))
+    return neonRemapKernels;
+#endif
+
+  return scalarRemapKernels;
+}
+
+/* Add samples of Bytes bytes weighted by 8-bit weights to the accumulators. */
+template <unsigned int Bytes>
+void accumulate(uint16_t* acc,
+                const uint8_t* samples,
+                const uint8_t* weights,
+                unsigned int count) {
+  for (unsigned int i = 0; i < count * Bytes; ++i)
+    acc[i] += samples[i] * weights[i / Bytes];
+}
+
+/* Weights of a sample sum to 255, divide by 255 with rounding. */
+void normalize(const uint16_t* acc, uint8_t* dst, unsigned int count) {
+  for (unsigned int i = 0; i < count; ++i) {
+    const unsigned int value = acc[i] + 128;
+    dst[i] = (value + (value >> 8)) >> 8;
+  }
+}
+
+} /* namespace */
+
+/*
+ * Load a composite layout from a text file of "key value" lines, with #
+ * starting comments. Each "camera" line starts the description of a view:
+ *
+ *   size 1280x720              output size, defaults to the display mode
+ *   camera 0                   index of the camera, as listed by -l
+ *   rect 0 0 640 720           output region to fit the frame in
+ *   homography 1 0 0 0 1 0 0 0 1
+ *                              or, for top-down views, the homography from
+ *                              output pixels to camera pixels, row-major
+ *   calibration front.cal      lens calibration, see LensCalibration::load(),
+ *                              relative to the layout file
+ *   feather 48                 width of the blend with overlapping views
+ *
+ * Views with neither a rect nor a homography are placed side by side in a
+ * grid.
+ */
+int CompositorLayout::load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    EPRINT("Failed to open composite layout %s\n", path.c_str());
+    return -ENOENT;
+  }
+
+  *this = CompositorLayout();
+
+  const size_t slash = path.rfind('/');
+  const std::string directory =
+      slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+  unsigned int number = 0;
+  for (std::string line; std::getline(file, line);) {
+    ++number;
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream stream(line);
+    std::string key;
+    if (!(stream >> key))
+      continue;
+
+    bool valid = true;
+    if (key == "size") {
+      std::string value;
+      valid = (stream >> value) && sscanf(value.c_str(), "%ux%u", &size.width,
+                                          &size.height) == 2;
+    } else if (key == "camera") {
+      views.emplace_back();
+      valid = static_cast<bool>(stream >> views.back().camera);
+    } else if (views.empty()) {
+      valid = false;
+    } else if (key == "rect") {
+      Rectangle& rect = views.back().rect;
+      valid = (stream >> rect.x >> rect.y >> rect.width >> rect.height) &&
+              rect.x >= 0 && rect.y >= 0 && rect.width && rect.height;
+    } else if (key == "homography") {
+      View& view = views.back();
+      for (double& value : view.homography)
+        valid = valid && (stream >> value);
+      view.hasHomography = valid;
+    } else if (key == "calibration") {
+      std::string value;
+      valid = static_cast<bool>(stream >> value);
+      views.back().calibration =
+          value[0] == '/' ? value : directory + value;
+    } else if (key == "feather") {
+      valid = (stream >> views.back().feather) && views.back().feather >= 0.0;
+    } else {
+      valid = false;
+    }
+
+    std::string trailing;
+    if (!valid || stream >> trailing) {
+      EPRINT("%s:%u: invalid line '%s'\n", path.c_str(), number, line.c_str());
+      return -EINVAL;
+    }
+  }
+
+  if (views.empty()) {
+    EPRINT("%s: no camera views\n", path.c_str());
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+/* A layout view resolved against the output and camera frame sizes. */
+struct Compositor::View {
+  /* Output region the view is clipped to, the whole output when empty. */
+  Rectangle clip;
+  double homography[9];
+
+  bool undistort;
+  LensCalibration calibration;
+
+  /* Size of the camera frames, and of the pixels the homography maps to. */
+  Size input;
+  Size camera;
+
+  double feather;
+
+  bool source(double x, double y, double* sx, double* sy) const;
+};
+
+/*
+ * Find the position in the camera frame of the output pixel (x, y). Returns
+ * false if the view doesn't show the pixel.
+ */
+bool Compositor::View::source(double x,
+                              double y,
+                              double* sx,
+                              double* sy) const {
+  if (!clip.isNull() &&
+      (x < clip.x - 0.5 || y < clip.y - 0.5 ||
+       x > clip.x + clip.width - 0.5 || y > clip.y + clip.height - 0.5))
+    return false;
+
+  const double* h = homography;
+  const double w = h[6] * x + h[7] * y + h[8];
+  if (w <= 1e-9)
+    return false;
+
+  double cx = (h[0] * x + h[1] * y + h[2]) / w;
+  double cy = (h[3] * x + h[4] * y + h[5]) / w;
+
+  if (undistort)
+    calibration.distortPixel(&cx, &cy);
+
+  *sx = (cx + 0.5) * input.width / camera.width - 0.5;
+  *sy = (cy + 0.5) * input.height / camera.height - 0.5;
+
+  return true;
+}
+
+/**
+ * \class Compositor
+ * \brief Composite NV12 frames of two or more cameras into one NV12 frame
+ *
+ * Each view of the layout maps output pixels to a camera frame, either by
+ * fitting the frame in a rectangle for side-by-side layouts, or through a
+ * ground plane homography for top-down layouts, followed by the lens model
+ * when a calibration is given. Where views overlap, they are blended with
+ * weights that fall off over a feather width at the edges of each frame, so
+ * that seams fade rather than cut.
+ *
+ * As for LensRemap, configure() does all the geometry once. The output is cut
+ * in tiles of kTileWidth x kTileHeight samples, and each tile stores, for each
+ * view it shows, the Q4 source position of its samples and, where views
+ * overlap, 8-bit blend weights that sum to 255. Most tiles are covered by a
+ * single view and interpolated straight into the output. The others
+ * interpolate each view into a row buffer and accumulate the weighted rows.
+ * Tile data is stored contiguously in the order tiles are composed, and bands
+ * of tile rows are spread over a worker pool.
+ */
+Compositor::Compositor() = default;
+
+Compositor::~Compositor() = default;
+
+bool Compositor::isSupported(const PixelFormat& format) {
+  return format == formats::NV12;
+}
+
+/*
+ * Build the composition tables for the \a layout of views of the \a inputs,
+ * to output frames of \a size with rows of \a stride bytes.
+ */
+int Compositor::configure(const CompositorLayout& layout,
+                          const std::vector<StreamConfiguration>& inputs,
+                          const Size& size,
+                          unsigned int stride) {
+  if (inputs.size() != layout.views.size())
+    return -EINVAL;
+
+  if (!size.width || !size.height || size.width % 2 || size.height % 2 ||
+      stride < size.width) {
+    EPRINT("Cannot composite %s frames\n", size.toString().c_str());
+    return -EINVAL;
+  }
+
+  for (const StreamConfiguration& cfg : inputs) {
+    if (!isSupported(cfg.pixelFormat)) {
+      EPRINT("Cannot composite %s frames, use NV12\n",
+             cfg.pixelFormat.toString().c_str());
+      return -ENOTSUP;
+    }
+
+    if (cfg.size.width < 4 || cfg.size.height < 4 ||
+        cfg.size.width > kMaxSize || cfg.size.height > kMaxSize ||
+        cfg.size.width % 2 || cfg.size.height % 2) {
+      EPRINT("Cannot composite %s camera frames\n",
+             cfg.size.toString().c_str());
+      return -EINVAL;
+    }
+  }
+
+  /* Grid cells for views placed side by side. */
+  const unsigned int count = layout.views.size();
+  const unsigned int columns = ceil(sqrt(count));
+  const unsigned int rows = (count + columns - 1) / columns;
+  const Size cell(size.width / columns, size.height / rows);
+
+  std::vector<View> views;
+  for (unsigned int i = 0; i < count; ++i) {
+    const CompositorLayout::View& config = layout.views[i];
+    View view{};
+
+    view.input = inputs[i].size;
+    view.camera = inputs[i].size;
+    view.feather = config.feather;
+
+    view.undistort = !config.calibration.empty();
+    if (view.undistort) {
+      int ret = view.calibration.load(config.calibration);
+      if (ret < 0)
+        return ret;
+
+      view.camera = view.calibration.size;
+    }
+
+    if (config.hasHomography) {
+      std::copy(config.homography, config.homography + 9, view.homography);
+      views.push_back(view);
+      continue;
+    }
+
+    Rectangle rect = config.rect;
+    if (rect.isNull())
+      rect = Rectangle(cell.width * (i % columns), cell.height * (i / columns),
+                       cell);
+
+    /* Fit the frame in the rectangle, keeping its aspect ratio. */
+    const double scale =
+        std::min(static_cast<double>(rect.width) / view.camera.width,
+                 static_cast<double>(rect.height) / view.camera.height);
+    const double width = view.camera.width * scale;
+    const double height = view.camera.height * scale;
+    const double left = rect.x + (rect.width - width) / 2;
+    const double top = rect.y + (rect.height - height) / 2;
+
+    view.clip = Rectangle(lround(left), lround(top), lround(width),
+                          lround(height));
+    view.homography[0] = 1 / scale;
+    view.homography[2] = (0.5 - left) / scale - 0.5;
+    view.homography[4] = 1 / scale;
+    view.homography[5] = (0.5 - top) / scale - 0.5;
+    view.homography[8] = 1.0;
+
+    views.push_back(view);
+  }
+
+  size_ = size;
+  stride_ = stride;
+  inputSizes_.clear();
+  inputStrides_.clear();
+  for (const StreamConfiguration& cfg : inputs) {
+    inputSizes_.push_back(cfg.size);
+    inputStrides_.push_back(cfg.stride);
+  }
+
+  planes_.clear();
+  planes_.push_back({size.width, size.height, 1, 1, 16, {}, {}, {}, {}});
+  planes_.push_back(
+      {size.width / 2, size.height / 2, 2, 2, 128, {}, {}, {}, {}});
+
+  for (Plane& plane : planes_)
+    buildPlane(&plane, views);
+
+  kernels_ = &bestKernels();
+  workers_ = WorkerPool::instance();
+
+  VERBOSE_PRINT("Compositing %u views into %s with %s kernels, %zu kB of "
+                "tables\n",
+                count, size.toString().c_str(), kernels_->name,
+                tableSize() / 1000);
+
+  return 0;
+}
+
+/*
+ * Compute the source positions and blend weights of the samples of each tile
+ * of \a plane, for each of the \a views.
+ */
+void Compositor::buildPlane(Plane* plane,
+                            const std::vector<View>& views) const {
+  const unsigned int sub = plane->subsampling;
+  const unsigned int count = views.size();
+
+  std::vector<uint32_t> positions(count * kTileWidth * kTileHeight);
+  std::vector<double> coverage(count * kTileWidth * kTileHeight);
+  std::vector<uint8_t> weights(count * kTileWidth * kTileHeight);
+  std::vector<uint8_t> background(kTileWidth * kTileHeight);
+
+  for (unsigned int y0 = 0; y0 < plane->height; y0 += kTileHeight) {
+    for (unsigned int x0 = 0; x0 < plane->width; x0 += kTileWidth) {
+      Tile tile{x0,
+                y0,
+                std::min(kTileWidth, plane->width - x0),
+                std::min(kTileHeight, plane->height - y0),
+                static_cast<unsigned int>(plane->layers.size()),
+                0};
+      const unsigned int samples = tile.width * tile.height;
+
+      /* Source positions and unnormalized weights of each view. */
+      for (unsigned int v = 0; v < count; ++v) {
+        const View& view = views[v];
+        const unsigned int width = view.input.width / sub;
+        const unsigned int height = view.input.height / sub;
+        const long maxX = (width - 1) * 16 - 1;
+        const long maxY = (height - 1) * 16 - 1;
+
+        for (unsigned int i = 0; i < samples; ++i) {
+          const double x = (x0 + i % tile.width + 0.5) * sub - 0.5;
+          const double y = (y0 + i / tile.width + 0.5) * sub - 0.5;
+          double sx, sy;
+
+          uint32_t& position = positions[v * samples + i];
+          double& weight = coverage[v * samples + i];
+          position = kInvalidPosition;
+          weight = 0.0;
+
+          if (!view.source(x, y, &sx, &sy))
+            continue;
+
+          sx = (sx + 0.5) / sub - 0.5;
+          sy = (sy + 0.5) / sub - 0.5;
+          if (!(sx >= 0.0 && sx <= width - 1 && sy >= 0.0 && sy <= height - 1))
+            continue;
+
+          const uint32_t qx = std::min(lround(sx * 16), maxX);
+          const uint32_t qy = std::min(lround(sy * 16), maxY);
+          position = qx | qy << 16;
+
+          /* Keep a little weight at the very edge of views. */
+          const double edge =
+              std::min({sx, width - 1 - sx, sy, height - 1 - sy}) * sub;
+          weight = view.feather > 0.0 ? edge / view.feather : 1.0;
+          weight = std::clamp(weight, 1e-3, 1.0);
+        }
+      }
+
+      /* Normalize the weights of each sample to sum to 255. */
+      bool partial = false;
+      for (unsigned int i = 0; i < samples; ++i) {
+        double sum = 0.0;
+        for (unsigned int v = 0; v < count; ++v)
+          sum += coverage[v * samples + i];
+
+        unsigned int total = 0;
+        unsigned int largest = 0;
+        for (unsigned int v = 0; v < count; ++v) {
+          const double weight = sum > 0.0 ? coverage[v * samples + i] / sum : 0;
+          weights[v * samples + i] = lround(weight * 255);
+          total += weights[v * samples + i];
+          if (weights[v * samples + i] > weights[largest * samples + i])
+            largest = v;
+        }
+
+        if (sum > 0.0)
+          weights[largest * samples + i] += 255 - static_cast<int>(total);
+
+        background[i] = sum > 0.0 ? 0 : 255;
+        partial |= background[i] != 0;
+      }
+
+      /* Keep the views the tile shows. */
+      for (unsigned int v = 0; v < count; ++v) {
+        const uint8_t* begin = &weights[v * samples];
+        const uint8_t* end = begin + samples;
+        if (std::all_of(begin, end, [](uint8_t w) { return !w; }))
+          continue;
+
+        Layer layer{v, plane->positions.size(), kOpaque};
+        plane->positions.insert(plane->positions.end(), &positions[v * samples],
+                                &positions[v * samples] + samples);
+
+        if (!std::all_of(begin, end, [](uint8_t w) { return w == 255; })) {
+          layer.weights = plane->weights.size();
+          plane->weights.insert(plane->weights.end(), begin, end);
+        }
+
+        plane->layers.push_back(layer);
+        ++tile.layers;
+      }
+
+      if (partial && tile.layers) {
+        plane->layers.push_back({kBackground, 0, plane->weights.size()});
+        plane->weights.insert(plane->weights.end(), background.begin(),
+                              background.begin() + samples);
+        ++tile.layers;
+      }
+
+      plane->tiles.push_back(tile);
+    }
+  }
+}
+
+size_t Compositor::tableSize() const {
+  size_t size = 0;
+
+  for (const Plane& plane : planes_)
+    size += plane.positions.size() * sizeof(uint32_t) + plane.weights.size();
+
+  return size;
+}
+
+void Compositor::composeTile(const Plane& plane,
+                             const Tile& tile,
+                             const std::vector<const uint8_t*>& inputs,
+                             uint8_t* dst) const {
+  auto kernel = plane.bytes == 2 ? kernels_->remap16 : kernels_->remap8;
+  const unsigned int length = tile.width * plane.bytes;
+  const Layer* layers = &plane.layers[tile.firstLayer];
+
+  dst += static_cast<size_t>(tile.y) * stride_ + tile.x * plane.bytes;
+
+  /* Outside of all views, or inside a single one. */
+  if (!tile.layers || (tile.layers == 1 && layers[0].weights == kOpaque)) {
+    const uint8_t* src = tile.layers ? inputs[layers[0].view] : nullptr;
+    const unsigned int stride = tile.layers ? inputStrides_[layers[0].view] : 0;
+
+    for (unsigned int y = 0; y < tile.height; ++y, dst += stride_) {
+      if (!src) {
+        memset(dst, plane.fill, length);
+        continue;
+      }
+
+      const uint32_t* map =
+          &plane.positions[layers[0].positions + y * tile.width];
+      kernel(src, stride, map, dst, tile.width, plane.fill);
+    }
+
+    return;
+  }
+
+  uint16_t acc[kTileWidth * 2];
+  uint8_t samples[kTileWidth * 2];
+
+  for (unsigned int y = 0; y < tile.height; ++y, dst += stride_) {
+    std::fill(acc, acc + length, 0);
+
+    for (unsigned int l = 0; l < tile.layers; ++l) {
+      const Layer& layer = layers[l];
+      const uint8_t* src =
+          layer.view == kBackground ? nullptr : inputs[layer.view];
+
+      if (src)
+        kernel(src, inputStrides_[layer.view],
+               &plane.positions[layer.positions + y * tile.width], samples,
+               tile.width, plane.fill);
+      else
+        memset(samples, plane.fill, length);
+
+      /* Opaque layers cover their tile alone, blended ones have weights. */
+      const uint8_t* weights = &plane.weights[layer.weights + y * tile.width];
+      if (plane.bytes == 2)
+        accumulate<2>(acc, samples, weights, tile.width);
+      else
+        accumulate<1>(acc, samples, weights, tile.width);
+    }
+
+    normalize(acc, dst, length);
+  }
+}
+
+/*
+ * Composite the latest frame of each view, in \a inputs, into \a output. Views
+ * without a frame yet, with no planes in \a inputs, are shown black. Returns 0
+ * on success or a negative error code.
+ */
+int Compositor::compose(
+    const std::vector<std::vector<Span<const uint8_t>>>& inputs,
+    const std::vector<Span<uint8_t>>& output) {
+  if (!kernels_ || inputs.size() != inputSizes_.size())
+    return -EINVAL;
+
+  /* Per plane pointers to the input frames, by view. */
+  std::vector<std::vector<const uint8_t*>> sources(
+      planes_.size(), std::vector<const uint8_t*>(inputs.size()));
+
+  for (unsigned int v = 0; v < inputs.size(); ++v) {
+    if (inputs[v].empty())
+      continue;
+
+    const size_t luma =
+        static_cast<size_t>(inputStrides_[v]) * inputSizes_[v].height;
+    std::vector<const uint8_t*> data;
+    if (splitPlanes(inputs[v], {luma, luma / 2}, &data) < 0) {
+      EPRINT("Frame of view %u too small for NV12\n", v);
+      continue;
+    }
+
+    for (unsigned int p = 0; p < planes_.size(); ++p)
+      sources[p][v] = data[p];
+  }
+
+  const size_t luma = static_cast<size_t>(stride_) * size_.height;
+  std::vector<uint8_t*> out;
+  if (splitPlanes(output, {luma, luma / 2}, &out) < 0) {
+    EPRINT("Composite frame too small for NV12\n");
+    return -EINVAL;
+  }
+
+  /* A few bands per thread, in whole tile rows, to even out the load. */
+  const unsigned int bands = workers_->size() * 4;
+
+  for (unsigned int p = 0; p < planes_.size(); ++p) {
+    const Plane& plane = planes_[p];
+    const unsigned int columns = (plane.width + kTileWidth - 1) / kTileWidth;
+    const unsigned int rows = (plane.height + kTileHeight - 1) / kTileHeight;
+    const unsigned int rowsPerBand = std::max(1u, (rows + bands - 1) / bands);
+
+    for (unsigned int row = 0; row < rows; row += rowsPerBand) {
+      const unsigned int begin = row * columns;
+      const unsigned int end = std::min(row + rowsPerBand, rows) * columns;
+
+      workers_->run(batch_, [this, &plane, &src = sources[p], dst = out[p],
+                             begin, end]() {
+        for (unsigned int t = begin; t < end; ++t)
+          composeTile(plane, plane.tiles[t], src, dst);
+      });
+    }
+  }
+
+  workers_->wait(batch_);
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * compositor.h - Composite frames of several cameras into a single view
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "lens_remap_kernels.h"
+#include "worker_pool.h"
+
+struct CompositorLayout {
+  struct View {
+    /* Index of the camera in the camera manager list. */
+    unsigned int camera = 0;
+
+    /* Output region showing the whole frame, for side-by-side layouts. */
+    libcamera::Rectangle rect;
+
+    /*
+     * Row-major homography from output pixels to camera pixels, for
+     * top-down layouts. Camera pixels are those of the corrected frame when
+     * a lens calibration is given.
+     */
+    bool hasHomography = false;
+    double homography[9] = {};
+
+    std::string calibration;
+
+    /* Width of the blend ramp at the edges of the frame, in pixels. */
+    double feather = 32.0;
+  };
+
+  int load(const std::string& path);
+
+  /* Output size, the display mode size when empty. */
+  libcamera::Size size;
+  std::vector<View> views;
+};
+
+class Compositor {
+ public:
+  Compositor();
+  ~Compositor();
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const CompositorLayout& layout,
+                const std::vector<libcamera::StreamConfiguration>& inputs,
+                const libcamera::Size& size,
+                unsigned int stride);
+
+  const char* kernelsName() const { return kernels_ ? kernels_->name : ""; }
+  size_t tableSize() const;
+
+  int compose(
+      const std::vector<std::vector<libcamera::Span<const uint8_t>>>& inputs,
+      const std::vector<libcamera::Span<uint8_t>>& output);
+
+ private:
+  /* Samples of one view in one tile, with blend weights unless opaque. */
+  struct Layer {
+    unsigned int view;
+    size_t positions;
+    size_t weights;
+  };
+
+  struct Tile {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+    unsigned int firstLayer;
+    unsigned int layers;
+  };
+
+  struct Plane {
+    unsigned int width;
+    unsigned int height;
+    unsigned int subsampling;
+    unsigned int bytes;
+    uint8_t fill;
+
+    std::vector<Tile> tiles;
+    std::vector<Layer> layers;
+    std::vector<uint32_t> positions;
+    std::vector<uint8_t> weights;
+  };
+
+  struct View;
+
+  void buildPlane(Plane* plane, const std::vector<View>& views) const;
+  void composeTile(const Plane& plane,
+                   const Tile& tile,
+                   const std::vector<const uint8_t*>& inputs,
+                   uint8_t* dst) const;
+
+  libcamera::Size size_;
+  unsigned int stride_ = 0;
+  std::vector<unsigned int> inputStrides_;
+  std::vector<libcamera::Size> inputSizes_;
+  std::vector<Plane> planes_;
+
+  const LensRemapKernels* kernels_ = nullptr;
+  WorkerPool* workers_ = nullptr;
+  WorkerPool::Batch batch_;
+};
@@ -0,0 +1,136 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * cpu_features.cpp - Runtime detection of CPU features used by pixel kernels
+ */
+
+#include "cpu_features.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+
+#include <errno.h>
+#include <atomic>
+#include <sstream>
+
+#if defined(__arm__) || defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
+namespace {
+
+struct FeatureName {
+  CpuFeatures::Feature feature;
+  const char* name;
+};
+
+const FeatureName featureNames[] = {
+    {CpuFeatures::SSE2, "sse2"},
+    {CpuFeatures::SSE41, "sse4.1"},
+    {CpuFeatures::AVX2, "avx2"},
+    {CpuFeatures::NEON, "neon"},
+    {CpuFeatures::NEONDotProd, "dotprod"},
+};
+
+std::atomic<unsigned int> enabledMask{~0U};
+
+unsigned int detect() {
+  unsigned int features = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    features |= CpuFeatures::SSE2;
+  if (__builtin_cpu_supports("sse4.1"))
+    features |= CpuFeatures::SSE41;
+  if (__builtin_cpu_supports("avx2"))
+    features |= CpuFeatures::AVX2;
+#elif defined(__aarch64__)
+  /* Advanced SIMD is mandatory on AArch64. */
+  features |= CpuFeatures::NEON;
+#ifdef HWCAP_ASIMDDP
+  if (getauxval(AT_HWCAP) & HWCAP_ASIMDDP)
+    features |= CpuFeatures::NEONDotProd;
+#endif
+#elif defined(__arm__)
+#ifdef HWCAP_ARM_NEON
+  if (getauxval(AT_HWCAP) & HWCAP_ARM_NEON)
+    features |= CpuFeatures::NEON;
+#endif
+#endif
+
+  return features;
+}
+
+} /* namespace */
+
+/**
+ * \class CpuFeatures
+ * \brief Select pixel kernels by what the CPU running twincam supports
+ *
+ * twincam is built once for a baseline of each architecture. Kernels for
+ * extensions beyond that baseline are built separately with the matching
+ * compiler flags, and users such as FormatConverter pick them at runtime from
+ * function tables by checking has().
+ *
+ * restrictTo() masks features out, so that every kernel variant can be
+ * exercised on one machine with --cpu-features.
+ */
+unsigned int CpuFeatures::detected() {
+  static const unsigned int features = detect();
+
+  return features;
+}
+
+unsigned int CpuFeatures::enabled() {
+  return detected() & enabledMask.load(std::memory_order_relaxed);
+}
+
+/*
+ * Only enable the features in the comma separated list \a names, "none"
+ * leaves the scalar kernels only. Features the CPU lacks stay disabled.
+ */
+int CpuFeatures::restrictTo(const std::string& names) {
+  unsigned int mask = 0;
+  std::istringstream stream(names);
+
+  for (std::string name; std::getline(stream, name, ',');) {
+    if (name.empty() || name == "none")
+      continue;
+
+    bool found = false;
+    for (const FeatureName& entry : featureNames) {
+      if (name == entry.name) {
+        mask |= entry.feature;
+        found = true;
+        break;
+      }
+    }
+
+    if (!found) {
+      EPRINT("Unknown CPU feature '%s', known features are: %s\n",
+             name.c_str(), toString(~0U).c_str());
+      return -EINVAL;
+    }
+  }
+
+  if (mask & ~detected())
+    EPRINT("CPU lacks %s, ignoring\n", toString(mask & ~detected()).c_str());
+
+  enabledMask.store(mask, std::memory_order_relaxed);
+
+  return 0;
+}
+
+std::string CpuFeatures::toString(unsigned int features) {
+  std::string str;
+
+  for (const FeatureName& entry : featureNames) {
+    if (!(features & entry.feature))
+      continue;
+
+    if (!str.empty())
+      str += ",";
+    str += entry.name;
+  }
+
+  return str.empty() ? "none" : str;
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * cpu_features.h - Runtime detection of CPU features used by pixel kernels
+ */
+
+#pragma once
+
+#include <string>
+
+class CpuFeatures {
+ public:
+  enum Feature : unsigned int {
+    SSE2 = 1 << 0,
+    SSE41 = 1 << 1,
+    AVX2 = 1 << 2,
+    NEON = 1 << 3,
+    NEONDotProd = 1 << 4,
+  };
+
+  static unsigned int detected();
+  static unsigned int enabled();
+  static bool has(Feature feature) { return enabled() & feature; }
+
+  static int restrictTo(const std::string& names);
+
+  static std::string toString(unsigned int features);
+};
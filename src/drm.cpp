@@ -12,11 +12,13 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <algorithm>
 #include <set>
 
+#include <libcamera/formats.h>
 #include <libcamera/framebuffer.h>
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
@@ -141,6 +143,7 @@ const std::map<uint32_t, const char*> connectorTypeNames{
     {DRM_MODE_CONNECTOR_VIRTUAL, "Virtual"},
     {DRM_MODE_CONNECTOR_DSI, "DSI"},
     {DRM_MODE_CONNECTOR_DPI, "DPI"},
+    {DRM_MODE_CONNECTOR_WRITEBACK, "Writeback"},
 };
 
 } /* namespace */
@@ -242,6 +245,9 @@ int Plane::setup() {
 FrameBuffer::FrameBuffer(Device* dev) : Object(dev, 0, Object::TypeFb) {}
 
 FrameBuffer::~FrameBuffer() {
+  if (!data_.empty())
+    munmap(data_.data(), data_.size());
+
   for (const auto& [plane, value] : planes_) {
     struct drm_gem_close gem_close;
     gem_close.handle = value.handle;
@@ -318,6 +324,9 @@ int AtomicRequest::commit(unsigned int flags) {
 Device::Device() = default;
 
 Device::~Device() {
+  /* Held frame buffers are released through the device. */
+  crtcUsers_.clear();
+
   if (fd_ != -1)
     drmClose(fd_);
 }
@@ -361,7 +370,8 @@ static int openCard() {
   return fd;
 }
 
-int Device::init() {
+/* Open the DRM device, listing writeback connectors if \a writeback is set. */
+int Device::init(bool writeback) {
   fd_ = openCard();
   if (fd_ < 0) {
     EPRINT("Failed to open any DRM/KMS device\n");
@@ -379,6 +389,11 @@ int Device::init() {
     return ret;
   }
 
+  /* Writeback connectors read back what a CRTC scanned out. */
+  if (writeback &&
+      drmSetClientCap(fd_, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1) < 0)
+    EPRINT("Writeback connectors not supported: %s\n", strerror(errno));
+
   /* List all the resources. */
   ret = getResources();
   if (ret < 0)
@@ -583,6 +598,106 @@ std::unique_ptr<FrameBuffer> Device::createFrameBuffer(
   return fb;
 }
 
+/*
+ * Allocate a frame buffer the CPU draws into, for frames that don't come from
+ * a camera. Packed RGB and NV12 are supported, the chroma plane of NV12 follows
+ * the luma plane with the same stride. The buffer stays mapped until it is
+ * destroyed.
+ */
+std::unique_ptr<FrameBuffer> Device::createDumbFrameBuffer(
+    const libcamera::PixelFormat& format,
+    const libcamera::Size& size) {
+  const bool nv12 = format == libcamera::formats::NV12 ||
+                    format == libcamera::formats::NV21;
+  unsigned int bpp;
+
+  switch (format) {
+    case libcamera::formats::NV12:
+    case libcamera::formats::NV21:
+      bpp = 8;
+      break;
+    case libcamera::formats::RGB565:
+      bpp = 16;
+      break;
+    case libcamera::formats::XRGB8888:
+    case libcamera::formats::XBGR8888:
+    case libcamera::formats::ARGB8888:
+    case libcamera::formats::ABGR8888:
+      bpp = 32;
+      break;
+    default:
+      EPRINT("Unsupported dumb buffer format %s\n", format.toString().c_str());
+      return nullptr;
+  }
+
+  std::unique_ptr<FrameBuffer> fb{new FrameBuffer(this)};
+  int ret;
+
+  struct drm_mode_create_dumb create = {};
+  create.width = size.width;
+  create.height = nv12 ? size.height * 3 / 2 : size.height;
+  create.bpp = bpp;
+  if (drmIoctl(fd_, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+    ret = -errno;
+    EPRINT("Failed to allocate dumb buffer: %s\n", strerror(-ret));
+    return nullptr;
+  }
+
+  /* Dumb buffers have no dmabuf, the handle is closed with the others. */
+  fb->planes_[-1] = {create.handle};
+
+  struct drm_mode_map_dumb map = {};
+  map.handle = create.handle;
+  if (drmIoctl(fd_, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
+    ret = -errno;
+    EPRINT("Failed to map dumb buffer: %s\n", strerror(-ret));
+    return nullptr;
+  }
+
+  void* data = mmap(nullptr, create.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd_, map.offset);
+  if (data == MAP_FAILED) {
+    ret = -errno;
+    EPRINT("Failed to map dumb buffer: %s\n", strerror(-ret));
+    return nullptr;
+  }
+
+  fb->data_ =
+      libcamera::Span<uint8_t>(static_cast<uint8_t*>(data), create.size);
+  fb->stride_ = create.pitch;
+
+  uint32_t handles[4] = {create.handle};
+  uint32_t strides[4] = {create.pitch};
+  uint32_t offsets[4] = {};
+  if (nv12) {
+    handles[1] = create.handle;
+    strides[1] = create.pitch;
+    offsets[1] = create.pitch * size.height;
+  }
+
+  ret = drmModeAddFB2(fd_, size.width, size.height, format.fourcc(), handles,
+                      strides, offsets, &fb->id_, 0);
+  if (ret < 0) {
+    ret = -errno;
+    EPRINT("Failed to add framebuffer: %s\n", strerror(-ret));
+    return nullptr;
+  }
+
+  return fb;
+}
+
+/*
+ * Reserve \a plane for the caller, when several sinks display frames through
+ * the same device. Returns false if the plane is already in use.
+ */
+bool Device::claimPlane(const Plane* plane) {
+  return claimedPlanes_.insert(plane).second;
+}
+
+void Device::releasePlane(const Plane* plane) {
+  claimedPlanes_.erase(plane);
+}
+
 void Device::drmEvent() const {
   drmEventContext ctx{};
   ctx.version = DRM_EVENT_CONTEXT_VERSION;
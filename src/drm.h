@@ -217,12 +217,19 @@ class FrameBuffer : public Object {
   };
   ~FrameBuffer();
 
+  /* CPU mapping of dumb buffers, empty for imported buffers. */
+  libcamera::Span<uint8_t> data() const { return data_; }
+  unsigned int stride() const { return stride_; }
+
  private:
   friend class Device;
 
   FrameBuffer(Device* dev);
 
   std::map<int, Plane> planes_;
+
+  libcamera::Span<uint8_t> data_;
+  unsigned int stride_ = 0;
 };
 
 class AtomicRequest {
@@ -262,7 +269,7 @@ class Device {
   Device();
   ~Device();
 
-  int init();
+  int init(bool writeback = false);
 
   int fd() const { return fd_; }
 
@@ -279,6 +286,25 @@ class Device {
       const libcamera::PixelFormat& format,
       const libcamera::Size& size,
       const std::array<uint32_t, 4>& strides);
+  std::unique_ptr<FrameBuffer> createDumbFrameBuffer(
+      const libcamera::PixelFormat& format,
+      const libcamera::Size& size);
+
+  bool claimPlane(const Plane* plane);
+  void releasePlane(const Plane* plane);
+
+  /*
+   * Sinks showing frames through a CRTC. A primary plane whose sink stopped
+   * while others still show frames on top of it stays on, with the buffers it
+   * may scan out, until the last sink turns the CRTC off.
+   */
+  struct CrtcUsers {
+    unsigned int count = 0;
+    std::vector<const Plane*> planes;
+    std::vector<std::unique_ptr<FrameBuffer>> buffers;
+  };
+
+  CrtcUsers& crtcUsers(const Crtc* crtc) { return crtcUsers_[crtc]; }
 
   libcamera::Signal<AtomicRequest*> requestComplete;
 
@@ -311,6 +337,10 @@ class Device {
   std::list<Property> properties_;
 
   std::map<uint32_t, Object*> objects_;
+
+  /* Planes used by a sink, when several sinks share the device. */
+  std::set<const Plane*> claimedPlanes_;
+  std::map<const Crtc*, CrtcUsers> crtcUsers_;
 };
 
 } /* namespace DRM */
@@ -26,6 +26,8 @@ EventLoop::EventLoop() {
 EventLoop::~EventLoop() {
   instance_ = nullptr;
 
+  /* Pending calls may hold removed events, free them with the base alive. */
+  calls_.clear();
   events_.clear();
   event_base_free(base_);
   libevent_global_shutdown();
@@ -63,6 +65,8 @@ void EventLoop::addFdEvent(int fd,
   unsigned short events = ((type & Read) ? EV_READ : 0) |
                           ((type & Write) ? EV_WRITE : 0) | EV_PERSIST;
 
+  event->fd_ = fd;
+  event->type_ = type;
   event->event_ =
       event_new(base_, fd, events, &EventLoop::Event::dispatch, event.get());
   if (!event->event_) {
@@ -78,14 +82,37 @@ void EventLoop::addFdEvent(int fd,
   events_.push_back(std::move(event));
 }
 
-void EventLoop::addTimerEvent(const std::chrono::microseconds period,
-                              const std::function<void()>& callback) {
+/*
+ * Stop watching \a fd for the event \a types, all of them by default,
+ * typically before closing it. The handler may remove its own event, the event
+ * is only freed once the handler returned.
+ */
+void EventLoop::removeFdEvent(int fd, int types) {
+  for (auto iter = events_.begin(); iter != events_.end();) {
+    if ((*iter)->fd_ != fd || !((*iter)->type_ & types)) {
+      ++iter;
+      continue;
+    }
+
+    event_del((*iter)->event_);
+    std::shared_ptr<Event> event = std::move(*iter);
+    iter = events_.erase(iter);
+    callLater([event]() {});
+  }
+}
+
+/*
+ * Call \a callback every \a period. Returns an identifier to remove the timer
+ * with, 0 if it couldn't be added.
+ */
+unsigned int EventLoop::addTimerEvent(const std::chrono::microseconds period,
+                                      const std::function<void()>& callback) {
   std::unique_ptr<Event> event = std::make_unique<Event>(callback);
   event->event_ = event_new(base_, -1, EV_PERSIST, &EventLoop::Event::dispatch,
                             event.get());
   if (!event->event_) {
     EPRINT("Failed to create timer event\n");
-    return;
+    return 0;
   }
 
   struct timeval tv;
@@ -95,10 +122,26 @@ void EventLoop::addTimerEvent(const std::chrono::microseconds period,
   int ret = event_add(event->event_, &tv);
   if (ret < 0) {
     EPRINT("Failed to add timer event\n");
-    return;
+    return 0;
   }
 
+  event->timer_ = ++lastTimer_;
   events_.push_back(std::move(event));
+  return lastTimer_;
+}
+
+/* Stop the \a timer, freed like fd events once its handler returned. */
+void EventLoop::removeTimerEvent(unsigned int timer) {
+  for (auto iter = events_.begin(); iter != events_.end(); ++iter) {
+    if (!timer || (*iter)->timer_ != timer)
+      continue;
+
+    event_del((*iter)->event_);
+    std::shared_ptr<Event> event = std::move(*iter);
+    events_.erase(iter);
+    callLater([event]() {});
+    return;
+  }
 }
 
 void EventLoop::dispatchCallback([[maybe_unused]] evutil_socket_t fd,
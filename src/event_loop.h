@@ -35,10 +35,12 @@ class EventLoop {
   void callLater(const std::function<void()>& func);
 
   void addFdEvent(int fd, EventType type, const std::function<void()>& handler);
+  void removeFdEvent(int fd, int types = Read | Write);
 
   using duration = std::chrono::steady_clock::duration;
-  void addTimerEvent(const std::chrono::microseconds period,
-                     const std::function<void()>& handler);
+  unsigned int addTimerEvent(const std::chrono::microseconds period,
+                             const std::function<void()>& handler);
+  void removeTimerEvent(unsigned int timer);
 
  private:
   struct Event {
@@ -49,12 +51,16 @@ class EventLoop {
 
     std::function<void()> callback_;
     struct event* event_ = nullptr;
+    int fd_ = -1;
+    int type_ = 0;
+    unsigned int timer_ = 0;
   };
 
   static EventLoop* instance_;
 
   struct event_base* base_;
   int exitCode_;
+  unsigned int lastTimer_ = 0;
 
   std::list<std::function<void()>> calls_;
   std::list<std::unique_ptr<Event>> events_;
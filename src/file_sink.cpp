@@ -5,63 +5,291 @@
  * file_sink.cpp - File Sink
  */
 
-#include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <iomanip>
 
 #include <libcamera/camera.h>
 
+#include "event_loop.h"
 #include "file_sink.h"
+#include "frame_index.h"
 #include "image.h"
+#include "mapped_buffer_cache.h"
 #include "twncm_stdio.h"
+#ifdef HAVE_ZSTD
+#include "frame_compressor.h"
+#include "worker_pool.h"
+#endif
 
 using namespace libcamera;
 
+/*
+ * Write all of \a data, resuming after short writes and signals. Returns the
+ * number of bytes written, less than \a size on error with errno set.
+ */
+static size_t writeAll(int fd, const uint8_t* data, size_t size) {
+  size_t written = 0;
+
+  while (written < size) {
+    const ssize_t ret = ::write(fd, data + written, size - written);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      if (!ret)
+        errno = ENOSPC;
+      break;
+    }
+
+    written += ret;
+  }
+
+  return written;
+}
+
 FileSink::FileSink(
     const std::map<const libcamera::Stream*, std::string>& streamNames,
     const std::string& filename)
-    : streamNames_(streamNames), filename_(filename) {}
+    : streamNames_(streamNames),
+      filename_(filename.empty() ? "/dev/null" : filename) {}
 
-FileSink::~FileSink() {}
+FileSink::~FileSink() {
+  stop();
+}
+
+#ifdef HAVE_ZSTD
+/*
+ * Compress frames on the worker pool before writing them, trading
+ * spare CPU cores for storage bandwidth. Frames are still written in capture
+ * order, and requests are held until their frame is written.
+ */
+void FileSink::enableCompression(int level) {
+  compressor_ = std::make_unique<FrameCompressor>(level);
+  workers_ = WorkerPool::instance();
+}
+#endif
 
 int FileSink::configure(const libcamera::CameraConfiguration& config) {
   int ret = FrameSink::configure(config);
   if (ret < 0)
     return ret;
 
+  streamIndexes_.clear();
+  for (unsigned int index = 0; index < config.size(); ++index)
+    streamIndexes_[config.at(index).stream()] = index;
+
   return 0;
 }
 
-void FileSink::mapBuffer(FrameBuffer* buffer) {
-  std::unique_ptr<Image> image =
-      Image::fromFrameBuffer(buffer, Image::MapMode::ReadOnly);
-  assert(image != nullptr);
+int FileSink::start() {
+  fd_ = open(filename_.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+             S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (fd_ == -1) {
+    int ret = -errno;
+    EPRINT("failed to open file %s: %s\n", filename_.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  pos_ = 0;
+
+#ifdef HAVE_ZSTD
+  flushToken_ = std::make_shared<bool>(true);
+  flushPosted_ = false;
+#endif
+
+  return openIndex();
+}
+
+int FileSink::stop() {
+#ifdef HAVE_ZSTD
+  /* Write out and release all held frames, flushes still posted are void. */
+  if (workers_) {
+    workers_->wait(batch_);
+    flushToken_.reset();
+    flushCompressed();
+    compressor_->printStats();
+  }
+#endif
+
+  if (indexFd_ != -1) {
+    close(indexFd_);
+    indexFd_ = -1;
+  }
 
-  mappedBuffers_[buffer] = std::move(image);
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+
+  return FrameSink::stop();
+}
+
+/*
+ * Frames are only indexed when recording to a regular file, there is nothing
+ * to seek into when writing to /dev/null or a pipe.
+ */
+int FileSink::openIndex() {
+  struct stat st;
+  if (fstat(fd_, &st) || !S_ISREG(st.st_mode))
+    return 0;
+
+  const std::string indexName = filename_ + ".idx";
+  indexFd_ =
+      open(indexName.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+           S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (indexFd_ == -1) {
+    int ret = -errno;
+    EPRINT("failed to open file %s: %s\n", indexName.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  FrameIndexHeader header = {};
+  memcpy(header.magic, frameIndexMagic, sizeof(header.magic));
+  header.version = frameIndexVersion;
+  header.headerSize = sizeof(FrameIndexHeader);
+  header.recordSize = sizeof(FrameIndexRecord);
+#ifdef HAVE_ZSTD
+  if (compressor_)
+    header.flags |= frameIndexFlagZstd;
+#endif
+
+  if (::write(indexFd_, &header, sizeof(header)) != sizeof(header)) {
+    EPRINT("failed to write frame index header\n");
+    close(indexFd_);
+    indexFd_ = -1;
+    return -EIO;
+  }
+
+  return 0;
 }
 
 bool FileSink::processRequest(Request* request) {
-  for (auto [stream, buffer] : request->buffers())
-    writeBuffer(buffer);
+  if (fd_ == -1 || !recording_)
+    return true;
+
+#ifdef HAVE_ZSTD
+  if (compressor_) {
+    compressRequest(request);
+    return false;
+  }
+#endif
+
+  for (auto [stream, buffer] : request->buffers()) {
+    if (streamIndexes_.count(stream))
+      writeBuffer(stream, buffer);
+  }
 
   return true;
 }
 
-void FileSink::writeBuffer(FrameBuffer* buffer) {
-  int ret = 0;
+#ifdef HAVE_ZSTD
+void FileSink::compressRequest(Request* request) {
+  std::unique_ptr<CompressedFrame> frame;
+  if (!free_.empty()) {
+    frame = std::move(free_.back());
+    free_.pop_back();
+  } else {
+    frame = std::make_unique<CompressedFrame>();
+  }
 
-  int fd = open(filename_.c_str(), O_CREAT | O_WRONLY,
-                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
-  if (fd == -1) {
-    ret = -errno;
-    EPRINT("failed to open file %s: %s\n", filename_.c_str(), strerror(-ret));
-    return;
+  frame->request = request;
+  frame->done = false;
+  /* Only the streams of the configuration given to the sink are recorded. */
+  unsigned int count = 0;
+  for (auto [stream, buffer] : request->buffers())
+    count += streamIndexes_.count(stream);
+  frame->buffers.resize(count);
+
+  unsigned int index = 0;
+  for (auto [stream, buffer] : request->buffers()) {
+    if (!streamIndexes_.count(stream))
+      continue;
+
+    CompressedFrame::Buffer& compressed = frame->buffers[index++];
+    compressed.stream = stream;
+    compressed.buffer = buffer;
+    compressed.image = mappedBuffers_->image(buffer);
+    compressed.planes.clear();
+
+    Image* image = compressed.image;
+    if (!image)
+      continue;
+
+    for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
+      const unsigned int bytesused = buffer->metadata().planes()[i].bytesused;
+      Span<const uint8_t> data = image->data(i);
+
+      compressed.planes.push_back(
+          data.subspan(0, std::min<size_t>(bytesused, data.size())));
+    }
+  }
+
+  CompressedFrame* job = frame.get();
+  pending_.push_back(std::move(frame));
+
+  std::weak_ptr<bool> token = flushToken_;
+  workers_->run(batch_, [this, job, token]() {
+    for (CompressedFrame::Buffer& compressed : job->buffers) {
+      Image::CpuAccess access(compressed.image, Image::MapMode::ReadOnly);
+      compressor_->compress(compressed.planes, compressed.data);
+    }
+
+    job->done = true;
+    if (flushPosted_.exchange(true))
+      return;
+
+    EventLoop::instance()->callLater([this, token]() {
+      if (token.expired())
+        return;
+
+      flushPosted_ = false;
+      flushCompressed();
+    });
+  });
+}
+
+/*
+ * Write out compressed frames in capture order and release their requests.
+ * Frames that completed ahead of an older one stay queued until it is done.
+ */
+void FileSink::flushCompressed() {
+  while (!pending_.empty() && pending_.front()->done) {
+    std::unique_ptr<CompressedFrame> frame = std::move(pending_.front());
+    pending_.pop_front();
+
+    for (const CompressedFrame::Buffer& compressed : frame->buffers) {
+      const uint64_t offset = pos_;
+      const size_t size = compressed.data.size();
+      const size_t written = writeAll(fd_, compressed.data.data(), size);
+
+      /* A damaged frame stays out of the index, the next ones still match. */
+      pos_ += written;
+      if (written != size) {
+        EPRINT("write error: %s\n", strerror(errno));
+        continue;
+      }
+
+      writeIndex(compressed.stream, compressed.buffer, offset, size);
+    }
+
+    Request* request = frame->request;
+    free_.push_back(std::move(frame));
+    requestProcessed.emit(request);
   }
+}
+#endif
 
-  Image* image = mappedBuffers_[buffer].get();
+void FileSink::writeBuffer(const Stream* stream, FrameBuffer* buffer) {
+  Image* image = mappedBuffers_->image(buffer);
+  if (!image)
+    return;
 
+  Image::CpuAccess access(image, Image::MapMode::ReadOnly);
+
+  const uint64_t offset = pos_;
   for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
     const unsigned int bytesused = buffer->metadata().planes()[i].bytesused;
 
@@ -72,16 +300,40 @@ void FileSink::writeBuffer(FrameBuffer* buffer) {
       EPRINT("payload size %d larger than plane size %lu\n", bytesused,
              data.size());
 
-    ret = ::write(fd, data.data(), length);
-    if (ret < 0) {
-      ret = -errno;
-      EPRINT("write error: %s\n", strerror(-ret));
-      break;
-    } else if (ret != static_cast<int>(length)) {
-      EPRINT("write error: only %d bytes written instead of %d\n", ret, length);
-      break;
+    const size_t written = writeAll(fd_, data.data(), length);
+
+    /* A damaged frame stays out of the index, the next ones still match. */
+    pos_ += written;
+    if (written != length) {
+      EPRINT("write error: only %zu bytes written instead of %u: %s\n",
+             written, length, strerror(errno));
+      return;
     }
   }
 
-  close(fd);
+  writeIndex(stream, buffer, offset, pos_ - offset);
+}
+
+void FileSink::writeIndex(const Stream* stream,
+                          const FrameBuffer* buffer,
+                          uint64_t offset,
+                          uint64_t length) {
+  if (indexFd_ == -1)
+    return;
+
+  const FrameMetadata& metadata = buffer->metadata();
+
+  FrameIndexRecord record = {};
+  record.offset = offset;
+  record.length = length;
+  record.timestamp = metadata.timestamp;
+  record.sequence = metadata.sequence;
+  record.stream = streamIndexes_[stream];
+  record.numPlanes =
+      std::min<size_t>(metadata.planes().size(), frameIndexMaxPlanes);
+  for (unsigned int i = 0; i < record.numPlanes; ++i)
+    record.bytesused[i] = metadata.planes()[i].bytesused;
+
+  if (::write(indexFd_, &record, sizeof(record)) != sizeof(record))
+    EPRINT("failed to write frame index record\n");
 }
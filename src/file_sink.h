@@ -7,14 +7,22 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <atomic>
+#include <deque>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
+
+#include <libcamera/base/span.h>
 
 #include <libcamera/stream.h>
 
 #include "frame_sink.h"
+#include "worker_pool.h"
 
+class FrameCompressor;
 class Image;
 
 class FileSink : public FrameSink {
@@ -23,16 +31,65 @@ class FileSink : public FrameSink {
            const std::string& filename = "/dev/null");
   ~FileSink();
 
+#ifdef HAVE_ZSTD
+  void enableCompression(int level);
+#endif
+
   int configure(const libcamera::CameraConfiguration& config) override;
 
-  void mapBuffer(libcamera::FrameBuffer* buffer) override;
+  int start() override;
+  int stop() override;
 
   bool processRequest(libcamera::Request* request) override;
 
  private:
-  void writeBuffer(libcamera::FrameBuffer* buffer);
+  int openIndex();
+  void writeBuffer(const libcamera::Stream* stream,
+                   libcamera::FrameBuffer* buffer);
+  void writeIndex(const libcamera::Stream* stream,
+                  const libcamera::FrameBuffer* buffer,
+                  uint64_t offset,
+                  uint64_t length);
+
+#ifdef HAVE_ZSTD
+  struct CompressedFrame {
+    struct Buffer {
+      const libcamera::Stream* stream;
+      const libcamera::FrameBuffer* buffer;
+      Image* image;
+      std::vector<libcamera::Span<const uint8_t>> planes;
+      std::vector<uint8_t> data;
+    };
+
+    libcamera::Request* request;
+    std::vector<Buffer> buffers;
+    std::atomic<bool> done;
+  };
+
+  void compressRequest(libcamera::Request* request);
+  void flushCompressed();
+#endif
 
   std::map<const libcamera::Stream*, std::string> streamNames_;
+  std::map<const libcamera::Stream*, unsigned int> streamIndexes_;
   std::string filename_;
-  std::map<libcamera::FrameBuffer*, std::unique_ptr<Image>> mappedBuffers_;
+
+  int fd_ = -1;
+  int indexFd_ = -1;
+  uint64_t pos_ = 0;
+
+#ifdef HAVE_ZSTD
+  std::unique_ptr<FrameCompressor> compressor_;
+  WorkerPool* workers_ = nullptr;
+  WorkerPool::Batch batch_;
+  /* Frames in capture order, written once compressed. */
+  std::deque<std::unique_ptr<CompressedFrame>> pending_;
+  std::vector<std::unique_ptr<CompressedFrame>> free_;
+  /*
+   * Flushes posted to the event loop by the workers, one at a time, and only
+   * run while the token set by start() is alive.
+   */
+  std::shared_ptr<bool> flushToken_;
+  std::atomic<bool> flushPosted_{false};
+#endif
 };
@@ -0,0 +1,418 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * format_converter.cpp - Convert YUV and MJPEG frames to RGB
+ */
+
+#include "format_converter.h"
+#include "cpu_features.h"
+#include "frame_planes.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+
+#include <errno.h>
+#include <math.h>
+
+#include <libcamera/color_space.h>
+#include <libcamera/formats.h>
+
+#ifdef HAVE_LIBJPEG
+#include "jpeg_error_manager.h"
+#endif
+
+using namespace libcamera;
+
+namespace {
+
+uint8_t clampPixel(int value) {
+  return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+int saturate16(int value) {
+  return value < INT16_MIN ? INT16_MIN : value > INT16_MAX ? INT16_MAX : value;
+}
+
+/*
+ * Reference conversion of one pixel, the vector kernels replicate each step
+ * with 16-bit lanes.
+ */
+void pixelToRGB(uint8_t y,
+                uint8_t u,
+                uint8_t v,
+                const YUVCoefficients& coeffs,
+                uint8_t* r,
+                uint8_t* g,
+                uint8_t* b) {
+  const int yy = (y - coeffs.yOffset) * coeffs.yScale + 32;
+  const int cu = u - 128;
+  const int cv = v - 128;
+
+  *r = clampPixel(saturate16(yy + cv * coeffs.rv) >> 6);
+  *g = clampPixel(
+      saturate16(saturate16(yy - cu * coeffs.gu) - cv * coeffs.gv) >> 6);
+  *b = clampPixel(saturate16(yy + cu * coeffs.bu) >> 6);
+}
+
+void unpackYUYV(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  for (unsigned int i = 0; i < width / 2; ++i) {
+    y[2 * i] = src[4 * i];
+    u[i] = src[4 * i + 1];
+    y[2 * i + 1] = src[4 * i + 2];
+    v[i] = src[4 * i + 3];
+  }
+}
+
+void unpackUYVY(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  for (unsigned int i = 0; i < width / 2; ++i) {
+    u[i] = src[4 * i];
+    y[2 * i] = src[4 * i + 1];
+    v[i] = src[4 * i + 2];
+    y[2 * i + 1] = src[4 * i + 3];
+  }
+}
+
+void unpackUV(const uint8_t* src, uint8_t* u, uint8_t* v, unsigned int width) {
+  for (unsigned int i = 0; i < width / 2; ++i) {
+    u[i] = src[2 * i];
+    v[i] = src[2 * i + 1];
+  }
+}
+
+void toXRGB8888(const uint8_t* y,
+                const uint8_t* u,
+                const uint8_t* v,
+                uint8_t* dst,
+                unsigned int width,
+                const YUVCoefficients& coeffs) {
+  for (unsigned int i = 0; i < width; ++i) {
+    pixelToRGB(y[i], u[i / 2], v[i / 2], coeffs, &dst[2], &dst[1], &dst[0]);
+    dst[3] = 0xff;
+    dst += 4;
+  }
+}
+
+void toRGB888(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  for (unsigned int i = 0; i < width; ++i) {
+    pixelToRGB(y[i], u[i / 2], v[i / 2], coeffs, &dst[2], &dst[1], &dst[0]);
+    dst += 3;
+  }
+}
+
+void toRGB565(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  for (unsigned int i = 0; i < width; ++i) {
+    uint8_t r, g, b;
+    pixelToRGB(y[i], u[i / 2], v[i / 2], coeffs, &r, &g, &b);
+
+    const uint16_t pixel = (r & 0xf8) << 8 | (g & 0xfc) << 3 | b >> 3;
+    dst[0] = pixel & 0xff;
+    dst[1] = pixel >> 8;
+    dst += 2;
+  }
+}
+
+const FormatConverterKernels& bestKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::AVX2))
+    return avx2ConverterKernels;
+  if (CpuFeatures::has(CpuFeatures::SSE2))
+    return sse2ConverterKernels;
+#elif defined(__arm__) || defined(__aarch64__)
+  if (CpuFeatures::has(CpuFeatures::NEON))
+    return neonConverterKernels;
+#endif
+
+  return scalarConverterKernels;
+}
+
+unsigned int bytesPerPixel(const PixelFormat& format) {
+  switch (format) {
+    case formats::XRGB8888:
+      return 4;
+    case formats::RGB888:
+      return 3;
+    case formats::RGB565:
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+} /* namespace */
+
+const FormatConverterKernels scalarConverterKernels = {
+    "scalar",   unpackYUYV, unpackUYVY, unpackUV,
+    toXRGB8888, toRGB888,   toRGB565,
+};
+
+/**
+ * \class FormatConverter
+ * \brief Convert camera frames to an RGB format a sink can display
+ *
+ * YUYV, UYVY, NV12, NV21 and YUV420 (I420) frames are converted to XRGB8888,
+ * RGB888 or RGB565 with the best vector kernels the CPU supports, see
+ * format_converter_kernels.h. Chroma is upsampled by replicating samples.
+ * MJPEG frames are decoded straight to the output format with libjpeg.
+ *
+ * The YCbCr encoding and quantization range come from the stream colour space
+ * when the camera reports one, and default to limited range BT.601.
+ */
+bool FormatConverter::isSupported(const PixelFormat& input,
+                                  const PixelFormat& output) {
+  if (!bytesPerPixel(output))
+    return false;
+
+  switch (input) {
+    case formats::YUYV:
+    case formats::UYVY:
+    case formats::NV12:
+    case formats::NV21:
+    case formats::YUV420:
+      return true;
+#if defined(HAVE_LIBJPEG) && defined(JCS_EXTENSIONS)
+    case formats::MJPEG:
+#ifndef JCS_ALPHA_EXTENSIONS
+      if (output == formats::RGB565)
+        return false;
+#endif
+      return true;
+#endif
+    default:
+      return false;
+  }
+}
+
+int FormatConverter::configure(const StreamConfiguration& input,
+                               const PixelFormat& output,
+                               unsigned int outputStride) {
+  if (!isSupported(input.pixelFormat, output)) {
+    EPRINT("Cannot convert %s to %s\n", input.pixelFormat.toString().c_str(),
+           output.toString().c_str());
+    return -EINVAL;
+  }
+
+  if (input.size.width % 2) {
+    EPRINT("Cannot convert frames of odd width %u\n", input.size.width);
+    return -EINVAL;
+  }
+
+  const unsigned int minStride = input.size.width * bytesPerPixel(output);
+  if (outputStride && outputStride < minStride) {
+    EPRINT("Output stride %u too small, %u needed\n", outputStride, minStride);
+    return -EINVAL;
+  }
+
+  input_ = input.pixelFormat;
+  output_ = output;
+  size_ = input.size;
+  stride_ = input.stride;
+  outputStride_ = outputStride ? outputStride : minStride;
+
+  Encoding encoding = Encoding::Rec601;
+  Range range = Range::Limited;
+  if (input.colorSpace) {
+    if (input.colorSpace->ycbcrEncoding == ColorSpace::YcbcrEncoding::Rec709)
+      encoding = Encoding::Rec709;
+    if (input.colorSpace->range == ColorSpace::Range::Full)
+      range = Range::Full;
+  }
+
+  setColorSpace(encoding, range);
+
+  kernels_ = &bestKernels();
+  rows_.resize(size_.width * 2);
+
+  VERBOSE_PRINT("Converting %s to %s with %s kernels\n",
+                input_.toString().c_str(), output_.toString().c_str(),
+                kernels_->name);
+
+  return 0;
+}
+
+void FormatConverter::setColorSpace(Encoding encoding, Range range) {
+  const double kr = encoding == Encoding::Rec709 ? 0.2126 : 0.299;
+  const double kb = encoding == Encoding::Rec709 ? 0.0722 : 0.114;
+  const double kg = 1.0 - kr - kb;
+  const double yScale = range == Range::Limited ? 255.0 / 219.0 : 1.0;
+  const double cScale = range == Range::Limited ? 255.0 / 224.0 : 1.0;
+
+  auto q6 = [](double value) {
+    return static_cast<int16_t>(lround(value * 64));
+  };
+
+  coefficients_.yOffset = range == Range::Limited ? 16 : 0;
+  coefficients_.yScale = q6(yScale);
+  coefficients_.rv = q6(2 * (1 - kr) * cScale);
+  coefficients_.gu = q6(2 * kb * (1 - kb) / kg * cScale);
+  coefficients_.gv = q6(2 * kr * (1 - kr) / kg * cScale);
+  coefficients_.bu = q6(2 * (1 - kb) * cScale);
+}
+
+size_t FormatConverter::outputSize() const {
+  return static_cast<size_t>(outputStride_) * size_.height;
+}
+
+/*
+ * Convert the frame in \a planes to \a dst, which must hold outputSize()
+ * bytes. Returns 0 on success or a negative error code.
+ */
+int FormatConverter::convert(const std::vector<Span<const uint8_t>>& planes,
+                             uint8_t* dst) {
+  if (!kernels_ || planes.empty())
+    return -EINVAL;
+
+#ifdef HAVE_LIBJPEG
+  if (input_ == formats::MJPEG)
+    return convertMJPEG(planes[0], dst);
+#endif
+
+  return convertYUV(planes, dst);
+}
+
+int FormatConverter::convertYUV(const std::vector<Span<const uint8_t>>& planes,
+                                uint8_t* dst) {
+  const unsigned int width = size_.width;
+  const unsigned int height = size_.height;
+  const size_t lumaSize = static_cast<size_t>(stride_) * height;
+  const size_t chromaRows = (height + 1) / 2;
+
+  std::vector<size_t> sizes;
+  switch (input_) {
+    case formats::NV12:
+    case formats::NV21:
+      sizes = {lumaSize, stride_ * chromaRows};
+      break;
+    case formats::YUV420:
+      sizes = {lumaSize, stride_ / 2 * chromaRows, stride_ / 2 * chromaRows};
+      break;
+    default:
+      sizes = {lumaSize};
+      break;
+  }
+
+  std::vector<const uint8_t*> data;
+  if (splitPlanes(planes, sizes, &data) < 0) {
+    EPRINT("Frame too small for %s %ux%u\n", input_.toString().c_str(), width,
+           height);
+    return -EINVAL;
+  }
+
+  auto toRGB = kernels_->toXRGB8888;
+  if (output_ == formats::RGB888)
+    toRGB = kernels_->toRGB888;
+  else if (output_ == formats::RGB565)
+    toRGB = kernels_->toRGB565;
+
+  uint8_t* yRow = rows_.data();
+  uint8_t* uRow = yRow + width;
+  uint8_t* vRow = uRow + width / 2;
+
+  for (unsigned int row = 0; row < height; ++row) {
+    const uint8_t* src = data[0] + static_cast<size_t>(row) * stride_;
+    const uint8_t* y = yRow;
+    const uint8_t* u = uRow;
+    const uint8_t* v = vRow;
+
+    switch (input_) {
+      case formats::YUYV:
+        kernels_->unpackYUYV(src, yRow, uRow, vRow, width);
+        break;
+      case formats::UYVY:
+        kernels_->unpackUYVY(src, yRow, uRow, vRow, width);
+        break;
+      case formats::NV12:
+      case formats::NV21:
+        y = src;
+        /* Odd rows share the chroma of the row above. */
+        if (!(row % 2)) {
+          const uint8_t* uv = data[1] + static_cast<size_t>(row / 2) * stride_;
+          if (input_ == formats::NV12)
+            kernels_->unpackUV(uv, uRow, vRow, width);
+          else
+            kernels_->unpackUV(uv, vRow, uRow, width);
+        }
+        break;
+      case formats::YUV420:
+        y = src;
+        u = data[1] + static_cast<size_t>(row / 2) * (stride_ / 2);
+        v = data[2] + static_cast<size_t>(row / 2) * (stride_ / 2);
+        break;
+      default:
+        return -EINVAL;
+    }
+
+    toRGB(y, u, v, dst + static_cast<size_t>(row) * outputStride_, width,
+          coefficients_);
+  }
+
+  return 0;
+}
+
+#ifdef HAVE_LIBJPEG
+int FormatConverter::convertMJPEG(const Span<const uint8_t>& data,
+                                  uint8_t* dst) {
+  struct jpeg_decompress_struct cinfo;
+  JpegErrorManager jpegErrorManager(cinfo);
+  if (setjmp(jpegErrorManager.escape_)) {
+    /* libjpeg found an error */
+    jpeg_destroy_decompress(&cinfo);
+    EPRINT("JPEG decompression error\n");
+    return -EINVAL;
+  }
+
+  jpeg_create_decompress(&cinfo);
+
+  jpeg_mem_src(&cinfo, data.data(), data.size());
+
+  jpeg_read_header(&cinfo, TRUE);
+
+#ifdef JCS_EXTENSIONS
+  if (output_ == formats::XRGB8888)
+    cinfo.out_color_space = JCS_EXT_BGRX;
+  else if (output_ == formats::RGB888)
+    cinfo.out_color_space = JCS_EXT_BGR;
+#ifdef JCS_ALPHA_EXTENSIONS
+  else
+    cinfo.out_color_space = JCS_RGB565;
+#endif
+#endif
+
+  jpeg_start_decompress(&cinfo);
+
+  if (cinfo.output_width != size_.width ||
+      cinfo.output_height != size_.height) {
+    EPRINT("JPEG frame is %ux%u, expected %ux%u\n", cinfo.output_width,
+           cinfo.output_height, size_.width, size_.height);
+    jpeg_destroy_decompress(&cinfo);
+    return -EINVAL;
+  }
+
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW rowptr =
+        dst + static_cast<size_t>(cinfo.output_scanline) * outputStride_;
+    jpeg_read_scanlines(&cinfo, &rowptr, 1);
+  }
+
+  jpeg_finish_decompress(&cinfo);
+
+  jpeg_destroy_decompress(&cinfo);
+
+  return 0;
+}
+#endif
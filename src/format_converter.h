@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * format_converter.h - Convert YUV and MJPEG frames to RGB
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "format_converter_kernels.h"
+
+class FormatConverter {
+ public:
+  enum class Encoding {
+    Rec601,
+    Rec709,
+  };
+
+  enum class Range {
+    Limited,
+    Full,
+  };
+
+  static bool isSupported(const libcamera::PixelFormat& input,
+                          const libcamera::PixelFormat& output);
+
+  int configure(const libcamera::StreamConfiguration& input,
+                const libcamera::PixelFormat& output,
+                unsigned int outputStride = 0);
+  void setColorSpace(Encoding encoding, Range range);
+
+  const libcamera::PixelFormat& outputFormat() const { return output_; }
+  unsigned int outputStride() const { return outputStride_; }
+  size_t outputSize() const;
+
+  int convert(const std::vector<libcamera::Span<const uint8_t>>& planes,
+              uint8_t* dst);
+
+ private:
+  int convertYUV(const std::vector<libcamera::Span<const uint8_t>>& planes,
+                 uint8_t* dst);
+#ifdef HAVE_LIBJPEG
+  int convertMJPEG(const libcamera::Span<const uint8_t>& data, uint8_t* dst);
+#endif
+
+  libcamera::PixelFormat input_;
+  libcamera::PixelFormat output_;
+  libcamera::Size size_;
+  unsigned int stride_ = 0;
+  unsigned int outputStride_ = 0;
+
+  YUVCoefficients coefficients_ = {};
+  const FormatConverterKernels* kernels_ = nullptr;
+
+  std::vector<uint8_t> rows_;
+};
@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * format_converter_avx2.cpp - AVX2 row kernels for FormatConverter
+ */
+
+#include "format_converter_kernels.h"
+
+#if defined(__AVX2__)
+
+#include <string.h>
+
+#include <immintrin.h>
+
+namespace {
+
+struct Coefficients {
+  Coefficients(const YUVCoefficients& coeffs)
+      : yOffset(_mm256_set1_epi16(coeffs.yOffset)),
+        yScale(_mm256_set1_epi16(coeffs.yScale)),
+        rv(_mm256_set1_epi16(coeffs.rv)),
+        gu(_mm256_set1_epi16(coeffs.gu)),
+        gv(_mm256_set1_epi16(coeffs.gv)),
+        bu(_mm256_set1_epi16(coeffs.bu)) {}
+
+  __m256i yOffset;
+  __m256i yScale;
+  __m256i rv;
+  __m256i gu;
+  __m256i gv;
+  __m256i bu;
+};
+
+/*
+ * Packing 16-bit lanes to bytes works within 128-bit lanes, restore the
+ * element order afterwards.
+ */
+__m256i packus(__m256i a, __m256i b) {
+  return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+/* Convert 16 pixels held in 16-bit lanes, clamped to [0, 255]. */
+void pixelsToRGB(__m256i y,
+                 __m256i cu,
+                 __m256i cv,
+                 const Coefficients& c,
+                 __m256i* r,
+                 __m256i* g,
+                 __m256i* b) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max = _mm256_set1_epi16(255);
+  const __m256i yy = _mm256_add_epi16(
+      _mm256_mullo_epi16(_mm256_sub_epi16(y, c.yOffset), c.yScale),
+      _mm256_set1_epi16(32));
+
+  *r = _mm256_srai_epi16(
+      _mm256_adds_epi16(yy, _mm256_mullo_epi16(cv, c.rv)), 6);
+  *g = _mm256_srai_epi16(
+      _mm256_subs_epi16(_mm256_subs_epi16(yy, _mm256_mullo_epi16(cu, c.gu)),
+                        _mm256_mullo_epi16(cv, c.gv)),
+      6);
+  *b = _mm256_srai_epi16(
+      _mm256_adds_epi16(yy, _mm256_mullo_epi16(cu, c.bu)), 6);
+
+  *r = _mm256_min_epi16(_mm256_max_epi16(*r, zero), max);
+  *g = _mm256_min_epi16(_mm256_max_epi16(*g, zero), max);
+  *b = _mm256_min_epi16(_mm256_max_epi16(*b, zero), max);
+}
+
+/*
+ * Convert 32 pixels, returning R, G and B in 16-bit lanes, pixels 0-15 in lo
+ * and 16-31 in hi.
+ */
+void blockToRGB(const uint8_t* y,
+                const uint8_t* u,
+                const uint8_t* v,
+                const Coefficients& c,
+                __m256i rgb[3][2]) {
+  const __m256i bias = _mm256_set1_epi16(128);
+
+  const __m128i u8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u));
+  const __m128i v8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v));
+
+  for (unsigned int i = 0; i < 2; ++i) {
+    const __m256i luma = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + i * 16)));
+    const __m256i cu = _mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(i ? _mm_unpackhi_epi8(u8, u8)
+                               : _mm_unpacklo_epi8(u8, u8)),
+        bias);
+    const __m256i cv = _mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(i ? _mm_unpackhi_epi8(v8, v8)
+                               : _mm_unpacklo_epi8(v8, v8)),
+        bias);
+
+    pixelsToRGB(luma, cu, cv, c, &rgb[0][i], &rgb[1][i], &rgb[2][i]);
+  }
+}
+
+void storeXRGB8888(const __m256i rgb[3][2], uint8_t* dst) {
+  const __m256i r = packus(rgb[0][0], rgb[0][1]);
+  const __m256i g = packus(rgb[1][0], rgb[1][1]);
+  const __m256i b = packus(rgb[2][0], rgb[2][1]);
+  const __m256i x = _mm256_set1_epi8(-1);
+
+  /* Interleaving also works within 128-bit lanes, pixels 0-7 and 16-23. */
+  const __m256i bgLo = _mm256_unpacklo_epi8(b, g);
+  const __m256i rxLo = _mm256_unpacklo_epi8(r, x);
+  /* Pixels 8-15 and 24-31. */
+  const __m256i bgHi = _mm256_unpackhi_epi8(b, g);
+  const __m256i rxHi = _mm256_unpackhi_epi8(r, x);
+
+  const __m256i p0 = _mm256_unpacklo_epi16(bgLo, rxLo);
+  const __m256i p1 = _mm256_unpackhi_epi16(bgLo, rxLo);
+  const __m256i p2 = _mm256_unpacklo_epi16(bgHi, rxHi);
+  const __m256i p3 = _mm256_unpackhi_epi16(bgHi, rxHi);
+
+  __m256i* out = reinterpret_cast<__m256i*>(dst);
+  _mm256_storeu_si256(out, _mm256_permute2x128_si256(p0, p1, 0x20));
+  _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+  _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+  _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+}
+
+/* Split 32 interleaved pairs of bytes into even and odd bytes. */
+void deinterleave(const uint8_t* src, __m256i* even, __m256i* odd) {
+  const __m256i mask = _mm256_set1_epi16(0xff);
+  const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+  const __m256i b =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+
+  *even = packus(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+  *odd = packus(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+}
+
+/* Split 16 interleaved pairs of bytes held in a register. */
+void splitChroma(__m256i chroma, uint8_t* u, uint8_t* v) {
+  const __m256i mask = _mm256_set1_epi16(0xff);
+  const __m256i zero = _mm256_setzero_si256();
+
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(u),
+                   _mm256_castsi256_si128(
+                       packus(_mm256_and_si256(chroma, mask), zero)));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(v),
+                   _mm256_castsi256_si128(
+                       packus(_mm256_srli_epi16(chroma, 8), zero)));
+}
+
+void unpackYUYV(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    __m256i luma, chroma;
+    deinterleave(src, &luma, &chroma);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), luma);
+    splitChroma(chroma, u + i / 2, v + i / 2);
+    src += 64;
+  }
+
+  scalarConverterKernels.unpackYUYV(src, y + i, u + i / 2, v + i / 2,
+                                    width - i);
+}
+
+void unpackUYVY(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    __m256i luma, chroma;
+    deinterleave(src, &chroma, &luma);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), luma);
+    splitChroma(chroma, u + i / 2, v + i / 2);
+    src += 64;
+  }
+
+  scalarConverterKernels.unpackUYVY(src, y + i, u + i / 2, v + i / 2,
+                                    width - i);
+}
+
+void unpackUV(const uint8_t* src, uint8_t* u, uint8_t* v, unsigned int width) {
+  unsigned int i = 0;
+
+  for (; i + 64 <= width; i += 64) {
+    __m256i cb, cr;
+    deinterleave(src, &cb, &cr);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(u + i / 2), cb);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i / 2), cr);
+    src += 64;
+  }
+
+  scalarConverterKernels.unpackUV(src, u + i / 2, v + i / 2, width - i);
+}
+
+void toXRGB8888(const uint8_t* y,
+                const uint8_t* u,
+                const uint8_t* v,
+                uint8_t* dst,
+                unsigned int width,
+                const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    __m256i rgb[3][2];
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, rgb);
+    storeXRGB8888(rgb, dst + i * 4);
+  }
+
+  scalarConverterKernels.toXRGB8888(y + i, u + i / 2, v + i / 2, dst + i * 4,
+                                    width - i, coeffs);
+}
+
+void toRGB888(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  alignas(32) uint8_t block[128];
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    __m256i rgb[3][2];
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, rgb);
+    storeXRGB8888(rgb, block);
+
+    uint8_t* out = dst + i * 3;
+    for (unsigned int j = 0; j < 32; ++j)
+      memcpy(out + j * 3, block + j * 4, 3);
+  }
+
+  scalarConverterKernels.toRGB888(y + i, u + i / 2, v + i / 2, dst + i * 3,
+                                  width - i, coeffs);
+}
+
+void toRGB565(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  const __m256i rMask = _mm256_set1_epi16(0xf8);
+  const __m256i gMask = _mm256_set1_epi16(0xfc);
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    __m256i rgb[3][2];
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, rgb);
+
+    __m256i* out = reinterpret_cast<__m256i*>(dst + i * 2);
+    for (unsigned int j = 0; j < 2; ++j) {
+      const __m256i pixels = _mm256_or_si256(
+          _mm256_or_si256(
+              _mm256_slli_epi16(_mm256_and_si256(rgb[0][j], rMask), 8),
+              _mm256_slli_epi16(_mm256_and_si256(rgb[1][j], gMask), 3)),
+          _mm256_srli_epi16(rgb[2][j], 3));
+      _mm256_storeu_si256(out + j, pixels);
+    }
+  }
+
+  scalarConverterKernels.toRGB565(y + i, u + i / 2, v + i / 2, dst + i * 2,
+                                  width - i, coeffs);
+}
+
+} /* namespace */
+
+const FormatConverterKernels avx2ConverterKernels = {
+    "AVX2",     unpackYUYV, unpackUYVY, unpackUV,
+    toXRGB8888, toRGB888,   toRGB565,
+};
+
+#endif /* __AVX2__ */
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * format_converter_kernels.h - Row kernels used by FormatConverter
+ *
+ * Conversion runs one row at a time in two steps. Packed and semi-planar
+ * input is first split into separate Y, U and V rows, with one U and V sample
+ * per two pixels, then the planar rows are converted to RGB.
+ *
+ * All implementations use the same 16-bit fixed-point arithmetic, with
+ * saturating additions, and produce exactly the output of the scalar kernels.
+ * The vector kernels process whole blocks of pixels and hand the remainder of
+ * the row over to the scalar kernels. Widths are always even.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Coefficients in Q6, R = Y' + rv * V', G = Y' - gu * U' - gv * V' and
+ * B = Y' + bu * U', with Y' = yScale * (Y - yOffset) and U' and V' centered on
+ * zero. yScale * (255 - yOffset) plus any chroma term may exceed the 16-bit
+ * range, the saturating additions clamp it to white.
+ */
+struct YUVCoefficients {
+  int16_t yOffset;
+  int16_t yScale;
+  int16_t rv;
+  int16_t gu;
+  int16_t gv;
+  int16_t bu;
+};
+
+struct FormatConverterKernels {
+  const char* name;
+
+  /* Split width pixels of YUYV or UYVY into Y, U and V rows. */
+  void (*unpackYUYV)(const uint8_t* src,
+                     uint8_t* y,
+                     uint8_t* u,
+                     uint8_t* v,
+                     unsigned int width);
+  void (*unpackUYVY)(const uint8_t* src,
+                     uint8_t* y,
+                     uint8_t* u,
+                     uint8_t* v,
+                     unsigned int width);
+  /* Split the interleaved chroma row covering width pixels. */
+  void (*unpackUV)(const uint8_t* src,
+                   uint8_t* u,
+                   uint8_t* v,
+                   unsigned int width);
+
+  void (*toXRGB8888)(const uint8_t* y,
+                     const uint8_t* u,
+                     const uint8_t* v,
+                     uint8_t* dst,
+                     unsigned int width,
+                     const YUVCoefficients& coeffs);
+  void (*toRGB888)(const uint8_t* y,
+                   const uint8_t* u,
+                   const uint8_t* v,
+                   uint8_t* dst,
+                   unsigned int width,
+                   const YUVCoefficients& coeffs);
+  void (*toRGB565)(const uint8_t* y,
+                   const uint8_t* u,
+                   const uint8_t* v,
+                   uint8_t* dst,
+                   unsigned int width,
+                   const YUVCoefficients& coeffs);
+};
+
+/*
+ * The vector kernels are built with the compiler flags for their instruction
+ * set, callers check CpuFeatures before using them.
+ */
+extern const FormatConverterKernels scalarConverterKernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const FormatConverterKernels sse2ConverterKernels;
+extern const FormatConverterKernels avx2ConverterKernels;
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+extern const FormatConverterKernels neonConverterKernels;
+#endif
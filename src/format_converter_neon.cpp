@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * format_converter_neon.cpp - NEON row kernels for FormatConverter
+ */
+
+#include "format_converter_kernels.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+namespace {
+
+struct Coefficients {
+  Coefficients(const YUVCoefficients& coeffs)
+      : yOffset(vdupq_n_s16(coeffs.yOffset)),
+        yScale(vdupq_n_s16(coeffs.yScale)),
+        rv(vdupq_n_s16(coeffs.rv)),
+        gu(vdupq_n_s16(coeffs.gu)),
+        gv(vdupq_n_s16(coeffs.gv)),
+        bu(vdupq_n_s16(coeffs.bu)) {}
+
+  int16x8_t yOffset;
+  int16x8_t yScale;
+  int16x8_t rv;
+  int16x8_t gu;
+  int16x8_t gv;
+  int16x8_t bu;
+};
+
+/*
+ * Convert 8 pixels held in 16-bit lanes. vqshrun shifts and clamps to
+ * [0, 255] in one step.
+ */
+void pixelsToRGB(uint8x8_t y,
+                 int16x8_t cu,
+                 int16x8_t cv,
+                 const Coefficients& c,
+                 uint8x8_t* r,
+                 uint8x8_t* g,
+                 uint8x8_t* b) {
+  const int16x8_t luma = vreinterpretq_s16_u16(vmovl_u8(y));
+  const int16x8_t yy = vaddq_s16(
+      vmulq_s16(vsubq_s16(luma, c.yOffset), c.yScale), vdupq_n_s16(32));
+
+  *r = vqshrun_n_s16(vqaddq_s16(yy, vmulq_s16(cv, c.rv)), 6);
+  *g = vqshrun_n_s16(
+      vqsubq_s16(vqsubq_s16(yy, vmulq_s16(cu, c.gu)), vmulq_s16(cv, c.gv)),
+      6);
+  *b = vqshrun_n_s16(vqaddq_s16(yy, vmulq_s16(cu, c.bu)), 6);
+}
+
+/* Convert 16 pixels. */
+void blockToRGB(const uint8_t* y,
+                const uint8_t* u,
+                const uint8_t* v,
+                const Coefficients& c,
+                uint8x16_t* r,
+                uint8x16_t* g,
+                uint8x16_t* b) {
+  const uint8x8_t bias = vdup_n_u8(128);
+  const uint8x16_t luma = vld1q_u8(y);
+  const int16x8_t cu = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(u), bias));
+  const int16x8_t cv = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(v), bias));
+  const int16x8x2_t cu2 = vzipq_s16(cu, cu);
+  const int16x8x2_t cv2 = vzipq_s16(cv, cv);
+
+  uint8x8_t rLo, gLo, bLo, rHi, gHi, bHi;
+  pixelsToRGB(vget_low_u8(luma), cu2.val[0], cv2.val[0], c, &rLo, &gLo, &bLo);
+  pixelsToRGB(vget_high_u8(luma), cu2.val[1], cv2.val[1], c, &rHi, &gHi,
+              &bHi);
+
+  *r = vcombine_u8(rLo, rHi);
+  *g = vcombine_u8(gLo, gHi);
+  *b = vcombine_u8(bLo, bHi);
+}
+
+void unpackYUYV(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    const uint8x16x4_t pixels = vld4q_u8(src);
+    const uint8x16x2_t luma = {{pixels.val[0], pixels.val[2]}};
+
+    vst2q_u8(y + i, luma);
+    vst1q_u8(u + i / 2, pixels.val[1]);
+    vst1q_u8(v + i / 2, pixels.val[3]);
+    src += 64;
+  }
+
+  scalarConverterKernels.unpackYUYV(src, y + i, u + i / 2, v + i / 2,
+                                    width - i);
+}
+
+void unpackUYVY(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    const uint8x16x4_t pixels = vld4q_u8(src);
+    const uint8x16x2_t luma = {{pixels.val[1], pixels.val[3]}};
+
+    vst2q_u8(y + i, luma);
+    vst1q_u8(u + i / 2, pixels.val[0]);
+    vst1q_u8(v + i / 2, pixels.val[2]);
+    src += 64;
+  }
+
+  scalarConverterKernels.unpackUYVY(src, y + i, u + i / 2, v + i / 2,
+                                    width - i);
+}
+
+void unpackUV(const uint8_t* src, uint8_t* u, uint8_t* v, unsigned int width) {
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    const uint8x16x2_t chroma = vld2q_u8(src);
+
+    vst1q_u8(u + i / 2, chroma.val[0]);
+    vst1q_u8(v + i / 2, chroma.val[1]);
+    src += 32;
+  }
+
+  scalarConverterKernels.unpackUV(src, u + i / 2, v + i / 2, width - i);
+}
+
+void toXRGB8888(const uint8_t* y,
+                const uint8_t* u,
+                const uint8_t* v,
+                uint8_t* dst,
+                unsigned int width,
+                const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    uint8x16x4_t pixels;
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, &pixels.val[2], &pixels.val[1],
+               &pixels.val[0]);
+    pixels.val[3] = vdupq_n_u8(0xff);
+    vst4q_u8(dst + i * 4, pixels);
+  }
+
+  scalarConverterKernels.toXRGB8888(y + i, u + i / 2, v + i / 2, dst + i * 4,
+                                    width - i, coeffs);
+}
+
+void toRGB888(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    uint8x16x3_t pixels;
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, &pixels.val[2], &pixels.val[1],
+               &pixels.val[0]);
+    vst3q_u8(dst + i * 3, pixels);
+  }
+
+  scalarConverterKernels.toRGB888(y + i, u + i / 2, v + i / 2, dst + i * 3,
+                                  width - i, coeffs);
+}
+
+void toRGB565(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  const uint8x16_t rMask = vdupq_n_u8(0xf8);
+  const uint8x16_t gMask = vdupq_n_u8(0xfc);
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    uint8x16_t r, g, b;
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, &r, &g, &b);
+
+    r = vandq_u8(r, rMask);
+    g = vandq_u8(g, gMask);
+    b = vshrq_n_u8(b, 3);
+
+    const uint16x8_t lo =
+        vorrq_u16(vorrq_u16(vshll_n_u8(vget_low_u8(r), 8),
+                            vshll_n_u8(vget_low_u8(g), 3)),
+                  vmovl_u8(vget_low_u8(b)));
+    const uint16x8_t hi =
+        vorrq_u16(vorrq_u16(vshll_n_u8(vget_high_u8(r), 8),
+                            vshll_n_u8(vget_high_u8(g), 3)),
+                  vmovl_u8(vget_high_u8(b)));
+
+    uint16_t* out = reinterpret_cast<uint16_t*>(dst + i * 2);
+    vst1q_u16(out, lo);
+    vst1q_u16(out + 8, hi);
+  }
+
+  scalarConverterKernels.toRGB565(y + i, u + i / 2, v + i / 2, dst + i * 2,
+                                  width - i, coeffs);
+}
+
+} /* namespace */
+
+const FormatConverterKernels neonConverterKernels = {
+    "NEON",     unpackYUYV, unpackUYVY, unpackUV,
+    toXRGB8888, toRGB888,   toRGB565,
+};
+
+#endif /* __ARM_NEON */
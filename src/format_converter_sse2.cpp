@@ -0,0 +1,273 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * format_converter_sse2.cpp - SSE2 row kernels for FormatConverter
+ */
+
+#include "format_converter_kernels.h"
+
+#if defined(__SSE2__)
+
+#include <string.h>
+
+#include <emmintrin.h>
+
+namespace {
+
+struct Coefficients {
+  Coefficients(const YUVCoefficients& coeffs)
+      : yOffset(_mm_set1_epi16(coeffs.yOffset)),
+        yScale(_mm_set1_epi16(coeffs.yScale)),
+        rv(_mm_set1_epi16(coeffs.rv)),
+        gu(_mm_set1_epi16(coeffs.gu)),
+        gv(_mm_set1_epi16(coeffs.gv)),
+        bu(_mm_set1_epi16(coeffs.bu)) {}
+
+  __m128i yOffset;
+  __m128i yScale;
+  __m128i rv;
+  __m128i gu;
+  __m128i gv;
+  __m128i bu;
+};
+
+/* Convert 8 pixels held in 16-bit lanes, results are not clamped yet. */
+void pixelsToRGB(__m128i y,
+                 __m128i cu,
+                 __m128i cv,
+                 const Coefficients& c,
+                 __m128i* r,
+                 __m128i* g,
+                 __m128i* b) {
+  const __m128i yy =
+      _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, c.yOffset), c.yScale),
+                    _mm_set1_epi16(32));
+
+  *r = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(cv, c.rv)), 6);
+  *g = _mm_srai_epi16(
+      _mm_subs_epi16(_mm_subs_epi16(yy, _mm_mullo_epi16(cu, c.gu)),
+                     _mm_mullo_epi16(cv, c.gv)),
+      6);
+  *b = _mm_srai_epi16(_mm_adds_epi16(yy, _mm_mullo_epi16(cu, c.bu)), 6);
+}
+
+/*
+ * Convert 16 pixels, returning R, G and B in 16-bit lanes clamped to
+ * [0, 255], pixels 0-7 in lo and 8-15 in hi.
+ */
+void blockToRGB(const uint8_t* y,
+                const uint8_t* u,
+                const uint8_t* v,
+                const Coefficients& c,
+                __m128i rgb[3][2]) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi16(255);
+  const __m128i bias = _mm_set1_epi16(128);
+
+  const __m128i y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y));
+  const __m128i cu = _mm_sub_epi16(
+      _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u)),
+                        zero),
+      bias);
+  const __m128i cv = _mm_sub_epi16(
+      _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v)),
+                        zero),
+      bias);
+
+  pixelsToRGB(_mm_unpacklo_epi8(y8, zero), _mm_unpacklo_epi16(cu, cu),
+              _mm_unpacklo_epi16(cv, cv), c, &rgb[0][0], &rgb[1][0],
+              &rgb[2][0]);
+  pixelsToRGB(_mm_unpackhi_epi8(y8, zero), _mm_unpackhi_epi16(cu, cu),
+              _mm_unpackhi_epi16(cv, cv), c, &rgb[0][1], &rgb[1][1],
+              &rgb[2][1]);
+
+  for (unsigned int i = 0; i < 3; ++i) {
+    for (unsigned int j = 0; j < 2; ++j)
+      rgb[i][j] = _mm_min_epi16(_mm_max_epi16(rgb[i][j], zero), max);
+  }
+}
+
+void storeXRGB8888(const __m128i rgb[3][2], uint8_t* dst) {
+  const __m128i r = _mm_packus_epi16(rgb[0][0], rgb[0][1]);
+  const __m128i g = _mm_packus_epi16(rgb[1][0], rgb[1][1]);
+  const __m128i b = _mm_packus_epi16(rgb[2][0], rgb[2][1]);
+  const __m128i x = _mm_set1_epi8(-1);
+
+  const __m128i bgLo = _mm_unpacklo_epi8(b, g);
+  const __m128i bgHi = _mm_unpackhi_epi8(b, g);
+  const __m128i rxLo = _mm_unpacklo_epi8(r, x);
+  const __m128i rxHi = _mm_unpackhi_epi8(r, x);
+
+  __m128i* out = reinterpret_cast<__m128i*>(dst);
+  _mm_storeu_si128(out, _mm_unpacklo_epi16(bgLo, rxLo));
+  _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bgLo, rxLo));
+  _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bgHi, rxHi));
+  _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bgHi, rxHi));
+}
+
+void unpackYUYV(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  const __m128i mask = _mm_set1_epi16(0xff);
+  const __m128i zero = _mm_setzero_si128();
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+
+    const __m128i luma =
+        _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+    const __m128i chroma =
+        _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), luma);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(u + i / 2),
+                     _mm_packus_epi16(_mm_and_si128(chroma, mask), zero));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(v + i / 2),
+                     _mm_packus_epi16(_mm_srli_epi16(chroma, 8), zero));
+    src += 32;
+  }
+
+  scalarConverterKernels.unpackYUYV(src, y + i, u + i / 2, v + i / 2,
+                                    width - i);
+}
+
+void unpackUYVY(const uint8_t* src,
+                uint8_t* y,
+                uint8_t* u,
+                uint8_t* v,
+                unsigned int width) {
+  const __m128i mask = _mm_set1_epi16(0xff);
+  const __m128i zero = _mm_setzero_si128();
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+
+    const __m128i luma =
+        _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    const __m128i chroma =
+        _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), luma);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(u + i / 2),
+                     _mm_packus_epi16(_mm_and_si128(chroma, mask), zero));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(v + i / 2),
+                     _mm_packus_epi16(_mm_srli_epi16(chroma, 8), zero));
+    src += 32;
+  }
+
+  scalarConverterKernels.unpackUYVY(src, y + i, u + i / 2, v + i / 2,
+                                    width - i);
+}
+
+void unpackUV(const uint8_t* src, uint8_t* u, uint8_t* v, unsigned int width) {
+  const __m128i mask = _mm_set1_epi16(0xff);
+  unsigned int i = 0;
+
+  for (; i + 32 <= width; i += 32) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(u + i / 2),
+        _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask)));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(v + i / 2),
+        _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    src += 32;
+  }
+
+  scalarConverterKernels.unpackUV(src, u + i / 2, v + i / 2, width - i);
+}
+
+void toXRGB8888(const uint8_t* y,
+                const uint8_t* u,
+                const uint8_t* v,
+                uint8_t* dst,
+                unsigned int width,
+                const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    __m128i rgb[3][2];
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, rgb);
+    storeXRGB8888(rgb, dst + i * 4);
+  }
+
+  scalarConverterKernels.toXRGB8888(y + i, u + i / 2, v + i / 2, dst + i * 4,
+                                    width - i, coeffs);
+}
+
+/*
+ * SSE2 has no byte shuffle, build XRGB8888 pixels and drop the padding byte
+ * while the block is still in L1.
+ */
+void toRGB888(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  alignas(16) uint8_t block[64];
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    __m128i rgb[3][2];
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, rgb);
+    storeXRGB8888(rgb, block);
+
+    uint8_t* out = dst + i * 3;
+    for (unsigned int j = 0; j < 16; ++j)
+      memcpy(out + j * 3, block + j * 4, 3);
+  }
+
+  scalarConverterKernels.toRGB888(y + i, u + i / 2, v + i / 2, dst + i * 3,
+                                  width - i, coeffs);
+}
+
+void toRGB565(const uint8_t* y,
+              const uint8_t* u,
+              const uint8_t* v,
+              uint8_t* dst,
+              unsigned int width,
+              const YUVCoefficients& coeffs) {
+  const Coefficients c(coeffs);
+  const __m128i rMask = _mm_set1_epi16(0xf8);
+  const __m128i gMask = _mm_set1_epi16(0xfc);
+  unsigned int i = 0;
+
+  for (; i + 16 <= width; i += 16) {
+    __m128i rgb[3][2];
+    blockToRGB(y + i, u + i / 2, v + i / 2, c, rgb);
+
+    __m128i* out = reinterpret_cast<__m128i*>(dst + i * 2);
+    for (unsigned int j = 0; j < 2; ++j) {
+      const __m128i pixels = _mm_or_si128(
+          _mm_or_si128(_mm_slli_epi16(_mm_and_si128(rgb[0][j], rMask), 8),
+                       _mm_slli_epi16(_mm_and_si128(rgb[1][j], gMask), 3)),
+          _mm_srli_epi16(rgb[2][j], 3));
+      _mm_storeu_si128(out + j, pixels);
+    }
+  }
+
+  scalarConverterKernels.toRGB565(y + i, u + i / 2, v + i / 2, dst + i * 2,
+                                  width - i, coeffs);
+}
+
+} /* namespace */
+
+const FormatConverterKernels sse2ConverterKernels = {
+    "SSE2",     unpackYUYV, unpackUYVY, unpackUV,
+    toXRGB8888, toRGB888,   toRGB565,
+};
+
+#endif /* __SSE2__ */
@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_compressor.cpp - Lossless frame compression
+ */
+
+#include "frame_compressor.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <algorithm>
+#include <memory>
+
+#include <zstd.h>
+
+#include "twincam.h"
+#include "twncm_stdio.h"
+
+using namespace libcamera;
+
+namespace {
+
+struct CCtxDeleter {
+  void operator()(ZSTD_CCtx* cctx) const { ZSTD_freeCCtx(cctx); }
+};
+
+uint64_t threadCpuTime() {
+  struct timespec ts = {0, 0};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+}  // namespace
+
+/**
+ * \class FrameCompressor
+ * \brief Compress frames with zstd, safe to call from several threads
+ *
+ * Each plane is compressed into its own zstd frame, appended to the output.
+ * Concatenated zstd frames decompress as a single stream, so a compressed
+ * recording can be restored with "zstd -d".
+ *
+ * Negative levels select the zstd fast modes, which is what raw camera
+ * frames want: the goal is to get under the storage bandwidth, not the best
+ * ratio.
+ */
+FrameCompressor::FrameCompressor(int level)
+    : level_(std::clamp(level, ZSTD_minCLevel(), ZSTD_maxCLevel())) {}
+
+int FrameCompressor::compress(const std::vector<Span<const uint8_t>>& planes,
+                              std::vector<uint8_t>& output) {
+  /* Compression contexts are expensive to create, keep one per thread. */
+  static thread_local std::unique_ptr<ZSTD_CCtx, CCtxDeleter> cctx(
+      ZSTD_createCCtx());
+  if (!cctx)
+    return -ENOMEM;
+
+  const uint64_t start = threadCpuTime();
+
+  size_t raw = 0;
+  output.clear();
+  for (const Span<const uint8_t>& plane : planes) {
+    const size_t offset = output.size();
+    output.resize(offset + ZSTD_compressBound(plane.size()));
+
+    const size_t ret =
+        ZSTD_compressCCtx(cctx.get(), output.data() + offset,
+                          output.size() - offset, plane.data(), plane.size(),
+                          level_);
+    if (ZSTD_isError(ret)) {
+      EPRINT("zstd compression failed: %s\n", ZSTD_getErrorName(ret));
+      output.clear();
+      return -EIO;
+    }
+
+    output.resize(offset + ret);
+    raw += plane.size();
+  }
+
+  const uint64_t cpuTime = threadCpuTime() - start;
+
+  ++frames_;
+  rawBytes_ += raw;
+  compressedBytes_ += output.size();
+  cpuTime_ += cpuTime;
+
+  uint64_t max = maxCpuTime_;
+  while (cpuTime > max && !maxCpuTime_.compare_exchange_weak(max, cpuTime))
+    ;
+
+  return 0;
+}
+
+void FrameCompressor::printStats() const {
+  if (!frames_)
+    return;
+
+  PRINT("zstd level %d: %" PRIu64 " frames, ratio %.2f:1, CPU per frame "
+        "%.2f ms avg %.2f ms max\n",
+        level_, frames_.load(),
+        compressedBytes_ ? static_cast<double>(rawBytes_) / compressedBytes_
+                         : 0.0,
+        cpuTime_ / 1000000.0 / frames_, maxCpuTime_ / 1000000.0);
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_compressor.h - Lossless frame compression
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+class FrameCompressor {
+ public:
+  FrameCompressor(int level);
+
+  int level() const { return level_; }
+
+  int compress(const std::vector<libcamera::Span<const uint8_t>>& planes,
+               std::vector<uint8_t>& output);
+
+  void printStats() const;
+
+ private:
+  const int level_;
+
+  std::atomic<uint64_t> frames_ = 0;
+  std::atomic<uint64_t> rawBytes_ = 0;
+  std::atomic<uint64_t> compressedBytes_ = 0;
+  std::atomic<uint64_t> cpuTime_ = 0;
+  std::atomic<uint64_t> maxCpuTime_ = 0;
+};
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_index.h - Recording frame index
+ *
+ * A frame index is a sidecar file written next to a raw recording, named after
+ * it with a ".idx" suffix. It holds a header followed by one fixed-size record
+ * per frame buffer written, in native byte order, so the file can be mmap()ed
+ * and record n found at headerSize + n * recordSize.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+static constexpr char frameIndexMagic[8] = "TWCMIDX";
+static constexpr uint32_t frameIndexVersion = 1;
+static constexpr unsigned int frameIndexMaxPlanes = 4;
+
+/*
+ * The recording holds zstd compressed frames, each record covers one zstd
+ * frame per plane and bytesused gives the uncompressed plane sizes.
+ */
+static constexpr uint32_t frameIndexFlagZstd = 1 << 0;
+
+struct FrameIndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t recordSize;
+  uint32_t flags;
+  uint64_t reserved;
+};
+
+struct FrameIndexRecord {
+  /* Position and size of the frame data in the recording. */
+  uint64_t offset;
+  uint64_t length;
+  /* Sensor timestamp in nanoseconds. */
+  uint64_t timestamp;
+  uint32_t sequence;
+  uint16_t stream;
+  uint16_t numPlanes;
+  uint32_t bytesused[frameIndexMaxPlanes];
+};
+
+static_assert(sizeof(FrameIndexHeader) == 32);
+static_assert(sizeof(FrameIndexRecord) == 48);
@@ -0,0 +1,389 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_monitor.cpp - Alarm on frozen, stalled, black or saturated frames
+ */
+
+#include "frame_monitor.h"
+#include "cpu_features.h"
+#include "event_loop.h"
+#include "frame_planes.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+#include "uptime.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+/* Rows sampled evenly over the frame. */
+constexpr unsigned int kSampleRows = 32;
+
+/*
+ * Luma mean and standard deviation of a uniformly black or saturated frame,
+ * such as a covered lens or a sensor blinded by a light, noise included.
+ */
+constexpr double kBlackMean = 24.0;
+constexpr double kSaturatedMean = 232.0;
+constexpr double kUniformDeviation = 6.0;
+
+/* Time without frames to raise the stalled alarm, at least. */
+constexpr std::chrono::milliseconds kStallTimeout(500);
+/* Time allowed for the first frame, cameras take a while to start. */
+constexpr std::chrono::seconds kStartTimeout(3);
+
+constexpr std::chrono::milliseconds kWatchdogPeriod(250);
+constexpr std::chrono::seconds kStatusPeriod(1);
+
+constexpr uint64_t kFnvOffset = 0xcbf29ce484222325ULL;
+constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+
+void rowStats(const uint8_t* row,
+              unsigned int count,
+              uint16_t lumaMask,
+              FrameMonitorRowStats* stats) {
+  for (unsigned int i = 0; i < count; ++i) {
+    const unsigned int luma = (lumaMask >> (i % 2 * 8)) & row[i];
+    stats->sum += luma;
+    stats->squares += luma * luma;
+    stats->checksum += row[i] * (i % 8 + 1);
+  }
+}
+
+const FrameMonitorKernels& bestKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::SSE2))
+    return sse2MonitorKernels;
+#elif defined(__arm__) || defined(__aarch64__)
+  if (CpuFeatures::has(CpuFeatures::NEON))
+    return neonMonitorKernels;
+#endif
+
+  return scalarMonitorKernels;
+}
+
+const char* alarmName(FrameMonitor::Alarm alarm) {
+  switch (alarm) {
+    case FrameMonitor::Frozen:
+      return "frozen";
+    case FrameMonitor::Stalled:
+      return "stalled";
+    case FrameMonitor::Black:
+      return "black";
+    case FrameMonitor::Saturated:
+      return "saturated";
+  }
+
+  return "";
+}
+
+constexpr FrameMonitor::Alarm kAlarms[] = {
+    FrameMonitor::Frozen,
+    FrameMonitor::Stalled,
+    FrameMonitor::Black,
+    FrameMonitor::Saturated,
+};
+
+} /* namespace */
+
+const FrameMonitorKernels scalarMonitorKernels = {
+    "scalar",
+    rowStats,
+};
+
+/**
+ * \class FrameMonitor
+ * \brief Tell when a camera stops delivering a live picture
+ *
+ * A few evenly spaced rows of each frame are reduced to luma statistics and a
+ * signature of all their bytes. Alarms are raised when the signature stops
+ * changing, as sensor noise changes it in every live frame, when the sequence
+ * stops advancing or frames stop coming, and when the picture is uniformly
+ * black or saturated, each once the condition lasted a number of frames.
+ *
+ * Alarms are logged and, with the frame statistics, written to a status file
+ * in the Prometheus text format, replaced atomically so that a node exporter
+ * textfile collector or a script can read it at any time. Reading 32 rows
+ * takes microseconds, frames are analyzed on the event loop before delivery.
+ */
+FrameMonitor::FrameMonitor() = default;
+
+FrameMonitor::~FrameMonitor() {
+  stop();
+}
+
+bool FrameMonitor::isSupported(const PixelFormat& format) {
+  switch (format) {
+    case formats::NV12:
+    case formats::NV21:
+    case formats::NV16:
+    case formats::YUV420:
+    case formats::YVU420:
+    case formats::YUYV:
+    case formats::YVYU:
+    case formats::UYVY:
+    case formats::VYUY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * Prepare to analyze frames of \a cfg from camera index \a camera, raising
+ * alarms when a condition lasts \a frames frames, and write the status to
+ * \a path.
+ */
+int FrameMonitor::configure(const StreamConfiguration& cfg,
+                            const std::string& path,
+                            unsigned int camera,
+                            unsigned int frames) {
+  if (!isSupported(cfg.pixelFormat)) {
+    EPRINT("Cannot monitor %s frames\n", cfg.pixelFormat.toString().c_str());
+    return -EINVAL;
+  }
+
+  if (!cfg.size.width || !cfg.size.height || !frames) {
+    EPRINT("Cannot monitor frames of %ux%u over %u frames\n", cfg.size.width,
+           cfg.size.height, frames);
+    return -EINVAL;
+  }
+
+  kernels_ = &bestKernels();
+  width_ = cfg.size.width;
+  height_ = cfg.size.height;
+  stride_ = cfg.stride;
+  if (cfg.pixelFormat == formats::YUYV || cfg.pixelFormat == formats::YVYU) {
+    bytesPerPixel_ = 2;
+    lumaMask_ = 0x00ff;
+  } else if (cfg.pixelFormat == formats::UYVY ||
+             cfg.pixelFormat == formats::VYUY) {
+    bytesPerPixel_ = 2;
+    lumaMask_ = 0xff00;
+  } else {
+    bytesPerPixel_ = 1;
+    lumaMask_ = 0xffff;
+  }
+
+  path_ = path;
+  camera_ = std::to_string(camera);
+  frames_ = frames;
+
+  return 0;
+}
+
+/* Start watching for stalls, until stop(). */
+void FrameMonitor::start() {
+  alarms_ = 0;
+  frozenFrames_ = 0;
+  stalledFrames_ = 0;
+  blackFrames_ = 0;
+  saturatedFrames_ = 0;
+  primed_ = false;
+  interval_ = clock::duration::zero();
+  frameCount_ = 0;
+  alarmCount_ = 0;
+  analysisTime_ = 0;
+  writeFailed_ = false;
+
+  advanced_ = clock::now();
+
+  timer_ = EventLoop::instance()->addTimerEvent(kWatchdogPeriod,
+                                                [this]() { watchdog(); });
+  writeStatus();
+}
+
+void FrameMonitor::stop() {
+  if (!timer_)
+    return;
+
+  /* The event loop may be gone when destroying the monitor. */
+  if (EventLoop* loop = EventLoop::instance())
+    loop->removeTimerEvent(timer_);
+  timer_ = 0;
+  writeStatus();
+}
+
+/*
+ * Analyze the frame in \a planes with sequence number \a sequence. Returns the
+ * alarms raised.
+ */
+unsigned int FrameMonitor::analyze(
+    const std::vector<Span<const uint8_t>>& planes,
+    uint32_t sequence) {
+  std::vector<const uint8_t*> data;
+  if (splitPlanes(planes, {static_cast<size_t>(stride_) * height_}, &data) <
+      0)
+    return alarms_;
+
+  const clock::time_point start = clock::now();
+
+  /* Rows in the middle of kSampleRows bands, all of them in small frames. */
+  const unsigned int rows = std::min(kSampleRows, height_);
+  FrameMonitorRowStats frame = {};
+  uint64_t signature = kFnvOffset;
+  for (unsigned int i = 0; i < rows; ++i) {
+    const unsigned int y = (2 * i + 1) * height_ / (2 * rows);
+    FrameMonitorRowStats row = {};
+    kernels_->rowStats(data[0] + static_cast<size_t>(y) * stride_,
+                       width_ * bytesPerPixel_, lumaMask_, &row);
+
+    signature = (signature ^ row.checksum) * kFnvPrime;
+    signature = (signature ^ row.squares) * kFnvPrime;
+    frame.sum += row.sum;
+    frame.squares += row.squares;
+  }
+
+  const double samples = static_cast<double>(rows) * width_;
+  mean_ = frame.sum / samples;
+  deviation_ = sqrt(std::max(frame.squares / samples - mean_ * mean_, 0.0));
+
+  /* Sequences go up by more than one when frames are dropped. */
+  if (!primed_ || static_cast<int32_t>(sequence - sequence_) > 0) {
+    if (primed_) {
+      const clock::duration elapsed = start - advanced_;
+      interval_ = interval_ == clock::duration::zero()
+                      ? elapsed
+                      : (interval_ * 7 + elapsed) / 8;
+    }
+    advanced_ = start;
+    sequence_ = sequence;
+    stalledFrames_ = 0;
+  } else {
+    ++stalledFrames_;
+  }
+
+  frozenFrames_ = primed_ && signature == signature_ ? frozenFrames_ + 1 : 0;
+  signature_ = signature;
+  primed_ = true;
+
+  const bool uniform = deviation_ < kUniformDeviation;
+  blackFrames_ = uniform && mean_ < kBlackMean ? blackFrames_ + 1 : 0;
+  saturatedFrames_ =
+      uniform && mean_ > kSaturatedMean ? saturatedFrames_ + 1 : 0;
+
+  ++frameCount_;
+  analysisTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       clock::now() - start)
+                       .count();
+
+  setAlarm(Frozen, frozenFrames_ >= frames_);
+  /* Stalls the watchdog noticed first last until the sequence advances. */
+  setAlarm(Stalled, stalledFrames_ >= frames_ ||
+                        (stalledFrames_ && (alarms_ & Stalled)));
+  setAlarm(Black, blackFrames_ >= frames_);
+  setAlarm(Saturated, saturatedFrames_ >= frames_);
+
+  return alarms_;
+}
+
+/*
+ * Raise the stalled alarm when no new frame came for the time of as many
+ * frames as alarms wait for, and refresh the status file.
+ */
+void FrameMonitor::watchdog() {
+  const clock::time_point now = clock::now();
+
+  clock::duration timeout = kStartTimeout;
+  if (primed_)
+    timeout = std::max<clock::duration>(interval_ * frames_, kStallTimeout);
+  if (now - advanced_ > timeout)
+    setAlarm(Stalled, true);
+
+  if (now - written_ >= kStatusPeriod)
+    writeStatus();
+}
+
+void FrameMonitor::setAlarm(Alarm alarm, bool raised) {
+  if (!!(alarms_ & alarm) == raised)
+    return;
+
+  if (raised) {
+    alarms_ |= alarm;
+    ++alarmCount_;
+    EPRINT("cam%s: frames %s\n", camera_.c_str(), alarmName(alarm));
+  } else {
+    alarms_ &= ~alarm;
+    PRINT("cam%s: frames no longer %s\n", camera_.c_str(), alarmName(alarm));
+  }
+
+  writeStatus();
+}
+
+/* Replace the status file with the current alarms and statistics. */
+void FrameMonitor::writeStatus() {
+  written_ = clock::now();
+
+  const std::string& cam = camera_;
+  std::string status;
+  STRING_PRINTF(status,
+                "# HELP twincam_monitor_alarm Frame monitor alarms, 1 when "
+                "raised.\n"
+                "# TYPE twincam_monitor_alarm gauge\n");
+  for (Alarm alarm : kAlarms)
+    STRING_PRINTF(status,
+                  "twincam_monitor_alarm{camera=\"%s\",alarm=\"%s\"} %d\n",
+                  cam.c_str(), alarmName(alarm), !!(alarms_ & alarm));
+
+  const double age =
+      std::chrono::duration<double>(written_ - advanced_).count();
+  STRING_PRINTF(status,
+                "# HELP twincam_monitor_alarms_total Frame monitor alarms "
+                "raised.\n"
+                "# TYPE twincam_monitor_alarms_total counter\n"
+                "twincam_monitor_alarms_total{camera=\"%s\"} %" PRIu64 "\n"
+                "# HELP twincam_monitor_frames_total Frames analyzed.\n"
+                "# TYPE twincam_monitor_frames_total counter\n"
+                "twincam_monitor_frames_total{camera=\"%s\"} %" PRIu64 "\n"
+                "# HELP twincam_monitor_sequence Sequence of the last "
+                "frame.\n"
+                "# TYPE twincam_monitor_sequence gauge\n"
+                "twincam_monitor_sequence{camera=\"%s\"} %u\n"
+                "# HELP twincam_monitor_frame_age_seconds Time since the "
+                "sequence last advanced.\n"
+                "# TYPE twincam_monitor_frame_age_seconds gauge\n"
+                "twincam_monitor_frame_age_seconds{camera=\"%s\"} %.3f\n",
+                cam.c_str(), alarmCount_, cam.c_str(), frameCount_,
+                cam.c_str(), sequence_, cam.c_str(), age);
+  STRING_PRINTF(status,
+                "# HELP twincam_monitor_luma_mean Mean luma of the last "
+                "frame.\n"
+                "# TYPE twincam_monitor_luma_mean gauge\n"
+                "twincam_monitor_luma_mean{camera=\"%s\"} %.2f\n"
+                "# HELP twincam_monitor_luma_stddev Standard deviation of "
+                "the luma of the last frame.\n"
+                "# TYPE twincam_monitor_luma_stddev gauge\n"
+                "twincam_monitor_luma_stddev{camera=\"%s\"} %.2f\n"
+                "# HELP twincam_monitor_analysis_seconds_total Time spent "
+                "analyzing frames.\n"
+                "# TYPE twincam_monitor_analysis_seconds_total counter\n"
+                "twincam_monitor_analysis_seconds_total{camera=\"%s\"} %.6f\n",
+                cam.c_str(), mean_, cam.c_str(), deviation_, cam.c_str(),
+                analysisTime_ / 1000000000.0);
+
+  /* Readers see the previous file or this one, never a partial write. */
+  const std::string tmp = path_ + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool written = fd >= 0;
+  if (written) {
+    written = write(fd, status.data(), status.size()) ==
+              static_cast<ssize_t>(status.size());
+    written = !close(fd) && written;
+    written = written && !rename(tmp.c_str(), path_.c_str());
+  }
+
+  /* Only report the first of repeated failures. */
+  if (!written && !writeFailed_)
+    EPRINT("Failed to write %s: %s\n", path_.c_str(), strerror(errno));
+  writeFailed_ = !written;
+}
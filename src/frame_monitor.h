@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_monitor.h - Alarm on frozen, stalled, black or saturated frames
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "frame_monitor_kernels.h"
+
+class FrameMonitor {
+ public:
+  enum Alarm {
+    Frozen = 1 << 0,
+    Stalled = 1 << 1,
+    Black = 1 << 2,
+    Saturated = 1 << 3,
+  };
+
+  FrameMonitor();
+  ~FrameMonitor();
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const libcamera::StreamConfiguration& cfg,
+                const std::string& path,
+                unsigned int camera,
+                unsigned int frames);
+
+  const char* kernelsName() const { return kernels_ ? kernels_->name : ""; }
+
+  void start();
+  void stop();
+
+  unsigned int analyze(
+      const std::vector<libcamera::Span<const uint8_t>>& planes,
+      uint32_t sequence);
+
+  /* Alarms raised, a combination of Alarm. */
+  unsigned int alarms() const { return alarms_; }
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  void watchdog();
+  void setAlarm(Alarm alarm, bool raised);
+  void writeStatus();
+
+  const FrameMonitorKernels* kernels_ = nullptr;
+
+  unsigned int width_ = 0;
+  unsigned int height_ = 0;
+  unsigned int stride_ = 0;
+  /* Bytes per pixel of the luma plane and the luma bytes in it. */
+  unsigned int bytesPerPixel_ = 1;
+  uint16_t lumaMask_ = 0xffff;
+
+  std::string path_;
+  std::string camera_;
+  /* Frames a condition must last to raise its alarm. */
+  unsigned int frames_ = 0;
+  unsigned int timer_ = 0;
+
+  unsigned int alarms_ = 0;
+  unsigned int frozenFrames_ = 0;
+  unsigned int stalledFrames_ = 0;
+  unsigned int blackFrames_ = 0;
+  unsigned int saturatedFrames_ = 0;
+
+  bool primed_ = false;
+  uint64_t signature_ = 0;
+  uint32_t sequence_ = 0;
+  double mean_ = 0.0;
+  double deviation_ = 0.0;
+
+  /* Last frame with a new sequence, and average time between frames. */
+  clock::time_point advanced_;
+  clock::duration interval_{};
+  clock::time_point written_;
+  bool writeFailed_ = false;
+
+  uint64_t frameCount_ = 0;
+  uint64_t alarmCount_ = 0;
+  uint64_t analysisTime_ = 0;
+};
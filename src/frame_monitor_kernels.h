@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_monitor_kernels.h - Row kernels used by FrameMonitor
+ *
+ * A few rows of each frame are reduced to luma statistics and a checksum of
+ * all their bytes, chroma included, that changes with any change of a pixel.
+ * All implementations produce exactly the output of the scalar kernels.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct FrameMonitorRowStats {
+  /* Sum of the luma samples and of their squares. */
+  uint64_t sum;
+  uint64_t squares;
+  /* Sum of all bytes weighted by their position, 1 to 8 repeating. */
+  uint64_t checksum;
+};
+
+struct FrameMonitorKernels {
+  const char* name;
+
+  /*
+   * Add the statistics of the count bytes of row to stats. lumaMask selects
+   * the luma bytes of each pair of bytes, 0xffff for planar luma, 0x00ff for
+   * the even bytes and 0xff00 for the odd bytes of packed 4:2:2.
+   */
+  void (*rowStats)(const uint8_t* row,
+                   unsigned int count,
+                   uint16_t lumaMask,
+                   FrameMonitorRowStats* stats);
+};
+
+extern const FrameMonitorKernels scalarMonitorKernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const FrameMonitorKernels sse2MonitorKernels;
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+extern const FrameMonitorKernels neonMonitorKernels;
+#endif
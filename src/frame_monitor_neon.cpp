@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_monitor_neon.cpp - NEON row kernels for FrameMonitor
+ */
+
+#include "frame_monitor_kernels.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+namespace {
+
+/* Vectors added up in 32-bit lanes before they could overflow. */
+constexpr unsigned int kBatch = 4096;
+
+uint64_t sumLanes32(uint32x4_t v) {
+  const uint64x2_t sum = vpaddlq_u32(v);
+  return vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+}
+
+void rowStats(const uint8_t* row,
+              unsigned int count,
+              uint16_t lumaMask,
+              FrameMonitorRowStats* stats) {
+  static const uint8_t kWeights[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  const uint8x16_t mask = vreinterpretq_u8_u16(vdupq_n_u16(lumaMask));
+  const uint8x8_t weights = vld1_u8(kWeights);
+  unsigned int i = 0;
+
+  while (i + 16 <= count) {
+    uint32x4_t sum = vdupq_n_u32(0);
+    uint32x4_t squares = vdupq_n_u32(0);
+    uint32x4_t checksum = vdupq_n_u32(0);
+
+    for (unsigned int n = 0; n < kBatch && i + 16 <= count; ++n, i += 16) {
+      const uint8x16_t v = vld1q_u8(row + i);
+      const uint8x16_t luma = vandq_u8(v, mask);
+      sum = vpadalq_u16(sum, vpaddlq_u8(luma));
+
+      const uint8x8_t lumaLo = vget_low_u8(luma);
+      const uint8x8_t lumaHi = vget_high_u8(luma);
+      squares = vpadalq_u16(squares, vmull_u8(lumaLo, lumaLo));
+      squares = vpadalq_u16(squares, vmull_u8(lumaHi, lumaHi));
+
+      checksum = vpadalq_u16(checksum, vmull_u8(vget_low_u8(v), weights));
+      checksum = vpadalq_u16(checksum, vmull_u8(vget_high_u8(v), weights));
+    }
+
+    stats->sum += sumLanes32(sum);
+    stats->squares += sumLanes32(squares);
+    stats->checksum += sumLanes32(checksum);
+  }
+
+  /* The tail starts on a multiple of 16 bytes, the mask and weights align. */
+  scalarMonitorKernels.rowStats(row + i, count - i, lumaMask, stats);
+}
+
+} /* namespace */
+
+const FrameMonitorKernels neonMonitorKernels = {
+    "NEON",
+    rowStats,
+};
+
+#endif /* __ARM_NEON */
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_monitor_sse2.cpp - SSE2 row kernels for FrameMonitor
+ */
+
+#include "frame_monitor_kernels.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace {
+
+/* Vectors added up in 32-bit lanes before they could overflow. */
+constexpr unsigned int kBatch = 4096;
+
+uint64_t sumLanes32(__m128i v) {
+  alignas(16) uint32_t lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i*>(lanes), v);
+  return static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+
+/*
+ * PSADBW against zero sums the luma, PMADDWD squares it and weights the bytes
+ * of the checksum, 16 bytes at a time.
+ */
+void rowStats(const uint8_t* row,
+              unsigned int count,
+              uint16_t lumaMask,
+              FrameMonitorRowStats* stats) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i mask = _mm_set1_epi16(static_cast<short>(lumaMask));
+  const __m128i weights = _mm_setr_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+  __m128i sum = zero;
+  unsigned int i = 0;
+
+  while (i + 16 <= count) {
+    __m128i squares = zero;
+    __m128i checksum = zero;
+
+    for (unsigned int n = 0; n < kBatch && i + 16 <= count; ++n, i += 16) {
+      const __m128i v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      const __m128i luma = _mm_and_si128(v, mask);
+      sum = _mm_add_epi64(sum, _mm_sad_epu8(luma, zero));
+
+      const __m128i lumaLo = _mm_unpacklo_epi8(luma, zero);
+      const __m128i lumaHi = _mm_unpackhi_epi8(luma, zero);
+      squares = _mm_add_epi32(squares, _mm_madd_epi16(lumaLo, lumaLo));
+      squares = _mm_add_epi32(squares, _mm_madd_epi16(lumaHi, lumaHi));
+
+      const __m128i lo = _mm_unpacklo_epi8(v, zero);
+      const __m128i hi = _mm_unpackhi_epi8(v, zero);
+      checksum = _mm_add_epi32(checksum, _mm_madd_epi16(lo, weights));
+      checksum = _mm_add_epi32(checksum, _mm_madd_epi16(hi, weights));
+    }
+
+    stats->squares += sumLanes32(squares);
+    stats->checksum += sumLanes32(checksum);
+  }
+
+  stats->sum += static_cast<uint64_t>(_mm_cvtsi128_si32(sum)) +
+                static_cast<uint64_t>(
+                    _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+
+  /* The tail starts on a multiple of 16 bytes, the mask and weights align. */
+  scalarMonitorKernels.rowStats(row + i, count - i, lumaMask, stats);
+}
+
+} /* namespace */
+
+const FrameMonitorKernels sse2MonitorKernels = {
+    "SSE2",
+    rowStats,
+};
+
+#endif /* __SSE2__ */
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_planes.cpp - Locate the planes of a frame
+ */
+
+#include "frame_planes.h"
+
+#include <errno.h>
+
+using namespace libcamera;
+
+/*
+ * Find the start of each plane of \a sizes bytes in \a planes. Multi-planar
+ * formats may come in one contiguous span, in which case it is split at the
+ * plane boundaries. Returns -EINVAL if the frame is too small.
+ */
+int splitPlanes(const std::vector<Span<const uint8_t>>& planes,
+                const std::vector<size_t>& sizes,
+                std::vector<const uint8_t*>* data) {
+  data->clear();
+
+  if (planes.size() >= sizes.size()) {
+    for (unsigned int i = 0; i < sizes.size(); ++i) {
+      if (planes[i].size() < sizes[i])
+        return -EINVAL;
+      data->push_back(planes[i].data());
+    }
+
+    return 0;
+  }
+
+  if (planes.size() != 1)
+    return -EINVAL;
+
+  size_t offset = 0;
+  for (size_t size : sizes) {
+    if (offset + size > planes[0].size())
+      return -EINVAL;
+    data->push_back(planes[0].data() + offset);
+    offset += size;
+  }
+
+  return 0;
+}
+
+/* Same as above, for frames modified in place. */
+int splitPlanes(const std::vector<Span<uint8_t>>& planes,
+                const std::vector<size_t>& sizes,
+                std::vector<uint8_t*>* data) {
+  const std::vector<Span<const uint8_t>> readOnly(planes.begin(), planes.end());
+  std::vector<const uint8_t*> found;
+
+  int ret = splitPlanes(readOnly, sizes, &found);
+  if (ret < 0)
+    return ret;
+
+  /* The pointers all come from the writable spans in planes. */
+  data->clear();
+  for (const uint8_t* plane : found)
+    data->push_back(const_cast<uint8_t*>(plane));
+
+  return 0;
+}
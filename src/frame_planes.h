@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_planes.h - Locate the planes of a frame
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+int splitPlanes(const std::vector<libcamera::Span<const uint8_t>>& planes,
+                const std::vector<size_t>& sizes,
+                std::vector<const uint8_t*>* data);
+int splitPlanes(const std::vector<libcamera::Span<uint8_t>>& planes,
+                const std::vector<size_t>& sizes,
+                std::vector<uint8_t*>* data);
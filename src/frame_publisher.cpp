@@ -0,0 +1,310 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_publisher.cpp - Share frames with local processes over a Unix socket
+ */
+
+#include "frame_publisher.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <libcamera/camera.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+#include "event_loop.h"
+#include "twincam.h"
+#include "twncm_fnctl.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Clients beyond this are refused, each costs a send per frame. */
+constexpr unsigned int kMaxClients = 16;
+
+}  // namespace
+
+/**
+ * \class FramePublisher
+ * \brief Lend camera buffers to other processes without copying frames
+ *
+ * Clients connect to a Unix socket, see frame_share.h, and receive the dmabuf
+ * file descriptors of all buffers once. Each frame then costs one small
+ * message per client, and the request is only requeued once every client it
+ * was sent to released the buffer. A client may hold at most half of the
+ * buffers, frames are skipped for a client at that limit or whose socket is
+ * full, so that a slow client never stalls the camera or the other sinks.
+ */
+FramePublisher::FramePublisher(const std::string& path) : path_(path) {}
+
+FramePublisher::~FramePublisher() {
+  stop();
+}
+
+int FramePublisher::configure(const CameraConfiguration& config) {
+  const StreamConfiguration& cfg = config.at(0);
+  stream_ = cfg.stream();
+
+  info_ = {};
+  info_.type = FrameShareMessageStream;
+  info_.version = frameShareVersion;
+  memcpy(info_.magic, frameShareMagic, sizeof(info_.magic));
+  info_.fourcc = cfg.pixelFormat.fourcc();
+  info_.modifier = cfg.pixelFormat.modifier();
+  info_.width = cfg.size.width;
+  info_.height = cfg.size.height;
+  info_.stride = cfg.stride;
+
+  buffers_.clear();
+  indexes_.clear();
+
+  return 0;
+}
+
+void FramePublisher::mapBuffer(const Stream* stream, FrameBuffer* buffer) {
+  if (stream != stream_ || buffer->planes().size() > frameShareMaxPlanes)
+    return;
+
+  indexes_[buffer] = buffers_.size();
+  buffers_.push_back(buffer);
+}
+
+int FramePublisher::start() {
+  info_.numBuffers = buffers_.size();
+  loans_.assign(buffers_.size(), Loan());
+  maxHeld_ = std::max<unsigned int>(buffers_.size() / 2, 1);
+  frames_ = 0;
+  sent_ = 0;
+  skipped_ = 0;
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path_.size() >= sizeof(addr.sun_path)) {
+    EPRINT("Socket path %s too long\n", path_.c_str());
+    return -ENAMETOOLONG;
+  }
+  memcpy(addr.sun_path, path_.c_str(), path_.size());
+
+  /* A socket left behind by a previous run would make bind() fail. */
+  if (int ret = twncm_remove_socket(path_.c_str()); ret < 0) {
+    EPRINT("Failed to listen on %s: %s\n", path_.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  listenFd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd_ < 0) {
+    int ret = -errno;
+    EPRINT("Failed to create socket: %s\n", strerror(-ret));
+    return ret;
+  }
+
+  if (bind(listenFd_, reinterpret_cast<struct sockaddr*>(&addr),
+           sizeof(addr)) < 0 ||
+      listen(listenFd_, 4) < 0) {
+    int ret = -errno;
+    EPRINT("Failed to listen on %s: %s\n", path_.c_str(), strerror(-ret));
+    close(listenFd_);
+    listenFd_ = -1;
+    return ret;
+  }
+
+  EventLoop::instance()->addFdEvent(listenFd_, EventLoop::Read,
+                                    [this]() { acceptClient(); });
+
+  PRINT("Sharing %u buffers of %ux%u frames on %s\n", info_.numBuffers,
+        info_.width, info_.height, path_.c_str());
+
+  return 0;
+}
+
+int FramePublisher::stop() {
+  if (listenFd_ < 0)
+    return 0;
+
+  while (!clients_.empty())
+    removeClient(clients_.back().get());
+
+  EventLoop::instance()->removeFdEvent(listenFd_);
+  close(listenFd_);
+  listenFd_ = -1;
+  twncm_remove_socket(path_.c_str());
+
+  if (frames_) {
+    PRINT("Shared %" PRIu64 " frames, %" PRIu64 " sent to clients, %" PRIu64
+          " skipped for busy clients\n",
+          frames_, sent_, skipped_);
+  }
+
+  return 0;
+}
+
+void FramePublisher::acceptClient() {
+  int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  if (clients_.size() >= kMaxClients) {
+    EPRINT("Refusing frame client, %u connected already\n", kMaxClients);
+    close(fd);
+    return;
+  }
+
+  int ret = sendBuffers(fd);
+  if (ret < 0) {
+    EPRINT("Failed to send buffers to frame client: %s\n", strerror(-ret));
+    close(fd);
+    return;
+  }
+
+  auto client = std::make_unique<Client>();
+  client->fd = fd;
+  Client* c = client.get();
+  clients_.push_back(std::move(client));
+
+  EventLoop::instance()->addFdEvent(fd, EventLoop::Read,
+                                    [this, c]() { readClient(c); });
+
+  VERBOSE_PRINT("Frame client %d connected\n", fd);
+}
+
+/*
+ * Send the stream description and the planes of all buffers, the socket
+ * buffer is large enough to take them without blocking.
+ */
+int FramePublisher::sendBuffers(int fd) {
+  if (send(fd, &info_, sizeof(info_), MSG_NOSIGNAL) != sizeof(info_))
+    return -errno;
+
+  for (unsigned int index = 0; index < buffers_.size(); ++index) {
+    const std::vector<FrameBuffer::Plane>& planes = buffers_[index]->planes();
+
+    FrameShareBuffer msg = {};
+    msg.type = FrameShareMessageBuffer;
+    msg.index = index;
+    msg.numPlanes = planes.size();
+
+    int fds[frameShareMaxPlanes];
+    for (unsigned int i = 0; i < planes.size(); ++i) {
+      msg.planes[i].offset = planes[i].offset;
+      msg.planes[i].length = planes[i].length;
+      fds[i] = planes[i].fd.get();
+    }
+
+    struct iovec iov = {&msg, sizeof(msg)};
+    char control[CMSG_SPACE(sizeof(fds))] = {};
+
+    struct msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = CMSG_SPACE(sizeof(int) * planes.size());
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * planes.size());
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * planes.size());
+
+    if (sendmsg(fd, &hdr, MSG_NOSIGNAL) != sizeof(msg))
+      return errno ? -errno : -EIO;
+  }
+
+  return 0;
+}
+
+void FramePublisher::readClient(Client* client) {
+  for (;;) {
+    FrameShareRelease msg;
+    ssize_t ret = recv(client->fd, &msg, sizeof(msg), MSG_DONTWAIT);
+    if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+
+    if (ret <= 0) {
+      VERBOSE_PRINT("Frame client %d disconnected\n", client->fd);
+      removeClient(client);
+      return;
+    }
+
+    if (ret != sizeof(msg) || msg.type != FrameShareMessageRelease)
+      continue;
+
+    /* Ignore buffers the client doesn't hold, it can't release them twice. */
+    if (client->held.erase(msg.index))
+      releaseBuffer(msg.index);
+  }
+}
+
+/* Disconnect \a client, releasing the buffers it still holds. */
+void FramePublisher::removeClient(Client* client) {
+  for (unsigned int index : client->held)
+    releaseBuffer(index);
+
+  EventLoop::instance()->removeFdEvent(client->fd);
+  close(client->fd);
+
+  clients_.erase(std::find_if(clients_.begin(), clients_.end(),
+                              [client](const std::unique_ptr<Client>& c) {
+                                return c.get() == client;
+                              }));
+}
+
+void FramePublisher::releaseBuffer(unsigned int index) {
+  Loan& loan = loans_[index];
+  if (!loan.request || --loan.clients)
+    return;
+
+  Request* request = loan.request;
+  loan.request = nullptr;
+  requestProcessed.emit(request);
+}
+
+bool FramePublisher::processRequest(Request* request) {
+  FrameBuffer* buffer = request->findBuffer(stream_);
+  auto iter = buffer ? indexes_.find(buffer) : indexes_.end();
+  if (iter == indexes_.end())
+    return true;
+
+  const unsigned int index = iter->second;
+  const FrameMetadata& metadata = buffer->metadata();
+
+  FrameShareFrame msg = {};
+  msg.type = FrameShareMessageFrame;
+  msg.index = index;
+  msg.sequence = metadata.sequence;
+  msg.timestamp = metadata.timestamp;
+  msg.numPlanes =
+      std::min<size_t>(metadata.planes().size(), frameShareMaxPlanes);
+  for (unsigned int i = 0; i < msg.numPlanes; ++i)
+    msg.bytesused[i] = metadata.planes()[i].bytesused;
+
+  ++frames_;
+
+  unsigned int clients = 0;
+  for (std::unique_ptr<Client>& client : clients_) {
+    if (client->held.size() >= maxHeld_ ||
+        send(client->fd, &msg, sizeof(msg), MSG_DONTWAIT | MSG_NOSIGNAL) !=
+            sizeof(msg)) {
+      ++skipped_;
+      continue;
+    }
+
+    client->held.insert(index);
+    ++clients;
+    ++sent_;
+  }
+
+  if (!clients)
+    return true;
+
+  loans_[index].request = request;
+  loans_[index].clients = clients;
+
+  return false;
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_publisher.h - Share frames with local processes over a Unix socket
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <libcamera/stream.h>
+
+#include "frame_share.h"
+#include "frame_sink.h"
+
+class FramePublisher : public FrameSink {
+ public:
+  FramePublisher(const std::string& path);
+  ~FramePublisher();
+
+  int configure(const libcamera::CameraConfiguration& config) override;
+  void mapBuffer(const libcamera::Stream* stream,
+                 libcamera::FrameBuffer* buffer) override;
+
+  int start() override;
+  int stop() override;
+
+  bool processRequest(libcamera::Request* request) override;
+
+ private:
+  struct Client {
+    int fd;
+    /* Buffers lent to the client, by index. */
+    std::set<unsigned int> held;
+  };
+
+  /* A buffer lent to clients, with the number of clients holding it. */
+  struct Loan {
+    libcamera::Request* request = nullptr;
+    unsigned int clients = 0;
+  };
+
+  void acceptClient();
+  int sendBuffers(int fd);
+  void readClient(Client* client);
+  void removeClient(Client* client);
+  void releaseBuffer(unsigned int index);
+
+  std::string path_;
+  int listenFd_ = -1;
+
+  const libcamera::Stream* stream_ = nullptr;
+  FrameShareStream info_ = {};
+
+  std::vector<libcamera::FrameBuffer*> buffers_;
+  std::map<const libcamera::FrameBuffer*, unsigned int> indexes_;
+  std::vector<Loan> loans_;
+  unsigned int maxHeld_ = 1;
+
+  std::vector<std::unique_ptr<Client>> clients_;
+
+  uint64_t frames_ = 0;
+  uint64_t sent_ = 0;
+  uint64_t skipped_ = 0;
+};
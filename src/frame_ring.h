@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_ring.h - Shared memory frame metadata ring
+ *
+ * twincam publishes the metadata of each frame it captures in a POSIX shared
+ * memory object, /dev/shm/<name>, laid out as a header followed by a ring of
+ * fixed-size records in native byte order. There is a single writer and any
+ * number of readers, which map the object read-only and poll it without any
+ * system call or lock.
+ *
+ * Record n lives in slot n % capacity. Its seq field is odd while the record
+ * is written and 2 * (n + 1) once complete, so that readers detect both torn
+ * reads and records overwritten since they read the header, as a seqlock does.
+ * The header head field counts the records written. Use frameRingRead() to
+ * read a record consistently.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+
+static constexpr char frameRingMagic[8] = "TWCMRNG";
+static constexpr uint32_t frameRingVersion = 1;
+
+/* Motion was detected in the frame. */
+static constexpr uint32_t frameRingFlagMotion = 1 << 0;
+/* A frame monitor alarm is raised, see twincam --monitor. */
+static constexpr uint32_t frameRingFlagAlarm = 1 << 1;
+
+struct FrameRingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  uint32_t recordSize;
+  uint32_t capacity;
+  /* Number of records written, read it with __atomic_load_n(ACQUIRE). */
+  uint64_t head;
+  uint64_t reserved[4];
+};
+
+struct FrameRingRecord {
+  uint64_t seq;
+  /* Sensor timestamp in nanoseconds. */
+  uint64_t timestamp;
+  /* CLOCK_MONOTONIC times the request completed and the frame was shown. */
+  uint64_t completed;
+  /* Written after the record, 0 until a display showed the frame. */
+  uint64_t displayed;
+  uint32_t sequence;
+  uint32_t bytesused;
+  /* Exposure time in microseconds and gains, 0 when not reported. */
+  uint32_t exposureTime;
+  float analogueGain;
+  float digitalGain;
+  uint32_t flags;
+  uint32_t reserved[2];
+};
+
+static_assert(sizeof(FrameRingHeader) == 64);
+static_assert(sizeof(FrameRingRecord) == 64);
+
+/*
+ * Copy record \a n of the ring at \a header into \a record. Returns 0 on
+ * success, -EAGAIN if the record isn't written yet or is being written, and
+ * -ENOENT if it has been overwritten already.
+ */
+static inline int frameRingRead(const FrameRingHeader* header,
+                                uint64_t n,
+                                FrameRingRecord* record) {
+  const uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+  if (n >= head)
+    return -EAGAIN;
+  if (head - n > header->capacity)
+    return -ENOENT;
+
+  const FrameRingRecord* slot = reinterpret_cast<const FrameRingRecord*>(
+      reinterpret_cast<const uint8_t*>(header) + header->headerSize +
+      (n % header->capacity) * header->recordSize);
+
+  const uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1)
+    return -EAGAIN;
+  if (seq != 2 * (n + 1))
+    return -ENOENT;
+
+  *record = *slot;
+  record->displayed = __atomic_load_n(&slot->displayed, __ATOMIC_RELAXED);
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+    return -EAGAIN;
+
+  return 0;
+}
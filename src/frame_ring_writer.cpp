@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_ring_writer.cpp - Publish frame metadata in shared memory
+ */
+
+#include "frame_ring_writer.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <optional>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+#include "twincam.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+/**
+ * \class FrameRingWriter
+ * \brief Write the metadata of each frame into a shared memory ring
+ *
+ * Tools that only need frame timing and exposure read the ring described in
+ * frame_ring.h, instead of parsing the output of twincam. Writing a record
+ * costs a few stores to memory mapped once, no system call, and readers never
+ * hold back the writer: records they didn't read in time are overwritten.
+ */
+FrameRingWriter::FrameRingWriter() = default;
+
+FrameRingWriter::~FrameRingWriter() {
+  close();
+}
+
+/* Create the shared memory object \a name, as /dev/shm/<name>. */
+int FrameRingWriter::open(const std::string& name, unsigned int capacity) {
+  close();
+
+  name_ = "/" + name;
+  int fd = shm_open(name_.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    int ret = -errno;
+    EPRINT("Failed to create shared memory %s: %s\n", name_.c_str(),
+           strerror(-ret));
+    return ret;
+  }
+
+  size_ = sizeof(FrameRingHeader) + capacity * sizeof(FrameRingRecord);
+  void* map = MAP_FAILED;
+  if (!ftruncate(fd, size_))
+    map = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int ret = -errno;
+  ::close(fd);
+
+  if (map == MAP_FAILED) {
+    EPRINT("Failed to map shared memory %s: %s\n", name_.c_str(),
+           strerror(-ret));
+    shm_unlink(name_.c_str());
+    return ret;
+  }
+
+  header_ = static_cast<FrameRingHeader*>(map);
+  header_->version = frameRingVersion;
+  header_->headerSize = sizeof(FrameRingHeader);
+  header_->recordSize = sizeof(FrameRingRecord);
+  header_->capacity = capacity;
+  head_ = 0;
+
+  /* Readers check the magic last, once the layout is valid. */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header_->magic, frameRingMagic, sizeof(header_->magic));
+
+  PRINT("Publishing frame metadata in /dev/shm%s\n", name_.c_str());
+
+  return 0;
+}
+
+void FrameRingWriter::close() {
+  if (!header_)
+    return;
+
+  munmap(header_, size_);
+  header_ = nullptr;
+  shm_unlink(name_.c_str());
+}
+
+FrameRingRecord* FrameRingWriter::slot(uint64_t n) const {
+  return reinterpret_cast<FrameRingRecord*>(
+      reinterpret_cast<uint8_t*>(header_) + header_->headerSize +
+      (n % header_->capacity) * header_->recordSize);
+}
+
+/*
+ * Append the record of \a request, completed at \a completed on the
+ * CLOCK_MONOTONIC clock.
+ */
+void FrameRingWriter::write(Request* request,
+                            uint64_t completed,
+                            uint32_t flags) {
+  if (!header_)
+    return;
+
+  FrameBuffer* buffer = request->buffers().begin()->second;
+  const FrameMetadata& metadata = buffer->metadata();
+  const ControlList& controls = request->metadata();
+
+  FrameRingRecord* record = slot(head_);
+
+  /* Mark the record as being written before touching it. */
+  __atomic_store_n(&record->seq, 2 * head_ + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  const std::optional<int64_t> sensor =
+      controls.get(controls::SensorTimestamp);
+  record->timestamp = sensor ? *sensor : metadata.timestamp;
+  record->completed = completed;
+  __atomic_store_n(&record->displayed, 0, __ATOMIC_RELAXED);
+  record->sequence = metadata.sequence;
+
+  record->bytesused = 0;
+  for (const FrameMetadata::Plane& plane : metadata.planes())
+    record->bytesused += plane.bytesused;
+
+  const std::optional<int32_t> exposure =
+      controls.get(controls::ExposureTime);
+  record->exposureTime = exposure ? *exposure : 0;
+  const std::optional<float> analogue = controls.get(controls::AnalogueGain);
+  record->analogueGain = analogue ? *analogue : 0.0f;
+  const std::optional<float> digital = controls.get(controls::DigitalGain);
+  record->digitalGain = digital ? *digital : 0.0f;
+  record->flags = flags;
+
+  __atomic_store_n(&record->seq, 2 * (head_ + 1), __ATOMIC_RELEASE);
+  __atomic_store_n(&header_->head, ++head_, __ATOMIC_RELEASE);
+}
+
+/* Find the record of frame \a sequence, the most recent records first. */
+FrameRingRecord* FrameRingWriter::find(uint32_t sequence) const {
+  const uint64_t count = std::min<uint64_t>(head_, header_->capacity);
+  for (uint64_t i = 1; i <= count; ++i) {
+    FrameRingRecord* record = slot(head_ - i);
+    if (record->sequence == sequence)
+      return record;
+  }
+
+  return nullptr;
+}
+
+/* Record when frame \a sequence was shown, if it's still in the ring. */
+void FrameRingWriter::setDisplayed(uint32_t sequence, uint64_t displayed) {
+  if (!header_)
+    return;
+
+  FrameRingRecord* record = find(sequence);
+  if (record)
+    __atomic_store_n(&record->displayed, displayed, __ATOMIC_RELAXED);
+}
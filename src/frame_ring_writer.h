@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_ring_writer.h - Publish frame metadata in shared memory
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "frame_ring.h"
+
+namespace libcamera {
+class Request;
+} /* namespace libcamera */
+
+class FrameRingWriter {
+ public:
+  FrameRingWriter();
+  ~FrameRingWriter();
+
+  int open(const std::string& name, unsigned int capacity = 256);
+  void close();
+
+  void write(libcamera::Request* request,
+             uint64_t completed,
+             uint32_t flags = 0);
+  void setDisplayed(uint32_t sequence, uint64_t displayed);
+
+ private:
+  FrameRingRecord* slot(uint64_t n) const;
+  FrameRingRecord* find(uint32_t sequence) const;
+
+  std::string name_;
+  FrameRingHeader* header_ = nullptr;
+  size_t size_ = 0;
+  uint64_t head_ = 0;
+};
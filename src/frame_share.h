@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_share.h - Frame sharing protocol
+ *
+ * twincam shares the frames of a camera with other processes over a Unix
+ * SOCK_SEQPACKET socket, each message being one of the structures below, in
+ * native byte order. On connection the publisher sends a FrameShareStream
+ * message and one FrameShareBuffer message per buffer, with the dmabuf file
+ * descriptors of the buffer planes attached as SCM_RIGHTS, one per plane.
+ *
+ * Frames then only take a FrameShareFrame message naming the buffer that holds
+ * them. The buffer is lent to the client until it sends a FrameShareRelease
+ * message for it, and the camera can't reuse it meanwhile, so clients must
+ * release frames promptly. A client holding too many frames, or not reading
+ * its socket, misses the next frames.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+static constexpr char frameShareMagic[8] = "TWCMSHR";
+static constexpr uint32_t frameShareVersion = 1;
+static constexpr unsigned int frameShareMaxPlanes = 4;
+
+enum FrameShareMessage : uint32_t {
+  FrameShareMessageStream = 1,
+  FrameShareMessageBuffer = 2,
+  FrameShareMessageFrame = 3,
+  FrameShareMessageRelease = 4,
+};
+
+struct FrameShareStream {
+  uint32_t type;
+  uint32_t version;
+  char magic[8];
+  /* DRM fourcc and modifier of the frames. */
+  uint32_t fourcc;
+  uint32_t reserved;
+  uint64_t modifier;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t numBuffers;
+};
+
+struct FrameShareBuffer {
+  uint32_t type;
+  uint32_t index;
+  uint32_t numPlanes;
+  uint32_t reserved;
+  struct {
+    uint32_t offset;
+    uint32_t length;
+  } planes[frameShareMaxPlanes];
+};
+
+struct FrameShareFrame {
+  uint32_t type;
+  uint32_t index;
+  uint32_t sequence;
+  uint32_t numPlanes;
+  /* Sensor timestamp in nanoseconds, CLOCK_BOOTTIME or CLOCK_MONOTONIC. */
+  uint64_t timestamp;
+  uint32_t bytesused[frameShareMaxPlanes];
+};
+
+struct FrameShareRelease {
+  uint32_t type;
+  uint32_t index;
+};
+
+static_assert(sizeof(FrameShareStream) == 48);
+static_assert(sizeof(FrameShareBuffer) == 48);
+static_assert(sizeof(FrameShareFrame) == 40);
+static_assert(sizeof(FrameShareRelease) == 8);
@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_share_client.cpp - Receive frames shared by twincam
+ */
+
+#include "frame_share_client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * \class FrameShareClient
+ * \brief Connect to a twincam frame publisher and borrow its frames
+ *
+ * The client receives the buffers once on connection, then one message per
+ * frame. Frames must be given back with release() as soon as the client is
+ * done with them, the camera can't reuse the buffer until every client did.
+ * Buffers are dmabufs, which may be imported into a GPU or codec as is, or
+ * mapped for CPU access with map().
+ */
+FrameShareClient::FrameShareClient() = default;
+
+FrameShareClient::~FrameShareClient() {
+  disconnect();
+}
+
+/*
+ * Connect to the publisher listening on \a path and receive its buffers.
+ * Returns 0 on success or a negative error code.
+ */
+int FrameShareClient::connect(const char* path) {
+  disconnect();
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -ENAMETOOLONG;
+  strcpy(addr.sun_path, path);
+
+  fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd_ < 0)
+    return -errno;
+
+  if (::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr),
+                sizeof(addr)) < 0) {
+    int ret = -errno;
+    disconnect();
+    return ret;
+  }
+
+  ssize_t size = recv(fd_, &stream_, sizeof(stream_), 0);
+  if (size != sizeof(stream_) || stream_.type != FrameShareMessageStream ||
+      memcmp(stream_.magic, frameShareMagic, sizeof(stream_.magic)) ||
+      stream_.version != frameShareVersion) {
+    disconnect();
+    return -EPROTO;
+  }
+
+  buffers_.resize(stream_.numBuffers);
+  for (unsigned int i = 0; i < stream_.numBuffers; ++i) {
+    int ret = receiveBuffer();
+    if (ret < 0) {
+      disconnect();
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
+int FrameShareClient::receiveBuffer() {
+  FrameShareBuffer msg;
+  struct iovec iov = {&msg, sizeof(msg)};
+  char control[CMSG_SPACE(sizeof(int) * frameShareMaxPlanes)];
+
+  struct msghdr hdr = {};
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = control;
+  hdr.msg_controllen = sizeof(control);
+
+  ssize_t size = recvmsg(fd_, &hdr, MSG_CMSG_CLOEXEC);
+  if (size < 0)
+    return -errno;
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+  if (size != sizeof(msg) || msg.type != FrameShareMessageBuffer ||
+      msg.index >= buffers_.size() || msg.numPlanes > frameShareMaxPlanes ||
+      !cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int) * msg.numPlanes))
+    return -EPROTO;
+
+  Buffer& buffer = buffers_[msg.index];
+  buffer.numPlanes = msg.numPlanes;
+  memcpy(buffer.fds, CMSG_DATA(cmsg), sizeof(int) * msg.numPlanes);
+  for (unsigned int i = 0; i < msg.numPlanes; ++i) {
+    buffer.offsets[i] = msg.planes[i].offset;
+    buffer.lengths[i] = msg.planes[i].length;
+  }
+
+  return 0;
+}
+
+void FrameShareClient::disconnect() {
+  for (Buffer& buffer : buffers_) {
+    for (unsigned int i = 0; i < buffer.numPlanes; ++i) {
+      if (buffer.maps[i])
+        munmap(buffer.maps[i], buffer.mapLengths[i]);
+      close(buffer.fds[i]);
+    }
+  }
+
+  buffers_.clear();
+
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+/*
+ * Wait for the next frame. Returns 0 with \a frame filled, or a negative error
+ * code, -EPIPE once twincam stopped sharing frames.
+ */
+int FrameShareClient::receive(FrameShareFrame* frame) {
+  for (;;) {
+    ssize_t size = recv(fd_, frame, sizeof(*frame), 0);
+    if (size < 0 && errno == EINTR)
+      continue;
+    if (size < 0)
+      return -errno;
+    if (!size)
+      return -EPIPE;
+
+    if (size == sizeof(*frame) && frame->type == FrameShareMessageFrame &&
+        frame->index < buffers_.size())
+      return 0;
+  }
+}
+
+/* Give the buffer of the frame back to the camera. */
+int FrameShareClient::release(unsigned int index) {
+  FrameShareRelease msg = {FrameShareMessageRelease, index};
+  if (send(fd_, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+    return -errno;
+
+  return 0;
+}
+
+/*
+ * Map a plane of a buffer for reading, once, and return its first byte. The
+ * mapping stays valid until disconnection.
+ */
+const uint8_t* FrameShareClient::map(unsigned int index, unsigned int plane) {
+  if (index >= buffers_.size() || plane >= buffers_[index].numPlanes)
+    return nullptr;
+
+  Buffer& buffer = buffers_[index];
+  if (!buffer.maps[plane]) {
+    /* Planes may share a dmabuf, map from its start to cover the offset. */
+    const size_t length = buffer.offsets[plane] + buffer.lengths[plane];
+    void* map =
+        mmap(nullptr, length, PROT_READ, MAP_SHARED, buffer.fds[plane], 0);
+    if (map == MAP_FAILED)
+      return nullptr;
+
+    buffer.maps[plane] = map;
+    buffer.mapLengths[plane] = length;
+  }
+
+  return static_cast<const uint8_t*>(buffer.maps[plane]) +
+         buffer.offsets[plane];
+}
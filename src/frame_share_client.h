@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_share_client.h - Receive frames shared by twincam
+ *
+ * A minimal client of the frame sharing protocol described in frame_share.h:
+ *
+ *   FrameShareClient client;
+ *   if (client.connect("/run/twincam.sock") < 0)
+ *     return;
+ *
+ *   for (FrameShareFrame frame; !client.receive(&frame);) {
+ *     const uint8_t* luma = client.map(frame.index, 0);
+ *     ...
+ *     client.release(frame.index);
+ *   }
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "frame_share.h"
+
+class FrameShareClient {
+ public:
+  struct Buffer {
+    unsigned int numPlanes = 0;
+    int fds[frameShareMaxPlanes] = {-1, -1, -1, -1};
+    uint32_t offsets[frameShareMaxPlanes] = {};
+    uint32_t lengths[frameShareMaxPlanes] = {};
+
+    /* CPU mappings of the planes, made by map(). */
+    void* maps[frameShareMaxPlanes] = {};
+    size_t mapLengths[frameShareMaxPlanes] = {};
+  };
+
+  FrameShareClient();
+  ~FrameShareClient();
+
+  int connect(const char* path);
+  void disconnect();
+
+  /* The socket, to poll for frames along with other file descriptors. */
+  int fd() const { return fd_; }
+
+  const FrameShareStream& stream() const { return stream_; }
+  const std::vector<Buffer>& buffers() const { return buffers_; }
+
+  int receive(FrameShareFrame* frame);
+  int release(unsigned int index);
+
+  const uint8_t* map(unsigned int index, unsigned int plane);
+
+ private:
+  int receiveBuffer();
+
+  int fd_ = -1;
+  FrameShareStream stream_ = {};
+  std::vector<Buffer> buffers_;
+};
@@ -7,6 +7,8 @@
 
 #include "frame_sink.h"
 
+#include <errno.h>
+
 /**
  * \class FrameSink
  * \brief Abstract class to model a consumer of frames
@@ -28,7 +30,61 @@ int FrameSink::configure(
   return 0;
 }
 
-void FrameSink::mapBuffer([[maybe_unused]] libcamera::FrameBuffer* buffer) {}
+/**
+ * \fn FrameSink::setTransform()
+ * \param[in] transform The transform to apply to frames when displaying them
+ *
+ * Called after configure() with the part of the requested transform the
+ * camera couldn't apply. Sinks that can flip frames for free, in the display
+ * hardware or the GPU, accept it, in which case the frames they receive are
+ * left untouched.
+ *
+ * \return 0 if the sink applies \a transform, -ENOTSUP otherwise
+ */
+int FrameSink::setTransform(libcamera::Transform transform) {
+  return transform == libcamera::Transform::Identity ? 0 : -ENOTSUP;
+}
+
+/**
+ * \fn FrameSink::setCrop()
+ * \param[in] crop The region of the frames to display, in pixels
+ *
+ * Called, possibly while streaming, to zoom into \a crop when the camera has
+ * no ScalerCrop control. Sinks that can scale the region up in hardware
+ * accept it and apply it from the next frame on.
+ *
+ * \return 0 if the sink applies \a crop, -ENOTSUP otherwise
+ */
+int FrameSink::setCrop([[maybe_unused]] const libcamera::Rectangle& crop) {
+  return -ENOTSUP;
+}
+
+void FrameSink::mapBuffer([[maybe_unused]] const libcamera::Stream* stream,
+                          [[maybe_unused]] libcamera::FrameBuffer* buffer) {}
+
+/**
+ * \fn FrameSink::setMappedBuffers()
+ * \param[in] mappedBuffers The CPU mappings of the camera buffers
+ *
+ * Sinks that access pixels with the CPU retrieve mappings from the cache owned
+ * by the camera session, rather than mapping buffers themselves in
+ * mapBuffer(), so that each buffer is mapped once for all sinks.
+ */
+
+/**
+ * \fn FrameSink::setRecording()
+ * \param[in] recording Whether frames should be recorded
+ *
+ * Called while streaming to pause and resume sinks that record frames, for
+ * instance to only record while motion is detected. Other sinks keep
+ * processing frames as usual.
+ */
+
+/**
+ * \var FrameSink::frameDisplayed
+ * \brief Emitted by display sinks when the frame of a request reaches the
+ * screen
+ */
 
 int FrameSink::start() {
   return 0;
@@ -9,23 +9,41 @@
 
 #include <libcamera/base/signal.h>
 
+#include <libcamera/geometry.h>
+#include <libcamera/transform.h>
+
 namespace libcamera {
 class CameraConfiguration;
 class FrameBuffer;
 class Request;
+class Stream;
 } /* namespace libcamera */
 
+class MappedBufferCache;
+
 class FrameSink {
  public:
   virtual ~FrameSink();
 
   virtual int configure(const libcamera::CameraConfiguration& config);
+  virtual int setTransform(libcamera::Transform transform);
+  virtual int setCrop(const libcamera::Rectangle& crop);
 
-  virtual void mapBuffer(libcamera::FrameBuffer* buffer);
+  virtual void mapBuffer(const libcamera::Stream* stream,
+                         libcamera::FrameBuffer* buffer);
+  virtual void setMappedBuffers(MappedBufferCache* mappedBuffers) {
+    mappedBuffers_ = mappedBuffers;
+  }
+  virtual void setRecording(bool recording) { recording_ = recording; }
 
   virtual int start();
   virtual int stop();
 
   virtual bool processRequest(libcamera::Request* request) = 0;
   libcamera::Signal<libcamera::Request*> requestProcessed;
+  libcamera::Signal<libcamera::Request*> frameDisplayed;
+
+ protected:
+  MappedBufferCache* mappedBuffers_ = nullptr;
+  bool recording_ = true;
 };
\ No newline at end of file
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_source.cpp - Frames to process without a camera
+ */
+
+#include "frame_source.h"
+
+#include <errno.h>
+#include <time.h>
+
+uint64_t FrameSource::monotonicTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void FrameSource::sleepUntil(uint64_t time) {
+  struct timespec ts;
+  ts.tv_sec = time / 1000000000ULL;
+  ts.tv_nsec = time % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+         EINTR) {
+  }
+}
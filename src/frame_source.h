@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_source.h - Frames to process without a camera
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/stream.h>
+
+/* A frame of a FrameSource, valid until the source gives the next one. */
+struct SourceFrame {
+  /* memfd the planes are mapped from, to share the frame by fd like dmabufs. */
+  int fd = -1;
+  /* The bytes used of each plane, a single plane for MJPEG. */
+  std::vector<libcamera::Span<uint8_t>> planes;
+  uint32_t sequence = 0;
+  /* CLOCK_MONOTONIC nanoseconds, the time base of libcamera timestamps. */
+  uint64_t timestamp = 0;
+};
+
+/*
+ * Frames from something other than a camera, in the layout libcamera gives
+ * them, for the frame processing to be measured and compared without one.
+ */
+class FrameSource {
+ public:
+  virtual ~FrameSource() = default;
+
+  /* Pixel format, size and stride of the frames, once configured. */
+  virtual const libcamera::StreamConfiguration& configuration() const = 0;
+
+  /* Next frame, when it is due at the source rate, nullptr at the end. */
+  virtual const SourceFrame* next() = 0;
+
+ protected:
+  /* CLOCK_MONOTONIC now, and sleeping until \a time on it, in nanoseconds. */
+  static uint64_t monotonicTime();
+  static void sleepUntil(uint64_t time);
+};
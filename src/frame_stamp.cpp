@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_stamp.cpp - Stamp frame sequence numbers into the pixels
+ */
+
+#include "frame_stamp.h"
+#include "frame_planes.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+constexpr unsigned int kColumns = 8;
+constexpr unsigned int kRows = FrameStamp::kBits / kColumns;
+
+/* Video range luma of the blocks, chroma is made neutral. */
+constexpr uint8_t kLumaBlack = 16;
+constexpr uint8_t kLumaWhite = 235;
+constexpr uint8_t kChromaNeutral = 128;
+
+/*
+ * Size of the blocks, a quarter of the largest that fits, and top left corner
+ * of the stamp, even for chroma subsampled formats.
+ */
+unsigned int blockSize(const Size& size) {
+  return std::max((std::min(size.width / kColumns, size.height / kRows) / 4) &
+                      ~1u,
+                  2u);
+}
+
+Point origin(const Size& size) {
+  const unsigned int block = blockSize(size);
+  return Point(((size.width - kColumns * block) / 2) & ~1u,
+               ((size.height - kRows * block) / 2) & ~1u);
+}
+
+bool isPacked(const PixelFormat& format) {
+  return format == formats::YUYV || format == formats::YVYU ||
+         format == formats::UYVY || format == formats::VYUY;
+}
+
+bool isRgb(const PixelFormat& format) {
+  return format == formats::XRGB8888 || format == formats::ARGB8888 ||
+         format == formats::XBGR8888 || format == formats::ABGR8888;
+}
+
+} /* namespace */
+
+bool FrameStamp::isSupported(const PixelFormat& format) {
+  switch (format) {
+    case formats::NV12:
+    case formats::NV21:
+    case formats::YUV420:
+    case formats::YVU420:
+      return true;
+    default:
+      return isPacked(format) || isRgb(format);
+  }
+}
+
+/*
+ * Draw the low bits of \a sequence into the frame of \a cfg in \a planes.
+ * Only the blocks are written, a few kilobytes of the frame.
+ */
+int FrameStamp::write(const StreamConfiguration& cfg,
+                      const std::vector<Span<uint8_t>>& planes,
+                      uint32_t sequence) {
+  const PixelFormat& format = cfg.pixelFormat;
+  const size_t stride = cfg.stride;
+  const unsigned int height = cfg.size.height;
+  if (!isSupported(format) || cfg.size.width < kColumns * 2 ||
+      height < kRows * 2)
+    return -EINVAL;
+
+  const bool planar = !isPacked(format) && !isRgb(format);
+  const bool semiPlanar = format == formats::NV12 || format == formats::NV21;
+  std::vector<size_t> sizes = {stride * height};
+  if (semiPlanar)
+    sizes.push_back(stride * (height / 2));
+  else if (planar)
+    sizes.insert(sizes.end(), 2, stride / 2 * (height / 2));
+
+  std::vector<uint8_t*> data;
+  if (splitPlanes(planes, sizes, &data) < 0)
+    return -EINVAL;
+
+  const uint32_t bits = (sequence & 0xffff) | (~sequence & 0xffff) << 16;
+  const unsigned int block = blockSize(cfg.size);
+  const Point corner = origin(cfg.size);
+  const unsigned int lumaOffset =
+      format == formats::UYVY || format == formats::VYUY;
+
+  for (unsigned int bit = 0; bit < kBits; ++bit) {
+    const bool white = (bits >> bit) & 1;
+    const uint8_t luma = white ? kLumaWhite : kLumaBlack;
+    const unsigned int x = corner.x + bit % kColumns * block;
+    const unsigned int y = corner.y + bit / kColumns * block;
+
+    for (unsigned int row = y; row < y + block; ++row) {
+      uint8_t* line = data[0] + row * stride;
+
+      if (isRgb(format)) {
+        for (unsigned int i = x; i < x + block; ++i) {
+          memset(line + i * 4, white ? 0xff : 0x00, 3);
+          line[i * 4 + 3] = 0xff;
+        }
+      } else if (!planar) {
+        for (unsigned int i = x; i < x + block; ++i) {
+          line[i * 2 + lumaOffset] = luma;
+          line[i * 2 + 1 - lumaOffset] = kChromaNeutral;
+        }
+      } else {
+        memset(line + x, luma, block);
+      }
+    }
+
+    if (!planar)
+      continue;
+
+    for (unsigned int row = y / 2; row < (y + block) / 2; ++row) {
+      if (semiPlanar) {
+        memset(data[1] + row * stride + x, kChromaNeutral, block);
+      } else {
+        memset(data[1] + row * (stride / 2) + x / 2, kChromaNeutral,
+               block / 2);
+        memset(data[2] + row * (stride / 2) + x / 2, kChromaNeutral,
+               block / 2);
+      }
+    }
+  }
+
+  return 0;
+}
+
+Point FrameStamp::bitPosition(const Size& size, unsigned int bit) {
+  const unsigned int block = blockSize(size);
+  const Point corner = origin(size);
+  return Point(corner.x + bit % kColumns * block + block / 2,
+               corner.y + bit / kColumns * block + block / 2);
+}
+
+int FrameStamp::decode(uint32_t bits) {
+  if ((bits >> 16) != (~bits & 0xffff))
+    return -1;
+
+  return bits & 0xffff;
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_stamp.h - Stamp frame sequence numbers into the pixels
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+/*
+ * The low 16 bits of the sequence of a frame and their complement drawn as
+ * 8x4 black and white blocks in the middle of the frame, large enough to be
+ * read back from the screen after scaling or zooming.
+ */
+class FrameStamp {
+ public:
+  static constexpr unsigned int kBits = 32;
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  static int write(const libcamera::StreamConfiguration& cfg,
+                   const std::vector<libcamera::Span<uint8_t>>& planes,
+                   uint32_t sequence);
+
+  /* Centre of the block of \a bit in frames of \a size. */
+  static libcamera::Point bitPosition(const libcamera::Size& size,
+                                      unsigned int bit);
+
+  /* Sequence bits of a stamp read back, -1 if it isn't a complete stamp. */
+  static int decode(uint32_t bits);
+};
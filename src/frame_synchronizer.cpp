@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_synchronizer.cpp - Match frames of several cameras by timestamp
+ */
+
+#include "frame_synchronizer.h"
+
+#include <inttypes.h>
+#include <algorithm>
+#include <optional>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+#include "twincam.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+namespace {
+
+/*
+ * Prefer the start of exposure reported by the pipeline handler, which doesn't
+ * depend on when the frame made it through the ISP, to the buffer timestamp.
+ */
+uint64_t frameTimestamp(Request* request) {
+  const std::optional<int64_t> sensor =
+      request->metadata().get(controls::SensorTimestamp);
+  if (sensor && *sensor > 0)
+    return *sensor;
+
+  return request->buffers().begin()->second->metadata().timestamp;
+}
+
+}  // namespace
+
+/**
+ * \class FrameSynchronizer
+ * \brief Match the frames of several cameras that were captured together
+ *
+ * Cameras complete their requests independently, so showing frames as they
+ * arrive pairs frames captured up to a frame period apart. The synchronizer
+ * holds on to the latest completed request of each camera, at most one per
+ * camera so that no camera runs out of requests, and emits frameReady for all
+ * of them at once when their timestamps lie within the tolerance.
+ *
+ * Cameras only deliver newer frames, so a held frame that is older than the
+ * newest held frame by more than the tolerance can never be part of a set. It
+ * is given back through frameDropped right away, as is a held frame replaced
+ * by a newer frame of the same camera.
+ */
+FrameSynchronizer::FrameSynchronizer(unsigned int streams, uint64_t tolerance)
+    : tolerance_(tolerance), slots_(streams) {}
+
+void FrameSynchronizer::push(unsigned int stream, Request* request) {
+  if (stream >= slots_.size())
+    return;
+
+  if (slots_[stream].request)
+    drop(stream);
+
+  slots_[stream].request = request;
+  slots_[stream].timestamp = frameTimestamp(request);
+
+  uint64_t newest = 0;
+  for (const Slot& slot : slots_) {
+    if (slot.request)
+      newest = std::max(newest, slot.timestamp);
+  }
+
+  uint64_t oldest = newest;
+  bool complete = true;
+  for (unsigned int i = 0; i < slots_.size(); ++i) {
+    if (slots_[i].request && newest - slots_[i].timestamp > tolerance_)
+      drop(i);
+
+    if (!slots_[i].request)
+      complete = false;
+    else
+      oldest = std::min(oldest, slots_[i].timestamp);
+  }
+
+  if (!complete)
+    return;
+
+  const uint64_t skew = newest - oldest;
+  skewSum_ += skew;
+  skewMax_ = std::max(skewMax_, skew);
+  ++sets_;
+
+  /* Release the slots first, the sinks may complete requests right away. */
+  std::vector<Request*> set;
+  for (Slot& slot : slots_) {
+    set.push_back(slot.request);
+    slot.request = nullptr;
+  }
+
+  for (unsigned int i = 0; i < set.size(); ++i)
+    frameReady.emit(i, set[i]);
+}
+
+/*
+ * Print the statistics and forget the held requests, the cameras are about to
+ * stop and won't need them anymore.
+ */
+void FrameSynchronizer::stop() {
+  if (sets_) {
+    PRINT("Synchronized %" PRIu64 " sets of %zu frames, skew %.2f ms mean, "
+          "%.2f ms max\n",
+          sets_, slots_.size(), skewSum_ / 1000000.0 / sets_,
+          skewMax_ / 1000000.0);
+  }
+
+  for (unsigned int i = 0; i < slots_.size(); ++i) {
+    if (slots_[i].dropped) {
+      PRINT("Dropped %" PRIu64 " frames of camera %u without a partner\n",
+            slots_[i].dropped, i);
+    }
+
+    slots_[i].request = nullptr;
+  }
+}
+
+void FrameSynchronizer::drop(unsigned int stream) {
+  Request* request = slots_[stream].request;
+
+  slots_[stream].request = nullptr;
+  ++slots_[stream].dropped;
+
+  frameDropped.emit(stream, request);
+}
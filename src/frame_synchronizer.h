@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_synchronizer.h - Match frames of several cameras by timestamp
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/signal.h>
+
+namespace libcamera {
+class Request;
+} /* namespace libcamera */
+
+class FrameSynchronizer {
+ public:
+  FrameSynchronizer(unsigned int streams, uint64_t tolerance);
+
+  void push(unsigned int stream, libcamera::Request* request);
+  void stop();
+
+  libcamera::Signal<unsigned int, libcamera::Request*> frameReady;
+  libcamera::Signal<unsigned int, libcamera::Request*> frameDropped;
+
+ private:
+  struct Slot {
+    libcamera::Request* request = nullptr;
+    uint64_t timestamp = 0;
+    uint64_t dropped = 0;
+  };
+
+  void drop(unsigned int stream);
+
+  /* Largest difference between timestamps of a set, in nanoseconds. */
+  uint64_t tolerance_;
+  std::vector<Slot> slots_;
+
+  uint64_t sets_ = 0;
+  uint64_t skewSum_ = 0;
+  uint64_t skewMax_ = 0;
+};
@@ -0,0 +1,312 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_transform.cpp - Mirror and rotate frames by 180 degrees in place
+ */
+
+#include "frame_transform.h"
+#include "cpu_features.h"
+#include "frame_planes.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+template <unsigned int N>
+void swapUnits(uint8_t* a, uint8_t* b) {
+  uint8_t tmp[N];
+  memcpy(tmp, a, N);
+  memcpy(a, b, N);
+  memcpy(b, tmp, N);
+}
+
+template <unsigned int N>
+void mirror(uint8_t* a, uint8_t* b, unsigned int length) {
+  if (a == b) {
+    if (length < 2 * N)
+      return;
+
+    for (unsigned int i = 0, j = length - N; i < j; i += N, j -= N)
+      swapUnits<N>(a + i, a + j);
+    return;
+  }
+
+  for (unsigned int i = 0; i < length; i += N)
+    swapUnits<N>(a + i, b + length - N - i);
+}
+
+/* Luma is at byte Luma and Luma + 2 of each macropixel. */
+template <unsigned int Luma>
+void mirrorYUV422(uint8_t* a, uint8_t* b, unsigned int length) {
+  mirror<4>(a, b, length);
+
+  for (uint8_t* row : {a, b}) {
+    for (unsigned int i = 0; i < length; i += 4)
+      std::swap(row[i + Luma], row[i + Luma + 2]);
+
+    if (a == b)
+      break;
+  }
+}
+
+/* Swap rows through a buffer that stays in L1 cache. */
+void swapRows(uint8_t* a, uint8_t* b, unsigned int length) {
+  uint8_t tmp[4096];
+
+  for (unsigned int i = 0; i < length; i += sizeof(tmp)) {
+    const unsigned int n = std::min<unsigned int>(sizeof(tmp), length - i);
+    memcpy(tmp, a + i, n);
+    memcpy(a + i, b + i, n);
+    memcpy(b + i, tmp, n);
+  }
+}
+
+const FrameTransformKernels& bestKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::SSE2))
+    return sse2TransformKernels;
+#elif defined(__arm__) || defined(__aarch64__)
+  if (CpuFeatures::has(CpuFeatures::NEON))
+    return neonTransformKernels;
+#endif
+
+  return scalarTransformKernels;
+}
+
+/* Bytes per pixel of the packed RGB formats, 0 for other formats. */
+unsigned int rgbBytesPerPixel(const PixelFormat& format) {
+  switch (format) {
+    case formats::RGB565:
+      return 2;
+    case formats::RGB888:
+    case formats::BGR888:
+      return 3;
+    case formats::XRGB8888:
+    case formats::XBGR8888:
+    case formats::ARGB8888:
+    case formats::ABGR8888:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+const struct {
+  Transform transform;
+  const char* name;
+} transformNames[] = {
+    {Transform::Identity, "none"},
+    {Transform::HFlip, "hflip"},
+    {Transform::VFlip, "vflip"},
+    {Transform::Rot180, "rot180"},
+};
+
+} /* namespace */
+
+const FrameTransformKernels scalarTransformKernels = {
+    "scalar",
+    mirror<1>,
+    mirror<2>,
+    mirror<3>,
+    mirror<4>,
+    mirrorYUV422<0>,
+    mirrorYUV422<1>,
+};
+
+/*
+ * Parse the \a name of a transform given on the command line. Only the
+ * transforms that keep the frame size are supported.
+ */
+int parseTransform(const std::string& name, Transform* transform) {
+  for (const auto& entry : transformNames) {
+    if (name == entry.name) {
+      *transform = entry.transform;
+      return 0;
+    }
+  }
+
+  EPRINT("Unknown transform '%s', expected none, hflip, vflip or rot180\n",
+         name.c_str());
+  return -EINVAL;
+}
+
+const char* transformName(Transform transform) {
+  for (const auto& entry : transformNames) {
+    if (transform == entry.transform)
+      return entry.name;
+  }
+
+  return "unsupported";
+}
+
+/**
+ * \class FrameTransform
+ * \brief Flip frames on the CPU when neither the camera nor the display can
+ *
+ * Frames are transformed in place, in the camera buffers, so that every sink
+ * sees the same transformed frame. A vertical flip swaps rows pairwise from
+ * the top and bottom of each plane. A horizontal flip reverses each row, with
+ * the vector kernels swapping blocks from both ends of the row. A 180 degree
+ * rotation does both in a single pass by mirroring the top and bottom rows
+ * into each other, so each pair of rows is read and written once while it is
+ * in cache.
+ *
+ * Packed YUV 4:2:2, semi-planar and planar YUV 4:2:0, and packed RGB are
+ * supported. Compressed formats such as MJPEG can't be transformed.
+ */
+bool FrameTransform::isSupported(const PixelFormat& format) {
+  switch (format) {
+    case formats::YUYV:
+    case formats::YVYU:
+    case formats::UYVY:
+    case formats::VYUY:
+    case formats::NV12:
+    case formats::NV21:
+    case formats::YUV420:
+    case formats::YVU420:
+      return true;
+    default:
+      return rgbBytesPerPixel(format) != 0;
+  }
+}
+
+int FrameTransform::configure(const StreamConfiguration& cfg,
+                              Transform transform) {
+  const PixelFormat& format = cfg.pixelFormat;
+  const unsigned int width = cfg.size.width;
+  const unsigned int height = cfg.size.height;
+
+  if (!isSupported(format)) {
+    EPRINT("Cannot transform %s frames\n", format.toString().c_str());
+    return -ENOTSUP;
+  }
+
+  switch (transform) {
+    case Transform::Identity:
+    case Transform::HFlip:
+    case Transform::VFlip:
+    case Transform::Rot180:
+      break;
+    default:
+      EPRINT("Unsupported transform %s\n", transformName(transform));
+      return -ENOTSUP;
+  }
+
+  const unsigned int bpp = rgbBytesPerPixel(format);
+  const bool hflip =
+      transform == Transform::HFlip || transform == Transform::Rot180;
+  if (hflip && !bpp && width % 2) {
+    EPRINT("Cannot mirror %s frames of odd width %u\n",
+           format.toString().c_str(), width);
+    return -EINVAL;
+  }
+
+  kernels_ = &bestKernels();
+  format_ = format;
+  hflip_ = hflip;
+  vflip_ = transform == Transform::VFlip || transform == Transform::Rot180;
+  planes_.clear();
+
+  const unsigned int chromaRows = (height + 1) / 2;
+
+  switch (format) {
+    case formats::YUYV:
+    case formats::YVYU:
+      addPlane(width * 2, height, cfg.stride, kernels_->mirrorLumaEven);
+      break;
+    case formats::UYVY:
+    case formats::VYUY:
+      addPlane(width * 2, height, cfg.stride, kernels_->mirrorLumaOdd);
+      break;
+    case formats::NV12:
+    case formats::NV21:
+      addPlane(width, height, cfg.stride, kernels_->mirror8);
+      addPlane(width, chromaRows, cfg.stride, kernels_->mirror16);
+      break;
+    case formats::YUV420:
+    case formats::YVU420:
+      addPlane(width, height, cfg.stride, kernels_->mirror8);
+      addPlane(width / 2, chromaRows, cfg.stride / 2, kernels_->mirror8);
+      addPlane(width / 2, chromaRows, cfg.stride / 2, kernels_->mirror8);
+      break;
+    default:
+      addPlane(width * bpp, height, cfg.stride,
+               bpp == 2   ? kernels_->mirror16
+               : bpp == 3 ? kernels_->mirror24
+                          : kernels_->mirror32);
+      break;
+  }
+
+  VERBOSE_PRINT("Transforming %s frames with %s kernels\n",
+                format.toString().c_str(), kernels_->name);
+
+  return 0;
+}
+
+void FrameTransform::addPlane(unsigned int rowLength,
+                              unsigned int height,
+                              unsigned int stride,
+                              void (*mirror)(uint8_t* a,
+                                             uint8_t* b,
+                                             unsigned int length)) {
+  planes_.push_back({rowLength, height, stride, mirror});
+}
+
+/*
+ * Transform the frame in \a planes in place. The caller shall bracket the call
+ * with CPU access to the buffer for reading and writing. Returns 0 on success
+ * or a negative error code.
+ */
+int FrameTransform::apply(const std::vector<Span<uint8_t>>& planes) {
+  if (!kernels_)
+    return -EINVAL;
+
+  if (!hflip_ && !vflip_)
+    return 0;
+
+  std::vector<size_t> sizes;
+  for (const Plane& plane : planes_)
+    sizes.push_back(static_cast<size_t>(plane.stride) * plane.height);
+
+  std::vector<uint8_t*> data;
+  if (splitPlanes(planes, sizes, &data) < 0) {
+    EPRINT("Frame too small for %s\n", format_.toString().c_str());
+    return -EINVAL;
+  }
+
+  for (unsigned int p = 0; p < planes_.size(); ++p) {
+    const Plane& plane = planes_[p];
+    auto row = [&](unsigned int y) {
+      return data[p] + static_cast<size_t>(y) * plane.stride;
+    };
+
+    if (!vflip_) {
+      for (unsigned int y = 0; y < plane.height; ++y)
+        plane.mirror(row(y), row(y), plane.rowLength);
+      continue;
+    }
+
+    const unsigned int half = plane.height / 2;
+    for (unsigned int y = 0; y < half; ++y) {
+      uint8_t* top = row(y);
+      uint8_t* bottom = row(plane.height - 1 - y);
+
+      if (hflip_)
+        plane.mirror(top, bottom, plane.rowLength);
+      else
+        swapRows(top, bottom, plane.rowLength);
+    }
+
+    if (hflip_ && plane.height % 2)
+      plane.mirror(row(half), row(half), plane.rowLength);
+  }
+
+  return 0;
+}
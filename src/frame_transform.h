@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_transform.h - Mirror and rotate frames by 180 degrees in place
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+#include <libcamera/transform.h>
+
+#include "frame_transform_kernels.h"
+
+int parseTransform(const std::string& name, libcamera::Transform* transform);
+const char* transformName(libcamera::Transform transform);
+
+class FrameTransform {
+ public:
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const libcamera::StreamConfiguration& cfg,
+                libcamera::Transform transform);
+
+  const char* kernelsName() const { return kernels_ ? kernels_->name : ""; }
+
+  int apply(const std::vector<libcamera::Span<uint8_t>>& planes);
+
+ private:
+  struct Plane {
+    unsigned int rowLength;
+    unsigned int height;
+    unsigned int stride;
+    void (*mirror)(uint8_t* a, uint8_t* b, unsigned int length);
+  };
+
+  void addPlane(unsigned int rowLength,
+                unsigned int height,
+                unsigned int stride,
+                void (*mirror)(uint8_t* a, uint8_t* b, unsigned int length));
+
+  libcamera::PixelFormat format_;
+  bool hflip_ = false;
+  bool vflip_ = false;
+
+  std::vector<Plane> planes_;
+
+  const FrameTransformKernels* kernels_ = nullptr;
+};
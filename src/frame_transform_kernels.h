@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_transform_kernels.h - Row kernels used by FrameTransform
+ *
+ * Each kernel mirrors two rows of length bytes into each other: a receives b
+ * reversed and b receives a reversed, so that a vertical flip combined with a
+ * horizontal one touches every row pair once. When a and b are the same row,
+ * it is mirrored in place. Lengths are a multiple of the unit size.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct FrameTransformKernels {
+  const char* name;
+
+  /* Reverse the order of 1, 2, 3 or 4 byte units. */
+  void (*mirror8)(uint8_t* a, uint8_t* b, unsigned int length);
+  void (*mirror16)(uint8_t* a, uint8_t* b, unsigned int length);
+  void (*mirror24)(uint8_t* a, uint8_t* b, unsigned int length);
+  void (*mirror32)(uint8_t* a, uint8_t* b, unsigned int length);
+
+  /*
+   * Reverse packed YUV 4:2:2 macropixels and swap the two luma samples of
+   * each, with luma on even bytes (YUYV, YVYU) or odd bytes (UYVY, VYUY).
+   */
+  void (*mirrorLumaEven)(uint8_t* a, uint8_t* b, unsigned int length);
+  void (*mirrorLumaOdd)(uint8_t* a, uint8_t* b, unsigned int length);
+};
+
+extern const FrameTransformKernels scalarTransformKernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const FrameTransformKernels sse2TransformKernels;
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+extern const FrameTransformKernels neonTransformKernels;
+#endif
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_transform_neon.cpp - NEON row kernels for FrameTransform
+ */
+
+#include "frame_transform_kernels.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+namespace {
+
+/* vrev64 reverses each half, vext swaps the halves. */
+uint8x16_t reverse8(uint8x16_t x) {
+  x = vrev64q_u8(x);
+  return vextq_u8(x, x, 8);
+}
+
+uint8x16_t reverse16(uint8x16_t x) {
+  x = vreinterpretq_u8_u16(vrev64q_u16(vreinterpretq_u16_u8(x)));
+  return vextq_u8(x, x, 8);
+}
+
+uint8x16_t reverse32(uint8x16_t x) {
+  x = vreinterpretq_u8_u32(vrev64q_u32(vreinterpretq_u32_u8(x)));
+  return vextq_u8(x, x, 8);
+}
+
+/* Reverse macropixels, then swap the luma bytes selected by mask in each. */
+uint8x16_t reverseYUV422(uint8x16_t x, uint8x16_t mask) {
+  x = reverse32(x);
+  const uint8x16_t swapped =
+      vreinterpretq_u8_u16(vrev32q_u16(vreinterpretq_u16_u8(x)));
+  return vbslq_u8(mask, swapped, x);
+}
+
+/*
+ * Swap 16-byte blocks from opposite ends of the rows, the remainder in the
+ * middle of the row, or at the end of a and the start of b, goes to the
+ * scalar kernel.
+ */
+template <typename Reverse>
+void mirror(uint8_t* a,
+            uint8_t* b,
+            unsigned int length,
+            Reverse reverse,
+            void (*tail)(uint8_t*, uint8_t*, unsigned int)) {
+  unsigned int i = 0;
+
+  if (a == b) {
+    unsigned int end = length;
+
+    for (; end - i >= 32; i += 16) {
+      end -= 16;
+      const uint8x16_t l = vld1q_u8(a + i);
+      const uint8x16_t r = vld1q_u8(a + end);
+      vst1q_u8(a + i, reverse(r));
+      vst1q_u8(a + end, reverse(l));
+    }
+
+    tail(a + i, a + i, end - i);
+    return;
+  }
+
+  for (; i + 16 <= length; i += 16) {
+    uint8_t* const mirrored = b + length - 16 - i;
+    const uint8x16_t l = vld1q_u8(a + i);
+    const uint8x16_t r = vld1q_u8(mirrored);
+    vst1q_u8(a + i, reverse(r));
+    vst1q_u8(mirrored, reverse(l));
+  }
+
+  tail(a + i, b, length - i);
+}
+
+void mirror8(uint8_t* a, uint8_t* b, unsigned int length) {
+  mirror(a, b, length, reverse8, scalarTransformKernels.mirror8);
+}
+
+void mirror16(uint8_t* a, uint8_t* b, unsigned int length) {
+  mirror(a, b, length, reverse16, scalarTransformKernels.mirror16);
+}
+
+void mirror24(uint8_t* a, uint8_t* b, unsigned int length) {
+  scalarTransformKernels.mirror24(a, b, length);
+}
+
+void mirror32(uint8_t* a, uint8_t* b, unsigned int length) {
+  mirror(a, b, length, reverse32, scalarTransformKernels.mirror32);
+}
+
+void mirrorLumaEven(uint8_t* a, uint8_t* b, unsigned int length) {
+  const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(0x00ff00ff));
+  mirror(
+      a, b, length, [mask](uint8x16_t x) { return reverseYUV422(x, mask); },
+      scalarTransformKernels.mirrorLumaEven);
+}
+
+void mirrorLumaOdd(uint8_t* a, uint8_t* b, unsigned int length) {
+  const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(0xff00ff00));
+  mirror(
+      a, b, length, [mask](uint8x16_t x) { return reverseYUV422(x, mask); },
+      scalarTransformKernels.mirrorLumaOdd);
+}
+
+} /* namespace */
+
+const FrameTransformKernels neonTransformKernels = {
+    "NEON",
+    mirror8,
+    mirror16,
+    mirror24,
+    mirror32,
+    mirrorLumaEven,
+    mirrorLumaOdd,
+};
+
+#endif /* __ARM_NEON */
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * frame_transform_sse2.cpp - SSE2 row kernels for FrameTransform
+ */
+
+#include "frame_transform_kernels.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace {
+
+__m128i reverse32(__m128i x) {
+  return _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+__m128i reverse16(__m128i x) {
+  x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+  x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+  return _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+__m128i reverse8(__m128i x) {
+  x = reverse16(x);
+  return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+/* Reverse macropixels, then swap the luma bytes selected by mask in each. */
+__m128i reverseYUV422(__m128i x, __m128i mask) {
+  x = reverse32(x);
+  __m128i swapped = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+  swapped = _mm_shufflehi_epi16(swapped, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_or_si128(_mm_and_si128(mask, swapped), _mm_andnot_si128(mask, x));
+}
+
+/*
+ * Swap 16-byte blocks from opposite ends of the rows, the remainder in the
+ * middle of the row, or at the end of a and the start of b, goes to the
+ * scalar kernel.
+ */
+template <typename Reverse>
+void mirror(uint8_t* a,
+            uint8_t* b,
+            unsigned int length,
+            Reverse reverse,
+            void (*tail)(uint8_t*, uint8_t*, unsigned int)) {
+  unsigned int i = 0;
+
+  if (a == b) {
+    unsigned int end = length;
+
+    for (; end - i >= 32; i += 16) {
+      end -= 16;
+      const __m128i l = _mm_loadu_si128(reinterpret_cast<__m128i*>(a + i));
+      const __m128i r = _mm_loadu_si128(reinterpret_cast<__m128i*>(a + end));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), reverse(r));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(a + end), reverse(l));
+    }
+
+    tail(a + i, a + i, end - i);
+    return;
+  }
+
+  for (; i + 16 <= length; i += 16) {
+    uint8_t* const mirrored = b + length - 16 - i;
+    const __m128i l = _mm_loadu_si128(reinterpret_cast<__m128i*>(a + i));
+    const __m128i r = _mm_loadu_si128(reinterpret_cast<__m128i*>(mirrored));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), reverse(r));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(mirrored), reverse(l));
+  }
+
+  tail(a + i, b, length - i);
+}
+
+void mirror8(uint8_t* a, uint8_t* b, unsigned int length) {
+  mirror(a, b, length, reverse8, scalarTransformKernels.mirror8);
+}
+
+void mirror16(uint8_t* a, uint8_t* b, unsigned int length) {
+  mirror(a, b, length, reverse16, scalarTransformKernels.mirror16);
+}
+
+void mirror24(uint8_t* a, uint8_t* b, unsigned int length) {
+  scalarTransformKernels.mirror24(a, b, length);
+}
+
+void mirror32(uint8_t* a, uint8_t* b, unsigned int length) {
+  mirror(a, b, length, reverse32, scalarTransformKernels.mirror32);
+}
+
+void mirrorLumaEven(uint8_t* a, uint8_t* b, unsigned int length) {
+  const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+  mirror(
+      a, b, length, [mask](__m128i x) { return reverseYUV422(x, mask); },
+      scalarTransformKernels.mirrorLumaEven);
+}
+
+void mirrorLumaOdd(uint8_t* a, uint8_t* b, unsigned int length) {
+  const __m128i mask = _mm_set1_epi32(~0x00ff00ff);
+  mirror(
+      a, b, length, [mask](__m128i x) { return reverseYUV422(x, mask); },
+      scalarTransformKernels.mirrorLumaOdd);
+}
+
+} /* namespace */
+
+const FrameTransformKernels sse2TransformKernels = {
+    "SSE2",
+    mirror8,
+    mirror16,
+    mirror24,
+    mirror32,
+    mirrorLumaEven,
+    mirrorLumaOdd,
+};
+
+#endif /* __SSE2__ */
@@ -0,0 +1,441 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * http_sink.cpp - Serve frames as MJPEG over HTTP
+ */
+
+#include "http_sink.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <libcamera/camera.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+#include "event_loop.h"
+#include "image.h"
+#ifdef HAVE_LIBJPEG
+#include "jpeg_encoder.h"
+#endif
+#include "mapped_buffer_cache.h"
+#include "twincam.h"
+#include "twncm_fnctl.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Clients beyond this are refused, each costs a send per frame. */
+constexpr unsigned int kMaxClients = 64;
+
+/* Longest HTTP request accepted, headers included. */
+constexpr size_t kMaxRequestSize = 8192;
+
+const char kStreamHeader[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Connection: close\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=twincam\r\n"
+    "\r\n";
+
+const char kMethodNotAllowed[] =
+    "HTTP/1.0 405 Method Not Allowed\r\n"
+    "Allow: GET\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+/* Ends each part, after the frame. */
+const char kPartTrailer[] = "\r\n";
+
+}  // namespace
+
+/**
+ * \class HttpSink
+ * \brief Stream frames to web browsers and video players over HTTP
+ *
+ * The sink listens on a loopback TCP port or a Unix socket and streams frames
+ * to any number of clients as a multipart/x-mixed-replace response, one JPEG
+ * per part. MJPEG frames are sent as the camera produced them, other formats
+ * are encoded, once per frame for all clients and only while a client is
+ * waiting for a frame.
+ *
+ * Each client has at most one frame in flight, shared with the other clients.
+ * Frames are skipped for a client still sending the previous one, so a slow
+ * client sees a lower frame rate instead of a growing delay, and never holds
+ * back the camera or the other clients.
+ */
+HttpSink::HttpSink(const std::string& address) : address_(address) {}
+
+HttpSink::~HttpSink() {
+  stop();
+}
+
+int HttpSink::configure(const CameraConfiguration& config) {
+  const StreamConfiguration& cfg = config.at(0);
+  stream_ = cfg.stream();
+  format_ = cfg.pixelFormat;
+
+  if (format_ == formats::MJPEG)
+    return 0;
+
+#ifdef HAVE_LIBJPEG
+  encoder_ = std::make_unique<JpegEncoder>();
+  return encoder_->configure(cfg);
+#else
+  EPRINT("Serving %s frames over HTTP needs libjpeg\n",
+         format_.toString().c_str());
+  return -ENOTSUP;
+#endif
+}
+
+/*
+ * Listen on the Unix socket address_ if it's a path, else on port address_ of
+ * the loopback interface.
+ */
+int HttpSink::listen() {
+  const bool local = address_.find('/') != std::string::npos;
+
+  struct sockaddr_un un = {};
+  struct sockaddr_in in = {};
+  struct sockaddr* addr;
+  socklen_t length;
+
+  if (local) {
+    un.sun_family = AF_UNIX;
+    if (address_.size() >= sizeof(un.sun_path)) {
+      EPRINT("Socket path %s too long\n", address_.c_str());
+      return -ENAMETOOLONG;
+    }
+    memcpy(un.sun_path, address_.c_str(), address_.size());
+    addr = reinterpret_cast<struct sockaddr*>(&un);
+    length = sizeof(un);
+  } else {
+    char* end;
+    unsigned long port = strtoul(address_.c_str(), &end, 10);
+    if (*end || end == address_.c_str() || !port || port > 65535) {
+      EPRINT("Invalid HTTP port '%s', expected a port or a socket path\n",
+             address_.c_str());
+      return -EINVAL;
+    }
+
+    in.sin_family = AF_INET;
+    in.sin_port = htons(port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr = reinterpret_cast<struct sockaddr*>(&in);
+    length = sizeof(in);
+  }
+
+  /* A socket left behind by a previous run would make bind() fail. */
+  if (local) {
+    if (int ret = twncm_remove_socket(address_.c_str()); ret < 0) {
+      EPRINT("Failed to listen on %s: %s\n", address_.c_str(),
+             strerror(-ret));
+      return ret;
+    }
+  }
+
+  listenFd_ = socket(addr->sa_family,
+                     SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd_ < 0) {
+    int ret = -errno;
+    EPRINT("Failed to create socket: %s\n", strerror(-ret));
+    return ret;
+  }
+
+  if (!local) {
+    int reuse = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  }
+
+  if (bind(listenFd_, addr, length) < 0 || ::listen(listenFd_, 8) < 0) {
+    int ret = -errno;
+    EPRINT("Failed to listen on %s: %s\n", address_.c_str(), strerror(-ret));
+    close(listenFd_);
+    listenFd_ = -1;
+    return ret;
+  }
+
+  return 0;
+}
+
+int HttpSink::start() {
+  frames_ = 0;
+  encoded_ = 0;
+  sent_ = 0;
+  skipped_ = 0;
+
+  int ret = listen();
+  if (ret < 0)
+    return ret;
+
+  EventLoop::instance()->addFdEvent(listenFd_, EventLoop::Read,
+                                    [this]() { acceptClient(); });
+
+  if (address_.find('/') != std::string::npos)
+    PRINT("Serving MJPEG on http+unix:%s\n", address_.c_str());
+  else
+    PRINT("Serving MJPEG on http://127.0.0.1:%s/\n", address_.c_str());
+
+  return 0;
+}
+
+int HttpSink::stop() {
+  if (listenFd_ < 0)
+    return 0;
+
+  while (!clients_.empty())
+    removeClient(clients_.back().get());
+
+  EventLoop::instance()->removeFdEvent(listenFd_);
+  close(listenFd_);
+  listenFd_ = -1;
+  if (address_.find('/') != std::string::npos)
+    twncm_remove_socket(address_.c_str());
+
+  frame_.reset();
+
+  if (frames_) {
+    PRINT("Served %" PRIu64 " frames, %" PRIu64 " encoded, %" PRIu64
+          " sent to clients, %" PRIu64 " skipped for busy clients\n",
+          frames_, encoded_, sent_, skipped_);
+  }
+
+  return 0;
+}
+
+void HttpSink::acceptClient() {
+  int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  if (clients_.size() >= kMaxClients) {
+    EPRINT("Refusing HTTP client, %u connected already\n", kMaxClients);
+    close(fd);
+    return;
+  }
+
+  auto client = std::make_unique<Client>();
+  client->fd = fd;
+  Client* c = client.get();
+  clients_.push_back(std::move(client));
+
+  EventLoop::instance()->addFdEvent(fd, EventLoop::Read,
+                                    [this, c]() { readClient(c); });
+
+  VERBOSE_PRINT("HTTP client %d connected\n", fd);
+}
+
+void HttpSink::readClient(Client* client) {
+  for (;;) {
+    char buf[1024];
+    ssize_t ret = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+
+    if (ret <= 0) {
+      VERBOSE_PRINT("HTTP client %d disconnected\n", client->fd);
+      removeClient(client);
+      return;
+    }
+
+    /* Once streaming, anything the client sends is ignored. */
+    if (client->streaming)
+      continue;
+
+    client->request.append(buf, ret);
+    if (client->request.find("\r\n\r\n") == std::string::npos) {
+      if (client->request.size() <= kMaxRequestSize)
+        continue;
+
+      removeClient(client);
+      return;
+    }
+
+    /* Every GET gets the stream, whatever the path. */
+    if (client->request.compare(0, 4, "GET ")) {
+      ::send(client->fd, kMethodNotAllowed, sizeof(kMethodNotAllowed) - 1,
+             MSG_DONTWAIT | MSG_NOSIGNAL);
+      removeClient(client);
+      return;
+    }
+
+    client->request.clear();
+    client->request.shrink_to_fit();
+    client->streaming = true;
+    send(client, kStreamHeader, nullptr);
+    return;
+  }
+}
+
+/* Disconnect \a client, dropping the data it didn't receive. */
+void HttpSink::removeClient(Client* client) {
+  EventLoop::instance()->removeFdEvent(client->fd);
+  close(client->fd);
+
+  clients_.erase(std::find_if(clients_.begin(), clients_.end(),
+                              [client](const std::unique_ptr<Client>& c) {
+                                return c.get() == client;
+                              }));
+}
+
+/* Start sending \a header and \a frame, the client must not be busy. */
+void HttpSink::send(Client* client,
+                    const std::string& header,
+                    const std::shared_ptr<const std::vector<uint8_t>>& frame) {
+  client->header = header;
+  client->frame = frame;
+  client->offset = 0;
+  flush(client);
+}
+
+/*
+ * Send as much of the pending data of \a client as its socket takes, and watch
+ * for the socket to drain when it doesn't take it all.
+ */
+void HttpSink::flush(Client* client) {
+  for (;;) {
+    struct iovec iov[3];
+    unsigned int count = 0;
+    size_t skip = client->offset;
+
+    auto add = [&](const void* data, size_t size) {
+      if (skip >= size) {
+        skip -= size;
+        return;
+      }
+      iov[count].iov_base =
+          const_cast<uint8_t*>(static_cast<const uint8_t*>(data)) + skip;
+      iov[count].iov_len = size - skip;
+      skip = 0;
+      ++count;
+    };
+
+    add(client->header.data(), client->header.size());
+    if (client->frame) {
+      add(client->frame->data(), client->frame->size());
+      add(kPartTrailer, sizeof(kPartTrailer) - 1);
+    }
+
+    if (!count) {
+      client->header.clear();
+      client->frame.reset();
+      client->offset = 0;
+      if (client->watchingWrite) {
+        EventLoop::instance()->removeFdEvent(client->fd, EventLoop::Write);
+        client->watchingWrite = false;
+      }
+      return;
+    }
+
+    struct msghdr hdr = {};
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = count;
+
+    ssize_t ret = sendmsg(client->fd, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (ret < 0 && errno == EINTR)
+      continue;
+
+    if (ret < 0 && errno == EAGAIN) {
+      if (!client->watchingWrite) {
+        EventLoop::instance()->addFdEvent(client->fd, EventLoop::Write,
+                                          [this, client]() { flush(client); });
+        client->watchingWrite = true;
+      }
+      return;
+    }
+
+    if (ret < 0) {
+      VERBOSE_PRINT("HTTP client %d disconnected\n", client->fd);
+      removeClient(client);
+      return;
+    }
+
+    client->offset += ret;
+  }
+}
+
+/* Get a buffer for the next frame, reusing the last unless still in flight. */
+std::shared_ptr<std::vector<uint8_t>> HttpSink::frameBuffer() {
+  if (!frame_ || frame_.use_count() > 1)
+    frame_ = std::make_shared<std::vector<uint8_t>>();
+
+  return frame_;
+}
+
+bool HttpSink::processRequest(Request* request) {
+  ++frames_;
+
+  std::vector<Client*> ready;
+  for (std::unique_ptr<Client>& client : clients_) {
+    if (!client->streaming)
+      continue;
+
+    if (client->frame || !client->header.empty()) {
+      ++skipped_;
+      continue;
+    }
+
+    ready.push_back(client.get());
+  }
+
+  /* Nobody to send the frame to, don't bother encoding it. */
+  if (ready.empty())
+    return true;
+
+  FrameBuffer* buffer = request->findBuffer(stream_);
+  Image* image =
+      buffer && mappedBuffers_ ? mappedBuffers_->image(buffer) : nullptr;
+  if (!image)
+    return true;
+
+  Image::CpuAccess access(image, Image::MapMode::ReadOnly);
+  std::shared_ptr<std::vector<uint8_t>> frame = frameBuffer();
+
+  if (format_ == formats::MJPEG) {
+    Span<const uint8_t> data = image->data(0);
+    const size_t length = std::min<size_t>(
+        buffer->metadata().planes()[0].bytesused, data.size());
+    frame->assign(data.begin(), data.begin() + length);
+  } else {
+#ifdef HAVE_LIBJPEG
+    std::vector<Span<const uint8_t>> planes;
+    for (unsigned int i = 0; i < image->numPlanes(); ++i)
+      planes.push_back(image->data(i));
+
+    if (encoder_->encode(planes, frame.get()) < 0)
+      return true;
+    ++encoded_;
+#else
+    return true;
+#endif
+  }
+
+  char header[128];
+  snprintf(header, sizeof(header),
+           "--twincam\r\n"
+           "Content-Type: image/jpeg\r\n"
+           "Content-Length: %zu\r\n"
+           "\r\n",
+           frame->size());
+
+  /* Sending may disconnect clients, only the ones in ready are valid. */
+  const std::string part = header;
+  for (Client* client : ready) {
+    send(client, part, frame);
+    ++sent_;
+  }
+
+  return true;
+}
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * http_sink.h - Serve frames as MJPEG over HTTP
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "frame_sink.h"
+
+#ifdef HAVE_LIBJPEG
+class JpegEncoder;
+#endif
+
+class HttpSink : public FrameSink {
+ public:
+  HttpSink(const std::string& address);
+  ~HttpSink();
+
+  int configure(const libcamera::CameraConfiguration& config) override;
+
+  int start() override;
+  int stop() override;
+
+  bool processRequest(libcamera::Request* request) override;
+
+ private:
+  struct Client {
+    int fd;
+    /* The HTTP request, until its headers are complete. */
+    std::string request;
+    bool streaming = false;
+    bool watchingWrite = false;
+
+    /* Data being sent, the header and frame, and how much of it was sent. */
+    std::string header;
+    std::shared_ptr<const std::vector<uint8_t>> frame;
+    size_t offset = 0;
+  };
+
+  int listen();
+  void acceptClient();
+  void readClient(Client* client);
+  void removeClient(Client* client);
+  void send(Client* client,
+            const std::string& header,
+            const std::shared_ptr<const std::vector<uint8_t>>& frame);
+  void flush(Client* client);
+
+  std::shared_ptr<std::vector<uint8_t>> frameBuffer();
+
+  std::string address_;
+  int listenFd_ = -1;
+
+  const libcamera::Stream* stream_ = nullptr;
+  libcamera::PixelFormat format_;
+#ifdef HAVE_LIBJPEG
+  std::unique_ptr<JpegEncoder> encoder_;
+#endif
+  std::shared_ptr<std::vector<uint8_t>> frame_;
+
+  std::vector<std::unique_ptr<Client>> clients_;
+
+  uint64_t frames_ = 0;
+  uint64_t encoded_ = 0;
+  uint64_t sent_ = 0;
+  uint64_t skipped_ = 0;
+};
@@ -6,16 +6,24 @@
  */
 
 #include "image.h"
+#include "cpu_features.h"
 #include "twincam.h"
 #include "twncm_stdio.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <map>
 
+#include <linux/dma-buf.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <smmintrin.h>
+#endif
+
 using namespace libcamera;
 
 std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer* buffer,
@@ -75,6 +83,7 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer* buffer,
 
       info.address = static_cast<uint8_t*>(address);
       image->maps_.emplace_back(info.address, info.mapLength);
+      image->fds_.push_back(fd);
     }
 
     image->planes_.emplace_back(info.address + plane.offset, plane.length);
@@ -83,6 +92,36 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer* buffer,
   return image;
 }
 
+/*
+ * Allocate an image in regular, cached memory, with the same plane sizes as
+ * layout. Used to snapshot frames that several CPU consumers read.
+ */
+std::unique_ptr<Image> Image::allocate(const Image& layout) {
+  std::unique_ptr<Image> image{new Image()};
+
+  size_t length = 0;
+  for (const Span<uint8_t>& plane : layout.planes_)
+    length += plane.size();
+
+  void* address = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (address == MAP_FAILED) {
+    int error = -errno;
+    EPRINT("Failed to allocate image: %s\n", strerror(-error));
+    return nullptr;
+  }
+
+  uint8_t* data = static_cast<uint8_t*>(address);
+  image->maps_.emplace_back(data, length);
+
+  for (const Span<uint8_t>& plane : layout.planes_) {
+    image->planes_.emplace_back(data, plane.size());
+    data += plane.size();
+  }
+
+  return image;
+}
+
 Image::Image() = default;
 
 Image::~Image() {
@@ -103,3 +142,129 @@ Span<const uint8_t> Image::data(unsigned int plane) const {
   assert(plane <= planes_.size());
   return planes_[plane];
 }
+
+/*
+ * Dmabufs can be backed by memory the CPU doesn't see coherently, on many ARM
+ * SoCs for instance. CPU accesses to the pixel data shall be bracketed by
+ * beginCpuAccess() and endCpuAccess(), or a CpuAccess instance, for the
+ * exporter to flush or invalidate caches as needed. This is a no-op for
+ * memory that isn't a dmabuf.
+ */
+int Image::beginCpuAccess(MapMode mode) {
+  uint64_t flags = DMA_BUF_SYNC_START;
+  if (mode & MapMode::ReadOnly)
+    flags |= DMA_BUF_SYNC_READ;
+  if (mode & MapMode::WriteOnly)
+    flags |= DMA_BUF_SYNC_WRITE;
+
+  return sync(flags);
+}
+
+int Image::endCpuAccess(MapMode mode) {
+  uint64_t flags = DMA_BUF_SYNC_END;
+  if (mode & MapMode::ReadOnly)
+    flags |= DMA_BUF_SYNC_READ;
+  if (mode & MapMode::WriteOnly)
+    flags |= DMA_BUF_SYNC_WRITE;
+
+  return sync(flags);
+}
+
+int Image::sync(uint64_t flags) {
+  struct dma_buf_sync sync = {flags};
+
+  for (int fd : fds_) {
+    int ret;
+    do {
+      ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (ret && (errno == EINTR || errno == EAGAIN));
+
+    /* Not a dmabuf, nothing to synchronise. */
+    if (ret && errno == ENOTTY)
+      continue;
+
+    if (ret) {
+      int error = -errno;
+      EPRINT("Failed to sync dmabuf: %s\n", strerror(-error));
+      return error;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Mappings of device memory are often uncached or write-combined, which makes
+ * CPU reads very slow. Non-temporal loads fetch whole lines at a time from
+ * such memory instead of one load at a time, and don't pollute the cache.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1"))) static size_t streamLoadCopy(
+    uint8_t* dst,
+    const uint8_t* src,
+    size_t length) {
+  const size_t blocks = length / 64;
+  const __m128i* s = reinterpret_cast<const __m128i*>(src);
+  __m128i* d = reinterpret_cast<__m128i*>(dst);
+
+  for (size_t i = 0; i < blocks; ++i, s += 4, d += 4) {
+    const __m128i a = _mm_stream_load_si128(const_cast<__m128i*>(s));
+    const __m128i b = _mm_stream_load_si128(const_cast<__m128i*>(s + 1));
+    const __m128i c = _mm_stream_load_si128(const_cast<__m128i*>(s + 2));
+    const __m128i e = _mm_stream_load_si128(const_cast<__m128i*>(s + 3));
+    _mm_store_si128(d, a);
+    _mm_store_si128(d + 1, b);
+    _mm_store_si128(d + 2, c);
+    _mm_store_si128(d + 3, e);
+  }
+
+  return blocks * 64;
+}
+#endif
+
+static void streamCopy(uint8_t* dst, const uint8_t* src, size_t length) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::SSE41) &&
+      !(reinterpret_cast<uintptr_t>(src) & 15) &&
+      !(reinterpret_cast<uintptr_t>(dst) & 15)) {
+    const size_t copied = streamLoadCopy(dst, src, length);
+
+    dst += copied;
+    src += copied;
+    length -= copied;
+  }
+#endif
+
+  memcpy(dst, src, length);
+}
+
+/*
+ * Copy the payload of each plane of src, as reported by metadata, and return
+ * the number of bytes copied. The caller handles CPU access synchronisation
+ * of src.
+ */
+size_t Image::copyFrom(const Image& src, const FrameMetadata& metadata) {
+  size_t copied = 0;
+
+  for (unsigned int i = 0; i < planes_.size() && i < src.planes_.size(); ++i) {
+    size_t length = std::min(planes_[i].size(), src.planes_[i].size());
+    if (i < metadata.planes().size())
+      length = std::min<size_t>(length, metadata.planes()[i].bytesused);
+
+    streamCopy(planes_[i].data(), src.planes_[i].data(), length);
+    copied += length;
+  }
+
+  return copied;
+}
+
+Image::CpuAccess::CpuAccess(Image* image, MapMode mode)
+    : image_(image), mode_(mode) {
+  if (image_)
+    image_->beginCpuAccess(mode_);
+}
+
+Image::CpuAccess::~CpuAccess() {
+  if (image_)
+    image_->endCpuAccess(mode_);
+}
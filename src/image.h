@@ -25,9 +25,22 @@ class Image {
     ReadWrite = ReadOnly | WriteOnly,
   };
 
+  class CpuAccess {
+   public:
+    CpuAccess(Image* image, MapMode mode);
+    ~CpuAccess();
+
+   private:
+    LIBCAMERA_DISABLE_COPY(CpuAccess)
+
+    Image* image_;
+    MapMode mode_;
+  };
+
   static std::unique_ptr<Image> fromFrameBuffer(
       const libcamera::FrameBuffer* buffer,
       MapMode mode);
+  static std::unique_ptr<Image> allocate(const Image& layout);
 
   ~Image();
 
@@ -36,13 +49,21 @@ class Image {
   libcamera::Span<uint8_t> data(unsigned int plane);
   libcamera::Span<const uint8_t> data(unsigned int plane) const;
 
+  int beginCpuAccess(MapMode mode);
+  int endCpuAccess(MapMode mode);
+
+  size_t copyFrom(const Image& src, const libcamera::FrameMetadata& metadata);
+
  private:
   LIBCAMERA_DISABLE_COPY(Image)
 
   Image();
 
+  int sync(uint64_t flags);
+
   std::vector<libcamera::Span<uint8_t>> maps_;
   std::vector<libcamera::Span<uint8_t>> planes_;
+  std::vector<int> fds_;
 };
 
 namespace libcamera {
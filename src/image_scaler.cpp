@@ -0,0 +1,361 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * image_scaler.cpp - Downscale YUV and RGB frames
+ */
+
+#include "image_scaler.h"
+#include "cpu_features.h"
+#include "frame_planes.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+
+#include <errno.h>
+#include <math.h>
+#include <algorithm>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+void blendRows(const uint8_t* const* rows,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  for (unsigned int x = begin; x < end; ++x) {
+    unsigned int sum = 128;
+    for (unsigned int k = 0; k < taps; ++k)
+      sum += rows[k][x] * weights[k];
+
+    dst[x] = sum >> 8;
+  }
+}
+
+void filterRow(const uint8_t* src,
+               unsigned int step,
+               const unsigned int* start,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  for (unsigned int x = begin; x < end; ++x) {
+    const uint8_t* in = src + start[x] * step;
+    const uint16_t* weight = weights + static_cast<size_t>(x) * taps;
+    unsigned int sum = 128;
+
+    for (unsigned int k = 0; k < taps; ++k)
+      sum += in[k * step] * weight[k];
+
+    dst[x * step] = sum >> 8;
+  }
+}
+
+const ImageScalerKernels& bestKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::AVX2))
+    return avx2ScalerKernels;
+  if (CpuFeatures::has(CpuFeatures::SSE2))
+    return sse2ScalerKernels;
+#elif defined(__arm__) || defined(__aarch64__)
+  if (CpuFeatures::has(CpuFeatures::NEON))
+    return neonScalerKernels;
+#endif
+
+  return scalarScalerKernels;
+}
+
+/* Bytes per pixel of the packed RGB formats, 0 for other formats. */
+unsigned int rgbBytesPerPixel(const PixelFormat& format) {
+  switch (format) {
+    case formats::RGB888:
+    case formats::BGR888:
+      return 3;
+    case formats::XRGB8888:
+    case formats::XBGR8888:
+    case formats::ARGB8888:
+    case formats::ABGR8888:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+} /* namespace */
+
+const ImageScalerKernels scalarScalerKernels = {
+    "scalar",
+    blendRows,
+    filterRow,
+};
+
+/**
+ * \class ImageScaler
+ * \brief Resize frames on the CPU when no hardware scaler is available
+ *
+ * Scaling is separable. Each output row is first blended from the input rows
+ * it covers by the vector kernels, in blocks that keep the running sums in
+ * registers, then filtered horizontally from that single row, several output
+ * samples at a time. Doing the vertical pass first means the horizontal pass
+ * only runs on output rows, which is what makes downscaling cheap.
+ *
+ * Filter taps and Q8 weights are computed once per input and output size.
+ * The area filter averages all input samples an output sample covers and
+ * suits large ratios, bilinear uses the two nearest samples.
+ *
+ * Packed YUV 4:2:2 (YUYV, YVYU, UYVY, VYUY), semi-planar YUV 4:2:0 (NV12,
+ * NV21) and packed RGB are supported, the output keeps the input format with
+ * all planes sharing outputStride() and following each other.
+ */
+bool ImageScaler::isSupported(const PixelFormat& format) {
+  switch (format) {
+    case formats::YUYV:
+    case formats::YVYU:
+    case formats::UYVY:
+    case formats::VYUY:
+    case formats::NV12:
+    case formats::NV21:
+      return true;
+    default:
+      return rgbBytesPerPixel(format) != 0;
+  }
+}
+
+int ImageScaler::configure(const PixelFormat& format,
+                           const Size& input,
+                           unsigned int inputStride,
+                           const Size& output,
+                           unsigned int outputStride,
+                           Filter filter) {
+  if (!isSupported(format)) {
+    EPRINT("Cannot scale %s\n", format.toString().c_str());
+    return -EINVAL;
+  }
+
+  if (!input.width || !input.height || !output.width || !output.height) {
+    EPRINT("Cannot scale from or to an empty size\n");
+    return -EINVAL;
+  }
+
+  const bool semiPlanar = format == formats::NV12 || format == formats::NV21;
+  const unsigned int bpp = rgbBytesPerPixel(format);
+
+  if (!bpp && (input.width % 2 || output.width % 2 ||
+               (semiPlanar && (input.height % 2 || output.height % 2)))) {
+    EPRINT("Cannot scale %s from %s to %s, sizes must be even\n",
+           format.toString().c_str(), input.toString().c_str(),
+           output.toString().c_str());
+    return -EINVAL;
+  }
+
+  const unsigned int minStride =
+      output.width * (bpp ? bpp : semiPlanar ? 1 : 2);
+  if (outputStride && outputStride < minStride) {
+    EPRINT("Output stride %u too small, %u needed\n", outputStride, minStride);
+    return -EINVAL;
+  }
+
+  format_ = format;
+  outputSize_ = output;
+  outputStride_ = outputStride ? outputStride : minStride;
+  filter_ = filter;
+  planes_.clear();
+  components_.clear();
+
+  if (bpp) {
+    addPlane(input.width * bpp, input.height, inputStride, output.height);
+    for (unsigned int i = 0; i < bpp; ++i)
+      addComponent(0, i, bpp, input.width, output.width);
+  } else if (semiPlanar) {
+    addPlane(input.width, input.height, inputStride, output.height);
+    addComponent(0, 0, 1, input.width, output.width);
+
+    addPlane(input.width, input.height / 2, inputStride, output.height / 2);
+    addComponent(1, 0, 2, input.width / 2, output.width / 2);
+    addComponent(1, 1, 2, input.width / 2, output.width / 2);
+  } else {
+    /* Luma is on even bytes for YUYV and YVYU, odd bytes otherwise. */
+    const unsigned int luma =
+        format == formats::YUYV || format == formats::YVYU ? 0 : 1;
+
+    addPlane(input.width * 2, input.height, inputStride, output.height);
+    addComponent(0, luma, 2, input.width, output.width);
+    addComponent(0, 1 - luma, 4, input.width / 2, output.width / 2);
+    addComponent(0, 3 - luma, 4, input.width / 2, output.width / 2);
+  }
+
+  unsigned int maxTaps = 0;
+  for (const Plane& plane : planes_)
+    maxTaps = std::max(maxTaps, plane.vertical.taps);
+
+  row_.resize(planes_[0].rowLength);
+  rows_.resize(maxTaps);
+  kernels_ = &bestKernels();
+
+  VERBOSE_PRINT("Scaling %s from %s to %s with %s kernels\n",
+                format.toString().c_str(), input.toString().c_str(),
+                output.toString().c_str(), kernels_->name);
+
+  return 0;
+}
+
+void ImageScaler::addPlane(unsigned int rowLength,
+                           unsigned int height,
+                           unsigned int stride,
+                           unsigned int outputHeight) {
+  planes_.push_back({rowLength, height, stride, outputHeight,
+                     buildFilter(height, outputHeight, filter_)});
+}
+
+void ImageScaler::addComponent(unsigned int plane,
+                               unsigned int offset,
+                               unsigned int step,
+                               unsigned int width,
+                               unsigned int outputWidth) {
+  components_.push_back(
+      {plane, offset, step, buildFilter(width, outputWidth, filter_)});
+}
+
+/*
+ * Compute the taps of each of the output samples covering input samples.
+ * Weights are quantized to Q8 with the rounding error folded into the largest
+ * weight, so that they always sum to 256.
+ */
+ImageScaler::FilterTable ImageScaler::buildFilter(unsigned int input,
+                                                  unsigned int output,
+                                                  Filter filter) {
+  const double scale = static_cast<double>(input) / output;
+  std::vector<std::vector<double>> weights(output);
+  std::vector<unsigned int> first(output);
+  FilterTable table = {};
+
+  for (unsigned int i = 0; i < output; ++i) {
+    if (filter == Filter::Area) {
+      const double begin = i * scale;
+      const double end = std::min<double>((i + 1) * scale, input);
+      first[i] = std::min<unsigned int>(floor(begin), input - 1);
+
+      for (unsigned int x = first[i]; x < end; ++x) {
+        const double overlap = std::min<double>(end, x + 1) -
+                               std::max<double>(begin, x);
+        weights[i].push_back(std::max(overlap, 0.0) / scale);
+      }
+    } else {
+      double center = (i + 0.5) * scale - 0.5;
+      center = std::clamp<double>(center, 0, input - 1);
+      first[i] = floor(center);
+
+      const double fraction = center - first[i];
+      weights[i].push_back(1.0 - fraction);
+      if (first[i] + 1 < input)
+        weights[i].push_back(fraction);
+    }
+
+    table.taps = std::max<unsigned int>(table.taps, weights[i].size());
+  }
+
+  table.start.resize(output);
+  table.weights.assign(static_cast<size_t>(output) * table.taps, 0);
+
+  for (unsigned int i = 0; i < output; ++i) {
+    /* Keep every tap inside the input, padding with zero weights. */
+    const unsigned int start = std::min(first[i], input - table.taps);
+    const unsigned int pad = first[i] - start;
+    uint16_t* q8 = &table.weights[static_cast<size_t>(i) * table.taps];
+
+    double total = 0;
+    for (double weight : weights[i])
+      total += weight;
+
+    int sum = 0;
+    unsigned int largest = pad;
+    for (unsigned int k = 0; k < weights[i].size(); ++k) {
+      q8[pad + k] = lround(weights[i][k] / total * 256);
+      sum += q8[pad + k];
+      if (q8[pad + k] > q8[largest])
+        largest = pad + k;
+    }
+
+    q8[largest] += 256 - sum;
+    table.start[i] = start;
+  }
+
+  return table;
+}
+
+size_t ImageScaler::outputLength() const {
+  size_t length = 0;
+  for (const Plane& plane : planes_)
+    length += static_cast<size_t>(outputStride_) * plane.outputHeight;
+
+  return length;
+}
+
+std::vector<Span<const uint8_t>> ImageScaler::outputPlanes(
+    const uint8_t* dst) const {
+  std::vector<Span<const uint8_t>> planes;
+
+  for (const Plane& plane : planes_) {
+    const size_t length =
+        static_cast<size_t>(outputStride_) * plane.outputHeight;
+    planes.emplace_back(dst, length);
+    dst += length;
+  }
+
+  return planes;
+}
+
+/*
+ * Scale the frame in \a planes to \a dst, which must hold outputLength()
+ * bytes. Returns 0 on success or a negative error code.
+ */
+int ImageScaler::scale(const std::vector<Span<const uint8_t>>& planes,
+                       uint8_t* dst) {
+  if (!kernels_)
+    return -EINVAL;
+
+  std::vector<size_t> sizes;
+  for (const Plane& plane : planes_)
+    sizes.push_back(static_cast<size_t>(plane.stride) * plane.height);
+
+  std::vector<const uint8_t*> data;
+  if (splitPlanes(planes, sizes, &data) < 0) {
+    EPRINT("Frame too small for %s\n", format_.toString().c_str());
+    return -EINVAL;
+  }
+
+  for (unsigned int p = 0; p < planes_.size(); ++p) {
+    const Plane& plane = planes_[p];
+    const FilterTable& vertical = plane.vertical;
+
+    for (unsigned int y = 0; y < plane.outputHeight; ++y) {
+      for (unsigned int k = 0; k < vertical.taps; ++k)
+        rows_[k] = data[p] +
+                   static_cast<size_t>(vertical.start[y] + k) * plane.stride;
+
+      kernels_->blendRows(
+          rows_.data(), &vertical.weights[y * vertical.taps], vertical.taps,
+          row_.data(), 0, plane.rowLength);
+
+      uint8_t* out = dst + static_cast<size_t>(y) * outputStride_;
+      for (const Component& component : components_) {
+        if (component.plane != p)
+          continue;
+
+        const FilterTable& horizontal = component.horizontal;
+        kernels_->filterRow(row_.data() + component.offset, component.step,
+                            horizontal.start.data(),
+                            horizontal.weights.data(), horizontal.taps,
+                            out + component.offset, 0,
+                            horizontal.start.size());
+      }
+    }
+
+    dst += static_cast<size_t>(outputStride_) * plane.outputHeight;
+  }
+
+  return 0;
+}
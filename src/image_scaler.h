@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * image_scaler.h - Downscale YUV and RGB frames
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "image_scaler_kernels.h"
+
+class ImageScaler {
+ public:
+  enum class Filter {
+    Bilinear,
+    Area,
+  };
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const libcamera::PixelFormat& format,
+                const libcamera::Size& input,
+                unsigned int inputStride,
+                const libcamera::Size& output,
+                unsigned int outputStride = 0,
+                Filter filter = Filter::Area);
+
+  const libcamera::Size& outputSize() const { return outputSize_; }
+  unsigned int outputStride() const { return outputStride_; }
+  size_t outputLength() const;
+  std::vector<libcamera::Span<const uint8_t>> outputPlanes(
+      const uint8_t* dst) const;
+
+  int scale(const std::vector<libcamera::Span<const uint8_t>>& planes,
+            uint8_t* dst);
+
+ private:
+  /*
+   * Taps and Q8 weights of each output sample. Output sample i reads taps
+   * input samples from start[i].
+   */
+  struct FilterTable {
+    unsigned int taps;
+    std::vector<unsigned int> start;
+    std::vector<uint16_t> weights;
+  };
+
+  struct Plane {
+    unsigned int rowLength;
+    unsigned int height;
+    unsigned int stride;
+    unsigned int outputHeight;
+    FilterTable vertical;
+  };
+
+  /* Samples of one colour component, step bytes apart within a row. */
+  struct Component {
+    unsigned int plane;
+    unsigned int offset;
+    unsigned int step;
+    FilterTable horizontal;
+  };
+
+  static FilterTable buildFilter(unsigned int input,
+                                 unsigned int output,
+                                 Filter filter);
+
+  void addPlane(unsigned int rowLength,
+                unsigned int height,
+                unsigned int stride,
+                unsigned int outputHeight);
+  void addComponent(unsigned int plane,
+                    unsigned int offset,
+                    unsigned int step,
+                    unsigned int width,
+                    unsigned int outputWidth);
+
+  libcamera::PixelFormat format_;
+  libcamera::Size outputSize_;
+  unsigned int outputStride_ = 0;
+  Filter filter_ = Filter::Area;
+
+  std::vector<Plane> planes_;
+  std::vector<Component> components_;
+
+  const ImageScalerKernels* kernels_ = nullptr;
+  std::vector<uint8_t> row_;
+  std::vector<const uint8_t*> rows_;
+};
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * image_scaler_avx2.cpp - AVX2 row kernels for ImageScaler
+ */
+
+#include "image_scaler_kernels.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace {
+
+/* Samples k and k + 1 of in, 0 past the last tap, as two 16-bit halves. */
+inline int samplePair(const uint8_t* in,
+                      unsigned int step,
+                      unsigned int k,
+                      unsigned int taps) {
+  return in[k * step] | (k + 1 < taps ? in[(k + 1) * step] << 16 : 0);
+}
+
+inline int weightPair(const uint16_t* weight, unsigned int k,
+                      unsigned int taps) {
+  return weight[k] | (k + 1 < taps ? weight[k + 1] << 16 : 0);
+}
+
+void blendRows(const uint8_t* const* rows,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  const __m256i round = _mm256_set1_epi16(128);
+  unsigned int x = begin;
+
+  for (; x + 32 <= end; x += 32) {
+    __m256i lo = round;
+    __m256i hi = round;
+
+    for (unsigned int k = 0; k < taps; ++k) {
+      const __m256i weight = _mm256_set1_epi16(weights[k]);
+      const __m128i* src = reinterpret_cast<const __m128i*>(rows[k] + x);
+
+      lo = _mm256_add_epi16(
+          lo, _mm256_mullo_epi16(
+                  _mm256_cvtepu8_epi16(_mm_loadu_si128(src)), weight));
+      hi = _mm256_add_epi16(
+          hi, _mm256_mullo_epi16(
+                  _mm256_cvtepu8_epi16(_mm_loadu_si128(src + 1)), weight));
+    }
+
+    /* Packing works within 128-bit lanes, restore the byte order. */
+    const __m256i pixels = _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)),
+        0xd8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), pixels);
+  }
+
+  scalarScalerKernels.blendRows(rows, weights, taps, dst, x, end);
+}
+
+/* As the SSE2 kernel, eight output samples at a time. */
+void filterRow(const uint8_t* src,
+               unsigned int step,
+               const unsigned int* start,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  unsigned int x = begin;
+
+  for (; x + 8 <= end; x += 8) {
+    const uint8_t* in[8];
+    for (unsigned int i = 0; i < 8; ++i)
+      in[i] = src + start[x + i] * step;
+
+    __m256i sum = _mm256_set1_epi32(128);
+    for (unsigned int k = 0; k < taps; k += 2) {
+      alignas(32) int pixels[8];
+      for (unsigned int i = 0; i < 8; ++i)
+        pixels[i] = samplePair(in[i], step, k, taps);
+
+      __m256i weight;
+      if (taps == 2) {
+        weight = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(weights + x * 2));
+      } else {
+        alignas(32) int pairs[8];
+        const uint16_t* row = weights + static_cast<size_t>(x) * taps;
+        for (unsigned int i = 0; i < 8; ++i)
+          pairs[i] = weightPair(row + i * taps, k, taps);
+        weight = _mm256_load_si256(reinterpret_cast<const __m256i*>(pairs));
+      }
+
+      sum = _mm256_add_epi32(
+          sum,
+          _mm256_madd_epi16(
+              _mm256_load_si256(reinterpret_cast<const __m256i*>(pixels)),
+              weight));
+    }
+
+    alignas(32) uint32_t out[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(out),
+                       _mm256_srli_epi32(sum, 8));
+    for (unsigned int i = 0; i < 8; ++i)
+      dst[(x + i) * step] = out[i];
+  }
+
+  scalarScalerKernels.filterRow(src, step, start, weights, taps, dst, x, end);
+}
+
+} /* namespace */
+
+const ImageScalerKernels avx2ScalerKernels = {
+    "AVX2",
+    blendRows,
+    filterRow,
+};
+
+#endif /* __AVX2__ */
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * image_scaler_kernels.h - Row kernels used by ImageScaler
+ *
+ * Filter weights are Q8 and the weights of each output sample sum to exactly
+ * 256, so weighted sums of 8-bit samples plus the rounding term fit in 16
+ * bits. All implementations produce exactly the output of the scalar kernels.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct ImageScalerKernels {
+  const char* name;
+
+  /*
+   * Blend bytes begin to end of taps input rows into dst, dst[x] is the sum
+   * of rows[k][x] * weights[k], rounded.
+   */
+  void (*blendRows)(const uint8_t* const* rows,
+                    const uint16_t* weights,
+                    unsigned int taps,
+                    uint8_t* dst,
+                    unsigned int begin,
+                    unsigned int end);
+
+  /*
+   * Filter output samples begin to end of one colour component of a row, its
+   * samples step bytes apart in both src and dst. dst[x * step] is the sum of
+   * the taps samples from src[start[x] * step] times weights[x * taps + k],
+   * rounded. Bilinear filters have two taps, area filters any number.
+   */
+  void (*filterRow)(const uint8_t* src,
+                    unsigned int step,
+                    const unsigned int* start,
+                    const uint16_t* weights,
+                    unsigned int taps,
+                    uint8_t* dst,
+                    unsigned int begin,
+                    unsigned int end);
+};
+
+extern const ImageScalerKernels scalarScalerKernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const ImageScalerKernels sse2ScalerKernels;
+extern const ImageScalerKernels avx2ScalerKernels;
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+extern const ImageScalerKernels neonScalerKernels;
+#endif
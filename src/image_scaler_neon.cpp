@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * image_scaler_neon.cpp - NEON row kernels for ImageScaler
+ */
+
+#include "image_scaler_kernels.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+namespace {
+
+void blendRows(const uint8_t* const* rows,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  unsigned int x = begin;
+
+  for (; x + 16 <= end; x += 16) {
+    uint16x8_t lo = vdupq_n_u16(128);
+    uint16x8_t hi = vdupq_n_u16(128);
+
+    for (unsigned int k = 0; k < taps; ++k) {
+      const uint16x8_t weight = vdupq_n_u16(weights[k]);
+      const uint8x16_t pixels = vld1q_u8(rows[k] + x);
+
+      lo = vmlaq_u16(lo, vmovl_u8(vget_low_u8(pixels)), weight);
+      hi = vmlaq_u16(hi, vmovl_u8(vget_high_u8(pixels)), weight);
+    }
+
+    vst1q_u8(dst + x, vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+  }
+
+  scalarScalerKernels.blendRows(rows, weights, taps, dst, x, end);
+}
+
+/*
+ * Four output samples at a time, the samples of each tap gathered into a
+ * vector and multiplied and accumulated by vmlal_u16. The weights of the two
+ * taps of bilinear filters are deinterleaved by vld2_u16.
+ */
+void filterRow(const uint8_t* src,
+               unsigned int step,
+               const unsigned int* start,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  unsigned int x = begin;
+
+  for (; x + 4 <= end; x += 4) {
+    const uint8_t* in[4];
+    for (unsigned int i = 0; i < 4; ++i)
+      in[i] = src + start[x + i] * step;
+
+    uint32x4_t sum = vdupq_n_u32(128);
+    if (taps == 2) {
+      const uint16x4x2_t weight = vld2_u16(weights + x * 2);
+      const uint16_t first[4] = {in[0][0], in[1][0], in[2][0], in[3][0]};
+      const uint16_t second[4] = {in[0][step], in[1][step], in[2][step],
+                                  in[3][step]};
+
+      sum = vmlal_u16(sum, vld1_u16(first), weight.val[0]);
+      sum = vmlal_u16(sum, vld1_u16(second), weight.val[1]);
+    } else {
+      const uint16_t* row = weights + static_cast<size_t>(x) * taps;
+      for (unsigned int k = 0; k < taps; ++k) {
+        const uint16_t pixels[4] = {in[0][k * step], in[1][k * step],
+                                    in[2][k * step], in[3][k * step]};
+        const uint16_t weight[4] = {row[k], row[taps + k], row[taps * 2 + k],
+                                    row[taps * 3 + k]};
+
+        sum = vmlal_u16(sum, vld1_u16(pixels), vld1_u16(weight));
+      }
+    }
+
+    uint32_t out[4];
+    vst1q_u32(out, vshrq_n_u32(sum, 8));
+    for (unsigned int i = 0; i < 4; ++i)
+      dst[(x + i) * step] = out[i];
+  }
+
+  scalarScalerKernels.filterRow(src, step, start, weights, taps, dst, x, end);
+}
+
+} /* namespace */
+
+const ImageScalerKernels neonScalerKernels = {
+    "NEON",
+    blendRows,
+    filterRow,
+};
+
+#endif /* __ARM_NEON */
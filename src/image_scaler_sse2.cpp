@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * image_scaler_sse2.cpp - SSE2 row kernels for ImageScaler
+ */
+
+#include "image_scaler_kernels.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+#include <string.h>
+
+namespace {
+
+/*
+ * Samples k and k + 1 of in, or sample k and 0 past the last tap, as the two
+ * 16-bit halves of a word to be multiplied by weightPair().
+ */
+inline int samplePair(const uint8_t* in,
+                      unsigned int step,
+                      unsigned int k,
+                      unsigned int taps) {
+  return in[k * step] | (k + 1 < taps ? in[(k + 1) * step] << 16 : 0);
+}
+
+inline int weightPair(const uint16_t* weight, unsigned int k,
+                      unsigned int taps) {
+  return weight[k] | (k + 1 < taps ? weight[k + 1] << 16 : 0);
+}
+
+void blendRows(const uint8_t* const* rows,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi16(128);
+  unsigned int x = begin;
+
+  for (; x + 16 <= end; x += 16) {
+    __m128i lo = round;
+    __m128i hi = round;
+
+    for (unsigned int k = 0; k < taps; ++k) {
+      const __m128i weight = _mm_set1_epi16(weights[k]);
+      const __m128i pixels =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + x));
+
+      lo = _mm_add_epi16(
+          lo, _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), weight));
+      hi = _mm_add_epi16(
+          hi, _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), weight));
+    }
+
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + x),
+        _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+  }
+
+  scalarScalerKernels.blendRows(rows, weights, taps, dst, x, end);
+}
+
+/*
+ * Four output samples at a time, the samples of each pair of taps gathered
+ * into 32-bit lanes and multiplied and summed by _mm_madd_epi16. The two taps
+ * of bilinear filters are one pair, their weights are loaded as they are.
+ */
+void filterRow(const uint8_t* src,
+               unsigned int step,
+               const unsigned int* start,
+               const uint16_t* weights,
+               unsigned int taps,
+               uint8_t* dst,
+               unsigned int begin,
+               unsigned int end) {
+  unsigned int x = begin;
+
+  for (; x + 4 <= end; x += 4) {
+    const uint8_t* in[4];
+    for (unsigned int i = 0; i < 4; ++i)
+      in[i] = src + start[x + i] * step;
+
+    __m128i sum = _mm_set1_epi32(128);
+    if (taps == 2) {
+      const __m128i pixels =
+          _mm_setr_epi32(samplePair(in[0], step, 0, 2),
+                         samplePair(in[1], step, 0, 2),
+                         samplePair(in[2], step, 0, 2),
+                         samplePair(in[3], step, 0, 2));
+      const __m128i weight =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + x * 2));
+      sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, weight));
+    } else {
+      const uint16_t* weight = weights + static_cast<size_t>(x) * taps;
+      for (unsigned int k = 0; k < taps; k += 2) {
+        const __m128i pixels =
+            _mm_setr_epi32(samplePair(in[0], step, k, taps),
+                           samplePair(in[1], step, k, taps),
+                           samplePair(in[2], step, k, taps),
+                           samplePair(in[3], step, k, taps));
+        const __m128i weight4 =
+            _mm_setr_epi32(weightPair(weight, k, taps),
+                           weightPair(weight + taps, k, taps),
+                           weightPair(weight + taps * 2, k, taps),
+                           weightPair(weight + taps * 3, k, taps));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, weight4));
+      }
+    }
+
+    /* Sums are at most 255 once shifted, packing doesn't saturate. */
+    sum = _mm_srli_epi32(sum, 8);
+    sum = _mm_packus_epi16(_mm_packs_epi32(sum, sum), sum);
+
+    uint8_t out[4];
+    const int packed = _mm_cvtsi128_si32(sum);
+    memcpy(out, &packed, sizeof(out));
+    for (unsigned int i = 0; i < 4; ++i)
+      dst[(x + i) * step] = out[i];
+  }
+
+  scalarScalerKernels.filterRow(src, step, start, weights, taps, dst, x, end);
+}
+
+} /* namespace */
+
+const ImageScalerKernels sse2ScalerKernels = {
+    "SSE2",
+    blendRows,
+    filterRow,
+};
+
+#endif /* __SSE2__ */
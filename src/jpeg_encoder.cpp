@@ -0,0 +1,287 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * jpeg_encoder.cpp - Encode YUV frames to JPEG
+ */
+
+#include "jpeg_encoder.h"
+
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+
+#include "frame_planes.h"
+#include "jpeg_error_manager.h"
+#include "twincam.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Offsets of the first Y, U and V samples in a packed 4:2:2 pixel pair. */
+struct PackedLayout {
+  unsigned int y;
+  unsigned int u;
+  unsigned int v;
+};
+
+bool packedLayout(const PixelFormat& format, PackedLayout* layout) {
+  switch (format) {
+    case formats::YUYV:
+      *layout = {0, 1, 3};
+      return true;
+    case formats::YVYU:
+      *layout = {0, 3, 1};
+      return true;
+    case formats::UYVY:
+      *layout = {1, 0, 2};
+      return true;
+    case formats::VYUY:
+      *layout = {1, 2, 0};
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* Copy \a width samples spaced by \a step, repeating the last up to \a pad. */
+void copySamples(uint8_t* dst,
+                 const uint8_t* src,
+                 unsigned int width,
+                 unsigned int step,
+                 unsigned int pad) {
+  if (step == 1) {
+    memcpy(dst, src, width);
+  } else {
+    for (unsigned int x = 0; x < width; ++x)
+      dst[x] = src[x * step];
+  }
+
+  memset(dst + width, dst[width - 1], pad - width);
+}
+
+/* A libjpeg destination growing a vector, reused from frame to frame. */
+struct VectorDestination {
+  struct jpeg_destination_mgr pub;
+  std::vector<uint8_t>* out;
+};
+
+void initDestination(j_compress_ptr cinfo) {
+  VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  dest->out->resize(std::max<size_t>(dest->out->capacity(), 64 * 1024));
+  dest->pub.next_output_byte = dest->out->data();
+  dest->pub.free_in_buffer = dest->out->size();
+}
+
+boolean emptyDestination(j_compress_ptr cinfo) {
+  VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  const size_t used = dest->out->size();
+  dest->out->resize(used * 2);
+  dest->pub.next_output_byte = dest->out->data() + used;
+  dest->pub.free_in_buffer = dest->out->size() - used;
+  return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+  VectorDestination* dest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+  dest->out->resize(dest->out->size() - dest->pub.free_in_buffer);
+}
+
+}  // namespace
+
+/**
+ * \class JpegEncoder
+ * \brief Encode frames of the camera YUV formats to JPEG
+ *
+ * Frames are handed to libjpeg as raw YCbCr planes, so the colour conversion
+ * and chroma downsampling steps are skipped entirely: the encoder only
+ * deinterleaves chroma into one band of MCU rows at a time.
+ */
+JpegEncoder::JpegEncoder() = default;
+
+JpegEncoder::~JpegEncoder() = default;
+
+bool JpegEncoder::isSupported(const PixelFormat& format) {
+  PackedLayout layout;
+  switch (format) {
+    case formats::NV12:
+    case formats::NV21:
+    case formats::YUV420:
+    case formats::YVU420:
+      return true;
+    default:
+      return packedLayout(format, &layout);
+  }
+}
+
+int JpegEncoder::configure(const StreamConfiguration& cfg, int quality) {
+  if (!isSupported(cfg.pixelFormat)) {
+    EPRINT("Cannot encode %s to JPEG\n", cfg.pixelFormat.toString().c_str());
+    return -EINVAL;
+  }
+
+  if (cfg.size.width % 2 || !cfg.size.height) {
+    EPRINT("Cannot encode frames of odd width %u\n", cfg.size.width);
+    return -EINVAL;
+  }
+
+  PackedLayout layout;
+  format_ = cfg.pixelFormat;
+  size_ = cfg.size;
+  stride_ = cfg.stride;
+  quality_ = quality;
+  mcuRows_ = packedLayout(format_, &layout) ? 8 : 16;
+  paddedWidth_ = (size_.width + 15) / 16 * 16;
+
+  /* A band of luma rows followed by the same number of U and V half rows. */
+  rows_.resize(static_cast<size_t>(paddedWidth_) * mcuRows_ * 2);
+
+  return 0;
+}
+
+/* Fill the band of MCU rows starting at luma \a row, repeating edge samples. */
+void JpegEncoder::fillRows(const std::vector<const uint8_t*>& data,
+                           unsigned int row) {
+  const unsigned int width = size_.width;
+  const unsigned int chromaWidth = width / 2;
+  const unsigned int chromaPad = paddedWidth_ / 2;
+  uint8_t* yRows = rows_.data();
+  uint8_t* uRows = yRows + static_cast<size_t>(paddedWidth_) * mcuRows_;
+  uint8_t* vRows = uRows + static_cast<size_t>(chromaPad) * mcuRows_;
+
+  PackedLayout layout;
+  if (packedLayout(format_, &layout)) {
+    for (unsigned int i = 0; i < mcuRows_; ++i) {
+      const unsigned int y = std::min(row + i, size_.height - 1);
+      const uint8_t* src = data[0] + static_cast<size_t>(y) * stride_;
+      copySamples(yRows + i * paddedWidth_, src + layout.y, width, 2,
+                  paddedWidth_);
+      copySamples(uRows + i * chromaPad, src + layout.u, chromaWidth, 4,
+                  chromaPad);
+      copySamples(vRows + i * chromaPad, src + layout.v, chromaWidth, 4,
+                  chromaPad);
+    }
+    return;
+  }
+
+  for (unsigned int i = 0; i < mcuRows_; ++i) {
+    const unsigned int y = std::min(row + i, size_.height - 1);
+    copySamples(yRows + i * paddedWidth_,
+                data[0] + static_cast<size_t>(y) * stride_, width, 1,
+                paddedWidth_);
+  }
+
+  const unsigned int chromaRows = (size_.height + 1) / 2;
+  for (unsigned int i = 0; i < mcuRows_ / 2; ++i) {
+    const unsigned int y = std::min(row / 2 + i, chromaRows - 1);
+    uint8_t* u = uRows + i * chromaPad;
+    uint8_t* v = vRows + i * chromaPad;
+
+    if (format_ == formats::NV12 || format_ == formats::NV21) {
+      const uint8_t* src = data[1] + static_cast<size_t>(y) * stride_;
+      const bool swap = format_ == formats::NV21;
+      copySamples(swap ? v : u, src, chromaWidth, 2, chromaPad);
+      copySamples(swap ? u : v, src + 1, chromaWidth, 2, chromaPad);
+    } else {
+      const size_t offset = static_cast<size_t>(y) * (stride_ / 2);
+      const bool swap = format_ == formats::YVU420;
+      copySamples(swap ? v : u, data[1] + offset, chromaWidth, 1, chromaPad);
+      copySamples(swap ? u : v, data[2] + offset, chromaWidth, 1, chromaPad);
+    }
+  }
+}
+
+/*
+ * Encode the frame in \a planes into \a jpeg, replacing its content. The
+ * vector keeps its capacity, pass the same one again to not reallocate.
+ */
+int JpegEncoder::encode(const std::vector<Span<const uint8_t>>& planes,
+                        std::vector<uint8_t>* jpeg) {
+  const size_t lumaSize = static_cast<size_t>(stride_) * size_.height;
+  const size_t chromaRows = (size_.height + 1) / 2;
+
+  std::vector<size_t> sizes;
+  switch (format_) {
+    case formats::NV12:
+    case formats::NV21:
+      sizes = {lumaSize, stride_ * chromaRows};
+      break;
+    case formats::YUV420:
+    case formats::YVU420:
+      sizes = {lumaSize, stride_ / 2 * chromaRows, stride_ / 2 * chromaRows};
+      break;
+    default:
+      sizes = {lumaSize};
+      break;
+  }
+
+  std::vector<const uint8_t*> data;
+  if (splitPlanes(planes, sizes, &data) < 0) {
+    EPRINT("Frame too small for %s %ux%u\n", format_.toString().c_str(),
+           size_.width, size_.height);
+    return -EINVAL;
+  }
+
+  struct jpeg_compress_struct cinfo;
+  JpegErrorManager jpegErrorManager(cinfo);
+  if (setjmp(jpegErrorManager.escape_)) {
+    /* libjpeg found an error */
+    jpeg_destroy_compress(&cinfo);
+    EPRINT("JPEG compression error\n");
+    return -EINVAL;
+  }
+
+  jpeg_create_compress(&cinfo);
+
+  VectorDestination dest;
+  dest.pub.init_destination = initDestination;
+  dest.pub.empty_output_buffer = emptyDestination;
+  dest.pub.term_destination = termDestination;
+  dest.out = jpeg;
+  cinfo.dest = &dest.pub;
+
+  cinfo.image_width = size_.width;
+  cinfo.image_height = size_.height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality_, TRUE);
+  cinfo.raw_data_in = TRUE;
+  cinfo.dct_method = JDCT_IFAST;
+  cinfo.comp_info[0].h_samp_factor = 2;
+  cinfo.comp_info[0].v_samp_factor = mcuRows_ / 8;
+  for (unsigned int i = 1; i < 3; ++i) {
+    cinfo.comp_info[i].h_samp_factor = 1;
+    cinfo.comp_info[i].v_samp_factor = 1;
+  }
+
+  jpeg_start_compress(&cinfo, TRUE);
+
+  const unsigned int chromaPad = paddedWidth_ / 2;
+  JSAMPROW yRows[16];
+  JSAMPROW uRows[8];
+  JSAMPROW vRows[8];
+  uint8_t* u = rows_.data() + static_cast<size_t>(paddedWidth_) * mcuRows_;
+  uint8_t* v = u + static_cast<size_t>(chromaPad) * mcuRows_;
+  for (unsigned int i = 0; i < mcuRows_; ++i)
+    yRows[i] = rows_.data() + i * paddedWidth_;
+  for (unsigned int i = 0; i < 8; ++i) {
+    uRows[i] = u + i * chromaPad;
+    vRows[i] = v + i * chromaPad;
+  }
+  JSAMPARRAY bands[3] = {yRows, uRows, vRows};
+
+  for (unsigned int row = 0; row < size_.height; row += mcuRows_) {
+    fillRows(data, row);
+    jpeg_write_raw_data(&cinfo, bands, mcuRows_);
+  }
+
+  jpeg_finish_compress(&cinfo);
+
+  jpeg_destroy_compress(&cinfo);
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * jpeg_encoder.h - Encode YUV frames to JPEG
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+namespace libcamera {
+class StreamConfiguration;
+} /* namespace libcamera */
+
+class JpegEncoder {
+ public:
+  JpegEncoder();
+  ~JpegEncoder();
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const libcamera::StreamConfiguration& cfg, int quality = 85);
+  int encode(const std::vector<libcamera::Span<const uint8_t>>& planes,
+             std::vector<uint8_t>* jpeg);
+
+ private:
+  void fillRows(const std::vector<const uint8_t*>& data, unsigned int row);
+
+  libcamera::PixelFormat format_;
+  libcamera::Size size_;
+  unsigned int stride_ = 0;
+  int quality_ = 85;
+
+  /* Luma rows of an MCU, 16 for 4:2:0 and 8 for 4:2:2. */
+  unsigned int mcuRows_ = 16;
+  /* Luma width rounded up to whole MCUs, as libjpeg reads raw data. */
+  unsigned int paddedWidth_ = 0;
+  std::vector<uint8_t> rows_;
+};
@@ -13,3 +13,8 @@ JpegErrorManager::JpegErrorManager(struct jpeg_decompress_struct& cinfo) {
   errmgr_.output_message = outputMessage;
 }
 
+JpegErrorManager::JpegErrorManager(struct jpeg_compress_struct& cinfo) {
+  cinfo.err = jpeg_std_error(&errmgr_);
+  errmgr_.error_exit = errorExit;
+  errmgr_.output_message = outputMessage;
+}
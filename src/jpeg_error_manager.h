@@ -6,6 +6,7 @@
 
 struct JpegErrorManager {
   JpegErrorManager(struct jpeg_decompress_struct& cinfo);
+  JpegErrorManager(struct jpeg_compress_struct& cinfo);
 
   /* Order very important for reinterpret_cast */
   struct jpeg_error_mgr errmgr_;
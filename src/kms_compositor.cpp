@@ -0,0 +1,370 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * kms_compositor.cpp - Display a composite of several cameras with KMS
+ */
+
+#include "kms_compositor.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <chrono>
+
+#include <libcamera/camera.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "event_loop.h"
+#include "format_converter.h"
+#include "frame_sink.h"
+#include "image.h"
+#include "mapped_buffer_cache.h"
+#include "twincam.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+/*
+ * Frame sink of one camera, which holds on to the latest request of the
+ * camera until a newer one completes.
+ */
+class KMSCompositor::Input : public FrameSink {
+ public:
+  Input(KMSCompositor* compositor, unsigned int view)
+      : compositor_(compositor), view_(view) {}
+  ~Input() override { compositor_->inputs_[view_] = nullptr; }
+
+  int configure(const CameraConfiguration& config) override {
+    cfg_ = config.at(0);
+    configured_ = true;
+    return Compositor::isSupported(cfg_.pixelFormat) ? 0 : -ENOTSUP;
+  }
+
+  int stop() override {
+    latest_ = nullptr;
+    return 0;
+  }
+
+  bool processRequest(Request* request) override {
+    if (!compositor_->started_)
+      return true;
+
+    Request* previous = latest_;
+    latest_ = request;
+    if (previous)
+      requestProcessed.emit(previous);
+
+    compositor_->frameAvailable();
+    return false;
+  }
+
+  Image* image() {
+    if (!latest_ || !mappedBuffers_)
+      return nullptr;
+
+    FrameBuffer* buffer = latest_->findBuffer(cfg_.stream());
+    return buffer ? mappedBuffers_->mapping(buffer) : nullptr;
+  }
+
+  const StreamConfiguration& config() const { return cfg_; }
+  bool configured() const { return configured_; }
+
+ private:
+  KMSCompositor* compositor_;
+  unsigned int view_;
+
+  StreamConfiguration cfg_;
+  bool configured_ = false;
+  Request* latest_ = nullptr;
+};
+
+/**
+ * \class KMSCompositor
+ * \brief Show the latest frames of several cameras as one composite with KMS
+ *
+ * Each camera session streams into an input sink created by createInput(),
+ * which keeps only the latest frame of its camera, so a slow or stalled
+ * camera never holds back the others. A composite is drawn with a Compositor
+ * into the back one of two dumb buffers, and flipped to the screen. The next
+ * composite is drawn when the flip completes, at the display vblank, if any
+ * camera delivered a new frame meanwhile, or as soon as one does otherwise.
+ * This shows at most one composite per vblank, always from the most recent
+ * frames, without drawing composites that would never be scanned out.
+ *
+ * The composite is drawn straight into the dumb buffer when the primary plane
+ * scans out NV12, and converted to XRGB8888 otherwise.
+ */
+KMSCompositor::KMSCompositor(const std::string& connectorName) {
+  PRINT_FUNC();
+  if (dev_.init() < 0)
+    return;
+
+  /*
+   * Pick the requested connector or, if no specific connector is requested,
+   * the first connected connector.
+   */
+  for (const DRM::Connector& conn : dev_.connectors()) {
+    if (connectorName.empty() ? conn.status() == DRM::Connector::Connected
+                              : conn.name() == connectorName) {
+      connector_ = &conn;
+      break;
+    }
+  }
+
+  if (!connector_) {
+    if (!connectorName.empty())
+      EPRINT("Connector %s not found\n", connectorName.c_str());
+    else
+      EPRINT("No connected connector found\n");
+    return;
+  }
+
+  dev_.requestComplete.connect(this, &KMSCompositor::requestComplete);
+}
+
+KMSCompositor::~KMSCompositor() = default;
+
+void KMSCompositor::setLayout(const CompositorLayout& layout) {
+  layout_ = layout;
+  inputs_.assign(layout.views.size(), nullptr);
+}
+
+/*
+ * Create the frame sink for the camera of \a view, to be given to its camera
+ * session before it starts. The sink must be destroyed before the compositor.
+ */
+std::unique_ptr<FrameSink> KMSCompositor::createInput(unsigned int view) {
+  if (view >= inputs_.size())
+    return nullptr;
+
+  auto input = std::make_unique<Input>(this, view);
+  inputs_[view] = input.get();
+
+  return input;
+}
+
+int KMSCompositor::selectPipeline() {
+  /* Restrict the search to primary planes, as KMSSink does. */
+  for (const PixelFormat& format : {formats::NV12, formats::XRGB8888}) {
+    for (const DRM::Encoder* encoder : connector_->encoders()) {
+      for (const DRM::Crtc* crtc : encoder->possibleCrtcs()) {
+        for (const DRM::Plane* plane : crtc->planes()) {
+          if (plane->planeType() != DRM::Plane::TypePrimary ||
+              !plane->supportsFormat(format))
+            continue;
+
+          crtc_ = crtc;
+          plane_ = plane;
+          format_ = format;
+          return 0;
+        }
+      }
+    }
+  }
+
+  EPRINT("Unable to find a display pipeline for NV12 or XRGB8888\n");
+  return -EPIPE;
+}
+
+/*
+ * Build the composition tables for the configured cameras and show a first,
+ * black, composite. All inputs must have been configured by their camera
+ * session.
+ */
+int KMSCompositor::start() {
+  PRINT_FUNC();
+  if (!connector_ || connector_->modes().empty())
+    return -EINVAL;
+
+  std::vector<StreamConfiguration> configs;
+  for (unsigned int view = 0; view < inputs_.size(); ++view) {
+    if (!inputs_[view] || !inputs_[view]->configured()) {
+      EPRINT("Camera of view %u not configured\n", view);
+      return -EINVAL;
+    }
+
+    configs.push_back(inputs_[view]->config());
+  }
+
+  int ret = selectPipeline();
+  if (ret < 0)
+    return ret;
+
+  mode_ = &connector_->modes()[0];
+  size_ = layout_.size;
+  if (size_.isNull())
+    size_ = Size(mode_->hdisplay & ~1, mode_->vdisplay & ~1);
+
+  if (size_.width > mode_->hdisplay || size_.height > mode_->vdisplay) {
+    EPRINT("Composite %s larger than the %ux%u display\n",
+           size_.toString().c_str(), mode_->hdisplay, mode_->vdisplay);
+    return -EINVAL;
+  }
+
+  for (std::unique_ptr<DRM::FrameBuffer>& buffer : buffers_) {
+    buffer = dev_.createDumbFrameBuffer(format_, size_);
+    if (!buffer)
+      return -ENOMEM;
+  }
+
+  unsigned int stride = buffers_[0]->stride();
+  converter_.reset();
+  if (format_ != formats::NV12) {
+    StreamConfiguration cfg;
+    cfg.pixelFormat = formats::NV12;
+    cfg.size = size_;
+    cfg.stride = size_.width;
+
+    converter_ = std::make_unique<FormatConverter>();
+    ret = converter_->configure(cfg, format_, stride);
+    if (ret < 0)
+      return ret;
+
+    stride = cfg.stride;
+    frame_.resize(static_cast<size_t>(stride) * size_.height * 3 / 2);
+  }
+
+  ret = compositor_.configure(layout_, configs, size_, stride);
+  if (ret < 0)
+    return ret;
+
+  PRINT("Compositing %zu cameras into %s %s with %s kernels, on KMS plane %u, "
+        "CRTC %u, connector %s, mode %ux%u@%u\n",
+        configs.size(), size_.toString().c_str(), format_.toString().c_str(),
+        compositor_.kernelsName(), plane_->id(), crtc_->id(),
+        connector_->name().c_str(), mode_->hdisplay, mode_->vdisplay,
+        mode_->vrefresh);
+
+  frames_ = 0;
+  composeTime_ = 0;
+  enabled_ = false;
+  started_ = true;
+  composeFrame();
+
+  return 0;
+}
+
+int KMSCompositor::stop() {
+  if (!started_)
+    return 0;
+
+  started_ = false;
+
+  if (frames_) {
+    PRINT("Composited %" PRIu64 " frames in %.2f ms per frame\n", frames_,
+          composeTime_ / 1000000.0 / frames_);
+  }
+
+  DRM::AtomicRequest request(&dev_);
+
+  request.addProperty(connector_, "CRTC_ID", 0);
+  request.addProperty(crtc_, "ACTIVE", 0);
+  request.addProperty(crtc_, "MODE_ID", 0);
+  request.addProperty(plane_, "CRTC_ID", 0);
+  request.addProperty(plane_, "FB_ID", 0);
+
+  if (int ret = request.commit(DRM::AtomicRequest::FlagAllowModeset); ret < 0) {
+    EPRINT("Failed to stop display pipeline: %s\n", strerror(-ret));
+    return ret;
+  }
+
+  queued_.reset();
+  for (std::unique_ptr<DRM::FrameBuffer>& buffer : buffers_)
+    buffer.reset();
+
+  return 0;
+}
+
+void KMSCompositor::frameAvailable() {
+  dirty_ = true;
+
+  /*
+   * Wait for the vblank if a composite is already on its way. Otherwise draw
+   * from the event loop, once all frames of a synchronized set have arrived.
+   */
+  if (queued_ || composePending_)
+    return;
+
+  composePending_ = true;
+  EventLoop::instance()->callLater([this]() {
+    composePending_ = false;
+    if (started_ && dirty_ && !queued_)
+      composeFrame();
+  });
+}
+
+void KMSCompositor::composeFrame() {
+  dirty_ = false;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::unique_ptr<Image::CpuAccess>> access;
+  std::vector<std::vector<Span<const uint8_t>>> inputs(inputs_.size());
+  for (unsigned int view = 0; view < inputs_.size(); ++view) {
+    Image* image = inputs_[view] ? inputs_[view]->image() : nullptr;
+    if (!image)
+      continue;
+
+    access.push_back(
+        std::make_unique<Image::CpuAccess>(image, Image::MapMode::ReadOnly));
+    for (unsigned int i = 0; i < image->numPlanes(); ++i)
+      inputs[view].push_back(image->data(i));
+  }
+
+  DRM::FrameBuffer* buffer = buffers_[back_].get();
+  uint8_t* frame = converter_ ? frame_.data() : buffer->data().data();
+  const size_t size = converter_ ? frame_.size() : buffer->data().size();
+
+  if (compositor_.compose(inputs, {Span<uint8_t>(frame, size)}) < 0)
+    return;
+
+  if (converter_)
+    converter_->convert({Span<const uint8_t>(frame, size)},
+                        buffer->data().data());
+
+  composeTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  ++frames_;
+
+  auto request = std::make_unique<DRM::AtomicRequest>(&dev_);
+  request->addProperty(plane_, "FB_ID", buffer->id());
+
+  if (!enabled_) {
+    /* Enable the display pipeline on the first composite. */
+    request->addProperty(connector_, "CRTC_ID", crtc_->id());
+    request->addProperty(plane_, "CRTC_ID", crtc_->id());
+
+    request->addProperty(plane_, "CRTC_X",
+                         (mode_->hdisplay - size_.width) / 2);
+    request->addProperty(plane_, "CRTC_Y",
+                         (mode_->vdisplay - size_.height) / 2);
+    request->addProperty(plane_, "CRTC_W", size_.width);
+    request->addProperty(plane_, "CRTC_H", size_.height);
+
+    request->addProperty(plane_, "SRC_X", 0);
+    request->addProperty(plane_, "SRC_Y", 0);
+    request->addProperty(plane_, "SRC_W", size_.width << 16);
+    request->addProperty(plane_, "SRC_H", size_.height << 16);
+  }
+
+  if (int ret = request->commit(DRM::AtomicRequest::FlagAsync); ret < 0) {
+    EPRINT("Failed to commit atomic request: %s\n", strerror(-ret));
+    return;
+  }
+
+  enabled_ = true;
+  queued_ = std::move(request);
+  back_ ^= 1;
+}
+
+void KMSCompositor::requestComplete(DRM::AtomicRequest* request) {
+  if (!queued_ || queued_.get() != request)
+    return;
+
+  /* The composite is on screen, draw the next one if there's news. */
+  queued_.reset();
+  if (started_ && dirty_)
+    composeFrame();
+}
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * kms_compositor.h - Display a composite of several cameras with KMS
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "compositor.h"
+#include "drm.h"
+
+class FormatConverter;
+class FrameSink;
+
+class KMSCompositor {
+ public:
+  KMSCompositor(const std::string& connectorName);
+  ~KMSCompositor();
+
+  void setLayout(const CompositorLayout& layout);
+  std::unique_ptr<FrameSink> createInput(unsigned int view);
+
+  int start();
+  int stop();
+
+ private:
+  class Input;
+
+  int selectPipeline();
+  void frameAvailable();
+  void composeFrame();
+  void requestComplete(DRM::AtomicRequest* request);
+
+  DRM::Device dev_;
+
+  const DRM::Connector* connector_ = nullptr;
+  const DRM::Crtc* crtc_ = nullptr;
+  const DRM::Plane* plane_ = nullptr;
+  const DRM::Mode* mode_ = nullptr;
+
+  libcamera::PixelFormat format_;
+  libcamera::Size size_;
+
+  CompositorLayout layout_;
+  Compositor compositor_;
+  std::vector<Input*> inputs_;
+
+  /* Composite in NV12 memory first when the plane can't scan out NV12. */
+  std::unique_ptr<FormatConverter> converter_;
+  std::vector<uint8_t> frame_;
+
+  /* Front and back buffers, a single commit is in flight at a time. */
+  std::unique_ptr<DRM::FrameBuffer> buffers_[2];
+  unsigned int back_ = 0;
+  std::unique_ptr<DRM::AtomicRequest> queued_;
+
+  bool started_ = false;
+  bool enabled_ = false;
+  bool dirty_ = false;
+  bool composePending_ = false;
+
+  uint64_t frames_ = 0;
+  uint64_t composeTime_ = 0;
+};
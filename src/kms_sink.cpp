@@ -7,12 +7,16 @@
 
 #include "kms_sink.h"
 
-#include <assert.h>
+#include <linux/sync_file.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <memory>
+#include <vector>
 
 #include <libcamera/camera.h>
 #include <libcamera/formats.h>
@@ -20,12 +24,49 @@
 #include <libcamera/stream.h>
 
 #include "drm.h"
+#include "event_loop.h"
+#include "frame_stamp.h"
 #include "twincam.h"
 #include "uptime.h"
 
-KMSSink::KMSSink(const std::string& connectorName) {
+namespace {
+
+/* Frames committed recently, whose stamp may be read back. */
+constexpr size_t kCapturedFrames = 32;
+
+/*
+ * Only one client can be DRM master and commit to the display, the sinks of
+ * all cameras share a single device.
+ */
+std::shared_ptr<DRM::Device> sharedDevice() {
+  static std::weak_ptr<DRM::Device> shared;
+
+  std::shared_ptr<DRM::Device> dev = shared.lock();
+  if (dev)
+    return dev;
+
+  dev = std::make_shared<DRM::Device>();
+  if (dev->init(opts.latency) < 0)
+    return nullptr;
+
+  shared = dev;
+
+  return dev;
+}
+
+} /* namespace */
+
+/*
+ * Display frames on \a connectorName, in column \a slot of \a slots equal
+ * columns when several cameras share the connector.
+ */
+KMSSink::KMSSink(const std::string& connectorName,
+                 unsigned int slot,
+                 unsigned int slots)
+    : slot_(slot), slots_(std::max(slots, 1u)) {
   PRINT_FUNC();
-  if (dev_.init() < 0)
+  dev_ = sharedDevice();
+  if (!dev_)
     return;
 
   /*
@@ -43,7 +84,27 @@ KMSSink::KMSSink(const std::string& connectorName) {
     return;
   }
 
-  dev_.requestComplete.connect(this, &KMSSink::requestComplete);
+  dev_->requestComplete.connect(this, &KMSSink::requestComplete);
+}
+
+KMSSink::~KMSSink() {
+  /* The device outlives the sink when other sinks share it. */
+  if (dev_)
+    dev_->requestComplete.disconnect(this);
+
+  if (crtcUser_)
+    --dev_->crtcUsers(crtc_).count;
+
+  for (Writeback& writeback : writebacks_) {
+    if (writeback.fence < 0)
+      continue;
+
+    EventLoop::instance()->removeFdEvent(writeback.fence);
+    close(writeback.fence);
+  }
+
+  if (dev_ && plane_)
+    dev_->releasePlane(plane_);
 }
 
 void KMSSink::findRequestedConnector(const std::string& connectorName) {
@@ -52,7 +113,7 @@ void KMSSink::findRequestedConnector(const std::string& connectorName) {
    * pick the first connected connector or, if no connector is connected,
    * the first connector with unknown status.
    */
-  for (const DRM::Connector& conn : dev_.connectors()) {
+  for (const DRM::Connector& conn : dev_->connectors()) {
     if (!connectorName.empty()) {
       if (conn.name() != connectorName)
         continue;
@@ -61,6 +122,10 @@ void KMSSink::findRequestedConnector(const std::string& connectorName) {
       return;
     }
 
+    /* Writeback connectors are listed with --latency, they show nothing. */
+    if (conn.connectorType() == DRM_MODE_CONNECTOR_WRITEBACK)
+      continue;
+
     if (conn.status() == DRM::Connector::Connected) {
       connector_ = &conn;
       return;
@@ -71,8 +136,12 @@ void KMSSink::findRequestedConnector(const std::string& connectorName) {
   }
 }
 
-void KMSSink::mapBuffer(libcamera::FrameBuffer* buffer) {
+void KMSSink::mapBuffer(const libcamera::Stream* stream,
+                        libcamera::FrameBuffer* buffer) {
   PRINT_FUNC();
+  if (stream != stream_)
+    return;
+
   std::array<uint32_t, 4> strides = {};
 
   /* \todo Should libcamera report per-plane strides ? */
@@ -98,7 +167,7 @@ void KMSSink::mapBuffer(libcamera::FrameBuffer* buffer) {
     strides[i] = stride_ * uvStrideMultiplier / 2;
 
   std::unique_ptr<DRM::FrameBuffer> drmBuffer =
-      dev_.createFrameBuffer(*buffer, format_, size_, strides);
+      dev_->createFrameBuffer(*buffer, format_, size_, strides);
   if (!drmBuffer)
     return;
 
@@ -111,11 +180,17 @@ int KMSSink::configure(const libcamera::CameraConfiguration& config) {
   if (!connector_)
     return -EINVAL;
 
+  if (crtcUser_)
+    --dev_->crtcUsers(crtc_).count;
+  crtcUser_ = false;
   crtc_ = nullptr;
+  if (plane_)
+    dev_->releasePlane(plane_);
   plane_ = nullptr;
   mode_ = nullptr;
 
   const libcamera::StreamConfiguration& cfg = config.at(0);
+  stream_ = cfg.stream();
 
   const std::vector<DRM::Mode>& modes = connector_->modes();
 
@@ -124,13 +199,108 @@ int KMSSink::configure(const libcamera::CameraConfiguration& config) {
 
   mode_ = &modes[0];
   size_ = cfg.size;
-  x_ = (mode_->hdisplay - size_.width) / 2;
-  y_ = (mode_->vdisplay - size_.height) / 2;
   stride_ = cfg.stride;
 
+  /* Shrink frames that don't fit their column, keeping the aspect ratio. */
+  const unsigned int column = mode_->hdisplay / slots_;
+  display_ = size_;
+  if (size_.width > column || size_.height > mode_->vdisplay) {
+    const double scale =
+        std::min(static_cast<double>(column) / size_.width,
+                 static_cast<double>(mode_->vdisplay) / size_.height);
+    display_ = libcamera::Size(static_cast<unsigned int>(size_.width * scale),
+                               static_cast<unsigned int>(size_.height * scale));
+  }
+
+  x_ = slot_ * column + (column - display_.width) / 2;
+  y_ = (mode_->vdisplay - display_.height) / 2;
+  crop_ = libcamera::Rectangle(0, 0, size_);
+
+  if (opts.latency) {
+    if (int ret = setupWriteback(); ret < 0)
+      return ret;
+  }
+
+  ++dev_->crtcUsers(crtc_).count;
+  crtcUser_ = true;
+
   PRINT("Using KMS plane %u, CRTC %u, connector %s (%u), mode %ux%u@%u\n",
         plane_->id(), crtc_->id(), connector_->name().c_str(), connector_->id(),
         mode_->hdisplay, mode_->vdisplay, mode_->vrefresh);
+  if (slots_ > 1)
+    PRINT("Sharing the display, %s frames shown as %s at %u,%u\n",
+          size_.toString().c_str(), display_.toString().c_str(), x_, y_);
+
+  return 0;
+}
+
+/*
+ * Flip frames with the plane rotation property, when the driver exposes the
+ * reflections or rotation needed. A 180 degree rotation may also be expressed
+ * as reflections along both axes.
+ */
+int KMSSink::setTransform(libcamera::Transform transform) {
+  PRINT_FUNC();
+  rotation_ = 0;
+  transform_ = libcamera::Transform::Identity;
+
+  if (transform == libcamera::Transform::Identity)
+    return 0;
+
+  const DRM::Property* property =
+      plane_ ? plane_->property("rotation") : nullptr;
+  if (!property || property->propertyType() != DRM::Property::TypeBitmask)
+    return -ENOTSUP;
+
+  std::vector<std::vector<std::string>> candidates;
+  switch (transform) {
+    case libcamera::Transform::HFlip:
+      candidates = {{"rotate-0", "reflect-x"}};
+      break;
+    case libcamera::Transform::VFlip:
+      candidates = {{"rotate-0", "reflect-y"}};
+      break;
+    case libcamera::Transform::Rot180:
+      candidates = {{"rotate-180"}, {"rotate-0", "reflect-x", "reflect-y"}};
+      break;
+    default:
+      return -ENOTSUP;
+  }
+
+  /* Bitmask property enums are keyed by bit number. */
+  for (const std::vector<std::string>& names : candidates) {
+    uint64_t value = 0;
+
+    for (const std::string& name : names) {
+      for (const auto& [bit, enumName] : property->enums()) {
+        if (enumName == name)
+          value |= 1ULL << bit;
+      }
+    }
+
+    if (static_cast<unsigned int>(__builtin_popcountll(value)) ==
+        names.size()) {
+      rotation_ = value;
+      transform_ = transform;
+      return 0;
+    }
+  }
+
+  return -ENOTSUP;
+}
+
+/*
+ * Zoom by scanning out only the crop rectangle of the frames, scaled up to the
+ * same area of the screen by the plane.
+ */
+int KMSSink::setCrop(const libcamera::Rectangle& crop) {
+  if (!crop.width || !crop.height || crop.x < 0 || crop.y < 0 ||
+      crop.x + crop.width > size_.width ||
+      crop.y + crop.height > size_.height)
+    return -EINVAL;
+
+  crop_ = crop;
+  cropChanged_ = true;
 
   return 0;
 }
@@ -162,28 +332,33 @@ int KMSSink::selectPipeline(const libcamera::PixelFormat& format) {
 
   /*
    * Find a CRTC and plane suitable for the request format and the
-   * connector at the end of the pipeline. Restrict the search to primary
-   * planes for now.
+   * connector at the end of the pipeline. The first camera on a connector
+   * uses the primary plane, the others sharing it use overlay planes.
    */
+  const DRM::Plane::Type type =
+      slot_ ? DRM::Plane::TypeOverlay : DRM::Plane::TypePrimary;
+
   for (const DRM::Encoder* encoder : connector_->encoders()) {
     for (const DRM::Crtc* crtc : encoder->possibleCrtcs()) {
       for (const DRM::Plane* plane : crtc->planes()) {
-        if (plane->planeType() != DRM::Plane::TypePrimary)
+        if (plane->planeType() != type)
+          continue;
+
+        libcamera::PixelFormat supported;
+        if (plane->supportsFormat(format))
+          supported = format;
+        else if (plane->supportsFormat(xFormat))
+          supported = xFormat;
+        else
+          continue;
+
+        if (!dev_->claimPlane(plane))
           continue;
 
-        if (plane->supportsFormat(format)) {
-          crtc_ = crtc;
-          plane_ = plane;
-          format_ = format;
-          return 0;
-        }
-
-        if (plane->supportsFormat(xFormat)) {
-          crtc_ = crtc;
-          plane_ = plane;
-          format_ = xFormat;
-          return 0;
-        }
+        crtc_ = crtc;
+        plane_ = plane;
+        format_ = supported;
+        return 0;
       }
     }
   }
@@ -203,27 +378,75 @@ int KMSSink::configurePipeline(const libcamera::PixelFormat& format) {
 }
 
 int KMSSink::stop() {
-  /* Display pipeline. */
-  DRM::AtomicRequest request(&dev_);
+  int ret = 0;
 
-  request.addProperty(connector_, "CRTC_ID", 0);
-  request.addProperty(crtc_, "ACTIVE", 0);
-  request.addProperty(crtc_, "MODE_ID", 0);
-  request.addProperty(plane_, "CRTC_ID", 0);
-  request.addProperty(plane_, "FB_ID", 0);
+  /*
+   * The last sink showing frames on the CRTC turns the display pipeline off.
+   * The others only turn their plane off, the overlays right away and the
+   * primary plane with the CRTC, as the overlays need it below them.
+   */
+  if (crtcUser_) {
+    DRM::Device::CrtcUsers& users = dev_->crtcUsers(crtc_);
+    const bool last = --users.count == 0;
+    crtcUser_ = false;
 
-  if (int ret = request.commit(DRM::AtomicRequest::FlagAllowModeset); ret < 0) {
-    EPRINT("Failed to stop display pipeline: %s\n", strerror(-ret));
-    return ret;
+    DRM::AtomicRequest request(dev_.get());
+    bool commit = false;
+
+    if (writeback_) {
+      request.addProperty(writeback_, "CRTC_ID", 0);
+      commit = true;
+    }
+
+    if (slot_ || last) {
+      request.addProperty(plane_, "CRTC_ID", 0);
+      request.addProperty(plane_, "FB_ID", 0);
+      commit = true;
+    } else {
+      users.planes.push_back(plane_);
+      for (auto& [buffer, drmBuffer] : buffers_)
+        users.buffers.push_back(std::move(drmBuffer));
+    }
+
+    if (last) {
+      for (const DRM::Plane* plane : users.planes) {
+        request.addProperty(plane, "CRTC_ID", 0);
+        request.addProperty(plane, "FB_ID", 0);
+      }
+      request.addProperty(connector_, "CRTC_ID", 0);
+      request.addProperty(crtc_, "ACTIVE", 0);
+      request.addProperty(crtc_, "MODE_ID", 0);
+    }
+
+    if (commit) {
+      ret = request.commit(DRM::AtomicRequest::FlagAllowModeset);
+      if (ret < 0)
+        EPRINT("Failed to stop display pipeline: %s\n", strerror(-ret));
+    }
+
+    if (last)
+      users = DRM::Device::CrtcUsers();
   }
 
-  /* Free all buffers. */
+  /* Free all buffers, even if the display couldn't be turned off. */
   pending_.reset();
   queued_.reset();
   active_.reset();
   buffers_.clear();
 
-  return 0;
+  if (writeback_) {
+    printLatency();
+    for (Writeback& writeback : writebacks_) {
+      if (writeback.fence >= 0) {
+        EventLoop::instance()->removeFdEvent(writeback.fence);
+        close(writeback.fence);
+      }
+      writeback = Writeback();
+    }
+    writeback_ = nullptr;
+  }
+
+  return ret;
 }
 
 bool KMSSink::processRequest(libcamera::Request* camRequest) {
@@ -234,57 +457,131 @@ bool KMSSink::processRequest(libcamera::Request* camRequest) {
   if (pending_)
     return true;
 
-  libcamera::FrameBuffer* buffer = camRequest->buffers().begin()->second;
+  libcamera::FrameBuffer* buffer = camRequest->findBuffer(stream_);
   auto iter = buffers_.find(buffer);
   if (iter == buffers_.end())
     return true;
 
   const DRM::FrameBuffer* drmBuffer = iter->second.get();
 
-  unsigned int flags = DRM::AtomicRequest::FlagAsync;
   std::unique_ptr<DRM::AtomicRequest> drmRequest =
-      std::make_unique<DRM::AtomicRequest>(&dev_);
+      std::make_unique<DRM::AtomicRequest>(dev_.get());
   drmRequest->addProperty(plane_, "FB_ID", drmBuffer->id());
 
-  if (!active_ && !queued_) {
+  /* Write the output back to a free buffer, frames are dropped otherwise. */
+  Writeback* writeback = nullptr;
+  if (writeback_) {
+    for (Writeback& candidate : writebacks_) {
+      if (!candidate.busy) {
+        writeback = &candidate;
+        break;
+      }
+    }
+  }
+
+  if (writeback) {
+    writeback->busy = true;
+    drmRequest->addProperty(writeback_, "WRITEBACK_FB_ID",
+                            writeback->buffer->id());
+    drmRequest->addProperty(writeback_, "WRITEBACK_OUT_FENCE_PTR",
+                            reinterpret_cast<uintptr_t>(&writeback->fence));
+
+    const libcamera::FrameMetadata& metadata = buffer->metadata();
+    captured_[metadata.sequence] = metadata.timestamp;
+    if (captured_.size() > kCapturedFrames)
+      captured_.erase(captured_.begin());
+  }
+
+  const bool enable = !active_ && !queued_;
+  if (enable) {
     /* Enable the display pipeline on the first frame. */
     drmRequest->addProperty(connector_, "CRTC_ID", crtc_->id());
+    drmRequest->addProperty(plane_, "CRTC_ID", crtc_->id());
 
-    drmRequest->addProperty(plane_, "SRC_X", 0 << 16);
-    drmRequest->addProperty(plane_, "SRC_Y", 0 << 16);
-    drmRequest->addProperty(plane_, "SRC_W", size_.width << 16);
-    drmRequest->addProperty(plane_, "SRC_H", size_.height << 16);
     drmRequest->addProperty(plane_, "CRTC_X", x_);
     drmRequest->addProperty(plane_, "CRTC_Y", y_);
-    drmRequest->addProperty(plane_, "CRTC_W", size_.width);
-    drmRequest->addProperty(plane_, "CRTC_H", size_.height);
+    drmRequest->addProperty(plane_, "CRTC_W", display_.width);
+    drmRequest->addProperty(plane_, "CRTC_H", display_.height);
+
+    if (rotation_)
+      drmRequest->addProperty(plane_, "rotation", rotation_);
+
+    cropChanged_ = true;
   }
 
+  /*
+   * The plane only fetches the source rectangle from memory, zooming costs
+   * neither CPU time nor bandwidth.
+   */
+  if (cropChanged_) {
+    drmRequest->addProperty(plane_, "SRC_X", crop_.x << 16);
+    drmRequest->addProperty(plane_, "SRC_Y", crop_.y << 16);
+    drmRequest->addProperty(plane_, "SRC_W", crop_.width << 16);
+    drmRequest->addProperty(plane_, "SRC_H", crop_.height << 16);
+    cropChanged_ = false;
+  }
+
+  /* Routing the writeback connector to the CRTC is a modeset. */
+  if (enable && writeback_)
+    drmRequest->addProperty(writeback_, "CRTC_ID", crtc_->id());
+
   pending_ = std::make_unique<Request>(std::move(drmRequest), camRequest);
+  pending_->writeback_ = writeback;
+  pending_->modeset_ = enable && writeback_;
 
   std::scoped_lock<std::mutex> lock(lock_);
 
-  if (!queued_) {
-    if (int ret = pending_->drmRequest_->commit(flags); ret < 0) {
-      EPRINT("Failed to commit atomic request: %s\n", strerror(-ret));
-      if (-ret == EACCES) {
-        EPRINT(
-            "You cannot use kms/drm sink while Desktop Environment is "
-            "running,\n"
-            "if you still have Gnome, XFCE, etc. running, you need to quit\n");
-      }
+  if (!queued_)
+    commitPending();
+
+  return false;
+}
+
+/*
+ * Commit the pending request. It stays pending if the CRTC is still busy with
+ * a commit of another camera sharing it, to be retried when that completes.
+ */
+void KMSSink::commitPending() {
+  unsigned int flags = DRM::AtomicRequest::FlagAsync;
+  if (pending_->modeset_)
+    flags |= DRM::AtomicRequest::FlagAllowModeset;
+
+  int ret = pending_->drmRequest_->commit(flags);
+  if (ret == -EBUSY && slots_ > 1)
+    return;
+
+  if (Writeback* writeback = pending_->writeback_) {
+    if (ret < 0 || writeback->fence < 0) {
+      writeback->busy = false;
+    } else {
+      EventLoop::instance()->addFdEvent(
+          writeback->fence, EventLoop::Read,
+          [this, writeback]() { writebackDone(writeback); });
     }
+  }
 
-    queued_ = std::move(pending_);
+  if (ret < 0) {
+    EPRINT("Failed to commit atomic request: %s\n", strerror(-ret));
+    if (-ret == EACCES) {
+      EPRINT(
+          "You cannot use kms/drm sink while Desktop Environment is "
+          "running,\n"
+          "if you still have Gnome, XFCE, etc. running, you need to quit\n");
+    }
   }
 
-  return false;
+  queued_ = std::move(pending_);
 }
 
 void KMSSink::requestComplete(DRM::AtomicRequest* const request) {
   const std::lock_guard lock(lock_);
 
-  assert(queued_ && queued_->drmRequest_.get() == request);
+  /* Sinks sharing the device are told about each other's requests. */
+  if (!queued_ || queued_->drmRequest_.get() != request) {
+    if (!queued_ && pending_)
+      commitPending();
+    return;
+  }
 
   /* Complete the active request, if any. */
   if (active_)
@@ -292,10 +589,149 @@ void KMSSink::requestComplete(DRM::AtomicRequest* const request) {
 
   /* The queued request becomes active. */
   active_ = std::move(queued_);
+  frameDisplayed.emit(active_->camRequest_);
 
   /* Queue the pending request, if any. */
-  if (pending_) {
-    pending_->drmRequest_->commit(DRM::AtomicRequest::FlagAsync);
-    queued_ = std::move(pending_);
+  if (pending_)
+    commitPending();
+}
+
+/*
+ * Find the writeback connector of the CRTC and allocate buffers of the mode
+ * size to read its output back, the first camera on the CRTC only.
+ */
+int KMSSink::setupWriteback() {
+  writeback_ = nullptr;
+  if (slot_)
+    return 0;
+
+  for (const DRM::Connector& conn : dev_->connectors()) {
+    if (conn.connectorType() != DRM_MODE_CONNECTOR_WRITEBACK)
+      continue;
+
+    for (const DRM::Encoder* encoder : conn.encoders()) {
+      const std::vector<const DRM::Crtc*>& crtcs = encoder->possibleCrtcs();
+      if (std::find(crtcs.begin(), crtcs.end(), crtc_) != crtcs.end())
+        writeback_ = &conn;
+    }
   }
+
+  if (!writeback_) {
+    EPRINT("No writeback connector on CRTC %u to measure latency\n",
+           crtc_->id());
+    return -ENODEV;
+  }
+
+  const libcamera::Size size(mode_->hdisplay, mode_->vdisplay);
+  for (Writeback& writeback : writebacks_) {
+    writeback = Writeback();
+    writeback.buffer =
+        dev_->createDumbFrameBuffer(libcamera::formats::XRGB8888, size);
+    if (!writeback.buffer) {
+      writeback_ = nullptr;
+      return -ENOMEM;
+    }
+  }
+
+  captured_.clear();
+  latencies_.clear();
+  unreadable_ = 0;
+
+  PRINT("Measuring latency through writeback connector %s\n",
+        writeback_->name().c_str());
+
+  return 0;
+}
+
+/*
+ * The output of a commit was written back. The fence tells when, in the
+ * CLOCK_MONOTONIC time base of the capture timestamps.
+ */
+void KMSSink::writebackDone(Writeback* writeback) {
+  struct sync_fence_info fence = {};
+  struct sync_file_info info = {};
+  info.num_fences = 1;
+  info.sync_fence_info = reinterpret_cast<uintptr_t>(&fence);
+
+  uint64_t done = 0;
+  if (!ioctl(writeback->fence, SYNC_IOC_FILE_INFO, &info))
+    done = fence.timestamp_ns;
+  if (!done)
+    done = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+               .count();
+
+  EventLoop::instance()->removeFdEvent(writeback->fence);
+  close(writeback->fence);
+  writeback->fence = -1;
+  writeback->busy = false;
+
+  const int stamp = readStamp(*writeback);
+  for (auto iter = captured_.rbegin(); stamp >= 0 && iter != captured_.rend();
+       ++iter) {
+    if ((iter->first & 0xffff) != static_cast<unsigned int>(stamp))
+      continue;
+
+    latencies_.push_back(done - iter->second);
+    return;
+  }
+
+  ++unreadable_;
+}
+
+/* Sequence stamped in the frame on screen, -1 if it can't be read. */
+int KMSSink::readStamp(const Writeback& writeback) const {
+  const libcamera::Span<uint8_t> data = writeback.buffer->data();
+  const unsigned int stride = writeback.buffer->stride();
+  const bool hflip = transform_ == libcamera::Transform::HFlip ||
+                     transform_ == libcamera::Transform::Rot180;
+  const bool vflip = transform_ == libcamera::Transform::VFlip ||
+                     transform_ == libcamera::Transform::Rot180;
+  uint32_t bits = 0;
+
+  for (unsigned int bit = 0; bit < FrameStamp::kBits; ++bit) {
+    libcamera::Point point = FrameStamp::bitPosition(size_, bit);
+    if (hflip)
+      point.x = size_.width - 1 - point.x;
+    if (vflip)
+      point.y = size_.height - 1 - point.y;
+
+    if (point.x < crop_.x || point.y < crop_.y ||
+        point.x >= crop_.x + static_cast<int>(crop_.width) ||
+        point.y >= crop_.y + static_cast<int>(crop_.height))
+      return -1;
+
+    const size_t x = x_ + static_cast<size_t>(point.x - crop_.x) *
+                              display_.width / crop_.width;
+    const size_t y = y_ + static_cast<size_t>(point.y - crop_.y) *
+                              display_.height / crop_.height;
+    const size_t offset = y * stride + x * 4;
+    if (offset + 4 > data.size())
+      return -1;
+
+    /* XRGB8888 is stored B, G, R, X. */
+    const uint8_t* pixel = data.data() + offset;
+    if (pixel[0] + 5 * pixel[1] + 2 * pixel[2] > 8 * 128)
+      bits |= 1u << bit;
+  }
+
+  return FrameStamp::decode(bits);
+}
+
+void KMSSink::printLatency() const {
+  if (latencies_.empty()) {
+    PRINT("Latency: no frame read back, %u unreadable\n", unreadable_);
+    return;
+  }
+
+  std::vector<uint64_t> sorted = latencies_;
+  std::sort(sorted.begin(), sorted.end());
+  const auto percentile = [&sorted](unsigned int percent) {
+    return sorted[(sorted.size() - 1) * percent / 100] / 1000000.0;
+  };
+
+  PRINT("Latency of %zu frames: min %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f "
+        "ms, %u unreadable\n",
+        sorted.size(), percentile(0), percentile(50), percentile(90),
+        percentile(99), percentile(100), unreadable_);
 }
@@ -7,33 +7,50 @@
 
 #pragma once
 
+#include <array>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <libcamera/base/signal.h>
 
 #include <libcamera/camera.h>
 #include <libcamera/geometry.h>
 #include <libcamera/pixel_format.h>
+#include <libcamera/transform.h>
 
 #include "drm.h"
 #include "frame_sink.h"
 
 class KMSSink : public FrameSink {
  public:
-  KMSSink(const std::string& connectorName);
+  KMSSink(const std::string& connectorName,
+          unsigned int slot = 0,
+          unsigned int slots = 1);
+  ~KMSSink();
 
-  void mapBuffer(libcamera::FrameBuffer* buffer) override;
+  void mapBuffer(const libcamera::Stream* stream,
+                 libcamera::FrameBuffer* buffer) override;
 
   int configure(const libcamera::CameraConfiguration& config) override;
+  int setTransform(libcamera::Transform transform) override;
+  int setCrop(const libcamera::Rectangle& crop) override;
   int stop() override;
 
   bool processRequest(libcamera::Request* request) override;
 
  private:
+  /* Buffer the CRTC output is written back to, busy until its fence. */
+  struct Writeback {
+    std::unique_ptr<DRM::FrameBuffer> buffer;
+    int fence = -1;
+    bool busy = false;
+  };
+
   class Request {
    public:
     Request(std::unique_ptr<DRM::AtomicRequest> drmRequest,
@@ -42,28 +59,62 @@ class KMSSink : public FrameSink {
 
     std::unique_ptr<DRM::AtomicRequest> drmRequest_;
     libcamera::Request* camRequest_;
+    Writeback* writeback_ = nullptr;
+    bool modeset_ = false;
   };
 
   int selectPipeline(const libcamera::PixelFormat& format);
   int configurePipeline(const libcamera::PixelFormat& format);
+  void commitPending();
   void requestComplete(DRM::AtomicRequest* const request);
   void findRequestedConnector(const std::string& connectorName);
+  int setupWriteback();
+  void writebackDone(Writeback* writeback);
+  int readStamp(const Writeback& writeback) const;
+  void printLatency() const;
+
+  std::shared_ptr<DRM::Device> dev_;
+
+  /* Column of the screen showing the frames, out of slots_ equal columns. */
+  unsigned int slot_;
+  unsigned int slots_;
 
-  DRM::Device dev_;
+  /* Counted in the users of crtc_, from configure() until stop(). */
+  bool crtcUser_ = false;
 
   const DRM::Connector* connector_ = nullptr;
   const DRM::Crtc* crtc_ = nullptr;
   const DRM::Plane* plane_ = nullptr;
   const DRM::Mode* mode_ = nullptr;
 
+  const libcamera::Stream* stream_ = nullptr;
   libcamera::PixelFormat format_;
   libcamera::Size size_;
   unsigned int stride_;
   unsigned int x_;  // Where to start drawing camera output
   unsigned int y_;  // Where to start drawing camera output
+  libcamera::Size display_;  // Size of the camera output on screen
+
+  /* Value of the plane rotation property, 0 to leave it untouched. */
+  uint64_t rotation_ = 0;
+  libcamera::Transform transform_ = libcamera::Transform::Identity;
+
+  /* Source rectangle scanned out, updated on the next commit if changed. */
+  libcamera::Rectangle crop_;
+  bool cropChanged_ = false;
 
   std::map<libcamera::FrameBuffer*, std::unique_ptr<DRM::FrameBuffer>> buffers_;
 
+  /*
+   * Latency measurement with --latency, from the capture timestamps of the
+   * last frames committed to the sequence stamped in the frame written back.
+   */
+  const DRM::Connector* writeback_ = nullptr;
+  std::array<Writeback, 2> writebacks_;
+  std::map<uint32_t, uint64_t> captured_;
+  std::vector<uint64_t> latencies_;
+  unsigned int unreadable_ = 0;
+
   std::mutex lock_;
   std::unique_ptr<Request> pending_;
   std::unique_ptr<Request> queued_;
@@ -0,0 +1,473 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * lens_remap.cpp - Lens distortion correction with a precomputed remap table
+ */
+
+#include "lens_remap.h"
+#include "cpu_features.h"
+#include "frame_planes.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+#include "worker_pool.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+/* Output tiles, sized so that the source samples they read stay in cache. */
+constexpr unsigned int kTileWidth = 64;
+constexpr unsigned int kTileHeight = 16;
+
+/* Q4 fixed-point positions must fit in 16 bits. */
+constexpr unsigned int kMaxSize = 4096;
+
+void remapSamples(const uint8_t* src,
+                  unsigned int stride,
+                  const uint32_t* map,
+                  uint8_t* dst,
+                  unsigned int count,
+                  uint8_t fill,
+                  unsigned int bytes) {
+  for (unsigned int i = 0; i < count; ++i) {
+    const uint32_t position = map[i];
+    if (position == kInvalidPosition) {
+      for (unsigned int c = 0; c < bytes; ++c)
+        dst[i * bytes + c] = fill;
+      continue;
+    }
+
+    const unsigned int x = position & 0xffff;
+    const unsigned int y = position >> 16;
+    const unsigned int fx = x & 15;
+    const unsigned int fy = y & 15;
+    const uint8_t* p = src + (y >> 4) * stride + (x >> 4) * bytes;
+
+    for (unsigned int c = 0; c < bytes; ++c) {
+      const unsigned int h0 = p[c] * (16 - fx) + p[c + bytes] * fx;
+      const unsigned int h1 =
+          p[c + stride] * (16 - fx) + p[c + stride + bytes] * fx;
+      dst[i * bytes + c] = (h0 * (16 - fy) + h1 * fy + 128) >> 8;
+    }
+  }
+}
+
+void remap8(const uint8_t* src,
+            unsigned int stride,
+            const uint32_t* map,
+            uint8_t* dst,
+            unsigned int count,
+            uint8_t fill) {
+  remapSamples(src, stride, map, dst, count, fill, 1);
+}
+
+void remap16(const uint8_t* src,
+             unsigned int stride,
+             const uint32_t* map,
+             uint8_t* dst,
+             unsigned int count,
+             uint8_t fill) {
+  remapSamples(src, stride, map, dst, count, fill, 2);
+}
+
+const LensRemapKernels& bestKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::SSE2))
+    return sse2RemapKernels;
+#elif defined(__arm__) || defined(__aarch64__)
+  if (CpuFeatures::has(CpuFeatures::NEON))
+    return neonRemapKernels;
+#endif
+
+  return scalarRemapKernels;
+}
+
+/*
+ * Apply the lens model to the normalized position (x, y) of an undistorted
+ * ray, following the OpenCV pinhole and fisheye camera models.
+ */
+void distort(const LensCalibration& calibration, double* x, double* y) {
+  const double* k = calibration.k;
+  const double r2 = *x * *x + *y * *y;
+
+  if (calibration.model == LensCalibration::Model::Fisheye) {
+    const double r = sqrt(r2);
+    if (r < 1e-9)
+      return;
+
+    const double theta = atan(r);
+    const double theta2 = theta * theta;
+    const double polynomial =
+        k[0] + theta2 * (k[1] + theta2 * (k[2] + theta2 * k[3]));
+    const double thetaD = theta * (1 + theta2 * polynomial);
+
+    *x *= thetaD / r;
+    *y *= thetaD / r;
+    return;
+  }
+
+  const double* p = calibration.p;
+  const double radial = 1 + r2 * (k[0] + r2 * (k[1] + r2 * k[2]));
+  const double xy = *x * *y;
+  const double xd = *x * radial + 2 * p[0] * xy + p[1] * (r2 + 2 * *x * *x);
+  const double yd = *y * radial + p[0] * (r2 + 2 * *y * *y) + 2 * p[1] * xy;
+
+  *x = xd;
+  *y = yd;
+}
+
+} /* namespace */
+
+const LensRemapKernels scalarRemapKernels = {
+    "scalar",
+    remap8,
+    remap16,
+};
+
+/*
+ * Load lens calibration parameters from a text file of "key value" lines,
+ * with # starting comments. Keys follow the OpenCV naming:
+ *
+ *   model fisheye        pinhole (default) or fisheye
+ *   size 1920x1080       frame size the calibration was done at
+ *   fx 1050.2            camera matrix, cx and cy default to the center
+ *   fy 1049.7
+ *   cx 961.4
+ *   cy 538.9
+ *   k1 -0.012            radial coefficients k1 to k4
+ *   p1 0.0001            tangential coefficients p1 and p2, pinhole only
+ *   scale 0.8            zoom of the corrected frames, below 1 to keep the
+ *                        corners of wide-angle lenses
+ */
+int LensCalibration::load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    EPRINT("Failed to open lens calibration %s\n", path.c_str());
+    return -ENOENT;
+  }
+
+  *this = LensCalibration();
+  cx = -1.0;
+  cy = -1.0;
+
+  unsigned int number = 0;
+  for (std::string line; std::getline(file, line);) {
+    ++number;
+    line = line.substr(0, line.find('#'));
+
+    std::istringstream stream(line);
+    std::string key;
+    std::string value;
+    if (!(stream >> key))
+      continue;
+
+    bool valid = static_cast<bool>(stream >> value);
+    if (valid) {
+      char* end = nullptr;
+      const double parsed = strtod(value.c_str(), &end);
+      const bool isNumber = end && !*end;
+
+      if (key == "model") {
+        if (value == "pinhole")
+          model = Model::Pinhole;
+        else if (value == "fisheye")
+          model = Model::Fisheye;
+        else
+          valid = false;
+      } else if (key == "size") {
+        valid = sscanf(value.c_str(), "%ux%u", &size.width, &size.height) == 2;
+      } else if (key == "fx") {
+        fx = parsed;
+        valid = isNumber;
+      } else if (key == "fy") {
+        fy = parsed;
+        valid = isNumber;
+      } else if (key == "cx") {
+        cx = parsed;
+        valid = isNumber;
+      } else if (key == "cy") {
+        cy = parsed;
+        valid = isNumber;
+      } else if (key.size() == 2 && key[0] == 'k' && key[1] >= '1' &&
+                 key[1] <= '4') {
+        k[key[1] - '1'] = parsed;
+        valid = isNumber;
+      } else if (key == "p1" || key == "p2") {
+        p[key[1] - '1'] = parsed;
+        valid = isNumber;
+      } else if (key == "scale") {
+        scale = parsed;
+        valid = isNumber && scale > 0.0;
+      } else {
+        valid = false;
+      }
+    }
+
+    if (!valid) {
+      EPRINT("%s:%u: invalid line '%s'\n", path.c_str(), number, line.c_str());
+      return -EINVAL;
+    }
+  }
+
+  if (!size.width || !size.height || fx <= 0.0 || fy <= 0.0) {
+    EPRINT("%s: size, fx and fy are required\n", path.c_str());
+    return -EINVAL;
+  }
+
+  if (cx < 0.0)
+    cx = (size.width - 1) / 2.0;
+  if (cy < 0.0)
+    cy = (size.height - 1) / 2.0;
+
+  return 0;
+}
+
+/*
+ * Move the pixel at (\a x, \a y) in a corrected frame of the calibration size
+ * to the position it is seen at in the distorted frame.
+ */
+void LensCalibration::distortPixel(double* x, double* y) const {
+  const double fxScaled = fx * scale;
+  const double fyScaled = fy * scale;
+
+  double nx = (*x - cx) / fxScaled;
+  double ny = (*y - cy) / fyScaled;
+
+  distort(*this, &nx, &ny);
+
+  *x = fx * nx + cx;
+  *y = fy * ny + cy;
+}
+
+/**
+ * \class LensRemap
+ * \brief Correct lens distortion of YUV 4:2:0 frames
+ *
+ * configure() computes, once, the position in the distorted source frame of
+ * every sample of the corrected frame, for the luma and chroma planes
+ * separately, and stores them in Q4 fixed point in 4 bytes per sample. The
+ * per-frame work is then a table lookup and a bilinear interpolation with
+ * integer weights, without any floating point.
+ *
+ * The output is processed in tiles of kTileWidth x kTileHeight samples. A tile
+ * reads from a small, compact region of the source even where the lens bends
+ * rows strongly, which keeps the source samples in cache instead of streaming
+ * whole distorted rows through it. Bands of tile rows are spread over a
+ * worker pool.
+ *
+ * Samples that map outside the source frame are set to black.
+ */
+LensRemap::LensRemap() = default;
+
+LensRemap::~LensRemap() = default;
+
+bool LensRemap::isSupported(const PixelFormat& format) {
+  switch (format) {
+    case formats::NV12:
+    case formats::NV21:
+    case formats::YUV420:
+    case formats::YVU420:
+      return true;
+    default:
+      return false;
+  }
+}
+
+int LensRemap::configure(const StreamConfiguration& cfg,
+                         const LensCalibration& calibration) {
+  const unsigned int width = cfg.size.width;
+  const unsigned int height = cfg.size.height;
+
+  if (!isSupported(cfg.pixelFormat)) {
+    EPRINT("Cannot correct lens distortion of %s frames\n",
+           cfg.pixelFormat.toString().c_str());
+    return -ENOTSUP;
+  }
+
+  if (width < 4 || height < 4 || width > kMaxSize || height > kMaxSize ||
+      width % 2 || height % 2) {
+    EPRINT("Cannot correct lens distortion of %ux%u frames\n", width, height);
+    return -EINVAL;
+  }
+
+  format_ = cfg.pixelFormat;
+  size_ = cfg.size;
+  planes_.clear();
+
+  addPlane(width, height, cfg.stride, 1, false, 16);
+  if (format_ == formats::NV12 || format_ == formats::NV21) {
+    addPlane(width / 2, height / 2, cfg.stride, 2, true, 128);
+  } else {
+    addPlane(width / 2, height / 2, cfg.stride / 2, 2, false, 128);
+    addPlane(width / 2, height / 2, cfg.stride / 2, 2, false, 128);
+  }
+
+  for (Plane& plane : planes_) {
+    /* The chroma planes of planar formats share a table. */
+    if (&plane != &planes_[0] && planes_[1].map) {
+      plane.map = planes_[1].map;
+      continue;
+    }
+
+    plane.map = std::make_shared<const std::vector<uint32_t>>(
+        buildMap(plane, calibration));
+  }
+
+  kernels_ = &bestKernels();
+  workers_ = WorkerPool::instance();
+
+  VERBOSE_PRINT(
+      "Correcting lens distortion of %s frames with %s kernels, %zu kB of "
+      "tables\n",
+      format_.toString().c_str(), kernels_->name, tableSize() / 1000);
+
+  return 0;
+}
+
+void LensRemap::addPlane(unsigned int width,
+                         unsigned int height,
+                         unsigned int stride,
+                         unsigned int subsampling,
+                         bool interleaved,
+                         uint8_t fill) {
+  planes_.push_back(
+      {width, height, stride, subsampling, interleaved, fill, nullptr});
+}
+
+/*
+ * Compute the source position of each sample of \a plane. Sample centers are
+ * converted to the pixel coordinates of the calibration, undistorted rays are
+ * projected through the lens model, and the result is converted back.
+ */
+std::vector<uint32_t> LensRemap::buildMap(
+    const Plane& plane,
+    const LensCalibration& calibration) const {
+  /* Scale from plane samples to calibration pixels, both center based. */
+  const double toCalibrationX = static_cast<double>(plane.subsampling) *
+                                calibration.size.width / size_.width;
+  const double toCalibrationY = static_cast<double>(plane.subsampling) *
+                                calibration.size.height / size_.height;
+
+  /* Keep the right and bottom neighbours inside the plane. */
+  const long maxX = (plane.width - 1) * 16 - 1;
+  const long maxY = (plane.height - 1) * 16 - 1;
+
+  std::vector<uint32_t> map(static_cast<size_t>(plane.width) * plane.height);
+
+  for (unsigned int v = 0; v < plane.height; ++v) {
+    for (unsigned int u = 0; u < plane.width; ++u) {
+      double x = (u + 0.5) * toCalibrationX - 0.5;
+      double y = (v + 0.5) * toCalibrationY - 0.5;
+
+      calibration.distortPixel(&x, &y);
+
+      const double sx = (x + 0.5) / toCalibrationX - 0.5;
+      const double sy = (y + 0.5) / toCalibrationY - 0.5;
+
+      uint32_t& position = map[static_cast<size_t>(v) * plane.width + u];
+      if (!(sx >= 0.0 && sx <= plane.width - 1 && sy >= 0.0 &&
+            sy <= plane.height - 1)) {
+        position = kInvalidPosition;
+        continue;
+      }
+
+      const uint32_t qx = std::min(lround(sx * 16), maxX);
+      const uint32_t qy = std::min(lround(sy * 16), maxY);
+      position = qx | qy << 16;
+    }
+  }
+
+  return map;
+}
+
+size_t LensRemap::tableSize() const {
+  size_t size = 0;
+  const std::vector<uint32_t>* previous = nullptr;
+
+  for (const Plane& plane : planes_) {
+    if (plane.map.get() == previous)
+      continue;
+
+    size += plane.map->size() * sizeof(uint32_t);
+    previous = plane.map.get();
+  }
+
+  return size;
+}
+
+void LensRemap::remapRows(const Plane& plane,
+                          const uint8_t* src,
+                          uint8_t* dst,
+                          unsigned int begin,
+                          unsigned int end) const {
+  auto kernel = plane.interleaved ? kernels_->remap16 : kernels_->remap8;
+  const unsigned int bytes = plane.interleaved ? 2 : 1;
+  const uint32_t* map = plane.map->data();
+
+  for (unsigned int y0 = begin; y0 < end; y0 += kTileHeight) {
+    const unsigned int y1 = std::min(y0 + kTileHeight, end);
+
+    for (unsigned int x0 = 0; x0 < plane.width; x0 += kTileWidth) {
+      const unsigned int count = std::min(kTileWidth, plane.width - x0);
+
+      for (unsigned int y = y0; y < y1; ++y) {
+        kernel(src, plane.stride,
+               map + static_cast<size_t>(y) * plane.width + x0,
+               dst + static_cast<size_t>(y) * plane.stride + x0 * bytes, count,
+               plane.fill);
+      }
+    }
+  }
+}
+
+/*
+ * Correct the frame in \a src into \a dst, which must not overlap. Returns 0
+ * on success or a negative error code.
+ */
+int LensRemap::remap(const std::vector<Span<const uint8_t>>& src,
+                     const std::vector<Span<uint8_t>>& dst) {
+  if (!kernels_)
+    return -EINVAL;
+
+  std::vector<size_t> sizes;
+  for (const Plane& plane : planes_)
+    sizes.push_back(static_cast<size_t>(plane.stride) * plane.height);
+
+  std::vector<const uint8_t*> in;
+  std::vector<uint8_t*> out;
+  if (splitPlanes(src, sizes, &in) < 0 || splitPlanes(dst, sizes, &out) < 0) {
+    EPRINT("Frame too small for %s\n", format_.toString().c_str());
+    return -EINVAL;
+  }
+
+  /* A few bands per thread, in whole tiles, to even out the load. */
+  const unsigned int bands = workers_->size() * 4;
+
+  for (unsigned int p = 0; p < planes_.size(); ++p) {
+    const Plane& plane = planes_[p];
+    const unsigned int tiles = (plane.height + kTileHeight - 1) / kTileHeight;
+    const unsigned int tilesPerBand = std::max(1u, (tiles + bands - 1) / bands);
+
+    for (unsigned int y = 0; y < plane.height;
+         y += tilesPerBand * kTileHeight) {
+      const unsigned int end =
+          std::min(y + tilesPerBand * kTileHeight, plane.height);
+      workers_->run(batch_,
+                    [this, &plane, src = in[p], dst = out[p], y, end]() {
+                      remapRows(plane, src, dst, y, end);
+                    });
+    }
+  }
+
+  workers_->wait(batch_);
+
+  return 0;
+}
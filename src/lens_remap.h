@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * lens_remap.h - Lens distortion correction with a precomputed remap table
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "lens_remap_kernels.h"
+#include "worker_pool.h"
+
+struct LensCalibration {
+  enum class Model {
+    Pinhole,
+    Fisheye,
+  };
+
+  int load(const std::string& path);
+  void distortPixel(double* x, double* y) const;
+
+  Model model = Model::Pinhole;
+  libcamera::Size size;
+
+  /* Camera matrix, in pixels of a frame of the calibration size. */
+  double fx = 0.0;
+  double fy = 0.0;
+  double cx = 0.0;
+  double cy = 0.0;
+
+  /* Radial coefficients, k4 is only used by the fisheye model. */
+  double k[4] = {};
+  /* Tangential coefficients of the pinhole model. */
+  double p[2] = {};
+
+  /* Focal length of the corrected frames, relative to fx and fy. */
+  double scale = 1.0;
+};
+
+class LensRemap {
+ public:
+  LensRemap();
+  ~LensRemap();
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const libcamera::StreamConfiguration& cfg,
+                const LensCalibration& calibration);
+
+  const char* kernelsName() const { return kernels_ ? kernels_->name : ""; }
+  size_t tableSize() const;
+
+  int remap(const std::vector<libcamera::Span<const uint8_t>>& src,
+            const std::vector<libcamera::Span<uint8_t>>& dst);
+
+ private:
+  struct Plane {
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;
+    unsigned int subsampling;
+    bool interleaved;
+    uint8_t fill;
+    std::shared_ptr<const std::vector<uint32_t>> map;
+  };
+
+  void addPlane(unsigned int width,
+                unsigned int height,
+                unsigned int stride,
+                unsigned int subsampling,
+                bool interleaved,
+                uint8_t fill);
+  std::vector<uint32_t> buildMap(const Plane& plane,
+                                 const LensCalibration& calibration) const;
+  void remapRows(const Plane& plane,
+                 const uint8_t* src,
+                 uint8_t* dst,
+                 unsigned int begin,
+                 unsigned int end) const;
+
+  libcamera::PixelFormat format_;
+  libcamera::Size size_;
+  std::vector<Plane> planes_;
+
+  const LensRemapKernels* kernels_ = nullptr;
+  WorkerPool* workers_ = nullptr;
+  WorkerPool::Batch batch_;
+};
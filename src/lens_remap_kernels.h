@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * lens_remap_kernels.h - Row kernels used by LensRemap
+ *
+ * Each output sample has a map entry holding the source position in Q4 fixed
+ * point, x in the low 16 bits and y in the high 16 bits, or kInvalidPosition
+ * for samples that fall outside the source. Positions are clamped when the
+ * map is built so that the four samples read by bilinear interpolation are
+ * always inside the plane. Weights are products of the Q4 fractions and sum to
+ * 256, so weighted sums fit in 16 bits. All implementations produce exactly the
+ * output of the scalar kernels.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+constexpr uint32_t kInvalidPosition = 0xffffffff;
+
+struct LensRemapKernels {
+  const char* name;
+
+  /*
+   * Interpolate count samples of 1 or 2 bytes (interleaved chroma) into dst,
+   * writing fill to the bytes of samples with an invalid position.
+   */
+  void (*remap8)(const uint8_t* src,
+                 unsigned int stride,
+                 const uint32_t* map,
+                 uint8_t* dst,
+                 unsigned int count,
+                 uint8_t fill);
+  void (*remap16)(const uint8_t* src,
+                  unsigned int stride,
+                  const uint32_t* map,
+                  uint8_t* dst,
+                  unsigned int count,
+                  uint8_t fill);
+};
+
+extern const LensRemapKernels scalarRemapKernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const LensRemapKernels sse2RemapKernels;
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+extern const LensRemapKernels neonRemapKernels;
+#endif
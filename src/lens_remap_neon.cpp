@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * lens_remap_neon.cpp - NEON row kernels for LensRemap
+ */
+
+#include "lens_remap_kernels.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+#include <string.h>
+
+namespace {
+
+/*
+ * Samples are gathered in horizontal pairs with 16-bit loads, one pair from
+ * each of the two source rows, and interpolated eight at a time. Samples with
+ * an invalid position read a pair of fill values with zero fractions.
+ */
+void remap8(const uint8_t* src,
+            unsigned int stride,
+            const uint32_t* map,
+            uint8_t* dst,
+            unsigned int count,
+            uint8_t fill) {
+  const uint8_t fillPair[2] = {fill, fill};
+  const uint16x8_t sixteen = vdupq_n_u16(16);
+  unsigned int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    uint16_t top[8];
+    uint16_t bottom[8];
+    uint16_t fx[8];
+    uint16_t fy[8];
+
+    for (unsigned int k = 0; k < 8; ++k) {
+      const uint32_t position = map[i + k];
+      const uint8_t* row0 = fillPair;
+      const uint8_t* row1 = fillPair;
+      fx[k] = 0;
+      fy[k] = 0;
+
+      if (position != kInvalidPosition) {
+        const unsigned int x = position & 0xffff;
+        const unsigned int y = position >> 16;
+        row0 = src + (y >> 4) * stride + (x >> 4);
+        row1 = row0 + stride;
+        fx[k] = x & 15;
+        fy[k] = y & 15;
+      }
+
+      memcpy(&top[k], row0, 2);
+      memcpy(&bottom[k], row1, 2);
+    }
+
+    const uint16x8_t t = vld1q_u16(top);
+    const uint16x8_t b = vld1q_u16(bottom);
+    const uint16x8_t wx1 = vld1q_u16(fx);
+    const uint16x8_t wy1 = vld1q_u16(fy);
+    const uint16x8_t wx0 = vsubq_u16(sixteen, wx1);
+    const uint16x8_t wy0 = vsubq_u16(sixteen, wy1);
+    const uint16x8_t lowBytes = vdupq_n_u16(0x00ff);
+
+    const uint16x8_t h0 =
+        vmlaq_u16(vmulq_u16(vandq_u16(t, lowBytes), wx0), vshrq_n_u16(t, 8),
+                  wx1);
+    const uint16x8_t h1 =
+        vmlaq_u16(vmulq_u16(vandq_u16(b, lowBytes), wx0), vshrq_n_u16(b, 8),
+                  wx1);
+
+    /* At most 255 * 256, vrshrn adds the rounding term. */
+    const uint16x8_t sum = vmlaq_u16(vmulq_u16(h0, wy0), h1, wy1);
+    vst1_u8(dst + i, vrshrn_n_u16(sum, 8));
+  }
+
+  scalarRemapKernels.remap8(src, stride, map + i, dst + i, count - i, fill);
+}
+
+void remap16(const uint8_t* src,
+             unsigned int stride,
+             const uint32_t* map,
+             uint8_t* dst,
+             unsigned int count,
+             uint8_t fill) {
+  scalarRemapKernels.remap16(src, stride, map, dst, count, fill);
+}
+
+} /* namespace */
+
+const LensRemapKernels neonRemapKernels = {
+    "NEON",
+    remap8,
+    remap16,
+};
+
+#endif /* __ARM_NEON */
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * lens_remap_sse2.cpp - SSE2 row kernels for LensRemap
+ */
+
+#include "lens_remap_kernels.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+#include <string.h>
+
+namespace {
+
+/*
+ * Samples are gathered in horizontal pairs with 16-bit loads, one pair from
+ * each of the two source rows, and interpolated eight at a time. Samples with
+ * an invalid position read a pair of fill values with zero fractions.
+ */
+void remap8(const uint8_t* src,
+            unsigned int stride,
+            const uint32_t* map,
+            uint8_t* dst,
+            unsigned int count,
+            uint8_t fill) {
+  const uint8_t fillPair[2] = {fill, fill};
+  const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+  const __m128i sixteen = _mm_set1_epi16(16);
+  const __m128i round = _mm_set1_epi16(128);
+  unsigned int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    alignas(16) uint16_t top[8];
+    alignas(16) uint16_t bottom[8];
+    alignas(16) uint16_t fx[8];
+    alignas(16) uint16_t fy[8];
+
+    for (unsigned int k = 0; k < 8; ++k) {
+      const uint32_t position = map[i + k];
+      const uint8_t* row0 = fillPair;
+      const uint8_t* row1 = fillPair;
+      fx[k] = 0;
+      fy[k] = 0;
+
+      if (position != kInvalidPosition) {
+        const unsigned int x = position & 0xffff;
+        const unsigned int y = position >> 16;
+        row0 = src + (y >> 4) * stride + (x >> 4);
+        row1 = row0 + stride;
+        fx[k] = x & 15;
+        fy[k] = y & 15;
+      }
+
+      memcpy(&top[k], row0, 2);
+      memcpy(&bottom[k], row1, 2);
+    }
+
+    const __m128i t = _mm_load_si128(reinterpret_cast<__m128i*>(top));
+    const __m128i b = _mm_load_si128(reinterpret_cast<__m128i*>(bottom));
+    const __m128i wx1 = _mm_load_si128(reinterpret_cast<__m128i*>(fx));
+    const __m128i wy1 = _mm_load_si128(reinterpret_cast<__m128i*>(fy));
+    const __m128i wx0 = _mm_sub_epi16(sixteen, wx1);
+    const __m128i wy0 = _mm_sub_epi16(sixteen, wy1);
+
+    const __m128i h0 =
+        _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(t, lowBytes), wx0),
+                      _mm_mullo_epi16(_mm_srli_epi16(t, 8), wx1));
+    const __m128i h1 =
+        _mm_add_epi16(_mm_mullo_epi16(_mm_and_si128(b, lowBytes), wx0),
+                      _mm_mullo_epi16(_mm_srli_epi16(b, 8), wx1));
+
+    /* At most 255 * 256 + 128, which fits in unsigned 16-bit lanes. */
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(h0, wy0),
+                                _mm_mullo_epi16(h1, wy1));
+    sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 8);
+
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(sum, sum));
+  }
+
+  scalarRemapKernels.remap8(src, stride, map + i, dst + i, count - i, fill);
+}
+
+void remap16(const uint8_t* src,
+             unsigned int stride,
+             const uint32_t* map,
+             uint8_t* dst,
+             unsigned int count,
+             uint8_t fill) {
+  scalarRemapKernels.remap16(src, stride, map, dst, count, fill);
+}
+
+} /* namespace */
+
+const LensRemapKernels sse2RemapKernels = {
+    "SSE2",
+    remap8,
+    remap16,
+};
+
+#endif /* __SSE2__ */
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * mapped_buffer_cache.cpp - CPU mappings of frame buffers
+ */
+
+#include "mapped_buffer_cache.h"
+
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include <libcamera/framebuffer.h>
+
+#include "twincam.h"
+#include "twncm_stdio.h"
+
+using namespace libcamera;
+
+#ifndef DMA_BUF_MAGIC
+#define DMA_BUF_MAGIC 0x444d4142
+#endif
+
+/**
+ * \class MappedBufferCache
+ * \brief Map each frame buffer once, for all consumers of a camera session
+ *
+ * Buffers are registered with add() when allocated, and are only mapped the
+ * first time image() is called for them, so sinks that never touch pixels
+ * with the CPU (KMS) don't pay for the mmap().
+ *
+ * Registration stores the entry index in the buffer cookie, making lookups on
+ * the per-frame path an array access. FrameBuffer instances wrapping the same
+ * memory, the same inode at the same offset for the first plane, share a
+ * single mapping. Only dmabufs since Linux 5.3 and memfds have an inode of
+ * their own, older dmabufs all share the anon_inode one and are never shared.
+ *
+ * With setCopyFrames(), image() instead returns a copy of the frame in cached
+ * memory, made once per frame with non-temporal loads. This is worth it when
+ * several CPU consumers read frames from uncached device memory. twincam-bench
+ * compares reading frames directly, copying them, and reading the copy.
+ *
+ * Buffers are mapped read-only unless setMapMode() asks for write access,
+ * which the session does when it transforms frames in place.
+ *
+ * The cache isn't thread-safe, image() shall be called from the event loop.
+ */
+MappedBufferCache::MappedBufferCache() = default;
+
+MappedBufferCache::~MappedBufferCache() = default;
+
+/* Tell whether \a fd has an inode of its own, identifying its memory. */
+static bool hasUniqueInode(int fd) {
+  struct statfs st;
+  if (fstatfs(fd, &st))
+    return false;
+
+  return st.f_type == DMA_BUF_MAGIC || st.f_type == TMPFS_MAGIC;
+}
+
+void MappedBufferCache::add(FrameBuffer* buffer) {
+  const FrameBuffer::Plane& plane = buffer->planes()[0];
+  buffer->setCookie(entries_.size());
+
+  struct stat st;
+  if (hasUniqueInode(plane.fd.get()) && !fstat(plane.fd.get(), &st)) {
+    const Key key = {st.st_dev, st.st_ino, plane.offset};
+    auto iter = dmabufs_.find(key);
+    if (iter != dmabufs_.end()) {
+      entries_.push_back(iter->second);
+      return;
+    }
+
+    dmabufs_[key] = mappings_.size();
+  }
+
+  entries_.push_back(mappings_.size());
+  mappings_.push_back({buffer, nullptr, nullptr, 0});
+}
+
+void MappedBufferCache::clear() {
+  mappings_.clear();
+  entries_.clear();
+  dmabufs_.clear();
+}
+
+unsigned int MappedBufferCache::index(const FrameBuffer* buffer) const {
+  return buffer->cookie();
+}
+
+MappedBufferCache::Mapping* MappedBufferCache::map(
+    const FrameBuffer* buffer) {
+  const unsigned int index = buffer->cookie();
+  if (index >= entries_.size()) {
+    EPRINT("Frame buffer %u isn't registered for mapping\n", index);
+    return nullptr;
+  }
+
+  Mapping& mapping = mappings_[entries_[index]];
+  if (!mapping.image) {
+    mapping.image = Image::fromFrameBuffer(mapping.buffer, mapMode_);
+    if (!mapping.image) {
+      EPRINT("Failed to map frame buffer %u\n", index);
+      return nullptr;
+    }
+  }
+
+  return &mapping;
+}
+
+Image* MappedBufferCache::image(const FrameBuffer* buffer) {
+  Mapping* mapping = map(buffer);
+  if (!mapping)
+    return nullptr;
+
+  if (copyFrames_)
+    return copy(*mapping, buffer);
+
+  return mapping->image.get();
+}
+
+/*
+ * Return the mapping of the buffer itself, bypassing copy mode, for the
+ * session to modify frames in place before sinks read them.
+ */
+Image* MappedBufferCache::mapping(const FrameBuffer* buffer) {
+  Mapping* mapping = map(buffer);
+
+  return mapping ? mapping->image.get() : nullptr;
+}
+
+/* Copy the frame of \a buffer out of \a mapping, once per frame. */
+Image* MappedBufferCache::copy(Mapping& mapping, const FrameBuffer* buffer) {
+  const FrameMetadata& metadata = buffer->metadata();
+
+  if (!mapping.copy) {
+    mapping.copy = Image::allocate(*mapping.image);
+    if (!mapping.copy)
+      return mapping.image.get();
+  } else if (mapping.copyTimestamp == metadata.timestamp) {
+    return mapping.copy.get();
+  }
+
+  {
+    Image::CpuAccess access(mapping.image.get(), Image::MapMode::ReadOnly);
+    mapping.copy->copyFrom(*mapping.image, metadata);
+  }
+
+  mapping.copyTimestamp = metadata.timestamp;
+
+  return mapping.copy.get();
+}
@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * mapped_buffer_cache.h - CPU mappings of frame buffers
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "image.h"
+
+namespace libcamera {
+class FrameBuffer;
+} /* namespace libcamera */
+
+class MappedBufferCache {
+ public:
+  MappedBufferCache();
+  ~MappedBufferCache();
+
+  void add(libcamera::FrameBuffer* buffer);
+  void clear();
+
+  void setCopyFrames(bool copy) { copyFrames_ = copy; }
+  void setMapMode(Image::MapMode mode) { mapMode_ = mode; }
+
+  unsigned int size() const { return entries_.size(); }
+  unsigned int index(const libcamera::FrameBuffer* buffer) const;
+
+  Image* image(const libcamera::FrameBuffer* buffer);
+  Image* mapping(const libcamera::FrameBuffer* buffer);
+
+ private:
+  /* A CPU mapping, shared by the frame buffers wrapping the same memory. */
+  struct Mapping {
+    const libcamera::FrameBuffer* buffer;
+    std::unique_ptr<Image> image;
+    std::unique_ptr<Image> copy;
+    uint64_t copyTimestamp;
+  };
+
+  /* Identity of the memory behind the first plane of a buffer. */
+  struct Key {
+    dev_t device;
+    ino_t inode;
+    unsigned int offset;
+
+    bool operator<(const Key& other) const {
+      return std::tie(device, inode, offset) <
+             std::tie(other.device, other.inode, other.offset);
+    }
+  };
+
+  Mapping* map(const libcamera::FrameBuffer* buffer);
+  Image* copy(Mapping& mapping, const libcamera::FrameBuffer* buffer);
+
+  std::vector<Mapping> mappings_;
+  /* Mapping of each registered buffer, indexed by the buffer cookie. */
+  std::vector<unsigned int> entries_;
+  std::map<Key, unsigned int> dmabufs_;
+
+  Image::MapMode mapMode_ = Image::MapMode::ReadOnly;
+  bool copyFrames_ = false;
+};
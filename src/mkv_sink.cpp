@@ -0,0 +1,494 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * mkv_sink.cpp - Matroska Sink
+ */
+
+#include "mkv_sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/formats.h>
+
+#include "image.h"
+#include "mapped_buffer_cache.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Matroska element IDs, EBML length marker bits included. */
+enum ElementId : uint32_t {
+  IdEBML = 0x1a45dfa3,
+  IdVoid = 0xec,
+  IdEBMLVersion = 0x4286,
+  IdEBMLReadVersion = 0x42f7,
+  IdEBMLMaxIDLength = 0x42f2,
+  IdEBMLMaxSizeLength = 0x42f3,
+  IdDocType = 0x4282,
+  IdDocTypeVersion = 0x4287,
+  IdDocTypeReadVersion = 0x4285,
+  IdSegment = 0x18538067,
+  IdSeekHead = 0x114d9b74,
+  IdSeek = 0x4dbb,
+  IdSeekID = 0x53ab,
+  IdSeekPosition = 0x53ac,
+  IdInfo = 0x1549a966,
+  IdTimestampScale = 0x2ad7b1,
+  IdDuration = 0x4489,
+  IdMuxingApp = 0x4d80,
+  IdWritingApp = 0x5741,
+  IdTracks = 0x1654ae6b,
+  IdTrackEntry = 0xae,
+  IdTrackNumber = 0xd7,
+  IdTrackUID = 0x73c5,
+  IdTrackType = 0x83,
+  IdFlagLacing = 0x9c,
+  IdCodecID = 0x86,
+  IdVideo = 0xe0,
+  IdPixelWidth = 0xb0,
+  IdPixelHeight = 0xba,
+  IdCluster = 0x1f43b675,
+  IdTimestamp = 0xe7,
+  IdSimpleBlock = 0xa3,
+  IdCues = 0x1c53bb6b,
+  IdCuePoint = 0xbb,
+  IdCueTime = 0xb3,
+  IdCueTrackPositions = 0xb7,
+  IdCueTrack = 0xf7,
+  IdCueClusterPosition = 0xf1,
+};
+
+/* Timestamps are stored in milliseconds, one cluster (and cue) per second. */
+constexpr uint64_t timestampScale = 1000000;
+constexpr uint64_t clusterDuration = 1000;
+
+void putBigEndian(std::vector<uint8_t>& buf, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; --i)
+    buf.push_back(value >> (8 * i));
+}
+
+void putId(std::vector<uint8_t>& buf, uint32_t id) {
+  const int bytes = id > 0xffffff ? 4 : id > 0xffff ? 3 : id > 0xff ? 2 : 1;
+  putBigEndian(buf, id, bytes);
+}
+
+void putSize(std::vector<uint8_t>& buf, uint64_t size) {
+  /* A size with all value bits set is reserved for "unknown". */
+  int bytes = 1;
+  while (bytes < 8 && size >= (1ULL << (7 * bytes)) - 1)
+    ++bytes;
+
+  putBigEndian(buf, size | (1ULL << (7 * bytes)), bytes);
+}
+
+/* 8-byte sizes, so that they can be patched in place once known. */
+void putFixedSize(std::vector<uint8_t>& buf, uint64_t size) {
+  putBigEndian(buf, size | (1ULL << 56), 8);
+}
+
+void putUnknownSize(std::vector<uint8_t>& buf) {
+  putBigEndian(buf, 0x01ffffffffffffffULL, 8);
+}
+
+void putUint(std::vector<uint8_t>& buf, uint32_t id, uint64_t value) {
+  int bytes = 1;
+  while (bytes < 8 && value >> (8 * bytes))
+    ++bytes;
+
+  putId(buf, id);
+  putSize(buf, bytes);
+  putBigEndian(buf, value, bytes);
+}
+
+void putFixedUint(std::vector<uint8_t>& buf, uint32_t id, uint64_t value) {
+  putId(buf, id);
+  putSize(buf, 8);
+  putBigEndian(buf, value, 8);
+}
+
+void putFloat(std::vector<uint8_t>& buf, uint32_t id, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  putId(buf, id);
+  putSize(buf, 8);
+  putBigEndian(buf, bits, 8);
+}
+
+void putString(std::vector<uint8_t>& buf, uint32_t id, const std::string& str) {
+  putId(buf, id);
+  putSize(buf, str.size());
+  buf.insert(buf.end(), str.begin(), str.end());
+}
+
+void putMaster(std::vector<uint8_t>& buf,
+               uint32_t id,
+               const std::vector<uint8_t>& payload) {
+  putId(buf, id);
+  putSize(buf, payload.size());
+  buf.insert(buf.end(), payload.begin(), payload.end());
+}
+
+/* Room for an element of \a length bytes, up to 128, written in later. */
+void putVoid(std::vector<uint8_t>& buf, size_t length) {
+  putId(buf, IdVoid);
+  putSize(buf, length - 2);
+  buf.insert(buf.end(), length - 2, 0);
+}
+
+void putSeek(std::vector<uint8_t>& buf, uint32_t id, uint64_t position) {
+  std::vector<uint8_t> seekId;
+  putId(seekId, id);
+
+  std::vector<uint8_t> seek;
+  putMaster(seek, IdSeekID, seekId);
+  putFixedUint(seek, IdSeekPosition, position);
+
+  putMaster(buf, IdSeek, seek);
+}
+
+}  // namespace
+
+MKVSink::MKVSink(const std::string& filename) : filename_(filename) {}
+
+MKVSink::~MKVSink() {
+  stop();
+}
+
+bool MKVSink::isMatroska(const std::string& filename) {
+  static const std::string ext = ".mkv";
+
+  return filename.size() > ext.size() &&
+         !filename.compare(filename.size() - ext.size(), ext.size(), ext);
+}
+
+int MKVSink::configure(const libcamera::CameraConfiguration& config) {
+  int ret = FrameSink::configure(config);
+  if (ret < 0)
+    return ret;
+
+  const libcamera::StreamConfiguration& cfg = config.at(0);
+  if (cfg.pixelFormat != libcamera::formats::MJPEG) {
+    EPRINT("Matroska sink only supports MJPEG, not %s\n",
+           cfg.pixelFormat.toString().c_str());
+    return -EINVAL;
+  }
+
+  if (config.size() > 1)
+    EPRINT("Matroska sink only records the first camera stream\n");
+
+  stream_ = cfg.stream();
+  size_ = cfg.size;
+
+  return 0;
+}
+
+int MKVSink::start() {
+  fd_ = open(filename_.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+             S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (fd_ == -1) {
+    int ret = -errno;
+    EPRINT("failed to open file %s: %s\n", filename_.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  pos_ = 0;
+  clusterOpen_ = false;
+  firstFrame_ = true;
+  lastTime_ = 0;
+  cues_.clear();
+
+  return writeHeader();
+}
+
+int MKVSink::stop() {
+  if (fd_ == -1)
+    return 0;
+
+  writeIndex();
+
+  close(fd_);
+  fd_ = -1;
+
+  return FrameSink::stop();
+}
+
+bool MKVSink::processRequest(Request* request) {
+  FrameBuffer* buffer = request->findBuffer(stream_);
+  if (buffer && fd_ != -1 && recording_)
+    writeFrame(buffer);
+
+  return true;
+}
+
+int MKVSink::writeHeader() {
+  std::vector<uint8_t> ebml;
+  putUint(ebml, IdEBMLVersion, 1);
+  putUint(ebml, IdEBMLReadVersion, 1);
+  putUint(ebml, IdEBMLMaxIDLength, 4);
+  putUint(ebml, IdEBMLMaxSizeLength, 8);
+  putString(ebml, IdDocType, "matroska");
+  putUint(ebml, IdDocTypeVersion, 4);
+  putUint(ebml, IdDocTypeReadVersion, 2);
+
+  std::vector<uint8_t> header;
+  putMaster(header, IdEBML, ebml);
+
+  /*
+   * The segment and cluster sizes are written as "unknown" and patched when
+   * closed, so a recording interrupted by a crash or power cut stays playable.
+   */
+  putId(header, IdSegment);
+  segmentSizePos_ = pos_ + header.size();
+  putUnknownSize(header);
+  segmentDataPos_ = pos_ + header.size();
+
+  std::vector<uint8_t> info;
+  putUint(info, IdTimestampScale, timestampScale);
+  putString(info, IdMuxingApp, "twincam");
+  putString(info, IdWritingApp, "twincam");
+  /* Skip the 2-byte ID and 1-byte size, the value is patched on close. */
+  const uint64_t durationOffset = info.size() + 3;
+  putFloat(info, IdDuration, 0.0);
+
+  std::vector<uint8_t> infoElement;
+  putMaster(infoElement, IdInfo, info);
+
+  std::vector<uint8_t> video;
+  putUint(video, IdPixelWidth, size_.width);
+  putUint(video, IdPixelHeight, size_.height);
+
+  std::vector<uint8_t> track;
+  putUint(track, IdTrackNumber, 1);
+  putUint(track, IdTrackUID, 1);
+  putUint(track, IdTrackType, 1);
+  putUint(track, IdFlagLacing, 0);
+  putString(track, IdCodecID, "V_MJPEG");
+  putMaster(track, IdVideo, video);
+
+  std::vector<uint8_t> tracks;
+  putMaster(tracks, IdTrackEntry, track);
+
+  std::vector<uint8_t> tracksElement;
+  putMaster(tracksElement, IdTracks, tracks);
+
+  /*
+   * Seek positions are fixed width, so the seek head size doesn't depend on
+   * them. The Cues entry is only known on close, until then a Void element of
+   * its size stands in for it, so that no entry points at a missing Cues.
+   */
+  std::vector<uint8_t> cuesSeek;
+  putSeek(cuesSeek, IdCues, 0);
+
+  std::vector<uint8_t> seeks;
+  putSeek(seeks, IdInfo, 0);
+  putSeek(seeks, IdTracks, 0);
+  putVoid(seeks, cuesSeek.size());
+
+  std::vector<uint8_t> seekHead;
+  putMaster(seekHead, IdSeekHead, seeks);
+
+  const uint64_t infoPos = seekHead.size();
+  const uint64_t tracksPos = infoPos + infoElement.size();
+
+  seeks.clear();
+  putSeek(seeks, IdInfo, infoPos);
+  putSeek(seeks, IdTracks, tracksPos);
+  putVoid(seeks, cuesSeek.size());
+
+  seekHead.clear();
+  putMaster(seekHead, IdSeekHead, seeks);
+
+  cuesSeekPos_ = segmentDataPos_ + seekHead.size() - cuesSeek.size();
+  durationPos_ = segmentDataPos_ + infoPos + infoElement.size() - info.size() +
+                 durationOffset;
+
+  header.insert(header.end(), seekHead.begin(), seekHead.end());
+  header.insert(header.end(), infoElement.begin(), infoElement.end());
+  header.insert(header.end(), tracksElement.begin(), tracksElement.end());
+
+  return write(header);
+}
+
+int MKVSink::writeFrame(FrameBuffer* buffer) {
+  const FrameMetadata& metadata = buffer->metadata();
+
+  /* A frame that can't be read leaves the timeline and clusters as they are. */
+  Image* image = mappedBuffers_->image(buffer);
+  if (!image)
+    return -ENOMEM;
+
+  if (firstFrame_) {
+    firstTimestamp_ = metadata.timestamp;
+    firstFrame_ = false;
+  }
+
+  const uint64_t time = metadata.timestamp > firstTimestamp_
+                            ? (metadata.timestamp - firstTimestamp_) /
+                                  timestampScale
+                            : 0;
+
+  /* Block timestamps are signed 16-bit offsets from the cluster timestamp. */
+  if (!clusterOpen_ || time < clusterTime_ ||
+      time - clusterTime_ >= clusterDuration) {
+    closeCluster();
+    if (int ret = openCluster(time); ret < 0)
+      return ret;
+  }
+
+  const uint64_t relative = time - clusterTime_;
+  lastTime_ = std::max(lastTime_, time);
+
+  /*
+   * The payload is written straight from the mapped buffer, only the few
+   * bytes of block header are built in memory.
+   */
+  iov_.clear();
+  iov_.push_back({nullptr, 0});
+
+  size_t length = 0;
+  for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
+    const unsigned int bytesused = metadata.planes()[i].bytesused;
+    Span<uint8_t> data = image->data(i);
+    const size_t planeLength = std::min<size_t>(bytesused, data.size());
+
+    if (bytesused > data.size())
+      EPRINT("payload size %u larger than plane size %zu\n", bytesused,
+             data.size());
+
+    iov_.push_back({data.data(), planeLength});
+    length += planeLength;
+  }
+
+  blockHeader_.clear();
+  putId(blockHeader_, IdSimpleBlock);
+  putSize(blockHeader_, length + 4);
+  blockHeader_.push_back(0x81); /* Track number 1 */
+  putBigEndian(blockHeader_, relative, 2);
+  blockHeader_.push_back(0x80); /* Keyframe */
+
+  iov_[0] = {blockHeader_.data(), blockHeader_.size()};
+
+  const ssize_t total = blockHeader_.size() + length;
+  ssize_t ret;
+  {
+    Image::CpuAccess access(image, Image::MapMode::ReadOnly);
+    ret = ::writev(fd_, iov_.data(), iov_.size());
+  }
+  if (ret < 0) {
+    int err = -errno;
+    EPRINT("write error: %s\n", strerror(-err));
+    return err;
+  } else if (ret != total) {
+    EPRINT("write error: only %zd bytes written instead of %zd\n", ret, total);
+    return -EIO;
+  }
+
+  pos_ += ret;
+
+  return 0;
+}
+
+int MKVSink::openCluster(uint64_t time) {
+  cues_.push_back({time, pos_ - segmentDataPos_});
+
+  std::vector<uint8_t> cluster;
+  putId(cluster, IdCluster);
+  clusterSizePos_ = pos_ + cluster.size();
+  putUnknownSize(cluster);
+  putUint(cluster, IdTimestamp, time);
+
+  int ret = write(cluster);
+  if (ret < 0)
+    return ret;
+
+  clusterOpen_ = true;
+  clusterTime_ = time;
+
+  return 0;
+}
+
+void MKVSink::closeCluster() {
+  if (!clusterOpen_)
+    return;
+
+  std::vector<uint8_t> size;
+  putFixedSize(size, pos_ - clusterSizePos_ - 8);
+  patch(clusterSizePos_, size);
+
+  clusterOpen_ = false;
+}
+
+void MKVSink::writeIndex() {
+  closeCluster();
+
+  const uint64_t cuesPos = pos_ - segmentDataPos_;
+
+  std::vector<uint8_t> cuePoints;
+  for (const CuePoint& cue : cues_) {
+    std::vector<uint8_t> positions;
+    putUint(positions, IdCueTrack, 1);
+    putUint(positions, IdCueClusterPosition, cue.clusterPosition);
+
+    std::vector<uint8_t> cuePoint;
+    putUint(cuePoint, IdCueTime, cue.time);
+    putMaster(cuePoint, IdCueTrackPositions, positions);
+
+    putMaster(cuePoints, IdCuePoint, cuePoint);
+  }
+
+  std::vector<uint8_t> cues;
+  putMaster(cues, IdCues, cuePoints);
+  if (write(cues) < 0)
+    return;
+
+  std::vector<uint8_t> value;
+  putSeek(value, IdCues, cuesPos);
+  patch(cuesSeekPos_, value);
+
+  double duration = lastTime_;
+  uint64_t bits;
+  memcpy(&bits, &duration, sizeof(bits));
+  value.clear();
+  putBigEndian(value, bits, 8);
+  patch(durationPos_, value);
+
+  value.clear();
+  putFixedSize(value, pos_ - segmentDataPos_);
+  patch(segmentSizePos_, value);
+}
+
+int MKVSink::write(const std::vector<uint8_t>& data) {
+  const ssize_t ret = ::write(fd_, data.data(), data.size());
+  if (ret < 0) {
+    int err = -errno;
+    EPRINT("write error: %s\n", strerror(-err));
+    return err;
+  } else if (ret != static_cast<ssize_t>(data.size())) {
+    EPRINT("write error: only %zd bytes written instead of %zu\n", ret,
+           data.size());
+    return -EIO;
+  }
+
+  pos_ += ret;
+
+  return 0;
+}
+
+int MKVSink::patch(uint64_t offset, const std::vector<uint8_t>& data) {
+  const ssize_t ret = ::pwrite(fd_, data.data(), data.size(), offset);
+  if (ret != static_cast<ssize_t>(data.size())) {
+    int err = ret < 0 ? -errno : -EIO;
+    EPRINT("failed to update %s: %s\n", filename_.c_str(), strerror(-err));
+    return err;
+  }
+
+  return 0;
+}
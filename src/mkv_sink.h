@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * mkv_sink.h - Matroska Sink
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/stream.h>
+
+#include "frame_sink.h"
+
+class MKVSink : public FrameSink {
+ public:
+  MKVSink(const std::string& filename);
+  ~MKVSink();
+
+  static bool isMatroska(const std::string& filename);
+
+  int configure(const libcamera::CameraConfiguration& config) override;
+
+  int start() override;
+  int stop() override;
+
+  bool processRequest(libcamera::Request* request) override;
+
+ private:
+  struct CuePoint {
+    uint64_t time;
+    uint64_t clusterPosition;
+  };
+
+  int writeHeader();
+  int writeFrame(libcamera::FrameBuffer* buffer);
+  int openCluster(uint64_t time);
+  void closeCluster();
+  void writeIndex();
+
+  int write(const std::vector<uint8_t>& data);
+  int patch(uint64_t offset, const std::vector<uint8_t>& data);
+
+  std::string filename_;
+  const libcamera::Stream* stream_ = nullptr;
+  libcamera::Size size_;
+
+  int fd_ = -1;
+  uint64_t pos_ = 0;
+
+  /* Offsets of the elements patched when the recording is closed. */
+  uint64_t segmentSizePos_ = 0;
+  uint64_t segmentDataPos_ = 0;
+  /* Void element in the SeekHead, replaced by the Cues entry on close. */
+  uint64_t cuesSeekPos_ = 0;
+  uint64_t durationPos_ = 0;
+  uint64_t clusterSizePos_ = 0;
+
+  bool clusterOpen_ = false;
+  uint64_t clusterTime_ = 0;
+
+  bool firstFrame_ = true;
+  uint64_t firstTimestamp_ = 0;
+  uint64_t lastTime_ = 0;
+
+  std::vector<CuePoint> cues_;
+
+  std::vector<uint8_t> blockHeader_;
+  std::vector<struct iovec> iov_;
+};
@@ -0,0 +1,236 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * motion_detector.cpp - Detect motion by comparing frames to a background
+ */
+
+#include "motion_detector.h"
+#include "cpu_features.h"
+#include "frame_planes.h"
+#include "twincam.h"
+#include "uptime.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+/* Luma samples averaged into a grid cell, and cells compared in a block. */
+constexpr unsigned int kCellSize = 8;
+constexpr unsigned int kBlockCells = 8;
+
+/* Mean difference of the cells of a block to the background to count it. */
+constexpr unsigned int kBlockThreshold = 12;
+
+void sumPlanar(const uint8_t* row, uint16_t* sums, unsigned int count) {
+  for (unsigned int i = 0; i < count; ++i) {
+    for (unsigned int x = 0; x < 8; ++x)
+      sums[i] += row[i * 8 + x];
+  }
+}
+
+void sumPacked(const uint8_t* row,
+               uint16_t* sums,
+               unsigned int count,
+               unsigned int lumaOffset) {
+  for (unsigned int i = 0; i < count; ++i) {
+    for (unsigned int x = 0; x < 8; ++x)
+      sums[i] += row[i * 16 + x * 2 + lumaOffset];
+  }
+}
+
+void sad(const uint8_t* a, const uint8_t* b, uint32_t* sums,
+         unsigned int count) {
+  for (unsigned int i = 0; i < count; ++i) {
+    for (unsigned int x = 0; x < 8; ++x)
+      sums[i] += std::abs(a[i * 8 + x] - b[i * 8 + x]);
+  }
+}
+
+void update(const uint8_t* grid,
+            uint16_t* background,
+            uint8_t* reference,
+            unsigned int count) {
+  for (unsigned int i = 0; i < count; ++i) {
+    const int diff = grid[i] * 16 - background[i];
+    background[i] += (diff + 4) >> 3;
+    reference[i] = (background[i] + 8) >> 4;
+  }
+}
+
+const MotionDetectorKernels& bestKernels() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (CpuFeatures::has(CpuFeatures::SSE2))
+    return sse2MotionKernels;
+#elif defined(__arm__) || defined(__aarch64__)
+  if (CpuFeatures::has(CpuFeatures::NEON))
+    return neonMotionKernels;
+#endif
+
+  return scalarMotionKernels;
+}
+
+} /* namespace */
+
+const MotionDetectorKernels scalarMotionKernels = {
+    "scalar",
+    sumPlanar,
+    sumPacked,
+    sad,
+    update,
+};
+
+/**
+ * \class MotionDetector
+ * \brief Tell when the scene in front of the camera changes
+ *
+ * Luma is reduced to a grid of cells, each the average of an 8x8 pixel area
+ * sampled on every other row, and the grid compared to a running average of
+ * the previous ones in blocks of 8x8 cells. A block changed when its cells
+ * differ from the background by more than a few levels on average, which
+ * averaging makes insensitive to sensor noise, and motion is reported when
+ * enough blocks changed. The background follows the scene within a few
+ * frames, so lighting that changes slowly doesn't count as motion.
+ *
+ * Only the luma rows sampled are read, a quarter of a 4:2:0 frame, and the
+ * grid is small enough to stay in cache.
+ */
+MotionDetector::MotionDetector() = default;
+
+MotionDetector::~MotionDetector() = default;
+
+bool MotionDetector::isSupported(const PixelFormat& format) {
+  switch (format) {
+    case formats::NV12:
+    case formats::NV21:
+    case formats::NV16:
+    case formats::YUV420:
+    case formats::YVU420:
+    case formats::YUYV:
+    case formats::YVYU:
+    case formats::UYVY:
+    case formats::VYUY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * Prepare to analyze frames of \a cfg, reporting motion when \a threshold
+ * percent of the frame changed.
+ */
+int MotionDetector::configure(const StreamConfiguration& cfg,
+                              double threshold) {
+  if (!isSupported(cfg.pixelFormat)) {
+    EPRINT("Cannot detect motion in %s frames\n",
+           cfg.pixelFormat.toString().c_str());
+    return -EINVAL;
+  }
+
+  const unsigned int blockSize = kCellSize * kBlockCells;
+  if (cfg.size.width < blockSize || cfg.size.height < blockSize) {
+    EPRINT("Frames of %ux%u too small to detect motion\n", cfg.size.width,
+           cfg.size.height);
+    return -EINVAL;
+  }
+
+  kernels_ = &bestKernels();
+  height_ = cfg.size.height;
+  stride_ = cfg.stride;
+  packed_ = cfg.pixelFormat == formats::YUYV ||
+            cfg.pixelFormat == formats::YVYU ||
+            cfg.pixelFormat == formats::UYVY ||
+            cfg.pixelFormat == formats::VYUY;
+  lumaOffset_ = cfg.pixelFormat == formats::UYVY ||
+                cfg.pixelFormat == formats::VYUY;
+  threshold_ = threshold;
+
+  /* Cells and blocks cut by the right and bottom edges are left out. */
+  gridWidth_ = cfg.size.width / kCellSize;
+  gridHeight_ = cfg.size.height / kCellSize;
+  blocksWide_ = gridWidth_ / kBlockCells;
+  blocksHigh_ = gridHeight_ / kBlockCells;
+
+  const size_t cells = static_cast<size_t>(gridWidth_) * gridHeight_;
+  sums_.resize(gridWidth_);
+  grid_.resize(cells);
+  background_.resize(cells);
+  reference_.resize(cells);
+  blockSums_.resize(blocksWide_);
+  primed_ = false;
+  changed_ = 0.0;
+
+  return 0;
+}
+
+/* Average the luma of each cell into the grid, from every other row. */
+void MotionDetector::downsample(const uint8_t* luma) {
+  for (unsigned int y = 0; y < gridHeight_; ++y) {
+    std::fill(sums_.begin(), sums_.end(), 0);
+
+    for (unsigned int row = 0; row < kCellSize; row += 2) {
+      const uint8_t* src =
+          luma + static_cast<size_t>(y * kCellSize + row) * stride_;
+      if (packed_)
+        kernels_->sumPacked(src, sums_.data(), gridWidth_, lumaOffset_);
+      else
+        kernels_->sumPlanar(src, sums_.data(), gridWidth_);
+    }
+
+    /* Each sum adds 32 samples. */
+    uint8_t* cells = grid_.data() + static_cast<size_t>(y) * gridWidth_;
+    for (unsigned int x = 0; x < gridWidth_; ++x)
+      cells[x] = (sums_[x] + 16) >> 5;
+  }
+}
+
+/*
+ * Compare the frame in \a planes to the background and blend it in. Returns
+ * true if motion was detected.
+ */
+bool MotionDetector::analyze(const std::vector<Span<const uint8_t>>& planes) {
+  std::vector<const uint8_t*> data;
+  if (splitPlanes(planes, {static_cast<size_t>(stride_) * height_}, &data) <
+      0)
+    return false;
+
+  downsample(data[0]);
+
+  const size_t cells = grid_.size();
+  if (!primed_) {
+    for (size_t i = 0; i < cells; ++i) {
+      background_[i] = grid_[i] * 16;
+      reference_[i] = grid_[i];
+    }
+    primed_ = true;
+    return false;
+  }
+
+  unsigned int changed = 0;
+  for (unsigned int by = 0; by < blocksHigh_; ++by) {
+    std::fill(blockSums_.begin(), blockSums_.end(), 0);
+
+    for (unsigned int row = 0; row < kBlockCells; ++row) {
+      const size_t offset =
+          static_cast<size_t>(by * kBlockCells + row) * gridWidth_;
+      kernels_->sad(grid_.data() + offset, reference_.data() + offset,
+                    blockSums_.data(), blocksWide_);
+    }
+
+    for (uint32_t sum : blockSums_) {
+      if (sum > kBlockThreshold * kBlockCells * kBlockCells)
+        ++changed;
+    }
+  }
+
+  kernels_->update(grid_.data(), background_.data(), reference_.data(),
+                   cells);
+
+  changed_ = 100.0 * changed / (blocksWide_ * blocksHigh_);
+  return changed && changed_ >= threshold_;
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * motion_detector.h - Detect motion by comparing frames to a background
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/span.h>
+
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "motion_detector_kernels.h"
+
+class MotionDetector {
+ public:
+  MotionDetector();
+  ~MotionDetector();
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const libcamera::StreamConfiguration& cfg, double threshold);
+
+  const char* kernelsName() const { return kernels_ ? kernels_->name : ""; }
+
+  bool analyze(const std::vector<libcamera::Span<const uint8_t>>& planes);
+
+  /* Percentage of the frame that changed in the last analyzed frame. */
+  double changed() const { return changed_; }
+
+ private:
+  void downsample(const uint8_t* luma);
+
+  const MotionDetectorKernels* kernels_ = nullptr;
+
+  unsigned int height_ = 0;
+  unsigned int stride_ = 0;
+  /* Packed 4:2:2 formats, luma in the even bytes, or odd with an offset. */
+  bool packed_ = false;
+  unsigned int lumaOffset_ = 0;
+  /* Percentage of blocks that must change to report motion. */
+  double threshold_ = 0.0;
+
+  unsigned int gridWidth_ = 0;
+  unsigned int gridHeight_ = 0;
+  unsigned int blocksWide_ = 0;
+  unsigned int blocksHigh_ = 0;
+
+  std::vector<uint16_t> sums_;
+  std::vector<uint8_t> grid_;
+  std::vector<uint16_t> background_;
+  std::vector<uint8_t> reference_;
+  std::vector<uint32_t> blockSums_;
+  bool primed_ = false;
+  double changed_ = 0.0;
+};
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * motion_detector_kernels.h - Row kernels used by MotionDetector
+ *
+ * Luma is reduced to a grid of cells, each the average of 8 samples of 4 rows.
+ * The background is a running average of the grid kept in Q4 fixed point,
+ * along with its rounding to 8 bits, the reference frames are compared to.
+ * All implementations produce exactly the output of the scalar kernels.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct MotionDetectorKernels {
+  const char* name;
+
+  /*
+   * Add the sum of each run of 8 luma samples of row to sums, for count runs.
+   * sumPacked reads 4:2:2 packed rows, 16 bytes per run, with luma in the
+   * even bytes if lumaOffset is 0 and the odd bytes if it's 1.
+   */
+  void (*sumPlanar)(const uint8_t* row, uint16_t* sums, unsigned int count);
+  void (*sumPacked)(const uint8_t* row,
+                    uint16_t* sums,
+                    unsigned int count,
+                    unsigned int lumaOffset);
+
+  /* Add the sum of absolute differences of each run of 8 cells to sums. */
+  void (*sad)(const uint8_t* a,
+              const uint8_t* b,
+              uint32_t* sums,
+              unsigned int count);
+
+  /*
+   * Move each of count background cells 1/8 of the way to the grid, and
+   * store the result rounded to 8 bits in reference.
+   */
+  void (*update)(const uint8_t* grid,
+                 uint16_t* background,
+                 uint8_t* reference,
+                 unsigned int count);
+};
+
+extern const MotionDetectorKernels scalarMotionKernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const MotionDetectorKernels sse2MotionKernels;
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+extern const MotionDetectorKernels neonMotionKernels;
+#endif
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * motion_detector_neon.cpp - NEON row kernels for MotionDetector
+ */
+
+#include "motion_detector_kernels.h"
+
+#if defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+namespace {
+
+/* Sum each half of a vector of bytes with pairwise widening additions. */
+inline uint64x2_t sumHalves(uint8x16_t v) {
+  return vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(v)));
+}
+
+void sumPlanar(const uint8_t* row, uint16_t* sums, unsigned int count) {
+  unsigned int i = 0;
+
+  for (; i + 2 <= count; i += 2) {
+    const uint64x2_t sum = sumHalves(vld1q_u8(row + i * 8));
+    sums[i] += vgetq_lane_u64(sum, 0);
+    sums[i + 1] += vgetq_lane_u64(sum, 1);
+  }
+
+  scalarMotionKernels.sumPlanar(row + i * 8, sums + i, count - i);
+}
+
+void sumPacked(const uint8_t* row,
+               uint16_t* sums,
+               unsigned int count,
+               unsigned int lumaOffset) {
+  const uint8x16_t mask =
+      vreinterpretq_u8_u16(vdupq_n_u16(lumaOffset ? 0xff00 : 0x00ff));
+
+  for (unsigned int i = 0; i < count; ++i) {
+    const uint64x2_t sum = sumHalves(vandq_u8(vld1q_u8(row + i * 16), mask));
+    sums[i] += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+  }
+}
+
+void sad(const uint8_t* a, const uint8_t* b, uint32_t* sums,
+         unsigned int count) {
+  unsigned int i = 0;
+
+  for (; i + 2 <= count; i += 2) {
+    const uint64x2_t sum =
+        sumHalves(vabdq_u8(vld1q_u8(a + i * 8), vld1q_u8(b + i * 8)));
+    sums[i] += vgetq_lane_u64(sum, 0);
+    sums[i + 1] += vgetq_lane_u64(sum, 1);
+  }
+
+  scalarMotionKernels.sad(a + i * 8, b + i * 8, sums + i, count - i);
+}
+
+void update(const uint8_t* grid,
+            uint16_t* background,
+            uint8_t* reference,
+            unsigned int count) {
+  unsigned int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const int16x8_t g =
+        vreinterpretq_s16_u16(vshll_n_u8(vld1_u8(grid + i), 4));
+    int16x8_t bg = vreinterpretq_s16_u16(vld1q_u16(background + i));
+    const int16x8_t diff = vsubq_s16(g, bg);
+    bg = vaddq_s16(bg, vshrq_n_s16(vaddq_s16(diff, vdupq_n_s16(4)), 3));
+    vst1q_u16(background + i, vreinterpretq_u16_s16(bg));
+
+    vst1_u8(reference + i, vqrshrun_n_s16(bg, 4));
+  }
+
+  scalarMotionKernels.update(grid + i, background + i, reference + i,
+                             count - i);
+}
+
+} /* namespace */
+
+const MotionDetectorKernels neonMotionKernels = {
+    "NEON",
+    sumPlanar,
+    sumPacked,
+    sad,
+    update,
+};
+
+#endif /* __ARM_NEON */
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * motion_detector_sse2.cpp - SSE2 row kernels for MotionDetector
+ */
+
+#include "motion_detector_kernels.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace {
+
+/* PSADBW against zero sums each half of a vector, two runs at a time. */
+void sumPlanar(const uint8_t* row, uint16_t* sums, unsigned int count) {
+  const __m128i zero = _mm_setzero_si128();
+  unsigned int i = 0;
+
+  for (; i + 2 <= count; i += 2) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i * 8));
+    const __m128i sum = _mm_sad_epu8(v, zero);
+    sums[i] += _mm_cvtsi128_si32(sum);
+    sums[i + 1] += _mm_extract_epi16(sum, 4);
+  }
+
+  scalarMotionKernels.sumPlanar(row + i * 8, sums + i, count - i);
+}
+
+/* Chroma bytes are masked out, the two halves hold 4 luma samples each. */
+void sumPacked(const uint8_t* row,
+               uint16_t* sums,
+               unsigned int count,
+               unsigned int lumaOffset) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i mask = _mm_set1_epi16(lumaOffset ? 0xff00 : 0x00ff);
+
+  for (unsigned int i = 0; i < count; ++i) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i * 16));
+    const __m128i sum = _mm_sad_epu8(_mm_and_si128(v, mask), zero);
+    sums[i] += _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+  }
+}
+
+void sad(const uint8_t* a, const uint8_t* b, uint32_t* sums,
+         unsigned int count) {
+  unsigned int i = 0;
+
+  for (; i + 2 <= count; i += 2) {
+    const __m128i va =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * 8));
+    const __m128i vb =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 8));
+    const __m128i sum = _mm_sad_epu8(va, vb);
+    sums[i] += _mm_cvtsi128_si32(sum);
+    sums[i + 1] += _mm_extract_epi16(sum, 4);
+  }
+
+  scalarMotionKernels.sad(a + i * 8, b + i * 8, sums + i, count - i);
+}
+
+/*
+ * The difference to the grid, at most 4080 either way, fits in signed 16-bit
+ * lanes, so does the background of at most 4080.
+ */
+void update(const uint8_t* grid,
+            uint16_t* background,
+            uint8_t* reference,
+            unsigned int count) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i four = _mm_set1_epi16(4);
+  const __m128i eight = _mm_set1_epi16(8);
+  unsigned int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const __m128i g = _mm_slli_epi16(
+        _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(grid + i)), zero),
+        4);
+    __m128i bg = _mm_loadu_si128(reinterpret_cast<__m128i*>(background + i));
+    const __m128i diff = _mm_sub_epi16(g, bg);
+    bg = _mm_add_epi16(bg, _mm_srai_epi16(_mm_add_epi16(diff, four), 3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(background + i), bg);
+
+    const __m128i ref = _mm_srli_epi16(_mm_add_epi16(bg, eight), 4);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(reference + i),
+                     _mm_packus_epi16(ref, ref));
+  }
+
+  scalarMotionKernels.update(grid + i, background + i, reference + i,
+                             count - i);
+}
+
+} /* namespace */
+
+const MotionDetectorKernels sse2MotionKernels = {
+    "SSE2",
+    sumPlanar,
+    sumPacked,
+    sad,
+    update,
+};
+
+#endif /* __SSE2__ */
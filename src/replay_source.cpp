@@ -0,0 +1,362 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * replay_source.cpp - Replay the frames of a recording
+ */
+
+#include "replay_source.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+#include "uptime.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+/* Bytes per pixel of the first plane, 0 for formats that can't be replayed. */
+unsigned int bytesPerPixel(const PixelFormat& format) {
+  switch (format) {
+    case formats::NV12:
+    case formats::NV21:
+    case formats::YUV420:
+    case formats::YVU420:
+      return 1;
+    case formats::YUYV:
+    case formats::YVYU:
+    case formats::UYVY:
+    case formats::VYUY:
+      return 2;
+    case formats::XRGB8888:
+    case formats::ARGB8888:
+    case formats::XBGR8888:
+    case formats::ABGR8888:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+bool isPlanar(const PixelFormat& format) {
+  return bytesPerPixel(format) == 1;
+}
+
+} /* namespace */
+
+/**
+ * \class ReplaySource
+ * \brief Frames of a recording made with -F, given again
+ *
+ * The frames of one stream of a recording are read using its frame index,
+ * decompressed if recorded with -z, and given at the rate they were captured
+ * at, from their recorded timestamps, or as fast as they are asked for.
+ * Sequence numbers and timestamps are the recorded ones, so every run sees
+ * the same frames in the same order and the processing of two builds can be
+ * compared frame for frame.
+ *
+ * The index doesn't record the pixel format or size of the frames, they must
+ * be given, the stride is worked out from the size of the recorded planes.
+ */
+ReplaySource::ReplaySource() = default;
+
+ReplaySource::~ReplaySource() {
+  release();
+}
+
+bool ReplaySource::isSupported(const PixelFormat& format) {
+  return format == formats::MJPEG || bytesPerPixel(format);
+}
+
+/*
+ * Replay stream \a stream of the recording \a path, holding \a format frames
+ * of \a size, at the recorded rate or as fast as possible if \a maxSpeed.
+ */
+int ReplaySource::configure(const std::string& path,
+                            const PixelFormat& format,
+                            const Size& size,
+                            unsigned int stream,
+                            bool maxSpeed) {
+  release();
+
+  if (!isSupported(format)) {
+    EPRINT("Cannot replay %s frames\n", format.toString().c_str());
+    return -EINVAL;
+  }
+
+  if (size.isNull()) {
+    EPRINT("Replaying needs the size of the recorded frames\n");
+    return -EINVAL;
+  }
+
+  cfg_ = StreamConfiguration();
+  cfg_.pixelFormat = format;
+  cfg_.size = size;
+  maxSpeed_ = maxSpeed;
+  position_ = 0;
+
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    const int ret = -errno;
+    EPRINT("Failed to open %s: %s\n", path.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  int ret = openIndex(path + ".idx");
+  if (ret < 0)
+    return ret;
+
+  const FrameIndexHeader* header =
+      reinterpret_cast<const FrameIndexHeader*>(index_);
+  compressed_ = header->flags & frameIndexFlagZstd;
+#ifndef HAVE_ZSTD
+  if (compressed_) {
+    EPRINT("%s is zstd compressed, replaying it needs zstd\n", path.c_str());
+    return -ENOTSUP;
+  }
+#endif
+
+  /* A trailing partial record is left behind if recording was interrupted. */
+  const size_t count =
+      (indexSize_ - header->headerSize) / header->recordSize;
+  for (size_t n = 0; n < count; ++n) {
+    const FrameIndexRecord* record = reinterpret_cast<const FrameIndexRecord*>(
+        index_ + header->headerSize + n * header->recordSize);
+    if (record->stream != stream || !record->numPlanes ||
+        record->numPlanes > frameIndexMaxPlanes)
+      continue;
+
+    size_t frameSize = 0;
+    for (unsigned int i = 0; i < record->numPlanes; ++i)
+      frameSize += record->bytesused[i];
+
+    mapSize_ = std::max(mapSize_, frameSize);
+    records_.push_back(record);
+  }
+
+  if (records_.empty()) {
+    EPRINT("No frames of stream %u in %s\n", stream, path.c_str());
+    return -EINVAL;
+  }
+
+  ret = computeStride(records_[0]);
+  if (ret < 0)
+    return ret;
+
+  memfd_ = memfd_create("twincam-replay", MFD_CLOEXEC);
+  if (memfd_ < 0 || ftruncate(memfd_, mapSize_) < 0) {
+    ret = -errno;
+    EPRINT("Failed to allocate a %zu bytes memfd: %s\n", mapSize_,
+           strerror(-ret));
+    return ret;
+  }
+
+  void* map = mmap(nullptr, mapSize_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   memfd_, 0);
+  if (map == MAP_FAILED) {
+    ret = -errno;
+    EPRINT("Failed to map a %zu bytes memfd: %s\n", mapSize_, strerror(-ret));
+    return ret;
+  }
+
+  map_ = static_cast<uint8_t*>(map);
+  frame_.fd = memfd_;
+
+#ifdef HAVE_ZSTD
+  if (compressed_) {
+    dctx_ = ZSTD_createDCtx();
+    if (!dctx_)
+      return -ENOMEM;
+  }
+#endif
+
+  return 0;
+}
+
+int ReplaySource::openIndex(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    const int ret = -errno;
+    EPRINT("Failed to open %s: %s\n", path.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) ||
+      static_cast<size_t>(st.st_size) < sizeof(FrameIndexHeader)) {
+    EPRINT("%s is not a frame index\n", path.c_str());
+    close(fd);
+    return -EINVAL;
+  }
+
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    const int ret = -errno;
+    EPRINT("Failed to map %s: %s\n", path.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  index_ = static_cast<const uint8_t*>(map);
+  indexSize_ = st.st_size;
+
+  const FrameIndexHeader* header = static_cast<const FrameIndexHeader*>(map);
+  if (memcmp(header->magic, frameIndexMagic, sizeof(header->magic)) ||
+      header->version != frameIndexVersion ||
+      header->headerSize < sizeof(FrameIndexHeader) ||
+      header->recordSize < sizeof(FrameIndexRecord) ||
+      header->headerSize > indexSize_) {
+    EPRINT("%s is not a version %u frame index\n", path.c_str(),
+           frameIndexVersion);
+    return -EINVAL;
+  }
+
+  return 0;
+}
+
+/*
+ * Work out the stride from the sizes of the planes of \a record, which is
+ * padded by some cameras. Planes of single plane buffers hold the whole frame.
+ */
+int ReplaySource::computeStride(const FrameIndexRecord* record) {
+  const PixelFormat& format = cfg_.pixelFormat;
+  if (format == formats::MJPEG)
+    return 0;
+
+  const unsigned int height = cfg_.size.height;
+  unsigned int stride = 0;
+  if (record->numPlanes == 1 && isPlanar(format))
+    stride = static_cast<uint64_t>(record->bytesused[0]) * 2 / (height * 3);
+  else
+    stride = record->bytesused[0] / height;
+
+  if (stride < cfg_.size.width * bytesPerPixel(format)) {
+    EPRINT("Recorded frames of %u bytes are too small for %s %s\n",
+           record->bytesused[0], format.toString().c_str(),
+           cfg_.size.toString().c_str());
+    return -EINVAL;
+  }
+
+  cfg_.stride = stride;
+  cfg_.frameSize = mapSize_;
+
+  return 0;
+}
+
+const SourceFrame* ReplaySource::next() {
+  if (position_ >= records_.size())
+    return nullptr;
+
+  const FrameIndexRecord* record = records_[position_++];
+
+  if (!maxSpeed_) {
+    if (position_ == 1) {
+      start_ = monotonicTime();
+      firstTimestamp_ = record->timestamp;
+    }
+
+    if (record->timestamp > firstTimestamp_)
+      sleepUntil(start_ + record->timestamp - firstTimestamp_);
+  }
+
+  if (readFrame(record) < 0)
+    return nullptr;
+
+  frame_.planes.clear();
+  size_t offset = 0;
+  for (unsigned int i = 0; i < record->numPlanes; ++i) {
+    frame_.planes.emplace_back(map_ + offset, record->bytesused[i]);
+    offset += record->bytesused[i];
+  }
+
+  frame_.sequence = record->sequence;
+  frame_.timestamp = record->timestamp;
+
+  return &frame_;
+}
+
+/* Read the planes of \a record into the memfd, one after the other. */
+int ReplaySource::readFrame(const FrameIndexRecord* record) {
+  size_t frameSize = 0;
+  for (unsigned int i = 0; i < record->numPlanes; ++i)
+    frameSize += record->bytesused[i];
+
+  uint8_t* data = map_;
+  if (compressed_) {
+#ifdef HAVE_ZSTD
+    compressedData_.resize(record->length);
+    data = compressedData_.data();
+#endif
+  } else if (record->length != frameSize) {
+    EPRINT("Frame %u is %" PRIu64 " bytes instead of %zu\n", record->sequence,
+           record->length, frameSize);
+    return -EINVAL;
+  }
+
+  const ssize_t len = pread(fd_, data, record->length, record->offset);
+  if (len != static_cast<ssize_t>(record->length)) {
+    EPRINT("Failed to read frame %u: %s\n", record->sequence,
+           len < 0 ? strerror(errno) : "recording truncated");
+    return -EIO;
+  }
+
+#ifdef HAVE_ZSTD
+  if (compressed_) {
+    /* The zstd frames of the planes decompress as one stream. */
+    const size_t ret =
+        ZSTD_decompressDCtx(dctx_, map_, frameSize, data, record->length);
+    if (ZSTD_isError(ret) || ret != frameSize) {
+      EPRINT("Failed to decompress frame %u: %s\n", record->sequence,
+             ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "short frame");
+      return -EIO;
+    }
+  }
+#endif
+
+  return 0;
+}
+
+void ReplaySource::release() {
+#ifdef HAVE_ZSTD
+  if (dctx_) {
+    ZSTD_freeDCtx(dctx_);
+    dctx_ = nullptr;
+  }
+#endif
+
+  if (map_) {
+    munmap(map_, mapSize_);
+    map_ = nullptr;
+  }
+
+  if (memfd_ >= 0) {
+    close(memfd_);
+    memfd_ = -1;
+  }
+
+  if (index_) {
+    munmap(const_cast<uint8_t*>(index_), indexSize_);
+    index_ = nullptr;
+  }
+
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+
+  records_.clear();
+  mapSize_ = 0;
+  frame_ = SourceFrame();
+}
@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * replay_source.h - Replay the frames of a recording
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "frame_index.h"
+#include "frame_source.h"
+
+#ifdef HAVE_ZSTD
+typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+#endif
+
+class ReplaySource : public FrameSource {
+ public:
+  ReplaySource();
+  ~ReplaySource();
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const std::string& path,
+                const libcamera::PixelFormat& format,
+                const libcamera::Size& size,
+                unsigned int stream,
+                bool maxSpeed);
+
+  const libcamera::StreamConfiguration& configuration() const override {
+    return cfg_;
+  }
+
+  const SourceFrame* next() override;
+
+  /* Frames of the stream in the recording. */
+  size_t frames() const { return records_.size(); }
+
+ private:
+  int openIndex(const std::string& path);
+  int computeStride(const FrameIndexRecord* record);
+  int readFrame(const FrameIndexRecord* record);
+  void release();
+
+  libcamera::StreamConfiguration cfg_;
+  bool maxSpeed_ = false;
+
+  int fd_ = -1;
+  const uint8_t* index_ = nullptr;
+  size_t indexSize_ = 0;
+  bool compressed_ = false;
+  std::vector<const FrameIndexRecord*> records_;
+  size_t position_ = 0;
+
+  /* memfd the frames are read into, sized for the largest. */
+  int memfd_ = -1;
+  uint8_t* map_ = nullptr;
+  size_t mapSize_ = 0;
+  SourceFrame frame_;
+
+#ifdef HAVE_ZSTD
+  ZSTD_DCtx* dctx_ = nullptr;
+  std::vector<uint8_t> compressedData_;
+#endif
+
+  /* Time the first frame was given and its recorded timestamp. */
+  uint64_t start_ = 0;
+  uint64_t firstTimestamp_ = 0;
+};
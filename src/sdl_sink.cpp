@@ -1,7 +1,6 @@
 #include "sdl_sink.h"
 #include "twncm_stdio.h"
 
-#include <assert.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
@@ -12,13 +11,17 @@
 #include <libcamera/formats.h>
 
 #include "event_loop.h"
+#include "format_converter.h"
 #include "image.h"
+#include "image_scaler.h"
+#include "mapped_buffer_cache.h"
 #include "twincam.h"
 #include "twncm_stdio.h"
 
 #ifdef HAVE_LIBJPEG
 #include "sdl_texture_mjpg.h"
 #endif
+#include "sdl_texture_converted.h"
 #include "sdl_texture_nv12.h"
 #include "sdl_texture_yuyv.h"
 
@@ -27,7 +30,11 @@ using namespace libcamera;
 using namespace std::chrono_literals;
 
 SDLSink::SDLSink()
-    : window_(nullptr), renderer_(nullptr), rect_({}), init_(false) {}
+    : window_(nullptr),
+      renderer_(nullptr),
+      rect_({}),
+      flip_(SDL_FLIP_NONE),
+      init_(false) {}
 
 SDLSink::~SDLSink() {
   stop();
@@ -47,7 +54,26 @@ int SDLSink::configure(const libcamera::CameraConfiguration& config) {
     return -EINVAL;
   }
 
-  const libcamera::StreamConfiguration& cfg = config.at(0);
+  libcamera::StreamConfiguration cfg = config.at(0);
+  stream_ = cfg.stream();
+
+  /*
+   * Scale frames down on the CPU when asked to, the texture then sees frames
+   * of the preview size.
+   */
+  if (opts.preview_width) {
+    scaler_ = std::make_unique<ImageScaler>();
+    ret = scaler_->configure(
+        cfg.pixelFormat, cfg.size, cfg.stride,
+        libcamera::Size(opts.preview_width, opts.preview_height));
+    if (ret < 0)
+      return ret;
+
+    cfg.size = scaler_->outputSize();
+    cfg.stride = scaler_->outputStride();
+    scaled_.resize(scaler_->outputLength());
+  }
+
   rect_.w = cfg.size.width;
   rect_.h = cfg.size.height;
 
@@ -65,17 +91,47 @@ int SDLSink::configure(const libcamera::CameraConfiguration& config) {
     case libcamera::formats::YUYV:
       texture_ = std::make_unique<SDLTextureYUYV>(rect_, cfg.stride);
       break;
-    default:
-      EPRINT("Unsupported pixel format %s\n",
-             cfg.pixelFormat.toString().c_str());
-      return -EINVAL;
+    default: {
+      auto converter = std::make_unique<FormatConverter>();
+      if (converter->configure(cfg, libcamera::formats::XRGB8888) < 0) {
+        EPRINT("Unsupported pixel format %s\n",
+               cfg.pixelFormat.toString().c_str());
+        return -EINVAL;
+      }
+
+      texture_ =
+          std::make_unique<SDLTextureConverted>(rect_, std::move(converter));
+      break;
+    }
   };
 
   return 0;
 }
 
+/* The renderer flips frames while copying the texture, on the GPU. */
+int SDLSink::setTransform(libcamera::Transform transform) {
+  switch (transform) {
+    case libcamera::Transform::Identity:
+      flip_ = SDL_FLIP_NONE;
+      return 0;
+    case libcamera::Transform::HFlip:
+      flip_ = SDL_FLIP_HORIZONTAL;
+      return 0;
+    case libcamera::Transform::VFlip:
+      flip_ = SDL_FLIP_VERTICAL;
+      return 0;
+    case libcamera::Transform::Rot180:
+      flip_ = static_cast<SDL_RendererFlip>(SDL_FLIP_HORIZONTAL |
+                                            SDL_FLIP_VERTICAL);
+      return 0;
+    default:
+      return -ENOTSUP;
+  }
+}
+
 int SDLSink::start() {
-  int ret = SDL_Init(SDL_INIT_VIDEO);
+  /* Video is reference counted, each camera of the process has a window. */
+  int ret = SDL_InitSubSystem(SDL_INIT_VIDEO);
   if (ret) {
     EPRINT("Failed to initialize SDL: %s\n", SDL_GetError());
     return ret;
@@ -132,25 +188,18 @@ int SDLSink::stop() {
   }
 
   if (init_) {
-    SDL_Quit();
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
     init_ = false;
   }
 
   return FrameSink::stop();
 }
 
-void SDLSink::mapBuffer(FrameBuffer* buffer) {
-  std::unique_ptr<Image> image =
-      Image::fromFrameBuffer(buffer, Image::MapMode::ReadOnly);
-  assert(image != nullptr);
-
-  mappedBuffers_[buffer] = std::move(image);
-}
-
 bool SDLSink::processRequest(Request* request) {
-  for (auto [stream, buffer] : request->buffers()) {
+  FrameBuffer* buffer = request->findBuffer(stream_);
+  if (buffer) {
     renderBuffer(buffer);
-    break; /* to be expanded to launch SDL window per buffer */
+    frameDisplayed.emit(request);
   }
 
   return true;
@@ -169,7 +218,11 @@ void SDLSink::processSDLEvents() {
 }
 
 void SDLSink::renderBuffer(FrameBuffer* buffer) {
-  Image* image = mappedBuffers_[buffer].get();
+  Image* image = mappedBuffers_->image(buffer);
+  if (!image)
+    return;
+
+  Image::CpuAccess access(image, Image::MapMode::ReadOnly);
 
   std::vector<Span<const uint8_t>> planes;
   unsigned int i = 0;
@@ -187,9 +240,17 @@ void SDLSink::renderBuffer(FrameBuffer* buffer) {
     i++;
   }
 
+  if (scaler_) {
+    if (scaler_->scale(planes, scaled_.data()) < 0)
+      return;
+
+    planes = scaler_->outputPlanes(scaled_.data());
+  }
+
   texture_->update(planes);
 
   SDL_RenderClear(renderer_);
-  SDL_RenderCopy(renderer_, texture_->get(), nullptr, nullptr);
+  SDL_RenderCopyEx(renderer_, texture_->get(), nullptr, nullptr, 0, nullptr,
+                   flip_);
   SDL_RenderPresent(renderer_);
 }
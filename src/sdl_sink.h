@@ -1,7 +1,7 @@
 #pragma once
 
-#include <map>
 #include <memory>
+#include <vector>
 
 #include <libcamera/stream.h>
 
@@ -9,7 +9,7 @@
 
 #include "frame_sink.h"
 
-class Image;
+class ImageScaler;
 class SDLTexture;
 
 class SDLSink : public FrameSink {
@@ -18,9 +18,9 @@ class SDLSink : public FrameSink {
   ~SDLSink();
 
   int configure(const libcamera::CameraConfiguration& config) override;
+  int setTransform(libcamera::Transform transform) override;
   int start() override;
   int stop() override;
-  void mapBuffer(libcamera::FrameBuffer* buffer) override;
 
   bool processRequest(libcamera::Request* request) override;
 
@@ -28,12 +28,14 @@ class SDLSink : public FrameSink {
   void renderBuffer(libcamera::FrameBuffer* buffer);
   void processSDLEvents();
 
-  std::map<libcamera::FrameBuffer*, std::unique_ptr<Image>> mappedBuffers_;
-
+  const libcamera::Stream* stream_ = nullptr;
   std::unique_ptr<SDLTexture> texture_;
+  std::unique_ptr<ImageScaler> scaler_;
+  std::vector<uint8_t> scaled_;
 
   SDL_Window* window_;
   SDL_Renderer* renderer_;
   SDL_Rect rect_;
+  SDL_RendererFlip flip_;
   bool init_;
 };
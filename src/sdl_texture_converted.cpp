@@ -0,0 +1,22 @@
+#include "sdl_texture_converted.h"
+
+using namespace libcamera;
+
+/*
+ * Display formats SDL has no texture for by converting them to XRGB8888,
+ * which SDL calls RGB888.
+ */
+SDLTextureConverted::SDLTextureConverted(
+    const SDL_Rect& rect,
+    std::unique_ptr<FormatConverter> converter)
+    : SDLTexture(rect, SDL_PIXELFORMAT_RGB888, converter->outputStride()),
+      converter_(std::move(converter)),
+      rgb_(std::make_unique<uint8_t[]>(converter_->outputSize())) {}
+
+void SDLTextureConverted::update(
+    const std::vector<libcamera::Span<const uint8_t>>& data) {
+  if (converter_->convert(data, rgb_.get()) < 0)
+    return;
+
+  SDL_UpdateTexture(ptr_, nullptr, rgb_.get(), stride_);
+}
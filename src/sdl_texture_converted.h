@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory>
+
+#include "format_converter.h"
+#include "sdl_texture.h"
+
+class SDLTextureConverted : public SDLTexture {
+ public:
+  SDLTextureConverted(const SDL_Rect& rect,
+                      std::unique_ptr<FormatConverter> converter);
+
+  void update(const std::vector<libcamera::Span<const uint8_t>>& data) override;
+
+ private:
+  std::unique_ptr<FormatConverter> converter_;
+  std::unique_ptr<uint8_t[]> rgb_;
+};
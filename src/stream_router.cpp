@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * stream_router.cpp - Route each stream of a camera to its own sink
+ */
+
+#include "stream_router.h"
+
+#include <errno.h>
+
+#include <libcamera/camera.h>
+#include <libcamera/request.h>
+#include <libcamera/stream.h>
+
+#include "twincam.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Configuration of a single stream, as seen by the sink of the stream. */
+class StreamConfigurationView : public CameraConfiguration {
+ public:
+  StreamConfigurationView(const CameraConfiguration& config,
+                          unsigned int index) {
+    addConfiguration(config.at(index));
+  }
+
+  Status validate() override { return Valid; }
+};
+
+}  // namespace
+
+/**
+ * \class StreamRouter
+ * \brief Hand each stream of the camera to a sink of its own
+ *
+ * Sinks show or record a single stream, the first one of the configuration
+ * they're given. The router configures each of its sinks with the stream
+ * routed to it alone, and passes every request to all of them as a TeeSink
+ * does, so that the ISP scales a viewfinder stream for the display while a
+ * full resolution stream is recorded.
+ *
+ * Transforms and crops, which the camera session computes for its first
+ * stream, go to the sink of the first stream.
+ */
+StreamRouter::StreamRouter() = default;
+
+StreamRouter::~StreamRouter() = default;
+
+/* Route stream \a stream, by index in the camera configuration, to \a sink. */
+void StreamRouter::addSink(unsigned int stream,
+                           std::unique_ptr<FrameSink> sink) {
+  TeeSink::addSink(std::move(sink));
+  indexes_.push_back(stream);
+  streams_.push_back(nullptr);
+}
+
+int StreamRouter::configure(const CameraConfiguration& config) {
+  for (unsigned int i = 0; i < sinks_.size(); ++i) {
+    if (indexes_[i] >= config.size()) {
+      EPRINT("No stream %u to route, %zu configured\n", indexes_[i],
+             config.size());
+      return -EINVAL;
+    }
+
+    streams_[i] = config.at(indexes_[i]).stream();
+
+    int ret =
+        sinks_[i]->configure(StreamConfigurationView(config, indexes_[i]));
+    if (ret < 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+FrameSink* StreamRouter::firstStreamSink() const {
+  for (unsigned int i = 0; i < sinks_.size(); ++i) {
+    if (indexes_[i] == 0)
+      return sinks_[i].get();
+  }
+
+  return nullptr;
+}
+
+int StreamRouter::setTransform(Transform transform) {
+  FrameSink* sink = firstStreamSink();
+  return sink ? sink->setTransform(transform)
+              : FrameSink::setTransform(transform);
+}
+
+int StreamRouter::setCrop(const Rectangle& crop) {
+  FrameSink* sink = firstStreamSink();
+  return sink ? sink->setCrop(crop) : -ENOTSUP;
+}
+
+void StreamRouter::mapBuffer(const Stream* stream, FrameBuffer* buffer) {
+  for (unsigned int i = 0; i < sinks_.size(); ++i) {
+    if (streams_[i] == stream)
+      sinks_[i]->mapBuffer(stream, buffer);
+  }
+}
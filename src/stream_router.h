@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * stream_router.h - Route each stream of a camera to its own sink
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "tee_sink.h"
+
+namespace libcamera {
+class Stream;
+} /* namespace libcamera */
+
+class StreamRouter : public TeeSink {
+ public:
+  StreamRouter();
+  ~StreamRouter();
+
+  void addSink(unsigned int stream, std::unique_ptr<FrameSink> sink);
+
+  int configure(const libcamera::CameraConfiguration& config) override;
+  int setTransform(libcamera::Transform transform) override;
+  int setCrop(const libcamera::Rectangle& crop) override;
+
+  void mapBuffer(const libcamera::Stream* stream,
+                 libcamera::FrameBuffer* buffer) override;
+
+ private:
+  FrameSink* firstStreamSink() const;
+
+  /* Index in the configuration and stream of each sink. */
+  std::vector<unsigned int> indexes_;
+  std::vector<const libcamera::Stream*> streams_;
+};
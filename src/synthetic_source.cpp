@@ -0,0 +1,411 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * synthetic_source.cpp - Generate test pattern or MJPEG frames
+ */
+
+#include "synthetic_source.h"
+#include "twincam.h"
+#include "twncm_stdio.h"
+#include "uptime.h"
+
+#ifdef HAVE_LIBJPEG
+#include "jpeg_encoder.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+/* Frames drawn, given in turn, so that consecutive frames differ. */
+constexpr unsigned int kPatternFrames = 8;
+
+/* Noise added to every sample, so frames compress like camera frames. */
+constexpr unsigned int kNoise = 8;
+
+/* Colour bars, white to black, in BT.601 limited range YCbCr and in RGB. */
+constexpr std::array<std::array<uint8_t, 3>, 8> kBarsYuv = {{
+    {235, 128, 128},
+    {210, 16, 146},
+    {170, 166, 16},
+    {145, 54, 34},
+    {106, 202, 222},
+    {81, 90, 240},
+    {41, 240, 110},
+    {16, 128, 128},
+}};
+
+constexpr std::array<std::array<uint8_t, 3>, 8> kBarsRgb = {{
+    {255, 255, 255},
+    {255, 255, 0},
+    {0, 255, 255},
+    {0, 255, 0},
+    {255, 0, 255},
+    {255, 0, 0},
+    {0, 0, 255},
+    {0, 0, 0},
+}};
+
+/* Small and fast noise, the quality of the randomness doesn't matter. */
+class Noise {
+ public:
+  explicit Noise(uint32_t seed) : state_(seed | 1) {}
+
+  uint8_t add(uint8_t value) {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    const int noisy = value + static_cast<int>(state_ % kNoise) - kNoise / 2;
+    return std::clamp(noisy, 0, 255);
+  }
+
+ private:
+  uint32_t state_;
+};
+
+bool isPackedYuv(const PixelFormat& format) {
+  return format == formats::YUYV || format == formats::YVYU ||
+         format == formats::UYVY || format == formats::VYUY;
+}
+
+bool isRgb(const PixelFormat& format) {
+  return format == formats::XRGB8888 || format == formats::ARGB8888 ||
+         format == formats::XBGR8888 || format == formats::ABGR8888;
+}
+
+} /* namespace */
+
+/**
+ * \class SyntheticSource
+ * \brief Frames of colour bars, or MJPEG frames, without a camera
+ *
+ * Moving colour bars with noise are drawn in YUV and RGB formats, a few
+ * frames once and then given in turn, so that giving a frame costs nothing.
+ * MJPEG frames are the JPEG images of a recording, such as one made with -F
+ * in MJPEG, or the bars encoded when none is given. Frames live in memfds,
+ * shared by fd like the dmabufs of cameras, and are given at a set rate or as
+ * fast as they are asked for.
+ */
+SyntheticSource::SyntheticSource() = default;
+
+SyntheticSource::~SyntheticSource() {
+  release();
+}
+
+bool SyntheticSource::isSupported(const PixelFormat& format) {
+  switch (format) {
+    case formats::NV12:
+    case formats::NV21:
+    case formats::YUV420:
+    case formats::YVU420:
+    case formats::MJPEG:
+      return true;
+    default:
+      return isPackedYuv(format) || isRgb(format);
+  }
+}
+
+/*
+ * Give \a frames frames, 0 for no end, of \a format and \a size at \a fps
+ * frames per second, as fast as possible if 0. MJPEG frames come from the
+ * recording \a mjpeg if given.
+ */
+int SyntheticSource::configure(const PixelFormat& format,
+                               const Size& size,
+                               double fps,
+                               uint64_t frames,
+                               const std::string& mjpeg) {
+  release();
+
+  if (!isSupported(format)) {
+    EPRINT("Cannot generate %s frames\n", format.toString().c_str());
+    return -EINVAL;
+  }
+
+  if (size.width < 16 || size.height < 16 || size.width % 2 ||
+      size.height % 2) {
+    EPRINT("Cannot generate frames of %ux%u\n", size.width, size.height);
+    return -EINVAL;
+  }
+
+  cfg_ = StreamConfiguration();
+  cfg_.pixelFormat = format;
+  cfg_.size = size;
+  if (isPackedYuv(format))
+    cfg_.stride = size.width * 2;
+  else if (isRgb(format))
+    cfg_.stride = size.width * 4;
+  else if (format != formats::MJPEG)
+    cfg_.stride = size.width;
+  cfg_.frameSize = format == formats::MJPEG
+                       ? 0
+                       : cfg_.stride * size.height *
+                             (isPackedYuv(format) || isRgb(format) ? 2 : 3) /
+                             2;
+
+  fps_ = fps;
+  frames_ = frames;
+  count_ = 0;
+
+  if (format == formats::MJPEG)
+    return mjpeg.empty() ? encodePatterns() : loadMjpeg(mjpeg);
+
+  for (unsigned int i = 0; i < kPatternFrames; ++i) {
+    Buffer* buffer = allocate(cfg_.frameSize);
+    if (!buffer)
+      return -ENOMEM;
+
+    /* Planes follow each other, as in the single dmabuf of many cameras. */
+    const size_t luma = static_cast<size_t>(cfg_.stride) * size.height;
+    if (isPackedYuv(format) || isRgb(format)) {
+      buffer->frame.planes = {Span<uint8_t>(buffer->map, luma)};
+    } else if (format == formats::NV12 || format == formats::NV21) {
+      buffer->frame.planes = {Span<uint8_t>(buffer->map, luma),
+                              Span<uint8_t>(buffer->map + luma, luma / 2)};
+    } else {
+      buffer->frame.planes = {
+          Span<uint8_t>(buffer->map, luma),
+          Span<uint8_t>(buffer->map + luma, luma / 4),
+          Span<uint8_t>(buffer->map + luma * 5 / 4, luma / 4)};
+    }
+
+    drawPattern(*buffer, i);
+  }
+
+  return 0;
+}
+
+const SourceFrame* SyntheticSource::next() {
+  if (buffers_.empty() || (frames_ && count_ >= frames_))
+    return nullptr;
+
+  if (!count_)
+    start_ = monotonicTime();
+
+  if (fps_ > 0.0)
+    sleepUntil(start_ + static_cast<uint64_t>(count_ * 1e9 / fps_));
+
+  SourceFrame& frame = buffers_[count_ % buffers_.size()].frame;
+  frame.sequence = count_++;
+  frame.timestamp = monotonicTime();
+
+  return &frame;
+}
+
+SyntheticSource::Buffer* SyntheticSource::allocate(size_t size) {
+  Buffer buffer;
+  buffer.fd = memfd_create("twincam-synthetic", MFD_CLOEXEC);
+  if (buffer.fd < 0 || ftruncate(buffer.fd, size) < 0) {
+    EPRINT("Failed to allocate a %zu bytes memfd: %s\n", size,
+           strerror(errno));
+    if (buffer.fd >= 0)
+      close(buffer.fd);
+    return nullptr;
+  }
+
+  void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   buffer.fd, 0);
+  if (map == MAP_FAILED) {
+    EPRINT("Failed to map a %zu bytes memfd: %s\n", size, strerror(errno));
+    close(buffer.fd);
+    return nullptr;
+  }
+
+  buffer.map = static_cast<uint8_t*>(map);
+  buffer.size = size;
+  buffer.frame.fd = buffer.fd;
+  buffers_.push_back(std::move(buffer));
+
+  return &buffers_.back();
+}
+
+void SyntheticSource::release() {
+  for (Buffer& buffer : buffers_) {
+    munmap(buffer.map, buffer.size);
+    close(buffer.fd);
+  }
+
+  buffers_.clear();
+}
+
+/* Draw colour bars moved by \a index sixteenths of the width. */
+void SyntheticSource::drawPattern(const Buffer& buffer,
+                                  unsigned int index) const {
+  const PixelFormat& format = cfg_.pixelFormat;
+  const unsigned int width = cfg_.size.width;
+  const unsigned int height = cfg_.size.height;
+  const unsigned int stride = cfg_.stride;
+  const unsigned int shift = index * width / 16;
+  const auto bar = [&](unsigned int x) {
+    return (x + shift) % width * kBarsYuv.size() / width;
+  };
+  Noise noise(index + 1);
+
+  if (isRgb(format)) {
+    /* XRGB8888 is stored B, G, R, X and XBGR8888 R, G, B, X. */
+    const bool bgr = format == formats::XRGB8888 || format == formats::ARGB8888;
+    for (unsigned int y = 0; y < height; ++y) {
+      uint8_t* row = buffer.map + static_cast<size_t>(y) * stride;
+      for (unsigned int x = 0; x < width; ++x) {
+        const std::array<uint8_t, 3>& rgb = kBarsRgb[bar(x)];
+        row[x * 4 + 0] = noise.add(rgb[bgr ? 2 : 0]);
+        row[x * 4 + 1] = noise.add(rgb[1]);
+        row[x * 4 + 2] = noise.add(rgb[bgr ? 0 : 2]);
+        row[x * 4 + 3] = 0xff;
+      }
+    }
+    return;
+  }
+
+  if (isPackedYuv(format)) {
+    /* Offsets of Y0, U, Y1 and V in each pair of pixels. */
+    std::array<unsigned int, 4> order;
+    if (format == formats::YUYV)
+      order = {0, 1, 2, 3};
+    else if (format == formats::YVYU)
+      order = {0, 3, 2, 1};
+    else if (format == formats::UYVY)
+      order = {1, 0, 3, 2};
+    else
+      order = {1, 2, 3, 0};
+
+    for (unsigned int y = 0; y < height; ++y) {
+      uint8_t* row = buffer.map + static_cast<size_t>(y) * stride;
+      for (unsigned int x = 0; x < width; x += 2) {
+        const std::array<uint8_t, 3>& yuv = kBarsYuv[bar(x)];
+        uint8_t* pair = row + x * 2;
+        pair[order[0]] = noise.add(yuv[0]);
+        pair[order[1]] = yuv[1];
+        pair[order[2]] = noise.add(yuv[0]);
+        pair[order[3]] = yuv[2];
+      }
+    }
+    return;
+  }
+
+  uint8_t* luma = buffer.frame.planes[0].data();
+  for (unsigned int y = 0; y < height; ++y) {
+    uint8_t* row = luma + static_cast<size_t>(y) * stride;
+    for (unsigned int x = 0; x < width; ++x)
+      row[x] = noise.add(kBarsYuv[bar(x)][0]);
+  }
+
+  const bool swap = format == formats::NV21 || format == formats::YVU420;
+  for (unsigned int y = 0; y < height / 2; ++y) {
+    for (unsigned int x = 0; x < width / 2; ++x) {
+      const std::array<uint8_t, 3>& yuv = kBarsYuv[bar(x * 2)];
+      const uint8_t u = swap ? yuv[2] : yuv[1];
+      const uint8_t v = swap ? yuv[1] : yuv[2];
+
+      if (buffer.frame.planes.size() == 2) {
+        uint8_t* row =
+            buffer.frame.planes[1].data() + static_cast<size_t>(y) * stride;
+        row[x * 2] = u;
+        row[x * 2 + 1] = v;
+      } else {
+        const size_t offset = static_cast<size_t>(y) * (stride / 2) + x;
+        buffer.frame.planes[1][offset] = u;
+        buffer.frame.planes[2][offset] = v;
+      }
+    }
+  }
+}
+
+/* MJPEG frames of the bars, drawn in YUYV and encoded once. */
+int SyntheticSource::encodePatterns() {
+#ifdef HAVE_LIBJPEG
+  SyntheticSource yuyv;
+  int ret = yuyv.configure(formats::YUYV, cfg_.size, 0.0, kPatternFrames);
+  if (ret < 0)
+    return ret;
+
+  JpegEncoder encoder;
+  ret = encoder.configure(yuyv.configuration());
+  if (ret < 0)
+    return ret;
+
+  std::vector<uint8_t> jpeg;
+  while (const SourceFrame* frame = yuyv.next()) {
+    const std::vector<Span<const uint8_t>> planes(frame->planes.begin(),
+                                                  frame->planes.end());
+    ret = encoder.encode(planes, &jpeg);
+    if (ret < 0)
+      return ret;
+
+    Buffer* buffer = allocate(jpeg.size());
+    if (!buffer)
+      return -ENOMEM;
+
+    memcpy(buffer->map, jpeg.data(), jpeg.size());
+    buffer->frame.planes = {Span<uint8_t>(buffer->map, jpeg.size())};
+  }
+
+  return 0;
+#else
+  EPRINT("Generating MJPEG frames needs libjpeg, give a recording\n");
+  return -ENOTSUP;
+#endif
+}
+
+/*
+ * Split the MJPEG recording \a path into its JPEG images, each from its start
+ * of image marker to the next one.
+ */
+int SyntheticSource::loadMjpeg(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0 || !st.st_size) {
+    EPRINT("Failed to open %s: %s\n", path.c_str(), strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -EINVAL;
+  }
+
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    EPRINT("Failed to map %s: %s\n", path.c_str(), strerror(errno));
+    return -EINVAL;
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(map);
+  const uint8_t* end = data + st.st_size;
+  static constexpr std::array<uint8_t, 3> soi = {0xff, 0xd8, 0xff};
+  const uint8_t* image = std::search(data, end, soi.begin(), soi.end());
+
+  int ret = 0;
+  while (image != end) {
+    const uint8_t* following =
+        std::search(image + soi.size(), end, soi.begin(), soi.end());
+    const size_t size = following - image;
+
+    Buffer* buffer = allocate(size);
+    if (!buffer) {
+      ret = -ENOMEM;
+      break;
+    }
+
+    memcpy(buffer->map, image, size);
+    buffer->frame.planes = {Span<uint8_t>(buffer->map, size)};
+    image = following;
+  }
+
+  munmap(map, st.st_size);
+
+  if (!ret && buffers_.empty()) {
+    EPRINT("No JPEG image in %s\n", path.c_str());
+    ret = -EINVAL;
+  }
+
+  return ret;
+}
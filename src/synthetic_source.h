@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * synthetic_source.h - Generate test pattern or MJPEG frames
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+#include "frame_source.h"
+
+class SyntheticSource : public FrameSource {
+ public:
+  SyntheticSource();
+  ~SyntheticSource();
+
+  static bool isSupported(const libcamera::PixelFormat& format);
+
+  int configure(const libcamera::PixelFormat& format,
+                const libcamera::Size& size,
+                double fps,
+                uint64_t frames,
+                const std::string& mjpeg = "");
+
+  const libcamera::StreamConfiguration& configuration() const override {
+    return cfg_;
+  }
+
+  const SourceFrame* next() override;
+
+ private:
+  struct Buffer {
+    int fd = -1;
+    uint8_t* map = nullptr;
+    size_t size = 0;
+    SourceFrame frame;
+  };
+
+  Buffer* allocate(size_t size);
+  void release();
+  void drawPattern(const Buffer& buffer, unsigned int index) const;
+  int encodePatterns();
+  int loadMjpeg(const std::string& path);
+
+  libcamera::StreamConfiguration cfg_;
+  std::vector<Buffer> buffers_;
+
+  /* Frames per second, 0 for as fast as they are asked for. */
+  double fps_ = 0.0;
+  /* Frames to give, 0 for no end. */
+  uint64_t frames_ = 0;
+  uint64_t count_ = 0;
+  uint64_t start_ = 0;
+};
@@ -0,0 +1,135 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * tee_sink.cpp - Pass requests to several sinks
+ */
+
+#include "tee_sink.h"
+
+#include <errno.h>
+
+#include <libcamera/request.h>
+
+using namespace libcamera;
+
+/**
+ * \class TeeSink
+ * \brief Show and record the same frames with several sinks
+ *
+ * Every request is passed to all sinks, which read the same camera buffers,
+ * so displaying while recording costs no copy. Sinks that hold on to the
+ * request are counted, and the request is only released for requeuing once
+ * the last of them is done with it.
+ */
+TeeSink::TeeSink() = default;
+
+TeeSink::~TeeSink() = default;
+
+void TeeSink::addSink(std::unique_ptr<FrameSink> sink) {
+  sink->requestProcessed.connect(this, &TeeSink::sinkRelease);
+  sink->frameDisplayed.connect(this, &TeeSink::sinkDisplayed);
+  sinks_.push_back(std::move(sink));
+}
+
+int TeeSink::configure(const CameraConfiguration& config) {
+  for (std::unique_ptr<FrameSink>& sink : sinks_) {
+    int ret = sink->configure(config);
+    if (ret < 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+/*
+ * A transform is only left to the sinks if all of them apply it, frames are
+ * otherwise transformed on the CPU and must reach every sink untouched.
+ */
+int TeeSink::setTransform(Transform transform) {
+  for (std::unique_ptr<FrameSink>& sink : sinks_) {
+    if (sink->setTransform(transform) < 0) {
+      for (std::unique_ptr<FrameSink>& other : sinks_)
+        other->setTransform(Transform::Identity);
+      return -ENOTSUP;
+    }
+  }
+
+  return 0;
+}
+
+/* Zoom applies to the sinks that can crop, displays, others see it all. */
+int TeeSink::setCrop(const Rectangle& crop) {
+  int ret = -ENOTSUP;
+  for (std::unique_ptr<FrameSink>& sink : sinks_) {
+    if (!sink->setCrop(crop))
+      ret = 0;
+  }
+
+  return ret;
+}
+
+void TeeSink::mapBuffer(const Stream* stream, FrameBuffer* buffer) {
+  for (std::unique_ptr<FrameSink>& sink : sinks_)
+    sink->mapBuffer(stream, buffer);
+}
+
+void TeeSink::setMappedBuffers(MappedBufferCache* mappedBuffers) {
+  FrameSink::setMappedBuffers(mappedBuffers);
+  for (std::unique_ptr<FrameSink>& sink : sinks_)
+    sink->setMappedBuffers(mappedBuffers);
+}
+
+void TeeSink::setRecording(bool recording) {
+  FrameSink::setRecording(recording);
+  for (std::unique_ptr<FrameSink>& sink : sinks_)
+    sink->setRecording(recording);
+}
+
+int TeeSink::start() {
+  for (std::unique_ptr<FrameSink>& sink : sinks_) {
+    int ret = sink->start();
+    if (ret < 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+int TeeSink::stop() {
+  int ret = 0;
+  for (std::unique_ptr<FrameSink>& sink : sinks_) {
+    int err = sink->stop();
+    if (err < 0 && !ret)
+      ret = err;
+  }
+
+  pending_.clear();
+
+  return ret;
+}
+
+bool TeeSink::processRequest(Request* request) {
+  unsigned int held = 0;
+  for (std::unique_ptr<FrameSink>& sink : sinks_) {
+    if (!sink->processRequest(request))
+      ++held;
+  }
+
+  if (!held)
+    return true;
+
+  pending_[request] = held;
+  return false;
+}
+
+void TeeSink::sinkRelease(Request* request) {
+  auto iter = pending_.find(request);
+  if (iter == pending_.end() || --iter->second)
+    return;
+
+  pending_.erase(iter);
+  requestProcessed.emit(request);
+}
+
+void TeeSink::sinkDisplayed(Request* request) {
+  frameDisplayed.emit(request);
+}
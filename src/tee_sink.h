@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * tee_sink.h - Pass requests to several sinks
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "frame_sink.h"
+
+class TeeSink : public FrameSink {
+ public:
+  TeeSink();
+  ~TeeSink();
+
+  void addSink(std::unique_ptr<FrameSink> sink);
+
+  int configure(const libcamera::CameraConfiguration& config) override;
+  int setTransform(libcamera::Transform transform) override;
+  int setCrop(const libcamera::Rectangle& crop) override;
+
+  void mapBuffer(const libcamera::Stream* stream,
+                 libcamera::FrameBuffer* buffer) override;
+  void setMappedBuffers(MappedBufferCache* mappedBuffers) override;
+  void setRecording(bool recording) override;
+
+  int start() override;
+  int stop() override;
+
+  bool processRequest(libcamera::Request* request) override;
+
+ protected:
+  std::vector<std::unique_ptr<FrameSink>> sinks_;
+
+ private:
+  void sinkRelease(libcamera::Request* request);
+  void sinkDisplayed(libcamera::Request* request);
+
+  /* Requests held by sinks, with the number of sinks yet to release them. */
+  std::map<libcamera::Request*, unsigned int> pending_;
+};
@@ -7,20 +7,30 @@
 
 #include <dirent.h>
 #include <getopt.h>
+#include <limits.h>
 #ifdef HAVE_LIBUDEV
 #include <libudev.h>
 #endif
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <atomic>
 #include <iomanip>
+#include <sstream>
 
 #include <libcamera/libcamera.h>
 #include <libcamera/property_ids.h>
 
 #include "camera_session.h"
+#include "cpu_features.h"
 #include "event_loop.h"
+#include "frame_sink.h"
+#include "frame_synchronizer.h"
+#include "frame_transform.h"
+#ifdef HAVE_DRM
+#include "kms_compositor.h"
+#endif
 #include "twincam.h"
 #include "twncm_fnctl.h"
 #include "twncm_stdlib.h"
@@ -45,6 +55,16 @@ class CamApp {
   void cameraRemoved(std::shared_ptr<Camera> cam);
   void captureDone();
   int run();
+#ifdef HAVE_DRM
+  int runComposite();
+#endif
+
+  int selectCameras(std::vector<long>* cameras) const;
+  static std::unique_ptr<FrameSynchronizer> createSynchronizer(
+      unsigned int cameras);
+
+  static void readCommand(
+      const std::vector<std::unique_ptr<CameraSession>>& sessions);
 
   static std::string cameraName(const Camera* camera);
 
@@ -337,6 +357,129 @@ void CamApp::quit() {
   loop_.exit();
 }
 
+/*
+ * Parse a zoom FACTOR[@X,Y], the center defaults to the middle of the frame.
+ */
+static int parseZoom(const char* arg, double* factor, double* x, double* y) {
+  double center[2] = {0.5, 0.5};
+  int n = sscanf(arg, "%lf@%lf,%lf", factor, &center[0], &center[1]);
+  if ((n != 1 && n != 3) || *factor < 1.0 || center[0] < 0.0 ||
+      center[0] > 1.0 || center[1] < 0.0 || center[1] > 1.0) {
+    EPRINT("Invalid zoom '%s', expected FACTOR[@X,Y] with FACTOR >= 1 and "
+           "X,Y in [0, 1]\n",
+           arg);
+    return -EINVAL;
+  }
+
+  *x = center[0];
+  *y = center[1];
+
+  return 0;
+}
+
+void CamApp::readCommand(
+    const std::vector<std::unique_ptr<CameraSession>>& sessions) {
+  char line[64];
+  ssize_t len = read(STDIN_FILENO, line, sizeof(line) - 1);
+  if (len <= 0)
+    return;
+
+  line[len] = '\0';
+
+  double factor, x, y;
+  if (strncmp(line, "zoom ", 5)) {
+    EPRINT("Unknown command, expected zoom FACTOR[@X,Y]\n");
+    return;
+  }
+
+  if (parseZoom(line + 5, &factor, &x, &y) < 0)
+    return;
+
+  for (const std::unique_ptr<CameraSession>& session : sessions)
+    session->setZoom(factor, x, y);
+}
+
+/*
+ * Resolve the comma separated cameras given with -c, by index as listed by
+ * -l, ID, or location (front, back or external). Without -c, a single session
+ * opens the first camera that can be configured, with index -1.
+ */
+int CamApp::selectCameras(std::vector<long>* cameras) const {
+  cameras->clear();
+
+  if (opts.camera.empty()) {
+    cameras->push_back(-1);
+    return 0;
+  }
+
+  static const struct {
+    const char* name;
+    int location;
+  } locations[] = {
+      {"front", properties::CameraLocationFront},
+      {"back", properties::CameraLocationBack},
+      {"external", properties::CameraLocationExternal},
+  };
+
+  const std::vector<std::shared_ptr<Camera>>& list = cm_->cameras();
+  std::istringstream stream(opts.camera);
+
+  for (std::string name; std::getline(stream, name, ',');) {
+    char* end = nullptr;
+    long index = strtol(name.c_str(), &end, 10);
+    if (name.empty() || *end || index < 0 ||
+        index >= static_cast<long>(list.size()))
+      index = -1;
+
+    for (size_t i = 0; i < list.size() && index < 0; ++i) {
+      if (list[i]->id() == name)
+        index = i;
+    }
+
+    for (const auto& location : locations) {
+      if (index >= 0 || name != location.name)
+        continue;
+
+      /* The first camera at the location not selected already. */
+      for (size_t i = 0; i < list.size() && index < 0; ++i) {
+        const auto value = list[i]->properties().get(properties::Location);
+        if (value && *value == location.location &&
+            std::find(cameras->begin(), cameras->end(), i) == cameras->end())
+          index = i;
+      }
+    }
+
+    if (index < 0) {
+      EPRINT("Camera '%s' not found, see -l\n", name.c_str());
+      return -ENODEV;
+    }
+
+    if (std::find(cameras->begin(), cameras->end(), index) != cameras->end()) {
+      EPRINT("Camera '%s' selected twice\n", name.c_str());
+      return -EINVAL;
+    }
+
+    cameras->push_back(index);
+  }
+
+  return 0;
+}
+
+/*
+ * Synchronize the frames of \a cameras cameras when --sync is given, there's
+ * nothing to wait for with a single camera.
+ */
+std::unique_ptr<FrameSynchronizer> CamApp::createSynchronizer(
+    unsigned int cameras) {
+  if (opts.sync <= 0.0 || cameras < 2)
+    return nullptr;
+
+  PRINT("Synchronizing %u cameras within %.2f ms\n", cameras, opts.sync);
+
+  return std::make_unique<FrameSynchronizer>(
+      cameras, static_cast<uint64_t>(opts.sync * 1000000.0));
+}
+
 int CamApp::run() {
   PRINT_FUNC();
   if (opts.print_available_cameras) {
@@ -353,25 +496,137 @@ int CamApp::run() {
     return 0;
   }
 
-  CameraSession session(cm_.get());
-  int ret = session.init();
-  if (ret) {
-    PRINT("Failed to init camera session\n");
+#ifdef HAVE_DRM
+  if (!opts.composite.empty())
+    return runComposite();
+#endif
+
+  std::vector<long> cameras;
+  int ret = selectCameras(&cameras);
+  if (ret < 0)
     return ret;
+
+#ifdef HAVE_DRM
+  /*
+   * Cameras beyond the connectors listed share the last one, and cameras on
+   * the same connector split the screen in columns.
+   */
+  std::vector<std::string> connectors;
+  std::istringstream stream(opts.connector);
+  for (std::string name; std::getline(stream, name, ',');)
+    connectors.push_back(name);
+  const std::string last = connectors.empty() ? "" : connectors.back();
+  connectors.resize(cameras.size(), last);
+#endif
+
+  /* One session per camera, all driven by the event loop. */
+  std::unique_ptr<FrameSynchronizer> sync = createSynchronizer(cameras.size());
+  std::vector<std::unique_ptr<CameraSession>> sessions;
+  for (unsigned int i = 0; i < cameras.size(); ++i) {
+    auto session = std::make_unique<CameraSession>(cm_.get(), cameras[i]);
+    session->setPosition(i, cameras.size());
+    if (sync)
+      session->setSynchronizer(sync.get(), i);
+
+#ifdef HAVE_DRM
+    const auto begin = connectors.begin();
+    const std::string& connector = connectors[i];
+    session->setDisplay(connector, std::count(begin, begin + i, connector),
+                        std::count(begin, connectors.end(), connector));
+#endif
+
+    ret = session->init();
+    if (ret) {
+      PRINT("Failed to init camera session\n");
+      break;
+    }
+
+    ret = session->start();
+    if (ret) {
+      PRINT("Failed to start camera session\n");
+      break;
+    }
+
+    sessions.push_back(std::move(session));
   }
 
-  ret = session.start();
-  if (ret) {
-    PRINT("Failed to start camera session\n");
+  if (!ret) {
+    /* Let the user zoom from an interactive terminal. */
+    if (isatty(STDIN_FILENO)) {
+      loop_.addFdEvent(STDIN_FILENO, EventLoop::Read,
+                       [&sessions]() { readCommand(sessions); });
+    }
+
+    loop_.exec();
+  }
+
+  if (sync)
+    sync->stop();
+  for (std::unique_ptr<CameraSession>& session : sessions)
+    session->stop();
+
+  return ret;
+}
+
+#ifdef HAVE_DRM
+/*
+ * Stream from each camera of the composite layout, and show the composite of
+ * their latest frames on the display.
+ */
+int CamApp::runComposite() {
+  CompositorLayout layout;
+  int ret = layout.load(opts.composite);
+  if (ret < 0)
     return ret;
+
+  /* The compositor reads NV12 frames. */
+  opts.pf = "NV12";
+
+  KMSCompositor compositor("");
+  compositor.setLayout(layout);
+
+  std::unique_ptr<FrameSynchronizer> sync =
+      createSynchronizer(layout.views.size());
+  std::vector<std::unique_ptr<CameraSession>> sessions;
+  for (unsigned int view = 0; view < layout.views.size(); ++view) {
+    auto session =
+        std::make_unique<CameraSession>(cm_.get(), layout.views[view].camera);
+    if (sync)
+      session->setSynchronizer(sync.get(), view);
+    if (session->init()) {
+      PRINT("Failed to init camera session %u\n", layout.views[view].camera);
+      ret = -ENODEV;
+      break;
+    }
+
+    session->setSink(compositor.createInput(view));
+    ret = session->start();
+    if (ret) {
+      PRINT("Failed to start camera session %u\n", layout.views[view].camera);
+      break;
+    }
+
+    sessions.push_back(std::move(session));
   }
 
-  loop_.exec();
+  if (!ret) {
+    ret = compositor.start();
+    if (ret)
+      PRINT("Failed to start the compositor\n");
+  }
 
-  session.stop();
+  if (!ret)
+    loop_.exec();
 
-  return 0;
+  compositor.stop();
+  if (sync)
+    sync->stop();
+  for (std::unique_ptr<CameraSession>& session : sessions)
+    session->stop();
+
+  return ret;
 }
+#endif
 
 std::string CamApp::cameraName(const Camera* camera) {
   const ControlList& props = camera->properties();
@@ -455,8 +710,41 @@ static void chrootThis([[maybe_unused]] int signal) {
   setlocale(LC_ALL, "");
 }
 
+/* Options without a short form */
+enum {
+  OptComposite = 256,
+  OptConnector,
+  OptCpuFeatures,
+  OptHttp,
+  OptLatency,
+  OptMetadataRing,
+  OptMonitor,
+  OptMonitorFrames,
+  OptMotion,
+  OptPreviewSize,
+  OptPublish,
+  OptRecordOnMotion,
+  OptStream,
+  OptSync,
+  OptUndistort,
+  OptV4L2Output,
+  OptZoom,
+};
+
 static int processArgs(int argc, char** argv) {
   const struct option options[] = {{"camera", required_argument, 0, 'c'},
+                                   {"copy-frames", no_argument, 0, 'C'},
+#ifdef HAVE_DRM
+                                   {"composite", required_argument, 0,
+                                    OptComposite},
+                                   {"connector", required_argument, 0,
+                                    OptConnector},
+#endif
+                                   {"cpu-features", required_argument, 0,
+                                    OptCpuFeatures},
+#ifdef HAVE_ZSTD
+                                   {"compress", required_argument, 0, 'z'},
+#endif
                                    {"daemon", no_argument, 0, 'd'},
 #ifdef HAVE_DRM
                                    {"drm", no_argument, 0, 'D'},
@@ -464,25 +752,67 @@ static int processArgs(int argc, char** argv) {
                                    {"filename", required_argument, 0, 'F'},
                                    {"function", no_argument, 0, 'f'},
                                    {"help", no_argument, 0, 'h'},
+                                   {"http", required_argument, 0, OptHttp},
                                    {"kill", no_argument, 0, 'k'},
+#ifdef HAVE_DRM
+                                   {"latency", no_argument, 0, OptLatency},
+#endif
                                    {"list-cameras", no_argument, 0, 'l'},
+                                   {"metadata-ring", required_argument, 0,
+                                    OptMetadataRing},
+                                   {"monitor", required_argument, 0,
+                                    OptMonitor},
+                                   {"monitor-frames", required_argument, 0,
+                                    OptMonitorFrames},
+                                   {"motion", required_argument, 0,
+                                    OptMotion},
                                    {"new-root-dir", no_argument, 0, 'n'},
                                    {"pixel-format", required_argument, 0, 'p'},
 #ifdef HAVE_SDL
+                                   {"preview-size", required_argument, 0,
+                                    OptPreviewSize},
                                    {"sdl", no_argument, 0, 'S'},
 #endif
+                                   {"stream", required_argument, 0,
+                                    OptStream},
+                                   {"sync", required_argument, 0, OptSync},
+                                   {"publish", required_argument, 0,
+                                    OptPublish},
+                                   {"record-on-motion", no_argument, 0,
+                                    OptRecordOnMotion},
                                    {"syslog", no_argument, 0, 's'},
+                                   {"transform", required_argument, 0, 't'},
+                                   {"undistort", required_argument, 0,
+                                    OptUndistort},
                                    {"uptime", no_argument, 0, 'u'},
+                                   {"v4l2-output", required_argument, 0,
+                                    OptV4L2Output},
                                    {"verbose", no_argument, 0, 'v'},
+                                   {"zoom", required_argument, 0, OptZoom},
                                    {NULL, 0, 0, '\0'}};
 
-  for (int opt; (opt = getopt_long(argc, argv, "c:dDF:fhklnp:Ssuv", options,
-                                   NULL)) != -1;) {
+  for (int opt; (opt = getopt_long(argc, argv, "c:CdDF:fhklnp:Sst:uvz:",
+                                   options, NULL)) != -1;) {
     int fd;
     char buf[16];
     switch (opt) {
       case 'c':
-        opts.camera = twncm_atoi(optarg);
+        opts.camera = optarg;
+        break;
+      case 'C':
+        opts.copy_frames = true;
+        break;
+#ifdef HAVE_DRM
+      case OptComposite:
+        opts.composite = optarg;
+        break;
+      case OptConnector:
+        opts.connector = optarg;
+        break;
+#endif
+      case OptCpuFeatures:
+        if (CpuFeatures::restrictTo(optarg) < 0)
+          return 1;
         break;
       case 'd':
         fd = twncm_open_write("/var/run/twincam.pid");
@@ -513,6 +843,42 @@ static int processArgs(int argc, char** argv) {
       case 'l':
         opts.print_available_cameras = true;
         break;
+#ifdef HAVE_DRM
+      case OptLatency:
+        opts.latency = true;
+        opts.drm = true;
+        break;
+#endif
+      case OptHttp:
+        opts.http = optarg;
+        break;
+      case OptMetadataRing:
+        opts.metadata_ring = optarg;
+        break;
+      case OptMonitor:
+        opts.monitor = optarg;
+        break;
+      case OptMonitorFrames: {
+        char* end;
+        const unsigned long frames = strtoul(optarg, &end, 10);
+        if (*end || end == optarg || !frames || frames > UINT_MAX) {
+          EPRINT("Invalid monitor frame count '%s'\n", optarg);
+          return 1;
+        }
+        opts.monitor_frames = frames;
+        break;
+      }
+      case OptMotion: {
+        char* end;
+        opts.motion = strtod(optarg, &end);
+        if (*end || end == optarg || !(opts.motion > 0.0) ||
+            opts.motion > 100.0) {
+          EPRINT("Invalid motion threshold '%s', expected a percentage\n",
+                 optarg);
+          return 1;
+        }
+        break;
+      }
       case 'n':
         fd = twncm_open_read("/var/run/twincam.pid");
         pid_read(fd, buf);
@@ -523,47 +889,195 @@ static int processArgs(int argc, char** argv) {
         opts.pf = optarg;
         break;
 #ifdef HAVE_SDL
+      case OptPreviewSize:
+        if (sscanf(optarg, "%ux%u", &opts.preview_width,
+                   &opts.preview_height) != 2 ||
+            !opts.preview_width || !opts.preview_height) {
+          EPRINT("Invalid preview size '%s', expected WIDTHxHEIGHT\n", optarg);
+          return 1;
+        }
+        break;
       case 'S':
         opts.sdl = true;
         break;
 #endif
+      case OptPublish:
+        opts.publish = optarg;
+        break;
+      case OptRecordOnMotion:
+        opts.record_on_motion = true;
+        if (opts.motion <= 0.0)
+          opts.motion = 1.0;
+        break;
+      case OptStream: {
+        StreamSpec stream;
+        if (parseStreamSpec(optarg, &stream) < 0)
+          return 1;
+        opts.streams.push_back(optarg);
+        break;
+      }
+      case OptSync: {
+        char* end;
+        opts.sync = strtod(optarg, &end);
+        if (*end || end == optarg || !(opts.sync >= 0.0)) {
+          EPRINT("Invalid sync tolerance '%s', expected milliseconds\n",
+                 optarg);
+          return 1;
+        }
+        break;
+      }
       case 's':
         opts.to_syslog = true;
         setenv("LIBCAMERA_LOG_FILE", "syslog", 1);
         openlog("twincam", 0, LOG_LOCAL1);
         break;
+      case 't': {
+        Transform transform;
+        if (parseTransform(optarg, &transform) < 0)
+          return 1;
+        opts.transform = optarg;
+        break;
+      }
+      case OptUndistort:
+        opts.undistort = optarg;
+        break;
       case 'u':
         opts.uptime = true;
         break;
+      case OptV4L2Output:
+        opts.v4l2_output = optarg;
+        break;
       case 'v':
         opts.verbose = true;
         setenv("LIBCAMERA_LOG_LEVELS", "DEBUG", 1);
         break;
+      case OptZoom:
+        if (parseZoom(optarg, &opts.zoom, &opts.zoom_x, &opts.zoom_y) < 0)
+          return 1;
+        break;
+#ifdef HAVE_ZSTD
+      case 'z':
+        opts.compress = true;
+        opts.compress_level = twncm_atoi(optarg);
+        break;
+#endif
       default:
         static const char* help =
             "Usage: twincam [OPTIONS]\n\n"
             "Options:\n"
-            "  -c, --camera        Camera to select\n"
+            "  -c, --camera        Cameras to stream from at once, comma "
+            "separated indices,\n"
+            "                      IDs or locations (front, back, "
+            "external). -F, --http,\n"
+            "                      --publish and --v4l2-output then take "
+            "one comma separated\n"
+            "                      target per camera, cameras sharing a "
+            "path get -camN added\n"
+            "                      to it and cameras sharing a port the "
+            "ports following it\n"
+            "  -C, --copy-frames   Copy frames to cached memory before "
+            "reading them\n"
+            "                      on the CPU\n"
+#ifdef HAVE_DRM
+            "      --composite     Show the cameras of this layout file "
+            "composited into\n"
+            "                      one view through drm\n"
+            "      --connector     drm connectors of the cameras, comma "
+            "separated, cameras\n"
+            "                      on the same connector share its screen\n"
+#endif
+            "      --cpu-features  Only use pixel kernels for these comma "
+            "separated CPU\n"
+            "                      features (sse2, sse4.1, avx2, neon, "
+            "dotprod or none)\n"
             "  -d, --daemon        Daemon mode (write a pid file "
             "/var/run/twincam.pid)\n"
 #ifdef HAVE_DRM
             "  -D, --drm           Display viewfinder through drm\n"
 #endif
-            "  -F, --filename      Write captured frames to disk\n"
+            "  -F, --filename      Write captured frames to disk, a .mkv "
+            "filename\n"
+            "                      records MJPEG into a Matroska file, also "
+            "with -S or -D\n"
+            "                      to show and record the same frames\n"
             "  -f, --function      function tracer\n"
             "  -h, --help          Print this help\n"
+            "      --http          Serve frames as MJPEG over HTTP on this "
+            "loopback port or\n"
+            "                      Unix socket path\n"
             "  -k, --kill          Kill twincam (sends SIGTERM to "
             "pidfile pid)\n"
             "  -l, --list-cameras  List cameras\n"
+#ifdef HAVE_DRM
+            "      --latency       Measure the capture to scanout latency "
+            "through drm with\n"
+            "                      a writeback connector, such as the one "
+            "of vkms\n"
+#endif
+            "      --metadata-ring Publish frame metadata in shared memory "
+            "/dev/shm/NAME-camN,\n"
+            "                      see frame_ring.h\n"
+            "      --monitor       Raise alarms on frozen, stalled, black or "
+            "saturated\n"
+            "                      frames, with a status file FILE-camN in "
+            "the Prometheus\n"
+            "                      text format\n"
+            "      --monitor-frames\n"
+            "                      Frames an alarm condition must last, 15 by "
+            "default\n"
+            "      --motion        Report motion when this percentage of "
+            "the frame changes,\n"
+            "                      in YUV frames\n"
             "  -n, --new-root-dir  chroot to /sysroot (sends SIGUSR1 to "
             "pidfile pid)\n"
             "  -p, --pixel-format  Select pixel format\n"
 #ifdef HAVE_SDL
+            "      --preview-size  Scale frames to WIDTHxHEIGHT on the CPU "
+            "before\n"
+            "                      displaying them through SDL\n"
             "  -S, --sdl           Display viewfinder through SDL\n"
 #endif
+            "      --publish       Share frames with other processes on this "
+            "Unix socket,\n"
+            "                      see frame_share_client.h\n"
+            "      --record-on-motion\n"
+            "                      Only record with -F while motion is "
+            "detected, with\n"
+            "                      --motion 1 unless given\n"
+            "      --stream        Capture a ROLE[:WxH[:FORMAT]] stream, "
+            "repeat for more\n"
+            "                      streams, the first is shown and the "
+            "others recorded\n"
+            "                      with -F, ROLE is viewfinder, video, still "
+            "or raw\n"
             "  -s, --syslog        Also trace output in syslog\n"
+            "      --sync          Show frames of several cameras together "
+            "when their\n"
+            "                      timestamps are within this many "
+            "milliseconds\n"
+            "  -t, --transform     Flip frames with none, hflip, vflip or "
+            "rot180, by the\n"
+            "                      camera, else the display, else the CPU\n"
+            "      --undistort     Correct lens distortion with the "
+            "calibration in this\n"
+            "                      file, for NV12 and YUV420 frames\n"
             "  -u, --uptime        prepend prints with uptime\n"
-            "  -v, --verbose       Enable verbose logging";
+            "      --v4l2-output   Write frames to this V4L2 output device, "
+            "such as a\n"
+            "                      v4l2loopback device read by other "
+            "applications\n"
+            "  -v, --verbose       Enable verbose logging\n"
+            "      --zoom          Zoom FACTOR[@X,Y] times around X,Y, in "
+            "fractions of\n"
+            "                      the frame size, 'zoom FACTOR[@X,Y]' on "
+            "stdin changes it"
+#ifdef HAVE_ZSTD
+            "\n"
+            "  -z, --compress      zstd compress frames written with -F at "
+            "the given\n"
+            "                      level, negative levels are fastest"
+#endif
+            ;
         PRINT("%s\n", help);
 
         return 1;
@@ -588,6 +1102,9 @@ int main(int argc, char** argv) {
   }
 
   VERBOSE_PRINT("Successfully processed args\n");
+  VERBOSE_PRINT("CPU features: %s, enabled: %s\n",
+                CpuFeatures::toString(CpuFeatures::detected()).c_str(),
+                CpuFeatures::toString(CpuFeatures::enabled()).c_str());
 
   ret = app.init();
   if (ret) {
@@ -2,26 +2,61 @@
 
 #include <syslog.h>
 #include <string>
+#include <vector>
 
 struct options {
-  long camera = -1;
+  std::string camera;
+  bool copy_frames = false;
 #ifdef HAVE_DRM
   bool drm = false;
+  std::string composite;
+  std::string connector;
+  /* Measure the capture to scanout latency of -D through writeback. */
+  bool latency = false;
 #endif
+  /* Loopback port or Unix socket path to serve MJPEG over HTTP on. */
+  std::string http;
   bool print_available_cameras = false;
+  /* Percentage of the frame that must change to detect motion, 0 for off. */
+  double motion = 0.0;
+  bool record_on_motion = false;
+  /* Frame monitor status file, and frames an alarm condition must last. */
+  std::string monitor;
+  unsigned int monitor_frames = 15;
+  /* Shared memory prefix of the frame metadata rings, see frame_ring.h. */
+  std::string metadata_ring;
+  /* Unix socket to share frames on, see frame_share.h. */
+  std::string publish;
   bool print_func = false;
   bool to_syslog = false;
   bool uptime = false;
   bool verbose = false;
 #ifdef HAVE_SDL
   bool sdl = false;
+  unsigned int preview_width = 0;
+  unsigned int preview_height = 0;
 #endif
-#ifdef HAVE_LIBJPEG
+#if defined(HAVE_SDL) && defined(HAVE_LIBJPEG)
   std::string pf = "MJPEG";
 #else
   std::string pf = "YUYV";
 #endif
   std::string filename;
+  /* Streams requested with --stream, a single viewfinder when empty. */
+  std::vector<std::string> streams;
+  /* Largest timestamp difference of frames shown together, 0 to not wait. */
+  double sync = 0.0;
+  std::string transform = "none";
+  std::string undistort;
+  /* V4L2 output device, such as v4l2loopback, to write frames to. */
+  std::string v4l2_output;
+  double zoom = 1.0;
+  double zoom_x = 0.5;
+  double zoom_y = 0.5;
+#ifdef HAVE_ZSTD
+  bool compress = false;
+  int compress_level = 0;
+#endif
 };
 
 extern options opts;
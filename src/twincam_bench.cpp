@@ -0,0 +1,560 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * twincam_bench.cpp - Frame processing benchmark
+ *
+ * Feeds generated frames, or the frames of a recording, through the
+ * processing twincam applies to camera frames, one stage at a time, and
+ * prints the frames per second and CPU time per frame of each stage, for
+ * each pixel format. Replaying a recording at full speed gives the same
+ * frames on every run, to compare builds against, frame by frame with --csv.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+
+#include "format_converter.h"
+#include "frame_monitor.h"
+#include "frame_source.h"
+#include "frame_transform.h"
+#include "image.h"
+#include "image_scaler.h"
+#include "lens_remap.h"
+#include "motion_detector.h"
+#include "replay_source.h"
+#include "synthetic_source.h"
+#include "twincam.h"
+
+#ifdef HAVE_LIBJPEG
+#include "jpeg_encoder.h"
+#endif
+
+#ifdef HAVE_ZSTD
+#include "frame_compressor.h"
+#endif
+
+using namespace libcamera;
+
+options opts;
+
+namespace {
+
+struct BenchOptions {
+  std::string formats;
+  Size size = Size(1920, 1080);
+  uint64_t frames = 300;
+  double fps = 0.0;
+  std::string mjpeg;
+  std::string replay;
+  unsigned int stream = 0;
+  bool maxSpeed = false;
+  std::string csv;
+  std::string undistort;
+};
+
+/* A processing step of twincam, run on each frame of the source. */
+struct Stage {
+  std::string name;
+  std::function<int(const SourceFrame&)> run;
+  /* Print the bytes of frames read per second of the stage. */
+  bool bandwidth = false;
+
+  uint64_t frames = 0;
+  uint64_t wallTime = 0;
+  uint64_t cpuTime = 0;
+  uint64_t bytes = 0;
+};
+
+uint64_t clockNs(clockid_t clock) {
+  struct timespec ts = {0, 0};
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+std::vector<Span<const uint8_t>> constPlanes(const SourceFrame& frame) {
+  return std::vector<Span<const uint8_t>>(frame.planes.begin(),
+                                          frame.planes.end());
+}
+
+/*
+ * CPU mappings of the frames of a source, by memfd, and a copy of the last
+ * frame in cached memory, as MappedBufferCache makes with -C.
+ */
+struct FrameImages {
+  struct Entry {
+    std::unique_ptr<FrameBuffer> buffer;
+    std::unique_ptr<Image> image;
+  };
+
+  Image* image(const SourceFrame& frame);
+
+  std::map<int, Entry> entries;
+  std::unique_ptr<Image> copy;
+  uint64_t sum = 0;
+};
+
+/* The planes of \a frame follow the first one, at the start of its memfd. */
+Image* FrameImages::image(const SourceFrame& frame) {
+  Entry& entry = entries[frame.fd];
+  if (entry.image)
+    return entry.image.get();
+
+  std::vector<FrameBuffer::Plane> planes;
+  for (const Span<uint8_t>& plane : frame.planes) {
+    FrameBuffer::Plane bufferPlane;
+    bufferPlane.fd = SharedFD(frame.fd);
+    bufferPlane.offset = plane.data() - frame.planes[0].data();
+    bufferPlane.length = plane.size();
+    planes.push_back(std::move(bufferPlane));
+  }
+
+  entry.buffer = std::make_unique<FrameBuffer>(planes);
+  entry.image = Image::fromFrameBuffer(entry.buffer.get(),
+                                       Image::MapMode::ReadOnly);
+  if (!entry.image) {
+    entries.erase(frame.fd);
+    return nullptr;
+  }
+
+  if (!copy)
+    copy = Image::allocate(*entry.image);
+
+  return entry.image.get();
+}
+
+/* Read every byte of \a image, as the CPU consumers of frames do. */
+uint64_t readImage(const Image& image) {
+  uint64_t sum = 0;
+
+  for (unsigned int i = 0; i < image.numPlanes(); ++i) {
+    const Span<const uint8_t> data = image.data(i);
+    for (size_t offset = 0; offset + 8 <= data.size(); offset += 8) {
+      uint64_t word;
+      memcpy(&word, data.data() + offset, sizeof(word));
+      sum += word;
+    }
+  }
+
+  return sum;
+}
+
+/*
+ * The stages that apply to frames of \a cfg. Stages hold their state, so they
+ * must not outlive \a holders.
+ */
+std::vector<Stage> buildStages(const StreamConfiguration& cfg,
+                               const LensCalibration* calibration,
+                               std::vector<std::shared_ptr<void>>& holders) {
+  std::vector<Stage> stages;
+
+  /*
+   * -C, reading frames where they are, copying them out to cached memory and
+   * reading the copy. The frames of a source have the same layout, except
+   * MJPEG ones.
+   */
+  if (cfg.pixelFormat != formats::MJPEG) {
+    auto images = std::make_shared<FrameImages>();
+    holders.push_back(images);
+    stages.push_back({"read", [images](const SourceFrame& frame) {
+                        Image* image = images->image(frame);
+                        if (!image)
+                          return -ENOMEM;
+
+                        Image::CpuAccess access(image,
+                                                Image::MapMode::ReadOnly);
+                        images->sum += readImage(*image);
+                        return 0;
+                      },
+                      true});
+    stages.push_back({"copy", [images](const SourceFrame& frame) {
+                        Image* image = images->image(frame);
+                        if (!image || !images->copy)
+                          return -ENOMEM;
+
+                        Image::CpuAccess access(image,
+                                                Image::MapMode::ReadOnly);
+                        images->copy->copyFrom(*image, FrameMetadata{});
+                        return 0;
+                      },
+                      true});
+    stages.push_back({"cached", [images](const SourceFrame&) {
+                        if (!images->copy)
+                          return -ENOMEM;
+
+                        images->sum += readImage(*images->copy);
+                        return 0;
+                      },
+                      true});
+  }
+
+  /* -F, to a file that is never linked, so nothing is left behind. */
+  const int fd = open(".", O_TMPFILE | O_WRONLY | O_CLOEXEC, 0600);
+  if (fd >= 0) {
+    holders.emplace_back(nullptr, [fd](void*) { close(fd); });
+    stages.push_back({"write", [fd](const SourceFrame& frame) {
+                        for (const Span<uint8_t>& plane : frame.planes) {
+                          if (write(fd, plane.data(), plane.size()) < 0)
+                            return -errno;
+                        }
+                        return lseek(fd, 0, SEEK_SET) < 0 ? -errno : 0;
+                      }});
+  } else {
+    fprintf(stderr, "No write stage, O_TMPFILE failed: %s\n",
+            strerror(errno));
+  }
+
+#ifdef HAVE_ZSTD
+  /* -F -z 1. */
+  auto compressor = std::make_shared<FrameCompressor>(1);
+  auto compressed = std::make_shared<std::vector<uint8_t>>();
+  holders.push_back(compressor);
+  holders.push_back(compressed);
+  stages.push_back({"zstd", [compressor, compressed](const SourceFrame& frame) {
+                      return compressor->compress(constPlanes(frame),
+                                                  *compressed);
+                    }});
+#endif
+
+#ifdef HAVE_LIBJPEG
+  /* --http and MKV recording. */
+  if (JpegEncoder::isSupported(cfg.pixelFormat)) {
+    auto encoder = std::make_shared<JpegEncoder>();
+    auto jpeg = std::make_shared<std::vector<uint8_t>>();
+    if (!encoder->configure(cfg)) {
+      holders.push_back(encoder);
+      holders.push_back(jpeg);
+      stages.push_back({"jpeg", [encoder, jpeg](const SourceFrame& frame) {
+                          return encoder->encode(constPlanes(frame),
+                                                 jpeg.get());
+                        }});
+    }
+  }
+#endif
+
+  /* -S and -D of formats the display can't show. */
+  if (FormatConverter::isSupported(cfg.pixelFormat, formats::XRGB8888)) {
+    auto converter = std::make_shared<FormatConverter>();
+    if (!converter->configure(cfg, formats::XRGB8888)) {
+      auto rgb = std::make_shared<std::vector<uint8_t>>(
+          converter->outputSize());
+      holders.push_back(converter);
+      holders.push_back(rgb);
+      stages.push_back({"convert", [converter, rgb](const SourceFrame& frame) {
+                          return converter->convert(constPlanes(frame),
+                                                    rgb->data());
+                        }});
+    }
+  }
+
+  /* --preview-size at half the size. */
+  if (ImageScaler::isSupported(cfg.pixelFormat)) {
+    auto scaler = std::make_shared<ImageScaler>();
+    const Size half(cfg.size.width / 2, cfg.size.height / 2);
+    if (!scaler->configure(cfg.pixelFormat, cfg.size, cfg.stride, half)) {
+      auto scaled = std::make_shared<std::vector<uint8_t>>(
+          scaler->outputLength());
+      holders.push_back(scaler);
+      holders.push_back(scaled);
+      stages.push_back({"scale", [scaler, scaled](const SourceFrame& frame) {
+                          return scaler->scale(constPlanes(frame),
+                                               scaled->data());
+                        }});
+    }
+  }
+
+  /* --motion. */
+  if (MotionDetector::isSupported(cfg.pixelFormat)) {
+    auto detector = std::make_shared<MotionDetector>();
+    if (!detector->configure(cfg, 1.0)) {
+      holders.push_back(detector);
+      stages.push_back({"motion", [detector](const SourceFrame& frame) {
+                          detector->analyze(constPlanes(frame));
+                          return 0;
+                        }});
+    }
+  }
+
+  /* --monitor, without its watchdog and status file. */
+  if (FrameMonitor::isSupported(cfg.pixelFormat)) {
+    auto monitor = std::make_shared<FrameMonitor>();
+    if (!monitor->configure(cfg, "", 0, 15)) {
+      holders.push_back(monitor);
+      stages.push_back({"monitor", [monitor](const SourceFrame& frame) {
+                          monitor->analyze(constPlanes(frame), frame.sequence);
+                          return 0;
+                        }});
+    }
+  }
+
+  /* --undistort, to a frame of its own as twincam does. */
+  if (calibration && LensRemap::isSupported(cfg.pixelFormat)) {
+    auto remap = std::make_shared<LensRemap>();
+    if (!remap->configure(cfg, *calibration)) {
+      auto remapped = std::make_shared<std::vector<uint8_t>>();
+      holders.push_back(remap);
+      holders.push_back(remapped);
+      stages.push_back({"undistort", [remap, remapped](
+                                         const SourceFrame& frame) {
+                          size_t length = 0;
+                          for (const Span<uint8_t>& plane : frame.planes)
+                            length += plane.size();
+
+                          remapped->resize(length);
+                          return remap->remap(
+                              constPlanes(frame),
+                              {Span<uint8_t>(remapped->data(), length)});
+                        }});
+    }
+  }
+
+  /* -t rot180, last as it changes the frames in place. */
+  if (FrameTransform::isSupported(cfg.pixelFormat)) {
+    auto transform = std::make_shared<FrameTransform>();
+    if (!transform->configure(cfg, Transform::Rot180)) {
+      holders.push_back(transform);
+      stages.push_back({"rot180", [transform](const SourceFrame& frame) {
+                          return transform->apply(frame.planes);
+                        }});
+    }
+  }
+
+  return stages;
+}
+
+/*
+ * Run the frames of \a source through each stage and print the results, and
+ * the CPU time of each stage on each frame to \a csv if given. CPU time is
+ * that of the whole process, to count the worker threads of stages that
+ * spread frames over them.
+ */
+int runStages(FrameSource& source,
+              const LensCalibration* calibration,
+              FILE* csv) {
+  const StreamConfiguration& cfg = source.configuration();
+  std::vector<std::shared_ptr<void>> holders;
+  std::vector<Stage> stages = buildStages(cfg, calibration, holders);
+
+  if (csv) {
+    fprintf(csv, "format,sequence,timestamp");
+    for (const Stage& stage : stages)
+      fprintf(csv, ",%s_us", stage.name.c_str());
+    fprintf(csv, "\n");
+  }
+
+  uint64_t frames = 0;
+  const uint64_t start = clockNs(CLOCK_MONOTONIC);
+  while (const SourceFrame* frame = source.next()) {
+    if (csv)
+      fprintf(csv, "%s,%u,%" PRIu64, cfg.pixelFormat.toString().c_str(),
+              frame->sequence, frame->timestamp);
+
+    for (Stage& stage : stages) {
+      const uint64_t wall = clockNs(CLOCK_MONOTONIC);
+      const uint64_t cpu = clockNs(CLOCK_PROCESS_CPUTIME_ID);
+      const int ret = stage.run(*frame);
+      const uint64_t cpuTime = clockNs(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+      stage.wallTime += clockNs(CLOCK_MONOTONIC) - wall;
+      stage.cpuTime += cpuTime;
+      if (ret < 0) {
+        fprintf(stderr, "%s failed on frame %u: %s\n", stage.name.c_str(),
+                frame->sequence, strerror(-ret));
+        return ret;
+      }
+
+      ++stage.frames;
+      if (stage.bandwidth) {
+        for (const Span<uint8_t>& plane : frame->planes)
+          stage.bytes += plane.size();
+      }
+      if (csv)
+        fprintf(csv, ",%.1f", cpuTime / 1e3);
+    }
+
+    if (csv)
+      fprintf(csv, "\n");
+
+    ++frames;
+  }
+
+  const double elapsed = (clockNs(CLOCK_MONOTONIC) - start) / 1e9;
+  printf("%s %s, %" PRIu64 " frames in %.2f s, %.1f fps\n",
+         cfg.pixelFormat.toString().c_str(), cfg.size.toString().c_str(),
+         frames, elapsed, elapsed > 0.0 ? frames / elapsed : 0.0);
+
+  for (const Stage& stage : stages) {
+    if (!stage.frames)
+      continue;
+
+    printf("  %-8s %10.1f fps %8.3f ms CPU per frame", stage.name.c_str(),
+           stage.wallTime ? stage.frames * 1e9 / stage.wallTime : 0.0,
+           stage.cpuTime / 1e6 / stage.frames);
+    if (stage.bandwidth && stage.wallTime)
+      printf(" %8.1f MB/s", stage.bytes * 1e3 / stage.wallTime);
+    printf("\n");
+  }
+
+  return 0;
+}
+
+void usage() {
+  static const char* help =
+      "Usage: twincam-bench [OPTIONS]\n\n"
+      "Measure the frame processing of twincam on generated or recorded\n"
+      "frames.\n\n"
+      "Options:\n"
+      "  -p, --pixel-format  Comma separated pixel formats to generate\n"
+      "                      (YUYV,NV12,YUV420,XRGB8888,MJPEG), or the\n"
+      "                      pixel format of the recording replayed\n"
+      "  -s, --size          Frame size as WIDTHxHEIGHT (1920x1080)\n"
+      "  -n, --frames        Frames per pixel format (300)\n"
+      "  -r, --rate          Frames per second, 0 for as fast as possible\n"
+      "  -m, --mjpeg FILE    MJPEG recording to take MJPEG frames from,\n"
+      "                      instead of encoding test patterns\n"
+      "  -R, --replay FILE   Replay a recording made with -F, at the rate\n"
+      "                      it was captured at\n"
+      "  --max-speed         Replay as fast as possible\n"
+      "  --stream            Stream of the recording to replay (0)\n"
+      "  -u, --undistort     Correct lens distortion of YUV 4:2:0 frames\n"
+      "                      with the calibration in this file\n"
+      "  -c, --csv FILE      Write the CPU time of each stage on each frame\n"
+      "  -h, --help          Print this help";
+  printf("%s\n", help);
+}
+
+enum {
+  OptMaxSpeed = 256,
+  OptStream,
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const struct option options[] = {{"pixel-format", required_argument, 0, 'p'},
+                                   {"size", required_argument, 0, 's'},
+                                   {"frames", required_argument, 0, 'n'},
+                                   {"rate", required_argument, 0, 'r'},
+                                   {"mjpeg", required_argument, 0, 'm'},
+                                   {"replay", required_argument, 0, 'R'},
+                                   {"max-speed", no_argument, 0, OptMaxSpeed},
+                                   {"stream", required_argument, 0, OptStream},
+                                   {"csv", required_argument, 0, 'c'},
+                                   {"undistort", required_argument, 0, 'u'},
+                                   {"help", no_argument, 0, 'h'},
+                                   {NULL, 0, 0, '\0'}};
+  BenchOptions bench;
+
+  for (int opt; (opt = getopt_long(argc, argv, "p:s:n:r:m:R:c:u:h", options,
+                                   NULL)) != -1;) {
+    switch (opt) {
+      case 'p':
+        bench.formats = optarg;
+        break;
+      case 's':
+        if (sscanf(optarg, "%ux%u", &bench.size.width, &bench.size.height) !=
+                2 ||
+            bench.size.isNull()) {
+          fprintf(stderr, "Invalid size '%s', expected WIDTHxHEIGHT\n",
+                  optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'n':
+        bench.frames = strtoull(optarg, NULL, 10);
+        break;
+      case 'r':
+        bench.fps = strtod(optarg, NULL);
+        break;
+      case 'm':
+        bench.mjpeg = optarg;
+        break;
+      case 'R':
+        bench.replay = optarg;
+        break;
+      case OptMaxSpeed:
+        bench.maxSpeed = true;
+        break;
+      case OptStream:
+        bench.stream = strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        bench.csv = optarg;
+        break;
+      case 'u':
+        bench.undistort = optarg;
+        break;
+      default:
+        usage();
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (!bench.frames) {
+    fprintf(stderr, "Number of frames must be positive\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!bench.replay.empty() &&
+      (bench.formats.empty() ||
+       bench.formats.find(',') != std::string::npos)) {
+    fprintf(stderr, "Give the pixel format of the recording with -p\n");
+    return EXIT_FAILURE;
+  }
+
+  if (bench.formats.empty())
+    bench.formats = "YUYV,NV12,YUV420,XRGB8888,MJPEG";
+
+  std::unique_ptr<FILE, decltype(&fclose)> csv(nullptr, fclose);
+  if (!bench.csv.empty()) {
+    csv.reset(fopen(bench.csv.c_str(), "w"));
+    if (!csv) {
+      fprintf(stderr, "Failed to open %s: %s\n", bench.csv.c_str(),
+              strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  LensCalibration calibration;
+  if (!bench.undistort.empty() && calibration.load(bench.undistort) < 0)
+    return EXIT_FAILURE;
+  const LensCalibration* undistort =
+      bench.undistort.empty() ? nullptr : &calibration;
+
+  std::stringstream formats(bench.formats);
+  for (std::string name; std::getline(formats, name, ',');) {
+    const PixelFormat format = PixelFormat::fromString(name);
+    if (!format.isValid()) {
+      fprintf(stderr, "Unknown pixel format '%s'\n", name.c_str());
+      return EXIT_FAILURE;
+    }
+
+    if (!bench.replay.empty()) {
+      ReplaySource source;
+      if (source.configure(bench.replay, format, bench.size, bench.stream,
+                           bench.maxSpeed) < 0 ||
+          runStages(source, undistort, csv.get()) < 0)
+        return EXIT_FAILURE;
+      continue;
+    }
+
+    SyntheticSource source;
+    if (source.configure(format, bench.size, bench.fps, bench.frames,
+                         bench.mjpeg) < 0 ||
+        runStages(source, undistort, csv.get()) < 0)
+      return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * twincam_index.cpp - Frame index reader
+ *
+ * Prints the frame index written alongside a twincam recording, or extracts
+ * a single frame from the recording using it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "frame_index.h"
+
+namespace {
+
+struct FrameIndex {
+  ~FrameIndex() {
+    if (map)
+      munmap(const_cast<uint8_t*>(map), size);
+  }
+
+  const FrameIndexRecord* record(size_t n) const {
+    return reinterpret_cast<const FrameIndexRecord*>(
+        map + header->headerSize + n * header->recordSize);
+  }
+
+  const uint8_t* map = nullptr;
+  size_t size = 0;
+  const FrameIndexHeader* header = nullptr;
+  size_t count = 0;
+};
+
+int openIndex(const char* filename, FrameIndex& index) {
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+    return -errno;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) || static_cast<size_t>(st.st_size) <
+                            sizeof(FrameIndexHeader)) {
+    fprintf(stderr, "%s is not a frame index\n", filename);
+    close(fd);
+    return -EINVAL;
+  }
+
+  void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Failed to mmap %s: %s\n", filename, strerror(errno));
+    return -errno;
+  }
+
+  index.map = static_cast<const uint8_t*>(map);
+  index.size = st.st_size;
+  index.header = static_cast<const FrameIndexHeader*>(map);
+
+  const FrameIndexHeader* header = index.header;
+  if (memcmp(header->magic, frameIndexMagic, sizeof(header->magic)) ||
+      header->version != frameIndexVersion ||
+      header->headerSize < sizeof(FrameIndexHeader) ||
+      header->recordSize < sizeof(FrameIndexRecord) ||
+      header->headerSize > index.size) {
+    fprintf(stderr, "%s is not a version %u frame index\n", filename,
+            frameIndexVersion);
+    return -EINVAL;
+  }
+
+  /* A trailing partial record is left behind if recording was interrupted. */
+  index.count = (index.size - header->headerSize) / header->recordSize;
+
+  return 0;
+}
+
+void printRecord(size_t n, const FrameIndexRecord* record) {
+  printf("%zu: seq %u stream %u timestamp %" PRIu64 " offset %" PRIu64
+         " length %" PRIu64 " bytesused",
+         n, record->sequence, record->stream, record->timestamp,
+         record->offset, record->length);
+
+  for (unsigned int i = 0;
+       i < record->numPlanes && i < frameIndexMaxPlanes; ++i)
+    printf("%s%u", i ? "/" : " ", record->bytesused[i]);
+
+  printf("\n");
+}
+
+int extractFrame(const char* recording, const FrameIndexRecord* record) {
+  int fd = open(recording, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", recording, strerror(errno));
+    return -errno;
+  }
+
+  int ret = 0;
+  uint64_t done = 0;
+  char buf[65536];
+  while (done < record->length) {
+    const size_t chunk =
+        std::min<uint64_t>(sizeof(buf), record->length - done);
+    const ssize_t len = pread(fd, buf, chunk, record->offset + done);
+    if (len <= 0) {
+      fprintf(stderr, "Failed to read frame from %s\n", recording);
+      ret = -EIO;
+      break;
+    }
+
+    if (fwrite(buf, 1, len, stdout) != static_cast<size_t>(len)) {
+      ret = -EIO;
+      break;
+    }
+
+    done += len;
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+void usage() {
+  static const char* help =
+      "Usage: twincam-index [OPTIONS] INDEX [FRAME]\n\n"
+      "Print the records of a twincam frame index, or only record FRAME.\n\n"
+      "Options:\n"
+      "  -x, --extract FILE  Write FRAME of recording FILE to stdout\n"
+      "  -h, --help          Print this help";
+  printf("%s\n", help);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const struct option options[] = {{"extract", required_argument, 0, 'x'},
+                                   {"help", no_argument, 0, 'h'},
+                                   {NULL, 0, 0, '\0'}};
+  const char* recording = nullptr;
+
+  for (int opt; (opt = getopt_long(argc, argv, "x:h", options, NULL)) != -1;) {
+    switch (opt) {
+      case 'x':
+        recording = optarg;
+        break;
+      default:
+        usage();
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc || (recording && optind + 1 >= argc)) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  FrameIndex index;
+  if (openIndex(argv[optind], index))
+    return EXIT_FAILURE;
+
+  if (optind + 1 >= argc) {
+    if (index.header->flags & frameIndexFlagZstd)
+      printf("zstd compressed, lengths are compressed sizes\n");
+
+    for (size_t n = 0; n < index.count; ++n)
+      printRecord(n, index.record(n));
+
+    return EXIT_SUCCESS;
+  }
+
+  const size_t n = strtoul(argv[optind + 1], NULL, 10);
+  if (n >= index.count) {
+    fprintf(stderr, "Frame %zu out of range, index has %zu frames\n", n,
+            index.count);
+    return EXIT_FAILURE;
+  }
+
+  if (recording)
+    return extractFrame(recording, index.record(n)) ? EXIT_FAILURE
+                                                     : EXIT_SUCCESS;
+
+  printRecord(n, index.record(n));
+
+  return EXIT_SUCCESS;
+}
@@ -1,5 +1,6 @@
 #include "twncm_fnctl.h"
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "twincam.h"
 #include "twncm_stdio.h"
@@ -61,3 +62,23 @@ int twncm_remove(const char* file) {
 
   return ret;
 }
+
+/*
+ * Remove the Unix socket at path, left behind by a previous run, for bind() to
+ * create it again. Anything else at path is left alone and gives -EEXIST.
+ */
+int twncm_remove_socket(const char* path) {
+  struct stat st;
+  if (lstat(path, &st) < 0)
+    return errno == ENOENT ? 0 : -errno;
+
+  if (!S_ISSOCK(st.st_mode)) {
+    EPRINT("%s exists and isn't a socket\n", path);
+    return -EEXIST;
+  }
+
+  if (unlink(path) < 0 && errno != ENOENT)
+    return -errno;
+
+  return 0;
+}
@@ -6,3 +6,4 @@ int pid_write(const int pidfile_fd);
 int pid_read(const int pidfile_fd, char* const buf);
 int twncm_close(const int fd);
 int twncm_remove(const char* file);
+int twncm_remove_socket(const char* path);
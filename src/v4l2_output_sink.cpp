@@ -0,0 +1,532 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * v4l2_output_sink.cpp - Write frames to a V4L2 output device
+ */
+
+#include "v4l2_output_sink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/videodev2.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include <libcamera/camera.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+#include <libcamera/request.h>
+
+#include "event_loop.h"
+#include "frame_planes.h"
+#include "image.h"
+#include "mapped_buffer_cache.h"
+#include "twincam.h"
+#include "uptime.h"
+
+using namespace libcamera;
+
+namespace {
+
+/* Device buffers to copy frames into when the camera buffers can't be used. */
+constexpr unsigned int kCopyBuffers = 4;
+
+struct FormatInfo {
+  PixelFormat format;
+  uint32_t fourcc;
+  /* Chroma planes after the luma plane, and their bytes per line divisor. */
+  unsigned int chromaPlanes;
+  unsigned int chromaDivisor;
+};
+
+const FormatInfo kFormats[] = {
+    {formats::MJPEG, V4L2_PIX_FMT_MJPEG, 0, 1},
+    {formats::YUYV, V4L2_PIX_FMT_YUYV, 0, 1},
+    {formats::YVYU, V4L2_PIX_FMT_YVYU, 0, 1},
+    {formats::UYVY, V4L2_PIX_FMT_UYVY, 0, 1},
+    {formats::VYUY, V4L2_PIX_FMT_VYUY, 0, 1},
+    {formats::NV12, V4L2_PIX_FMT_NV12, 1, 1},
+    {formats::NV21, V4L2_PIX_FMT_NV21, 1, 1},
+    {formats::YUV420, V4L2_PIX_FMT_YUV420, 2, 2},
+    {formats::YVU420, V4L2_PIX_FMT_YVU420, 2, 2},
+};
+
+const FormatInfo* formatInfo(const PixelFormat& format) {
+  for (const FormatInfo& info : kFormats) {
+    if (info.format == format)
+      return &info;
+  }
+
+  return nullptr;
+}
+
+/* Bytes per line and number of lines of each plane of a frame. */
+std::vector<std::pair<unsigned int, unsigned int>> planeLayout(
+    const FormatInfo& info,
+    unsigned int stride,
+    unsigned int height) {
+  std::vector<std::pair<unsigned int, unsigned int>> layout = {
+      {stride, height}};
+  for (unsigned int i = 0; i < info.chromaPlanes; ++i)
+    layout.push_back({stride / info.chromaDivisor, (height + 1) / 2});
+
+  return layout;
+}
+
+}  // namespace
+
+/**
+ * \class V4L2OutputSink
+ * \brief Feed frames to applications that only read V4L2 capture devices
+ *
+ * The sink writes frames to the output side of a v4l2loopback device, whose
+ * capture side other applications open as if it were a camera. When the
+ * driver can import dmabufs and the camera buffers have the layout the device
+ * expects, the camera buffers are queued to the device as they are, and the
+ * requests held until the device is done with them. At most half the buffers
+ * are held, frames are skipped beyond that so that the camera keeps running.
+ * Otherwise frames are copied into buffers of the device, skipping frames
+ * when all of them are still in use.
+ */
+V4L2OutputSink::V4L2OutputSink(const std::string& device) : device_(device) {}
+
+V4L2OutputSink::~V4L2OutputSink() {
+  stop();
+
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+int V4L2OutputSink::configure(const CameraConfiguration& config) {
+  const StreamConfiguration& cfg = config.at(0);
+  const FormatInfo* info = formatInfo(cfg.pixelFormat);
+  if (!info) {
+    EPRINT("Cannot write %s frames to a V4L2 device\n",
+           cfg.pixelFormat.toString().c_str());
+    return -ENOTSUP;
+  }
+
+  if (fd_ < 0) {
+    fd_ = open(device_.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+      int ret = -errno;
+      EPRINT("Failed to open %s: %s\n", device_.c_str(), strerror(-ret));
+      return ret;
+    }
+  }
+
+  struct v4l2_capability caps = {};
+  if (ioctl(fd_, VIDIOC_QUERYCAP, &caps) < 0) {
+    int ret = -errno;
+    EPRINT("Failed to query %s: %s\n", device_.c_str(), strerror(-ret));
+    return ret;
+  }
+
+  const uint32_t deviceCaps = caps.capabilities & V4L2_CAP_DEVICE_CAPS
+                                  ? caps.device_caps
+                                  : caps.capabilities;
+  if (!(deviceCaps & V4L2_CAP_VIDEO_OUTPUT) ||
+      !(deviceCaps & V4L2_CAP_STREAMING)) {
+    EPRINT("%s is not a V4L2 output device\n", device_.c_str());
+    return -ENODEV;
+  }
+
+  stream_ = cfg.stream();
+  format_ = cfg.pixelFormat;
+  height_ = cfg.size.height;
+  stride_ = cfg.stride;
+
+  struct v4l2_format fmt = {};
+  fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  fmt.fmt.pix.width = cfg.size.width;
+  fmt.fmt.pix.height = cfg.size.height;
+  fmt.fmt.pix.pixelformat = info->fourcc;
+  fmt.fmt.pix.field = V4L2_FIELD_NONE;
+  fmt.fmt.pix.bytesperline = format_ == formats::MJPEG ? 0 : cfg.stride;
+  fmt.fmt.pix.sizeimage = cfg.frameSize;
+
+  if (ioctl(fd_, VIDIOC_S_FMT, &fmt) < 0) {
+    int ret = -errno;
+    EPRINT("Failed to set format of %s: %s\n", device_.c_str(),
+           strerror(-ret));
+    return ret;
+  }
+
+  if (fmt.fmt.pix.pixelformat != info->fourcc ||
+      fmt.fmt.pix.width != cfg.size.width ||
+      fmt.fmt.pix.height != cfg.size.height) {
+    EPRINT("%s doesn't take %s %ux%u frames\n", device_.c_str(),
+           format_.toString().c_str(), cfg.size.width, cfg.size.height);
+    return -EINVAL;
+  }
+
+  bytesPerLine_ = fmt.fmt.pix.bytesperline;
+
+  buffers_.clear();
+  indexes_.clear();
+
+  return 0;
+}
+
+void V4L2OutputSink::mapBuffer(const Stream* stream, FrameBuffer* buffer) {
+  if (stream != stream_)
+    return;
+
+  indexes_[buffer] = buffers_.size();
+  buffers_.push_back(buffer);
+}
+
+/*
+ * A buffer can be queued to the device as is if its planes follow each other
+ * in a single dmabuf, laid out as the device expects.
+ */
+bool V4L2OutputSink::canImport(const FrameBuffer* buffer) const {
+  const std::vector<FrameBuffer::Plane>& planes = buffer->planes();
+  if (planes[0].offset)
+    return false;
+
+  for (unsigned int i = 1; i < planes.size(); ++i) {
+    if (planes[i].fd.get() != planes[0].fd.get() ||
+        planes[i].offset != planes[i - 1].offset + planes[i - 1].length)
+      return false;
+  }
+
+  return format_ == formats::MJPEG || stride_ == bytesPerLine_;
+}
+
+/* Returns the number of buffers allocated or a negative error code. */
+int V4L2OutputSink::requestBuffers(unsigned int memory, unsigned int count) {
+  struct v4l2_requestbuffers req = {};
+  req.count = count;
+  req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  req.memory = memory;
+
+  if (ioctl(fd_, VIDIOC_REQBUFS, &req) < 0)
+    return -errno;
+
+  return req.count;
+}
+
+int V4L2OutputSink::mapBuffers(unsigned int count) {
+  for (unsigned int index = 0; index < count; ++index) {
+    struct v4l2_buffer buf = {};
+    buf.index = index;
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_MMAP;
+
+    if (ioctl(fd_, VIDIOC_QUERYBUF, &buf) < 0)
+      return -errno;
+
+    void* map = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd_, buf.m.offset);
+    if (map == MAP_FAILED)
+      return -errno;
+
+    mapped_.push_back({static_cast<uint8_t*>(map), buf.length});
+    free_.push_back(index);
+  }
+
+  return 0;
+}
+
+void V4L2OutputSink::unmapBuffers() {
+  for (MappedBuffer& buffer : mapped_)
+    munmap(buffer.data, buffer.length);
+
+  mapped_.clear();
+  free_.clear();
+}
+
+int V4L2OutputSink::start() {
+  frames_ = 0;
+  imported_ = 0;
+  copied_ = 0;
+  skipped_ = 0;
+
+  import_ = !buffers_.empty() &&
+            std::all_of(buffers_.begin(), buffers_.end(),
+                        [this](const FrameBuffer* buffer) {
+                          return canImport(buffer);
+                        });
+
+  /* Drivers without dmabuf import reject the memory type. */
+  if (import_) {
+    int ret = requestBuffers(V4L2_MEMORY_DMABUF, buffers_.size());
+    if (ret < static_cast<int>(buffers_.size())) {
+      if (ret > 0)
+        requestBuffers(V4L2_MEMORY_DMABUF, 0);
+      import_ = false;
+    }
+  }
+
+  int ret;
+  if (import_) {
+    queued_.assign(buffers_.size(), nullptr);
+    held_ = 0;
+    maxHeld_ = std::max<unsigned int>(buffers_.size() / 2, 1);
+  } else {
+    ret = requestBuffers(V4L2_MEMORY_MMAP, kCopyBuffers);
+    if (ret <= 0) {
+      ret = ret < 0 ? ret : -ENOMEM;
+      EPRINT("Failed to allocate buffers on %s: %s\n", device_.c_str(),
+             strerror(-ret));
+      return ret;
+    }
+
+    ret = mapBuffers(ret);
+    if (ret < 0) {
+      EPRINT("Failed to map buffers of %s: %s\n", device_.c_str(),
+             strerror(-ret));
+      unmapBuffers();
+      requestBuffers(V4L2_MEMORY_MMAP, 0);
+      return ret;
+    }
+  }
+
+  int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  if (ioctl(fd_, VIDIOC_STREAMON, &type) < 0) {
+    ret = -errno;
+    EPRINT("Failed to start streaming on %s: %s\n", device_.c_str(),
+           strerror(-ret));
+    unmapBuffers();
+    requestBuffers(import_ ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP, 0);
+    return ret;
+  }
+
+  streaming_ = true;
+
+  PRINT("Writing frames to %s, %s\n", device_.c_str(),
+        import_ ? "importing camera buffers" : "copying frames");
+
+  return 0;
+}
+
+int V4L2OutputSink::stop() {
+  if (!streaming_)
+    return 0;
+
+  if (watching_)
+    EventLoop::instance()->removeFdEvent(fd_);
+  watching_ = false;
+
+  int type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  ioctl(fd_, VIDIOC_STREAMOFF, &type);
+  streaming_ = false;
+
+  /* Streaming off gave all buffers back. */
+  for (Request*& request : queued_) {
+    if (!request)
+      continue;
+
+    Request* done = request;
+    request = nullptr;
+    requestProcessed.emit(done);
+  }
+  queued_.clear();
+  held_ = 0;
+
+  unmapBuffers();
+  requestBuffers(import_ ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP, 0);
+
+  if (frames_) {
+    PRINT("Wrote %" PRIu64 " frames to %s, %" PRIu64 " imported, %" PRIu64
+          " copied, %" PRIu64 " skipped\n",
+          frames_, device_.c_str(), imported_, copied_, skipped_);
+  }
+
+  return 0;
+}
+
+/*
+ * Take back the buffers the device is done with, without waiting, as soon as
+ * the device signals them and before queuing a frame.
+ */
+void V4L2OutputSink::dequeueBuffers() {
+  for (;;) {
+    struct v4l2_buffer buf = {};
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = import_ ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+
+    if (ioctl(fd_, VIDIOC_DQBUF, &buf) < 0)
+      return;
+
+    if (!import_) {
+      free_.push_back(buf.index);
+      continue;
+    }
+
+    if (buf.index >= queued_.size() || !queued_[buf.index])
+      continue;
+
+    Request* request = queued_[buf.index];
+    queued_[buf.index] = nullptr;
+    --held_;
+    requestProcessed.emit(request);
+  }
+}
+
+/* Buffers queued to the device and not dequeued yet. */
+unsigned int V4L2OutputSink::outstanding() const {
+  return import_ ? held_ : mapped_.size() - free_.size();
+}
+
+/*
+ * The device is writable when a buffer it's done with can be dequeued. Watch
+ * it only while buffers are queued: v4l2loopback reports its output always
+ * writable, and the level-triggered watch would fire in a loop.
+ */
+void V4L2OutputSink::watchBuffers() {
+  const bool watch = streaming_ && outstanding();
+  if (watch == watching_)
+    return;
+
+  watching_ = watch;
+  if (!watch) {
+    EventLoop::instance()->removeFdEvent(fd_);
+    return;
+  }
+
+  EventLoop::instance()->addFdEvent(fd_, EventLoop::Write, [this]() {
+    dequeueBuffers();
+    watchBuffers();
+  });
+}
+
+bool V4L2OutputSink::importFrame(Request* request, FrameBuffer* buffer) {
+  auto iter = indexes_.find(buffer);
+  if (iter == indexes_.end())
+    return false;
+
+  if (held_ >= maxHeld_) {
+    ++skipped_;
+    return false;
+  }
+
+  const std::vector<FrameBuffer::Plane>& planes = buffer->planes();
+  const FrameMetadata& metadata = buffer->metadata();
+
+  struct v4l2_buffer buf = {};
+  buf.index = iter->second;
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  buf.memory = V4L2_MEMORY_DMABUF;
+  buf.m.fd = planes[0].fd.get();
+  buf.length = planes.back().offset + planes.back().length;
+  const unsigned int last = metadata.planes().size() - 1;
+  buf.bytesused = planes[last].offset + metadata.planes()[last].bytesused;
+  buf.field = V4L2_FIELD_NONE;
+  buf.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+  buf.timestamp.tv_sec = metadata.timestamp / 1000000000;
+  buf.timestamp.tv_usec = metadata.timestamp / 1000 % 1000000;
+
+  if (ioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    EPRINT("Failed to queue frame to %s: %s\n", device_.c_str(),
+           strerror(errno));
+    return false;
+  }
+
+  queued_[buf.index] = request;
+  ++held_;
+  ++imported_;
+
+  return true;
+}
+
+void V4L2OutputSink::copyFrame(FrameBuffer* buffer) {
+  if (free_.empty()) {
+    ++skipped_;
+    return;
+  }
+
+  Image* image = mappedBuffers_ ? mappedBuffers_->image(buffer) : nullptr;
+  if (!image)
+    return;
+
+  Image::CpuAccess access(image, Image::MapMode::ReadOnly);
+
+  const unsigned int index = free_.back();
+  MappedBuffer& dst = mapped_[index];
+  size_t bytesused = 0;
+
+  if (format_ == formats::MJPEG) {
+    Span<const uint8_t> data = image->data(0);
+    bytesused = std::min<size_t>(
+        {buffer->metadata().planes()[0].bytesused, data.size(), dst.length});
+    memcpy(dst.data, data.data(), bytesused);
+  } else {
+    const FormatInfo& info = *formatInfo(format_);
+    const auto src = planeLayout(info, stride_, height_);
+    const auto out = planeLayout(info, bytesPerLine_, height_);
+
+    std::vector<Span<const uint8_t>> planes;
+    for (unsigned int i = 0; i < image->numPlanes(); ++i)
+      planes.push_back(image->data(i));
+
+    std::vector<size_t> sizes;
+    size_t size = 0;
+    for (unsigned int i = 0; i < src.size(); ++i) {
+      sizes.push_back(static_cast<size_t>(src[i].first) * src[i].second);
+      size += static_cast<size_t>(out[i].first) * out[i].second;
+    }
+
+    std::vector<const uint8_t*> data;
+    if (splitPlanes(planes, sizes, &data) < 0 || size > dst.length) {
+      EPRINT("Frame doesn't fit the buffers of %s\n", device_.c_str());
+      return;
+    }
+
+    uint8_t* to = dst.data;
+    for (unsigned int i = 0; i < src.size(); ++i) {
+      const unsigned int length = std::min(src[i].first, out[i].first);
+      for (unsigned int row = 0; row < src[i].second; ++row) {
+        memcpy(to + static_cast<size_t>(row) * out[i].first,
+               data[i] + static_cast<size_t>(row) * src[i].first, length);
+      }
+      to += static_cast<size_t>(out[i].first) * out[i].second;
+    }
+
+    bytesused = size;
+  }
+
+  const FrameMetadata& metadata = buffer->metadata();
+
+  struct v4l2_buffer buf = {};
+  buf.index = index;
+  buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  buf.memory = V4L2_MEMORY_MMAP;
+  buf.bytesused = bytesused;
+  buf.field = V4L2_FIELD_NONE;
+  buf.flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
+  buf.timestamp.tv_sec = metadata.timestamp / 1000000000;
+  buf.timestamp.tv_usec = metadata.timestamp / 1000 % 1000000;
+
+  if (ioctl(fd_, VIDIOC_QBUF, &buf) < 0) {
+    EPRINT("Failed to queue frame to %s: %s\n", device_.c_str(),
+           strerror(errno));
+    return;
+  }
+
+  free_.pop_back();
+  ++copied_;
+}
+
+bool V4L2OutputSink::processRequest(Request* request) {
+  FrameBuffer* buffer = request->findBuffer(stream_);
+  if (!buffer || !streaming_)
+    return true;
+
+  ++frames_;
+  dequeueBuffers();
+
+  bool done = true;
+  if (import_)
+    done = !importFrame(request, buffer);
+  else
+    copyFrame(buffer);
+
+  watchBuffers();
+
+  return done;
+}
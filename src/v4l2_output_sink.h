@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * v4l2_output_sink.h - Write frames to a V4L2 output device
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <libcamera/stream.h>
+
+#include "frame_sink.h"
+
+class V4L2OutputSink : public FrameSink {
+ public:
+  V4L2OutputSink(const std::string& device);
+  ~V4L2OutputSink();
+
+  int configure(const libcamera::CameraConfiguration& config) override;
+  void mapBuffer(const libcamera::Stream* stream,
+                 libcamera::FrameBuffer* buffer) override;
+
+  int start() override;
+  int stop() override;
+
+  bool processRequest(libcamera::Request* request) override;
+
+ private:
+  /* A buffer of the device, mapped when frames are copied into it. */
+  struct MappedBuffer {
+    uint8_t* data = nullptr;
+    size_t length = 0;
+  };
+
+  bool canImport(const libcamera::FrameBuffer* buffer) const;
+  int requestBuffers(unsigned int memory, unsigned int count);
+  int mapBuffers(unsigned int count);
+  void unmapBuffers();
+  void dequeueBuffers();
+  unsigned int outstanding() const;
+  void watchBuffers();
+
+  bool importFrame(libcamera::Request* request, libcamera::FrameBuffer* buffer);
+  void copyFrame(libcamera::FrameBuffer* buffer);
+
+  std::string device_;
+  int fd_ = -1;
+  bool streaming_ = false;
+  bool watching_ = false;
+
+  const libcamera::Stream* stream_ = nullptr;
+  libcamera::PixelFormat format_;
+  unsigned int height_ = 0;
+  unsigned int stride_ = 0;
+  unsigned int bytesPerLine_ = 0;
+
+  /* Camera buffers, by index of the device buffer they're imported as. */
+  std::vector<libcamera::FrameBuffer*> buffers_;
+  std::map<const libcamera::FrameBuffer*, unsigned int> indexes_;
+
+  /* DMABUF import: the requests whose buffers the device holds. */
+  bool import_ = false;
+  std::vector<libcamera::Request*> queued_;
+  unsigned int held_ = 0;
+  unsigned int maxHeld_ = 1;
+
+  /* Copy fallback: the device buffers, and those free to write into. */
+  std::vector<MappedBuffer> mapped_;
+  std::vector<unsigned int> free_;
+
+  uint64_t frames_ = 0;
+  uint64_t imported_ = 0;
+  uint64_t copied_ = 0;
+  uint64_t skipped_ = 0;
+};
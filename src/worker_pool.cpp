@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * worker_pool.cpp - Pool of worker threads
+ */
+
+#include "worker_pool.h"
+
+/**
+ * \class WorkerPool
+ * \brief Run jobs on a fixed set of threads, off the event loop
+ *
+ * Jobs are started in the order they are queued, but may complete in any
+ * order. Users that need ordered results keep their own queue and consume it
+ * from the event loop, see EventLoop::callLater().
+ *
+ * Each user queues its jobs in a Batch of its own and waits for that batch
+ * only, so that users can share the pool returned by instance(). All the CPU
+ * stages of the process share it, however many cameras and sinks there are,
+ * rather than each starting threads that compete for the same cores.
+ *
+ * When \a threads is 0 the pool leaves one CPU to the event loop and uses all
+ * the others, with a minimum of one thread.
+ */
+WorkerPool::WorkerPool(unsigned int threads) {
+  if (!threads) {
+    const unsigned int cpus = std::thread::hardware_concurrency();
+    threads = cpus > 1 ? cpus - 1 : 1;
+  }
+
+  threads_.reserve(threads);
+  for (unsigned int i = 0; i < threads; ++i)
+    threads_.emplace_back(&WorkerPool::worker, this);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    const std::scoped_lock locker(lock_);
+    exit_ = true;
+  }
+
+  jobAdded_.notify_all();
+
+  for (std::thread& thread : threads_)
+    thread.join();
+}
+
+/* The pool shared by the whole process, started on first use. */
+WorkerPool* WorkerPool::instance() {
+  static WorkerPool pool;
+  return &pool;
+}
+
+void WorkerPool::run(Batch& batch, const std::function<void()>& job) {
+  {
+    const std::scoped_lock locker(lock_);
+    jobs_.push_back({job, &batch});
+    ++batch.pending_;
+  }
+
+  jobAdded_.notify_one();
+}
+
+/* Wait until all jobs queued in \a batch have completed. */
+void WorkerPool::wait(Batch& batch) {
+  std::unique_lock locker(lock_);
+  jobDone_.wait(locker, [&batch]() { return !batch.pending_; });
+}
+
+void WorkerPool::worker() {
+  std::unique_lock locker(lock_);
+
+  for (;;) {
+    jobAdded_.wait(locker, [this]() { return exit_ || !jobs_.empty(); });
+    if (jobs_.empty())
+      return;
+
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+
+    locker.unlock();
+    job.function();
+    locker.lock();
+
+    if (!--job.batch->pending_)
+      jobDone_.notify_all();
+  }
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * worker_pool.h - Pool of worker threads
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+ public:
+  /* The jobs of one user of a pool, to wait for them alone. */
+  class Batch {
+   public:
+    Batch() = default;
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+   private:
+    friend class WorkerPool;
+
+    unsigned int pending_ = 0;
+  };
+
+  WorkerPool(unsigned int threads = 0);
+  ~WorkerPool();
+
+  static WorkerPool* instance();
+
+  unsigned int size() const { return threads_.size(); }
+
+  void run(Batch& batch, const std::function<void()>& job);
+  void wait(Batch& batch);
+
+ private:
+  struct Job {
+    std::function<void()> function;
+    Batch* batch;
+  };
+
+  void worker();
+
+  std::vector<std::thread> threads_;
+
+  std::mutex lock_;
+  std::condition_variable jobAdded_;
+  std::condition_variable jobDone_;
+  std::list<Job> jobs_;
+  bool exit_ = false;
+};
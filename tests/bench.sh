@@ -0,0 +1,54 @@
+#!/bin/bash
+
+# Compare the frame processing of two builds of twincam-bench on the same
+# recording, made with twincam -F, replayed at full speed so both see the same
+# frames. Each build runs a few times and its fastest run per stage counts.
+# Fails if a stage of the candidate takes more CPU per frame than the
+# baseline by more than THRESHOLD percent.
+#
+#   tests/bench.sh BASELINE CANDIDATE RECORDING FORMAT WIDTHxHEIGHT [THRESHOLD]
+
+set -e
+
+if [ "$#" -lt 5 ]; then
+  echo "Usage: $0 BASELINE CANDIDATE RECORDING FORMAT WIDTHxHEIGHT [THRESHOLD]"
+  exit 1
+fi
+
+baseline="$1"
+candidate="$2"
+recording="$3"
+format="$4"
+size="$5"
+threshold="${6:-10}"
+runs="${RUNS:-3}"
+
+# Prints "stage ms" for each stage, the least CPU per frame of the runs.
+measure() {
+  for _ in $(seq "$runs"); do
+    "$1" --replay "$recording" --max-speed -p "$format" -s "$size"
+  done | awk '/ms CPU per frame/ {
+      if (!($1 in best) || $4 < best[$1])
+        best[$1] = $4
+    }
+    END {
+      for (stage in best)
+        print stage, best[stage]
+    }' | sort
+}
+
+before="$(measure "$baseline")"
+after="$(measure "$candidate")"
+
+printf "%-8s %10s %10s %8s\n" "stage" "baseline" "candidate" "change"
+join <(echo "$before") <(echo "$after") | awk -v threshold="$threshold" '
+  {
+    change = $2 > 0 ? ($3 - $2) * 100 / $2 : 0
+    flag = change > threshold ? "  regressed" : ""
+    printf "%-8s %10.3f %10.3f %+7.1f%%%s\n", $1, $2, $3, change, flag
+    if (flag)
+      failed = 1
+  }
+  END {
+    exit failed
+  }'
@@ -40,11 +40,13 @@ tests() {
   set -e
 
   $1 twincam -h
+  $1 twincam-bench -n 10 -s 640x480 -u tests/fisheye.cal
 }
 
 build() {
   meson build $1 --buildtype=release --prefix=/usr
   ninja -v -C build
+  meson test -C build --print-errorlogs
   $prefix ninja -v -C build install
 }
 
@@ -0,0 +1,525 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * kernels.cpp - Check the vector pixel kernels against the scalar ones
+ *
+ * Every instruction set the CPU supports is enabled in turn with
+ * CpuFeatures::restrictTo(). Its kernels are run on random rows of every
+ * length up to a few vector blocks, so that each tail length is covered, and
+ * the frame processing using them on random frames whose rows end in partial
+ * blocks. Outputs must be exactly those of the scalar kernels.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+#include <libcamera/transform.h>
+
+#include "cpu_features.h"
+#include "format_converter.h"
+#include "frame_monitor_kernels.h"
+#include "frame_transform.h"
+#include "image_scaler.h"
+#include "lens_remap.h"
+#include "motion_detector_kernels.h"
+#include "twincam.h"
+
+using namespace libcamera;
+
+options opts;
+
+namespace {
+
+struct Isa {
+  const char* name;
+  unsigned int features;
+  const FormatConverterKernels* converter;
+  const ImageScalerKernels* scaler;
+  const FrameTransformKernels* transform;
+  const LensRemapKernels* remap;
+  const MotionDetectorKernels* motion;
+  const FrameMonitorKernels* monitor;
+};
+
+/* Instruction sets without kernels of a stage leave it to the scalar ones. */
+const Isa isas[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"sse2", CpuFeatures::SSE2, &sse2ConverterKernels, &sse2ScalerKernels,
+     &sse2TransformKernels, &sse2RemapKernels, &sse2MotionKernels,
+     &sse2MonitorKernels},
+    {"sse2,avx2", CpuFeatures::SSE2 | CpuFeatures::AVX2, &avx2ConverterKernels,
+     &avx2ScalerKernels, nullptr, nullptr, nullptr, nullptr},
+#elif defined(__arm__) || defined(__aarch64__)
+    {"neon", CpuFeatures::NEON, &neonConverterKernels, &neonScalerKernels,
+     &neonTransformKernels, &neonRemapKernels, &neonMotionKernels,
+     &neonMonitorKernels},
+#endif
+};
+
+/* Longest rows checked, past a few blocks of the widest vectors. */
+constexpr unsigned int kMaxLength = 200;
+
+std::mt19937 generator(1);
+unsigned int failures = 0;
+
+std::vector<uint8_t> randomBytes(size_t length) {
+  std::uniform_int_distribution<unsigned int> byte(0, 255);
+  std::vector<uint8_t> bytes(length);
+  for (uint8_t& value : bytes)
+    value = byte(generator);
+
+  return bytes;
+}
+
+unsigned int randomBelow(unsigned int limit) {
+  return std::uniform_int_distribution<unsigned int>(0, limit - 1)(generator);
+}
+
+/* taps random Q8 weights summing to 256. */
+void randomWeights(uint16_t* weights, unsigned int taps) {
+  unsigned int left = 256;
+  for (unsigned int k = 0; k + 1 < taps; ++k) {
+    weights[k] = randomBelow(left + 1);
+    left -= weights[k];
+  }
+
+  weights[taps - 1] = left;
+}
+
+template <typename T>
+void check(const char* isa,
+           const std::string& what,
+           const std::vector<T>& expected,
+           const std::vector<T>& actual) {
+  if (expected == actual)
+    return;
+
+  size_t i = 0;
+  while (i < expected.size() && i < actual.size() && expected[i] == actual[i])
+    ++i;
+
+  fprintf(stderr, "%s %s: mismatch at %zu\n", isa, what.c_str(), i);
+  ++failures;
+}
+
+void checkConverter(const Isa& isa, const FormatConverterKernels& kernels) {
+  const FormatConverterKernels& scalar = scalarConverterKernels;
+  const YUVCoefficients coefficients[] = {
+      {16, 75, 102, 25, 52, 129},
+      {0, 64, 90, 22, 46, 113},
+  };
+
+  for (unsigned int width = 2; width <= kMaxLength; width += 2) {
+    const std::string size = " width " + std::to_string(width);
+    const std::vector<uint8_t> packed = randomBytes(width * 2);
+    std::vector<uint8_t> y[2], u[2], v[2];
+
+    for (unsigned int i = 0; i < 2; ++i) {
+      y[i].assign(width, 0);
+      u[i].assign(width / 2, 0);
+      v[i].assign(width / 2, 0);
+    }
+
+    const std::pair<decltype(scalar.unpackYUYV), decltype(scalar.unpackYUYV)>
+        unpackers[] = {
+            {scalar.unpackYUYV, kernels.unpackYUYV},
+            {scalar.unpackUYVY, kernels.unpackUYVY},
+        };
+    for (const auto& unpack : unpackers) {
+      unpack.first(packed.data(), y[0].data(), u[0].data(), v[0].data(),
+                   width);
+      unpack.second(packed.data(), y[1].data(), u[1].data(), v[1].data(),
+                    width);
+      check(isa.name, "unpack YUV" + size, y[0], y[1]);
+      check(isa.name, "unpack U" + size, u[0], u[1]);
+      check(isa.name, "unpack V" + size, v[0], v[1]);
+    }
+
+    scalar.unpackUV(packed.data(), u[0].data(), v[0].data(), width);
+    kernels.unpackUV(packed.data(), u[1].data(), v[1].data(), width);
+    check(isa.name, "unpackUV U" + size, u[0], u[1]);
+    check(isa.name, "unpackUV V" + size, v[0], v[1]);
+
+    const std::vector<uint8_t> luma = randomBytes(width);
+    const std::vector<uint8_t> cb = randomBytes(width / 2);
+    const std::vector<uint8_t> cr = randomBytes(width / 2);
+    const std::pair<decltype(scalar.toXRGB8888), decltype(scalar.toXRGB8888)>
+        converters[] = {
+            {scalar.toXRGB8888, kernels.toXRGB8888},
+            {scalar.toRGB888, kernels.toRGB888},
+            {scalar.toRGB565, kernels.toRGB565},
+        };
+    for (const YUVCoefficients& coeffs : coefficients) {
+      for (const auto& convert : converters) {
+        std::vector<uint8_t> rgb[2] = {std::vector<uint8_t>(width * 4),
+                                       std::vector<uint8_t>(width * 4)};
+        convert.first(luma.data(), cb.data(), cr.data(), rgb[0].data(), width,
+                      coeffs);
+        convert.second(luma.data(), cb.data(), cr.data(), rgb[1].data(),
+                       width, coeffs);
+        check(isa.name, "to RGB" + size, rgb[0], rgb[1]);
+      }
+    }
+  }
+}
+
+void checkScaler(const Isa& isa, const ImageScalerKernels& kernels) {
+  const ImageScalerKernels& scalar = scalarScalerKernels;
+
+  for (unsigned int taps = 1; taps <= 5; ++taps) {
+    std::vector<std::vector<uint8_t>> rows;
+    std::vector<const uint8_t*> pointers;
+    for (unsigned int k = 0; k < taps; ++k) {
+      rows.push_back(randomBytes(kMaxLength));
+      pointers.push_back(rows.back().data());
+    }
+
+    for (unsigned int length = 1; length <= kMaxLength; ++length) {
+      const std::string what = "blendRows " + std::to_string(taps) +
+                               " taps length " + std::to_string(length);
+      std::vector<uint16_t> weights(taps);
+      randomWeights(weights.data(), taps);
+
+      std::vector<uint8_t> dst[2] = {randomBytes(length), {}};
+      dst[1] = dst[0];
+      const unsigned int begin = randomBelow(length);
+      scalar.blendRows(pointers.data(), weights.data(), taps, dst[0].data(),
+                       begin, length);
+      kernels.blendRows(pointers.data(), weights.data(), taps, dst[1].data(),
+                        begin, length);
+      check(isa.name, what, dst[0], dst[1]);
+    }
+
+    for (unsigned int step = 1; step <= 4; ++step) {
+      for (unsigned int count = 1; count <= kMaxLength / 4; ++count) {
+        const std::string what = "filterRow " + std::to_string(taps) +
+                                 " taps step " + std::to_string(step) +
+                                 " count " + std::to_string(count);
+        const unsigned int input = count * 3 + taps;
+        const std::vector<uint8_t> src = randomBytes(input * step);
+
+        std::vector<unsigned int> start(count);
+        std::vector<uint16_t> weights(count * taps);
+        for (unsigned int x = 0; x < count; ++x) {
+          start[x] = randomBelow(input - taps + 1);
+          randomWeights(&weights[x * taps], taps);
+        }
+
+        std::vector<uint8_t> dst[2] = {randomBytes(count * step), {}};
+        dst[1] = dst[0];
+        const unsigned int begin = randomBelow(count);
+        scalar.filterRow(src.data(), step, start.data(), weights.data(), taps,
+                         dst[0].data(), begin, count);
+        kernels.filterRow(src.data(), step, start.data(), weights.data(),
+                          taps, dst[1].data(), begin, count);
+        check(isa.name, what, dst[0], dst[1]);
+      }
+    }
+  }
+}
+
+void checkTransform(const Isa& isa, const FrameTransformKernels& kernels) {
+  const FrameTransformKernels& scalar = scalarTransformKernels;
+  using Mirror = void (*)(uint8_t*, uint8_t*, unsigned int);
+  const struct {
+    const char* name;
+    Mirror expected;
+    Mirror actual;
+    unsigned int unit;
+  } mirrors[] = {
+      {"mirror8", scalar.mirror8, kernels.mirror8, 1},
+      {"mirror16", scalar.mirror16, kernels.mirror16, 2},
+      {"mirror24", scalar.mirror24, kernels.mirror24, 3},
+      {"mirror32", scalar.mirror32, kernels.mirror32, 4},
+      {"mirrorLumaEven", scalar.mirrorLumaEven, kernels.mirrorLumaEven, 4},
+      {"mirrorLumaOdd", scalar.mirrorLumaOdd, kernels.mirrorLumaOdd, 4},
+  };
+
+  for (const auto& mirror : mirrors) {
+    for (unsigned int length = mirror.unit; length <= kMaxLength;
+         length += mirror.unit) {
+      const std::string what =
+          std::string(mirror.name) + " length " + std::to_string(length);
+
+      /* Two rows, then one row mirrored in place. */
+      std::vector<uint8_t> rows[2] = {randomBytes(length * 2), {}};
+      rows[1] = rows[0];
+      mirror.expected(rows[0].data(), rows[0].data() + length, length);
+      mirror.actual(rows[1].data(), rows[1].data() + length, length);
+      check(isa.name, what, rows[0], rows[1]);
+
+      mirror.expected(rows[0].data(), rows[0].data(), length);
+      mirror.actual(rows[1].data(), rows[1].data(), length);
+      check(isa.name, what + " in place", rows[0], rows[1]);
+    }
+  }
+}
+
+void checkRemap(const Isa& isa, const LensRemapKernels& kernels) {
+  const unsigned int width = 37;
+  const unsigned int height = 9;
+  const unsigned int stride = 41 * 2;
+  const std::vector<uint8_t> src = randomBytes(stride * height);
+
+  for (unsigned int bytes = 1; bytes <= 2; ++bytes) {
+    auto expected = bytes == 1 ? scalarRemapKernels.remap8
+                               : scalarRemapKernels.remap16;
+    auto actual = bytes == 1 ? kernels.remap8 : kernels.remap16;
+
+    for (unsigned int count = 1; count <= kMaxLength; ++count) {
+      const std::string what = "remap" + std::to_string(bytes * 8) +
+                               " count " + std::to_string(count);
+
+      /* Positions inside the plane, some invalid. */
+      std::vector<uint32_t> map(count);
+      for (uint32_t& position : map) {
+        if (!randomBelow(8))
+          position = kInvalidPosition;
+        else
+          position = randomBelow((width - 1) * 16) |
+                     randomBelow((height - 1) * 16) << 16;
+      }
+
+      std::vector<uint8_t> dst[2] = {randomBytes(count * bytes), {}};
+      dst[1] = dst[0];
+      expected(src.data(), stride, map.data(), dst[0].data(), count, 0x80);
+      actual(src.data(), stride, map.data(), dst[1].data(), count, 0x80);
+      check(isa.name, what, dst[0], dst[1]);
+    }
+  }
+}
+
+void checkMotion(const Isa& isa, const MotionDetectorKernels& kernels) {
+  const MotionDetectorKernels& scalar = scalarMotionKernels;
+
+  for (unsigned int count = 1; count <= kMaxLength / 4; ++count) {
+    const std::string size = " count " + std::to_string(count);
+    const std::vector<uint8_t> row = randomBytes(count * 16);
+
+    std::vector<uint16_t> sums[2] = {std::vector<uint16_t>(count), {}};
+    for (uint16_t& sum : sums[0])
+      sum = randomBelow(255 * 8 * 3);
+    sums[1] = sums[0];
+
+    scalar.sumPlanar(row.data(), sums[0].data(), count);
+    kernels.sumPlanar(row.data(), sums[1].data(), count);
+    check(isa.name, "sumPlanar" + size, sums[0], sums[1]);
+
+    for (unsigned int offset = 0; offset < 2; ++offset) {
+      scalar.sumPacked(row.data(), sums[0].data(), count, offset);
+      kernels.sumPacked(row.data(), sums[1].data(), count, offset);
+      check(isa.name, "sumPacked" + size, sums[0], sums[1]);
+    }
+
+    std::vector<uint32_t> sads[2] = {std::vector<uint32_t>(count), {}};
+    for (uint32_t& sad : sads[0])
+      sad = randomBelow(1 << 20);
+    sads[1] = sads[0];
+
+    scalar.sad(row.data(), row.data() + count * 8, sads[0].data(), count);
+    kernels.sad(row.data(), row.data() + count * 8, sads[1].data(), count);
+    check(isa.name, "sad" + size, sads[0], sads[1]);
+
+    std::vector<uint16_t> background[2] = {std::vector<uint16_t>(count), {}};
+    for (uint16_t& cell : background[0])
+      cell = randomBelow(255 * 16 + 1);
+    background[1] = background[0];
+
+    std::vector<uint8_t> reference[2] = {std::vector<uint8_t>(count),
+                                         std::vector<uint8_t>(count)};
+    scalar.update(row.data(), background[0].data(), reference[0].data(),
+                  count);
+    kernels.update(row.data(), background[1].data(), reference[1].data(),
+                   count);
+    check(isa.name, "update background" + size, background[0], background[1]);
+    check(isa.name, "update reference" + size, reference[0], reference[1]);
+  }
+}
+
+void checkMonitor(const Isa& isa, const FrameMonitorKernels& kernels) {
+  for (unsigned int count = 1; count <= kMaxLength; ++count) {
+    const std::vector<uint8_t> row = randomBytes(count);
+
+    for (uint16_t mask : {0xffff, 0x00ff, 0xff00}) {
+      FrameMonitorRowStats stats[2] = {{1, 2, 3}, {1, 2, 3}};
+      scalarMonitorKernels.rowStats(row.data(), count, mask, &stats[0]);
+      kernels.rowStats(row.data(), count, mask, &stats[1]);
+
+      check(isa.name, "rowStats count " + std::to_string(count),
+            std::vector<uint64_t>{stats[0].sum, stats[0].squares,
+                                  stats[0].checksum},
+            std::vector<uint64_t>{stats[1].sum, stats[1].squares,
+                                  stats[1].checksum});
+    }
+  }
+}
+
+StreamConfiguration configuration(const PixelFormat& format,
+                                  const Size& size,
+                                  unsigned int stride) {
+  StreamConfiguration cfg;
+  cfg.pixelFormat = format;
+  cfg.size = size;
+  cfg.stride = stride;
+
+  return cfg;
+}
+
+/* Size of a frame of cfg, planes following each other at its stride. */
+size_t frameSize(const StreamConfiguration& cfg) {
+  const PixelFormat& format = cfg.pixelFormat;
+  if (format == formats::NV12 || format == formats::NV21 ||
+      format == formats::YUV420)
+    return static_cast<size_t>(cfg.stride) * cfg.size.height * 3 / 2;
+
+  return static_cast<size_t>(cfg.stride) * cfg.size.height;
+}
+
+/*
+ * Run the stages using the kernels on random frames, with the CPU features
+ * enabled, appending the output of each to outputs.
+ */
+int processFrames(std::vector<std::vector<uint8_t>>* outputs) {
+  generator.seed(2);
+
+  for (const PixelFormat& format : {formats::YUYV, formats::UYVY,
+                                    formats::NV12, formats::NV21}) {
+    const StreamConfiguration cfg =
+        configuration(format, Size(198, 38), 211 * 2);
+    const std::vector<uint8_t> frame = randomBytes(frameSize(cfg));
+    const std::vector<Span<const uint8_t>> planes = {
+        Span<const uint8_t>(frame.data(), frame.size())};
+
+    for (const PixelFormat& output :
+         {formats::XRGB8888, formats::RGB888, formats::RGB565}) {
+      FormatConverter converter;
+      if (converter.configure(cfg, output) < 0)
+        return -1;
+
+      outputs->emplace_back(converter.outputSize());
+      if (converter.convert(planes, outputs->back().data()) < 0)
+        return -1;
+    }
+
+    if (format == formats::NV12 || format == formats::YUYV) {
+      for (const Size& size : {Size(66, 14), Size(158, 30)}) {
+        for (ImageScaler::Filter filter :
+             {ImageScaler::Filter::Bilinear, ImageScaler::Filter::Area}) {
+          ImageScaler scaler;
+          if (scaler.configure(format, cfg.size, cfg.stride, size, 0,
+                               filter) < 0)
+            return -1;
+
+          outputs->emplace_back(scaler.outputLength());
+          if (scaler.scale(planes, outputs->back().data()) < 0)
+            return -1;
+        }
+      }
+    }
+
+    for (Transform transform :
+         {Transform::HFlip, Transform::VFlip, Transform::Rot180}) {
+      FrameTransform flip;
+      if (flip.configure(cfg, transform) < 0)
+        return -1;
+
+      outputs->push_back(frame);
+      std::vector<uint8_t>& flipped = outputs->back();
+      if (flip.apply({Span<uint8_t>(flipped.data(), flipped.size())}) < 0)
+        return -1;
+    }
+  }
+
+  for (const PixelFormat& format : {formats::RGB888, formats::XRGB8888}) {
+    const StreamConfiguration cfg = configuration(format, Size(331, 17), 1400);
+    const std::vector<uint8_t> frame = randomBytes(frameSize(cfg));
+
+    ImageScaler scaler;
+    if (scaler.configure(format, cfg.size, cfg.stride, Size(101, 9)) < 0)
+      return -1;
+
+    outputs->emplace_back(scaler.outputLength());
+    if (scaler.scale({Span<const uint8_t>(frame.data(), frame.size())},
+                     outputs->back().data()) < 0)
+      return -1;
+  }
+
+  LensCalibration calibration;
+  calibration.model = LensCalibration::Model::Fisheye;
+  calibration.size = Size(640, 360);
+  calibration.fx = calibration.fy = 240;
+  calibration.cx = 320;
+  calibration.cy = 180;
+  calibration.k[0] = -0.05;
+  calibration.k[1] = 0.01;
+  calibration.scale = 0.7;
+
+  for (const PixelFormat& format : {formats::NV12, formats::YUV420}) {
+    const StreamConfiguration cfg = configuration(format, Size(318, 178), 333);
+    const std::vector<uint8_t> frame = randomBytes(frameSize(cfg));
+
+    LensRemap remap;
+    if (remap.configure(cfg, calibration) < 0)
+      return -1;
+
+    outputs->emplace_back(frame.size());
+    std::vector<uint8_t>& corrected = outputs->back();
+    if (remap.remap({Span<const uint8_t>(frame.data(), frame.size())},
+                    {Span<uint8_t>(corrected.data(), corrected.size())}) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+} /* namespace */
+
+int main() {
+  CpuFeatures::restrictTo("none");
+  std::vector<std::vector<uint8_t>> expected;
+  if (processFrames(&expected) < 0) {
+    fprintf(stderr, "Failed to process frames with the scalar kernels\n");
+    return 1;
+  }
+
+  for (const Isa& isa : isas) {
+    if ((CpuFeatures::detected() & isa.features) != isa.features) {
+      printf("%s: not supported, skipped\n", isa.name);
+      continue;
+    }
+
+    CpuFeatures::restrictTo(isa.name);
+    const unsigned int before = failures;
+    generator.seed(3);
+
+    if (isa.converter)
+      checkConverter(isa, *isa.converter);
+    if (isa.scaler)
+      checkScaler(isa, *isa.scaler);
+    if (isa.transform)
+      checkTransform(isa, *isa.transform);
+    if (isa.remap)
+      checkRemap(isa, *isa.remap);
+    if (isa.motion)
+      checkMotion(isa, *isa.motion);
+    if (isa.monitor)
+      checkMonitor(isa, *isa.monitor);
+
+    std::vector<std::vector<uint8_t>> actual;
+    if (processFrames(&actual) < 0) {
+      fprintf(stderr, "%s: failed to process frames\n", isa.name);
+      return 1;
+    }
+
+    for (size_t i = 0; i < expected.size(); ++i)
+      check(isa.name, "frame " + std::to_string(i), expected[i], actual[i]);
+
+    printf("%s: %s\n", isa.name, failures == before ? "ok" : "FAILED");
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Capture to scanout latency of twincam -D for a few sink configurations,
+# without camera or display: vivid provides the camera, vkms the display and
+# the writeback connector twincam --latency reads the scanned out frames back
+# from. Needs libcamera built with the vivid pipeline handler, twincam in the
+# PATH and no other DRM master on the vkms card.
+#
+#   tests/latency.sh [SECONDS]
+
+set -e
+
+duration="${1:-10}"
+
+if [ "$EUID" -ne 0 ]; then
+  prefix="sudo"
+fi
+
+$prefix modprobe vivid
+$prefix modprobe vkms enable_writeback=1
+
+# vkms scans out RGB on any kernel, YUV on recent ones only.
+formats="${FORMATS:-XRGB8888}"
+
+configs=(
+  "direct|"
+  "copy-frames|-C"
+  "hflip|-t hflip"
+  "zoom|--zoom 2"
+  "monitor|--monitor /tmp/twincam-latency.prom"
+)
+
+log="$(mktemp)"
+trap 'rm -f "$log"' EXIT
+
+printf "%-10s %-12s %s\n" "format" "config" "latency"
+for format in $formats; do
+  for config in "${configs[@]}"; do
+    name="${config%%|*}"
+    args="${config#*|}"
+
+    # twincam stops the display and prints the latency on SIGINT.
+    # shellcheck disable=SC2086
+    $prefix timeout -s INT "$duration" \
+      twincam --latency --connector Virtual-1 -p "$format" $args \
+      > "$log" 2>&1 || true
+
+    result="$(grep -E "^Latency" "$log" | tail -1)"
+    if [ -z "$result" ]; then
+      result="failed, see below"
+      cat "$log"
+    fi
+
+    printf "%-10s %-12s %s\n" "$format" "$name" "${result#Latency }"
+  done
+done
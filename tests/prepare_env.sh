@@ -35,6 +35,7 @@ if command -v apt > /dev/null; then
   $prefix apt install -y valgrind || true
   $prefix apt install -y libasan5 || true
   $prefix apt install -y libjpeg-dev || true
+  $prefix apt install -y libzstd-dev || true
 elif command -v dnf > /dev/null; then
   $prefix dnf install -y 'dnf-command(config-manager)'
   $prefix dnf config-manager --set-enabled crb || true
@@ -44,7 +45,7 @@ elif command -v dnf > /dev/null; then
     libdrm libdrm-devel systemd-udev doxygen cmake graphviz libatomic \
     texlive-latex cppcheck libyaml-devel clang zip valgrind libasan findutils \
     systemd-devel libjpeg-turbo-devel SDL2-devel libglvnd-devel \
-    mesa-libgbm-devel
+    mesa-libgbm-devel libzstd-devel
 fi
 
 $prefix pip install jinja2 ply pyyaml
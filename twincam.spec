@@ -17,6 +17,7 @@ BuildRequires: pkgconfig(libcamera)
 BuildRequires: pkgconfig(libdrm)
 BuildRequires: SDL2-devel
 BuildRequires: libjpeg-devel
+BuildRequires: pkgconfig(libzstd)
 BuildRequires: systemd
 
 Conflicts: plymouth
@@ -27,6 +28,14 @@ ExcludeArch: s390x ppc64le %ix86
 %description
 %{summary}.
 
+%package devel
+Summary:       Client library for the frames shared by twincam
+Requires:      %{name}%{?_isa} = %{version}-%{release}
+
+%description devel
+Library and headers to receive the frames twincam shares with --publish and
+to read the metadata rings of --metadata-ring.
+
 %prep
 %autosetup -p1
 
@@ -56,11 +65,21 @@ dracut -f
 %license COPYING
 %doc README.md
 %{_bindir}/twincam
+%{_bindir}/twincam-index
 %{dracutdir}/modules.d/81twincam/module-setup.sh
 %{_unitdir}/twincam.service
 %{_unitdir}/twincam-quit.service
 %{_unitdir}/sysinit.target.wants/twincam.service
 %{_unitdir}/multi-user.target.wants/twincam-quit.service
+%{_libdir}/libtwincam-client.so.0
+%{_libdir}/libtwincam-client.so.0.6.0
+
+%files devel
+%{_includedir}/twincam/frame_ring.h
+%{_includedir}/twincam/frame_share.h
+%{_includedir}/twincam/frame_share_client.h
+%{_libdir}/libtwincam-client.so
+%{_libdir}/pkgconfig/twincam-client.pc
 
 %changelog
 * Tue Feb 14 2023 Eric Curtin <ecurtin@redhat.com> - 0.6-3